@@ -5,6 +5,11 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <time.h>
+#include <limits.h>
+#include "../comun/buffer.h"
+#include "../comun/medidas.h"
+#include "../comun/config.h"
 
 
 
@@ -23,12 +28,24 @@
  * funciones producir y consumir, respectivamente. El buffer empleado es una pila LIFO.
  * En este ejercicio el consumidor se crea antes que el productor.
  *
+ * El buffer es un buffer de registros (módulo comun/buffer) cuyo tamaño se indica con la opción -t (1 byte por
+ * defecto). La variable cuenta forma parte de su cabecera, en su propia línea de caché: así, sus actualizaciones no
+ * invalidan los primeros registros del buffer (compartición falsa).
+ * Uso: ./prod_cons_1 [-r] [-t tam_elem] [--parámetro=valor ...]
+ *  -r: modo rendimiento. Se eliminan los mensajes, se realizan N_ITER_RENDIMIENTO iteraciones y se imprime una línea
+ *      CSV (módulo comun/medidas) con los items/s, la latencia de traspaso y los cambios de contexto. Como no hay
+ *      sincronización, los resultados solo sirven de referencia: las carreras críticas pueden corromper el buffer.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra): capacidad (N por defecto), items (iteraciones de cada
+ * proceso) y tam_elem (como -t). También se pueden fijar con las variables de entorno SOII_CAPACIDAD, etc.
+ *
  * Debe compilarse con la opción -pthread.
  */
 
 
-#define N 8                         // Tamaño del buffer compartido entre productor y consumidor
+#define N 8                         // Tamaño por defecto del buffer compartido entre productor y consumidor
 #define N_ITER 100                  // Número de iteraciones de cada proceso
+#define N_ITER_RENDIMIENTO 2000     // Número de iteraciones de cada proceso en el modo rendimiento
 
 #define VERDE "\033[32m"            // Color en el que imprimirá el productor
 #define AZUL "\033[34m"             // Color en el que imprimirá el consumidor
@@ -45,6 +62,10 @@ void consumir(int ralentizar);
 // Función de impresión del contenido del buffer
 void log_buffer(int proceso);
 
+// Funciones de medida de la latencia de traspaso de un registro
+void sellar(char * registro);
+void latencia(char * registro);
+
 // Función de cierre del área de memoria compartida
 void cerrar_mem_compartida();
 
@@ -53,8 +74,21 @@ void cerrar_con_error(char * mensaje, int ver_errno);
 
 
 
-int * cuenta = NULL;            // Número de items guardados en el buffer
-char * buffer = NULL;           // Buffer gestionado por productor y consumidor
+struct buffer * buffer = NULL;      // Buffer gestionado por productor y consumidor (incluye la variable cuenta)
+size_t tam_region = 0;              // Tamaño en bytes del área compartida
+size_t tam_elem = sizeof(char);     // Tamaño en bytes de cada registro del buffer
+int rendimiento = 0;                // !0 para ejecutar sin mensajes y medir items/s
+long n_iter = N_ITER;               // Número de iteraciones de cada proceso
+int capacidad = N;                  // Tamaño del buffer compartido
+struct medidas * medidas = NULL;    // Latencias de traspaso, compartidas con los hijos (un sello por hueco)
+
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"capacidad", &capacidad, CONFIG_INT, 1, CONFIG_MAX_CAPACIDAD, "Tamaño del buffer compartido"},
+    {"items", &n_iter, CONFIG_LONG, 1, LONG_MAX, "Iteraciones de cada proceso (N_ITER_RENDIMIENTO con -r)"},
+    {"tam_elem", &tam_elem, CONFIG_SIZE, 1, CONFIG_MAX_TAM_ELEM, "Tamaño en bytes de cada registro (como -t)"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
 
 
 int main(int argc, char * argv[]){
@@ -62,17 +96,38 @@ int main(int argc, char * argv[]){
     pid_t exit_wait;                    // Valor de retorno de waitpid
     int status;                         // Estado de waitpid
     pid_t error_fork;       // Variable que recoge la salida de los fork para corroborar la aparición de errores
+    int opcion;                         // Opción leída con getopt
+    struct timespec t_ini, t_fin;       // Instantes de comienzo y final de la ejecución de los hijos
+    double segundos;                    // Duración de la ejecución de los hijos
+
+    // Leemos los parámetros (del entorno y de las opciones largas) y las opciones de la línea de comandos: modo
+    // rendimiento y tamaño de los registros
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "rt:")) != -1){
+        switch (opcion){
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "items")) n_iter = N_ITER_RENDIMIENTO;
+                break;
+            case 't':
+                if ((tam_elem = strtoul(optarg, NULL, 10)) == 0)
+                    cerrar_con_error("Error: el tamaño de los registros debe ser de al menos 1 byte\n", 0);
+                break;
+            default:
+                cerrar_con_error("Uso: ./prod_cons_1 [-r] [-t tam_elem] [--parámetro=valor ...]\n", 0);
+        }
+    }
 
     /*
      * Reservamos un área de memoria compartida y anónima (sin archivo de respaldo) a través de mmap. Cuando creemos
      * los procesos hijos (productor y consumidor), hererdarán dicha región.
      *
-     * Esta región de memoria estará dividida en 2: en la posición inicial guardará el entero cuenta. El resto de la
-     * región se destinará a almacenar el buffer (N chars).
+     * Esta región de memoria contendrá el buffer de registros: una cabecera, que incluye el entero cuenta, seguida
+     * de los capacidad registros de tam_elem bytes.
      *
      * Indicamos como argumentos:
      * NULL -> El kernel elige la dirección inicial (alineada con las páginas)-
-     * N * sizeof(char) -> Tamaño en bytes que tendrá la zona de memoria (N chars)
+     * tam_region -> Tamaño en bytes que tendrá la zona de memoria (cabecera y capacidad registros)
      * PROT_READ | PROT_WRITE -> Se obtendrán permisos de escritura y lectura.
      * MAP_SHARED | MAP_ANONYMOUS -> Memoria compartida y sin archivo de respaldo. El contenido se inicializa a 0.
      * -1 -> No hay descriptor, al estar usando MAP_ANONYMOUS. En este caso, algunas implementaciones requieren que
@@ -80,25 +135,30 @@ int main(int argc, char * argv[]){
      * 0 -> El offset también debe ser 0, ya que estamos usando MAP_ANONYMOUS.
      * MAP_FAILED es (void *) -1, por lo que lo casteamos a (char *).
      */
-    if ((area_compartida = mmap(NULL, (size_t) sizeof(int) + N * sizeof(char), PROT_READ | PROT_WRITE,
+    tam_region = buffer_tam_region(capacidad, tam_elem);
+    if ((area_compartida = mmap(NULL, tam_region, PROT_READ | PROT_WRITE,
         MAP_SHARED | MAP_ANONYMOUS, -1, (off_t) 0)) == MAP_FAILED)
         // Si hay algún error, finalizamos la ejecución e imprimimos errno con un mensaje personalizado
         cerrar_con_error("Error: no se ha podido reservar un área de memoria compartida", 1);
 
-    // Almacenamos referencias a la variable cuenta y al buffer de forma global (pues al fin y al cabo, son
-    // compartidas por todos los procesos de forma "descontrolada")
-    cuenta = (int *) area_compartida;
-    buffer = (char *) (area_compartida + sizeof(int));          // El buffer comienza sizeof(int) posiciones después
+    // Almacenamos una referencia al buffer de forma global (pues al fin y al cabo, es compartido por todos los
+    // procesos de forma "descontrolada")
+    // El buffer estará inicialmente vacío, de forma que la cuenta será 0. También guardamos en cada posición del
+    // buffer un carácter que representa "posición vacía". Se ha elegido el carácter '_'
+    buffer = buffer_iniciar(area_compartida, capacidad, tam_elem, BUFFER_LIFO, '_');
 
-    // El buffer estará inicialmente vacío, de forma que la cuenta será 0
-    *cuenta = 0;
-    // También guardamos en cada posición del buffer un carácter que representa "posición vacía". Se ha elegido
-    // el carácter '_'
-    memset(buffer, '_', (size_t) N * sizeof(char));
+    // Las medidas también se reservan en memoria compartida, para que el padre pueda leer las latencias de los hijos
+    if ((medidas = medidas_crear(n_iter, capacidad)) == NULL)
+        cerrar_con_error("Error: no se ha podido reservar memoria para las medidas", 1);
 
-    printf("Se procede a iniciar los programas productor y consumidor. Se utilizará el código de colores:\n");
-    printf("%s\tPRODUCTOR%s\n", VERDE, RESET);
-    printf("%s\tCONSUMIDOR%s\n\n\n", AZUL, RESET);
+    if (!rendimiento){
+        printf("Se procede a iniciar los programas productor y consumidor. Se utilizará el código de colores:\n");
+        printf("%s\tPRODUCTOR%s\n", VERDE, RESET);
+        printf("%s\tCONSUMIDOR%s\n\n\n", AZUL, RESET);
+    }
+
+    // Medimos el tiempo que tardan los hijos en transferir todos los items
+    clock_gettime(CLOCK_MONOTONIC, &t_ini);
 
     /*
      * Al crear el consumidor antes que el productor, aseguramos que ambos procesos empiecen aproximadamente a la vez.
@@ -146,8 +206,15 @@ int main(int argc, char * argv[]){
             cerrar_con_error("Finalización incorrecta de un proceso hijo", 0);
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &t_fin);
+
+    // En el modo rendimiento se imprime la línea CSV con los items/s, las latencias y los cambios de contexto
+    segundos = (t_fin.tv_sec - t_ini.tv_sec) + (t_fin.tv_nsec - t_ini.tv_nsec) / 1e9;
+    if (rendimiento) medidas_informe(medidas, "prod_cons_1", "espera_activa", 1, tam_elem, n_iter, segundos);
+    medidas_destruir(medidas);
+
     // El proceso principal será el último en finalizar.
-    printf("\n\n\n\nFinalizando ejecucion del problema del productor-consumidor...\n");
+    if (!rendimiento) printf("\n\n\n\nFinalizando ejecucion del problema del productor-consumidor...\n");
     exit(EXIT_SUCCESS);
 }
 
@@ -164,14 +231,17 @@ int main(int argc, char * argv[]){
  */
 void producir(int ralentizar){
     char item = 96;         // Carácter anterior a la primera letra del alfabeto (que sería la 97, la 'a')
+    char * registro;        // Hueco del buffer donde se escribe el item
     int i=0;                // Variable de iteración
 
     // Las letras del alfabeto en minúsculas ocupan las posiciones [97,122] (26 posiciones)
 
-    while (i < N_ITER){         // Máximo de N_ITER iteraciones (no utilizamos bucles infinitos)
+    while (i < n_iter){         // Máximo de n_iter iteraciones (no utilizamos bucles infinitos)
         // El productor comienza cada iteración indicando el valor actual de la variable cuenta
-        printf("%s**INICIO** iteracion %d, cuenta = %d\t\t\t\t\t\t\t", VERDE, i, *cuenta);
-        log_buffer(1);
+        if (!rendimiento){
+            printf("%s**INICIO** iteracion %d, cuenta = %d\t\t\t\t\t\t\t", VERDE, i, buffer->cuenta);
+            log_buffer(1);
+        }
 
         item = (item - 96) % 26 + 97;       // Generamos un nuevo elemento
         /*
@@ -181,24 +251,31 @@ void producir(int ralentizar){
          * item en una unidad (se pasa a [1, 26]). Entonces, se hace el módulo por 26 para que los items no se pasen de
          * los límites del abecedario. Por último, se suma 97 para volver al intervalo [97, 122].
          */
-        while (*cuenta == N) ;              // Bucle de espera activa. Si el buffer está lleno, el productor no puede
+        while (buffer_lleno(buffer)) ;      // Bucle de espera activa. Si el buffer está lleno, el productor no puede
                 // actuar y queda esperando a que el consumidor libere alguna posición
 
         ////////// INICIO DE LA REGIÓN CRÍTICA
 
         /*
-         * La región crítica está delimitada por las líneas buffer[*cuenta] = item y (*cuenta)++, que son las que
-         * provocarán problemas: interrupciones en la actualización de cuenta por parte del consumidor provocarán que
-         * los elementos insertados por el productor en la línea buffer[*cuenta] = item no se introduzcan en la
-         * posición correcta. Aparecerán entonces errores de coherencia y el buffer quedará en un estado incorrecto.
+         * La región crítica está delimitada por la escritura del item en el hueco indicado por cuenta y la
+         * confirmación de la inserción (cuenta++), que son las que provocarán problemas: interrupciones en la
+         * actualización de cuenta por parte del consumidor provocarán que los elementos insertados por el productor
+         * no se introduzcan en la posición correcta. Aparecerán entonces errores de coherencia y el buffer quedará en
+         * un estado incorrecto.
          */
 
-        buffer[*cuenta] = item;             // Guardamos el nuevo item en la posición indicada por cuenta
+        // Guardamos el nuevo item directamente en la posición indicada por cuenta
+        registro = buffer_hueco_insertar(buffer, 0);
+        registro_rellenar(registro, tam_elem, item);
+        sellar(registro);
 
         // Imprimimos un mensaje que indica el estado en el que queda el buffer y la variable cuenta, así como
         // el contenido del primero
-        printf("%sPosición %d -> item %c%s\t\t\t\t\t\t\t\t\t", VERDE, *cuenta, item, RESET);
-        log_buffer(1);
+        if (!rendimiento){
+            printf("%sPosición %d -> item %c%s\t\t\t\t\t\t\t\t\t",
+                   VERDE, buffer_posicion(buffer, registro), item, RESET);
+            log_buffer(1);
+        }
 
         // Si el programador así lo indica, se ralentiza el productor en el punto realmente crítico del código, esto
         // es, entre la modificacíon del buffer y su registro a través de la actualización de la variable cuenta.
@@ -206,13 +283,15 @@ void producir(int ralentizar){
 
         // La segunda línea clave en el código es la actualización de cuenta, que refleja que hay un elemento más
         // en el buffer.
-        (*cuenta)++;
+        buffer_confirmar_insercion(buffer, 1);
 
         ////////// FIN DE LA REGIÓN CRÍTICA
 
         // Imprimimos el estado en el que quedan la variable cuenta y el buffer tras finalizar la iteración
-        printf("%s//FIN// iteracion %d; cuenta = %d  %s\t\t\t\t\t\t\t", VERDE, i, *cuenta, RESET);
-        log_buffer(1);
+        if (!rendimiento){
+            printf("%s//FIN// iteracion %d; cuenta = %d  %s\t\t\t\t\t\t\t", VERDE, i, buffer->cuenta, RESET);
+            log_buffer(1);
+        }
         i++;            // Pasamos a la siguiente iteración
     }
 
@@ -220,7 +299,7 @@ void producir(int ralentizar){
     // munmap
     cerrar_mem_compartida();
 
-    printf("\n%sFinalizando productor...%s\n", VERDE, RESET);
+    if (!rendimiento) printf("\n%sFinalizando productor...%s\n", VERDE, RESET);
     exit(EXIT_SUCCESS);
 }
 
@@ -234,47 +313,57 @@ void producir(int ralentizar){
  *                    en la región crítica.
  */
 void consumir(int ralentizar){
+    char * registro;        // Registro del buffer que se elimina
     int i = 0;              // Contador de iteraciones
 
-    while (i < N_ITER){         // Máximo de N_ITER iteraciones (no utilizamos bucles infinitos)
+    while (i < n_iter){         // Máximo de n_iter iteraciones (no utilizamos bucles infinitos)
         // El consumidor comienza cada iteración imprimiendo el valor de la variable cuenta y el contenido del buffer,
         // con el objetivo de poder corroborar la ocurrencia de carreras críticas
-        printf("\t\t\t\t\t%s**INICIO** iteracion %d, cuenta = %d\t\t", AZUL, i, *cuenta);
-        log_buffer(0);
+        if (!rendimiento){
+            printf("\t\t\t\t\t%s**INICIO** iteracion %d, cuenta = %d\t\t", AZUL, i, buffer->cuenta);
+            log_buffer(0);
+        }
 
-        while (*cuenta == 0) ;     // Bucle de espera activa
+        while (buffer_vacio(buffer)) ;     // Bucle de espera activa
         // El consumidor únicamente podrá entrar en la región crítica y eliminar un item si hay elementos guardados
         // en el buffer. En caso contrario, quedará ejecutando el bucle hasta que se verifique dicha condición.
 
         ////////// INICIO DE LA REGIÓN CRÍTICA
 
         /*
-         * La región crítica está delimitada por las líneas *(buffer + *cuenta - 1) = '_' y (*cuenta)++, que son las
-         * que provocan problemas: interrupciones en la actualización de cuenta por parte del productor provocarán que
-         * el consumidor no escriba el carácter '_' (que representa la eliminación de un elemento) en la posición
-         * correcta. Por consiguiente, el buffer quedará en un estado incoherente e incorrecto.
+         * La región crítica está delimitada por la escritura de '_' en el registro de la cima y la confirmación de la
+         * extracción (cuenta--), que son las que provocan problemas: interrupciones en la actualización de cuenta por
+         * parte del productor provocarán que el consumidor no escriba el carácter '_' (que representa la eliminación
+         * de un elemento) en la posición correcta. Por consiguiente, el buffer quedará en un estado incoherente e
+         * incorrecto.
          */
 
-        // Para las posiciones del buffer estamos empleando el rango [0, N-1], de forma que la posición a eliminar
-        // vendrá dada por *cuenta - 1.
-        *(buffer + *cuenta - 1) = '_';
+        // Para las posiciones del buffer estamos empleando el rango [0, capacidad-1], de forma que la posición a
+        // eliminar vendrá dada por cuenta - 1 (la cima de la pila).
+        registro = buffer_hueco_extraer(buffer, 0);
+        latencia(registro);
+        *registro = '_';
 
         // Imprimimos un mensaje de información acerca del estado actual del buffer y del elemento eliminado
-        printf("\t\t\t\t\t%sPosición %d consumida\t\t\t\t", AZUL, *cuenta - 1);
-        log_buffer(0);
+        if (!rendimiento){
+            printf("\t\t\t\t\t%sPosición %d consumida\t\t\t\t", AZUL, buffer_posicion(buffer, registro));
+            log_buffer(0);
+        }
 
         // Si el programador así lo indica, se ralentiza el productor en el punto realmente crítico del código, esto
         // es, entre la modificacíon del buffer y su registro a través de la actualización de la variable cuenta.
         if (ralentizar) sleep(ralentizar);
 
         // Decrementamos la cuenta para indicar que hay un elemento menos en el buffer
-        (*cuenta)--;
+        buffer_confirmar_extraccion(buffer, 1);
 
         ////////// FIN DE LA REGIÓN CRÍTICA
 
         // Imprimimos el estado en el que quedan la variable cuenta y el buffer tras finalizar la iteración
-        printf("\t\t\t\t\t%s//FIN// iteracion %d; cuenta = %d  %s\t\t", AZUL, i, *cuenta, RESET);
-        log_buffer(0);
+        if (!rendimiento){
+            printf("\t\t\t\t\t%s//FIN// iteracion %d; cuenta = %d  %s\t\t", AZUL, i, buffer->cuenta, RESET);
+            log_buffer(0);
+        }
         i++;            // Incrementamos el contador de iteraciones
     }
 
@@ -282,10 +371,33 @@ void consumir(int ralentizar){
     // munmap
     cerrar_mem_compartida();
 
-    printf("\n\t\t\t\t\t%sFinalizando consumidor...%s\n", AZUL, RESET);
+    if (!rendimiento) printf("\n\t\t\t\t\t%sFinalizando consumidor...%s\n", AZUL, RESET);
     exit(EXIT_SUCCESS);
 }
 
+/*
+ * Función que sella el hueco de un registro con el instante en el que el productor lo escribe.
+ * Como la variable cuenta no está protegida, una carrera crítica puede dejarla fuera del rango [0, capacidad]. En ese
+ * caso el registro cae fuera del buffer y no se sella, para no escribir fuera de la estructura de medidas.
+ * @param registro: Hueco del buffer en el que se ha escrito el item.
+ */
+void sellar(char * registro){
+    int pos = buffer_posicion(buffer, registro);
+
+    if (pos >= 0 && pos < capacidad) medidas_sellar(medidas, pos);
+}
+
+/*
+ * Función que registra la latencia de traspaso del registro que el consumidor va a eliminar (con la misma
+ * comprobación de rango que sellar).
+ * @param registro: Registro del buffer que se elimina.
+ */
+void latencia(char * registro){
+    int pos = buffer_posicion(buffer, registro);
+
+    if (pos >= 0 && pos < capacidad) medidas_latencia(medidas, pos);
+}
+
 /*
  * Función que imprime los contenidos del buffer en una línea. Es empleada por el productor, que imprime en verde,
  * y por el consumidor, que imprime en azul. Toda la cadena aparece en cursiva.
@@ -296,19 +408,20 @@ void log_buffer(int proceso){
 
     // Dependiendo del argumento proceso, se imprime en verde o en azul. Siempre se activa la cursiva.
     printf("%s%sbuffer = [", proceso? VERDE : AZUL, CURSIVA);
-    for (i = 0; i < N - 1; i++)
-        printf("%c ", *(buffer + i));           // Leemos uno a uno los caracteres contenidos en el buffer
-    printf("%c]%s%s\n", *(buffer + i), RESET, RESET_CURS);
+    for (i = 0; i < capacidad - 1; i++)
+        // Leemos uno a uno los registros contenidos en el buffer (su primer carácter)
+        printf("%c ", *(char *) buffer_registro(buffer, i));
+    printf("%c]%s%s\n", *(char *) buffer_registro(buffer, i), RESET, RESET_CURS);
     // No utilizamos \n hasta el final para tratar de que el buffer se imprima de forma atómica
 }
 
 /*
  * Función que cierra la región de memoria compartida para el proceso que la llama. Se asume que esta comienza en la
- * posición a la que apunta cuenta y que ocupa un entero y N chars.
+ * posición a la que apunta buffer y que ocupa tam_region bytes.
  */
 void cerrar_mem_compartida(){
-    // Utilizamos munmap, indicando el puntero a la región y el tamaño de esta (un entero y N caracteres)
-    if (munmap((void *) cuenta, (size_t) sizeof(int) + N * sizeof(char)) == -1)
+    // Utilizamos munmap, indicando el puntero a la región y el tamaño de esta (cabecera y capacidad registros)
+    if (munmap((void *) buffer, tam_region) == -1)
         cerrar_con_error("Error: no se ha podido cerrar la proyección del área compartida entre los procesos", 1);
 }
 
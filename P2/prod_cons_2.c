@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -8,6 +9,17 @@
 #include <semaphore.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "../comun/buffer.h"
+#include "../comun/cache.h"
+#include "../comun/medidas.h"
+#include "../comun/config.h"
+#include "../comun/contadores.h"
 
 /*
  * Xiana Carrera Alonso
@@ -18,12 +30,46 @@
  * El buffer empleado funciona como una cola FIFO.
  * En este ejercicio el consumidor se crea antes que el productor.
  *
+ * Como alternativa a los semáforos, se ofrece un modo para un único productor y un único consumidor (SPSC) basado en
+ * un buffer circular sin cerrojos: los índices de inicio y final son atómicos (C11) y residen en la misma región
+ * compartida que el buffer, en líneas de caché distintas. Los procesos solo acuden al kernel (futex) cuando el buffer
+ * está realmente lleno o vacío.
+ *
+ * El buffer es un buffer de registros (módulo comun/buffer): el productor genera cada item directamente en su hueco y
+ * el consumidor lo lee en el propio buffer, sin copias intermedias. Al terminar, el productor cierra el buffer y
+ * despierta al consumidor, que retira items hasta encontrarlo cerrado y vacío.
+ *
+ * Uso: ./prod_cons_2 [-m sem|spsc] [-r] [-l lote] [-t tam_elem] [--parámetro=valor ...]
+ *  -m: mecanismo de sincronización (semáforos con nombre, por defecto, o buffer circular SPSC).
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, se realizan N_ITER_RENDIMIENTO iteraciones y se
+ *      imprime una línea CSV (módulo comun/medidas) con los items/s, los percentiles de la latencia de traspaso
+ *      (desde que el item se genera en su hueco hasta que el consumidor lo lee) y los cambios de contexto, para
+ *      poder comparar ambos mecanismos.
+ *  -l: número máximo de items que se transfieren en cada entrada a la región crítica (1 por defecto, como mucho
+ *      MAX_LOTE). Así, el coste del mutex se paga una vez por lote y no una vez por item.
+ *  -t: tamaño en bytes de cada registro del buffer (1 por defecto).
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra): capacidad (N por defecto), items (los que genera el
+ * productor), tam_elem (como -t), lote (como -l), espera_max (las esperas duran de 0 a espera_max - 1 segundos) y
+ * contadores (con 1, el padre vuelca en JSON por la salida de errores, al acabar y al recibir SIGUSR2, los contadores
+ * del productor y del consumidor del módulo comun/contadores: esperas en los semáforos o en los futex, tiempo en la
+ * región crítica, veces que encontraron el buffer lleno o vacío e items procesados). También se pueden fijar con las
+ * variables de entorno SOII_CAPACIDAD, etc.
+ *
  * Debe compilarse con la opción -pthread.
  */
 
 
-#define N 15                        // Tamaño del buffer compartido entre productor y consumidor
+#define N 15                        // Tamaño por defecto del buffer compartido entre productor y consumidor
 #define N_ITER 100                  // Número de iteraciones de cada proceso
+#define N_ITER_RENDIMIENTO 1000000  // Número de iteraciones de cada proceso en el modo rendimiento
+#define ESPERA_MAX 5                // Las esperas aleatorias duran entre 0 y ESPERA_MAX - 1 segundos
+
+#define MODO_SEM 0                  // Sincronización con los semáforos PC_VACIAS, PC_MUTEX y PC_LLENAS
+#define MODO_SPSC 1                 // Sincronización con el buffer circular SPSC (atómicos y futex)
+
+#define MAX_LOTE 512                // Tamaño máximo de un lote de items (opción -l)
+
 
 #define VERDE "\033[32m"            // Color en el que imprimirá el productor
 #define AZUL "\033[34m"             // Color en el que imprimirá el consumidor
@@ -37,14 +83,18 @@ void producir();
 // Función del consumidor
 void consumir();
 
-// Función de generación de un item (productor)
-char produce_item(int pos);
+// Función de generación de un item en su hueco del buffer (productor)
+void produce_item(char * registro, int pos);
 // Función de inserción de un item en el buffer (productor)
-void insert_item(int * final, char letra);
+void insert_item();
 // Función de eliminación de un item del buffer (consumidor)
-char remove_item(int * inicio);
-// Función de impresión de un item eliminado (consumidor)
-void consume_item(char item);
+void remove_item();
+// Función de inserción de un lote de items en el buffer (productor)
+void insert_items(int n);
+// Función de eliminación de un lote de items del buffer (consumidor)
+void remove_items(int n);
+// Función de lectura de un item en su hueco del buffer (consumidor)
+void consume_item(char * registro);
 
 // Función de impresión del contenido del buffer
 void log_buffer(int proceso);
@@ -52,6 +102,20 @@ void log_buffer(int proceso);
 // Función de cierre del área de memoria compartida
 void cerrar_mem_compartida();
 
+// Función de inserción de un item en el buffer circular SPSC (productor)
+void insertar_anillo();
+// Función de eliminación de un item del buffer circular SPSC (consumidor)
+int extraer_anillo();
+// Función de espera sobre una palabra futex compartida entre procesos
+void esperar_futex(_Atomic uint32_t * palabra, uint32_t valor);
+// Función que despierta a los procesos bloqueados en una palabra futex
+void despertar_futex(_Atomic uint32_t * palabra, int n);
+
+// Función que decrementa un semáforo entre 1 y n veces, bloqueándose solo para la primera
+int esperar_semaforo_n(sem_t * sem, int n, int lleno);
+// Función que incrementa un semáforo n veces
+void senalar_semaforo_n(sem_t * sem, int n);
+
 // Función de cierre de semáforos con sem_close
 void cerrar_semaforos(sem_t * vacias, sem_t * mutex, sem_t * llenas);
 // Función de destrucción de semáforos con sem_unlink
@@ -61,7 +125,52 @@ void destruir_semaforos();
 void cerrar_con_error(char * mensaje, int ver_errno);
 
 
-char * buffer = NULL;                      // Área de memoria compartida: un buffer de caracteres (cola FIFO)
+/*
+ * Buffer circular para un productor y un consumidor. Cada índice lo escribe un único proceso, por lo que no es
+ * necesaria la exclusión mutua: basta con publicarlos con semántica release/acquire.
+ * Los índices crecen de forma indefinida (64 bits) y la posición real se obtiene con el módulo por N.
+ * Los campos de cada proceso se colocan en líneas de caché distintas (módulo comun/cache) para evitar la compartición
+ * falsa.
+ * Los registros se guardan en el buffer que sigue a esta estructura en la región compartida (sus índices inicio,
+ * final y cuenta no se usan en este modo).
+ */
+struct anillo {
+    CACHE_ALINEADO _Atomic uint64_t final;          // Próxima posición a escribir (solo la modifica el productor)
+    CACHE_ALINEADO _Atomic uint64_t inicio;         // Próxima posición a leer (solo la modifica el consumidor)
+    CACHE_ALINEADO _Atomic uint32_t aviso_hueco;    // Palabra futex en la que duerme el productor (lleno)
+    _Atomic uint32_t productor_dormido;             // 1 si el productor está (o va a estar) en el futex
+    CACHE_ALINEADO _Atomic uint32_t aviso_item;     // Palabra futex en la que duerme el consumidor (vacío)
+    _Atomic uint32_t consumidor_dormido;            // 1 si el consumidor está (o va a estar) en el futex
+};
+
+
+struct buffer * buffer = NULL;             // Buffer de registros en memoria compartida (cola FIFO)
+size_t tam_elem = sizeof(char);            // Tamaño en bytes de cada registro del buffer
+void * region = NULL;                      // Comienzo de la proyección compartida (struct anillo y buffer)
+size_t tam_region = 0;                     // Tamaño en bytes de la proyección compartida
+struct anillo * anillo = NULL;             // Buffer circular SPSC (solo en el modo MODO_SPSC)
+struct medidas * medidas = NULL;           // Latencias de traspaso, compartidas con los hijos (un sello por hueco)
+int instrumentar = 0;                      // !0 para llevar y volcar los contadores del productor y del consumidor
+struct contadores * contadores = NULL;     // Contadores de instrumentación, compartidos con los hijos (o NULL)
+struct contadores_hilo * cont = NULL;      // Contadores del proceso (cada hijo reserva los suyos)
+
+int modo = MODO_SEM;                       // Mecanismo de sincronización empleado
+int rendimiento = 0;                       // !0 para ejecutar sin esperas ni mensajes y medir items/s
+long n_iter = N_ITER;                      // Número de items que genera el productor
+int lote = 1;                              // Número máximo de items por entrada a la región crítica
+int capacidad = N;                         // Tamaño del buffer compartido
+int espera_max = ESPERA_MAX;               // Límite (exclusivo) en segundos de las esperas aleatorias
+
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"capacidad", &capacidad, CONFIG_INT, 1, CONFIG_MAX_CAPACIDAD, "Tamaño del buffer compartido"},
+    {"items", &n_iter, CONFIG_LONG, 1, LONG_MAX, "Items que genera el productor (N_ITER_RENDIMIENTO con -r)"},
+    {"tam_elem", &tam_elem, CONFIG_SIZE, 1, CONFIG_MAX_TAM_ELEM, "Tamaño en bytes de cada registro (como -t)"},
+    {"lote", &lote, CONFIG_INT, 1, MAX_LOTE, "Items por entrada a la región crítica (como -l)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+    {"contadores", &instrumentar, CONFIG_INT, 0, 1, "Con 1, vuelca en JSON los contadores de cada proceso"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
 
 
 int main(int argc, char * argv[]){
@@ -72,6 +181,37 @@ int main(int argc, char * argv[]){
     int status;           // Condición de finalización de un proceso hijo
     pid_t error_fork;     // Código de retorno del fork
     int exit_unlink;      // Error de la función sem_unlink
+    int opcion;           // Opción leída con getopt
+    struct timespec t_ini, t_fin;       // Instantes de comienzo y final de la ejecución de los hijos
+    double segundos;      // Duración de la ejecución de los hijos
+
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: mecanismo de sincronización, modo rendimiento, tamaño de lote y tamaño de los registros
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "m:rl:t:")) != -1){
+        switch (opcion){
+            case 'm':
+                if (!strcmp(optarg, "sem")) modo = MODO_SEM;
+                else if (!strcmp(optarg, "spsc")) modo = MODO_SPSC;
+                else cerrar_con_error("Error: el modo debe ser 'sem' o 'spsc'\n", 0);
+                break;
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "items")) n_iter = N_ITER_RENDIMIENTO;
+                break;
+            case 'l':
+                if ((lote = atoi(optarg)) < 1 || lote > MAX_LOTE)
+                    cerrar_con_error("Error: el tamaño de lote debe estar entre 1 y MAX_LOTE\n", 0);
+                break;
+            case 't':
+                if ((tam_elem = strtoul(optarg, NULL, 10)) == 0)
+                    cerrar_con_error("Error: el tamaño de los registros debe ser de al menos 1 byte\n", 0);
+                break;
+            default:
+                cerrar_con_error("Uso: ./prod_cons_2 [-m sem|spsc] [-r] [-l lote] [-t tam_elem] "
+                                 "[--parámetro=valor ...]\n", 0);
+        }
+    }
 
 
     /*
@@ -80,58 +220,79 @@ int main(int argc, char * argv[]){
      *
      * Indicamos como argumentos:
      * NULL -> El kernel elige la dirección inicial (alineada con las páginas)-
-     * N * sizeof(char) -> Tamaño en bytes que tendrá la zona de memoria (N chars)
+     * tam_region -> Tamaño en bytes que tendrá la zona de memoria (el buffer de N registros)
      * PROT_READ | PROT_WRITE -> Se obtendrán permisos de escritura y lectura.
      * MAP_SHARED | MAP_ANONYMOUS -> Memoria compartida y sin archivo de respaldo. El contenido se inicializa a 0.
      * -1 -> No hay descriptor, al estar usando MAP_ANONYMOUS. En este caso, algunas implementaciones requieren que
      *       este argumento sea -1.
      * 0 -> El offset también debe ser 0, ya que estamos usando MAP_ANONYMOUS.
      * MAP_FAILED es (void *) -1, por lo que lo casteamos a (char *).
+     *
+     * En el modo SPSC la región comienza con la estructura anillo (índices y palabras futex), seguida del buffer.
+     * Como MAP_ANONYMOUS inicializa a 0, los índices y las palabras futex ya parten de su valor inicial.
      */
-    if ((buffer = (char *) mmap(NULL, (size_t) N * sizeof(char), PROT_READ | PROT_WRITE,
-            MAP_SHARED | MAP_ANONYMOUS, -1, (off_t) 0)) == (char *) MAP_FAILED)
+    tam_region = (modo == MODO_SPSC? sizeof(struct anillo) : 0) + buffer_tam_region(capacidad, tam_elem);
+    if ((region = mmap(NULL, tam_region, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, (off_t) 0)) == MAP_FAILED)
         // Si hay algún error, finalizamos la ejecución e imprimimos errno con un mensaje personalizado
         cerrar_con_error("Error: no se ha podido realizar la proyección de memoria con archivo", 1);
 
+    if (modo == MODO_SPSC) anillo = (struct anillo *) region;
 
-    // En el buffer, el carácter ' ' indicará que la posición está vacía. Inicializamos así toda la región, esto es,
-    // los N * sizeof(char) bytes.
-    memset(buffer, ' ', (size_t) N * sizeof(char));
+    // Las medidas también se reservan en memoria compartida, para que el padre pueda leer las latencias de los hijos
+    if ((medidas = medidas_crear(n_iter, capacidad)) == NULL)
+        cerrar_con_error("Error: no se ha podido reservar memoria para las medidas", 1);
+    // Igual que las medidas, los contadores de los hijos (si se llevan) quedan en memoria compartida con el padre
+    if (instrumentar && (contadores = contadores_crear("prod_cons_2", 2)) == NULL)
+        cerrar_con_error("Error: no se ha podido reservar memoria para los contadores", 1);
 
-    // Destruimos los semáforos si ya existían previamente, como medida de precaución
-    // Si no hay ningún error, a continuación los creamos y les damos valores iniciales (N, 0 y 1)
+    // En el buffer, el carácter ' ' indicará que la posición está vacía. Inicializamos así todos los registros.
+    buffer = buffer_iniciar((char *) region + (anillo? sizeof(struct anillo) : 0), capacidad, tam_elem, BUFFER_FIFO,
+                            ' ');
 
-    // Utilizamos sem_unlink para destruir los semáforos si ya existían, indicando su nombre
-    // Si el semáforo no existía, sem_unlink guardará ENOENT en errno y devolverá un error (que ignoraremos)
-    if ((exit_unlink = sem_unlink("PC_VACIAS")) && errno != ENOENT)
-        // El único otro error posible es de permisos inadecuados
-        cerrar_con_error("Error: permisos inadecuados para el semáforo PC_VACIAS", 1);
+    // Los semáforos solo son necesarios en el modo MODO_SEM. En el modo SPSC la sincronización reside por completo
+    // en la región compartida.
+    if (modo == MODO_SEM){
+        // Destruimos los semáforos si ya existían previamente, como medida de precaución
+        // Si no hay ningún error, a continuación los creamos y les damos valores iniciales (N, 0 y 1)
 
-    if ((exit_unlink = sem_unlink("PC_MUTEX")) && errno != ENOENT)
-        cerrar_con_error("Error: permisos inadecuados para el semáforo PC_MUTEX", 1);
+        // Utilizamos sem_unlink para destruir los semáforos si ya existían, indicando su nombre
+        // Si el semáforo no existía, sem_unlink guardará ENOENT en errno y devolverá un error (que ignoraremos)
+        if ((exit_unlink = sem_unlink("PC_VACIAS")) && errno != ENOENT)
+            // El único otro error posible es de permisos inadecuados
+            cerrar_con_error("Error: permisos inadecuados para el semáforo PC_VACIAS", 1);
 
-    if ((exit_unlink = sem_unlink("PC_LLENAS")) && errno != ENOENT)
-        cerrar_con_error("Error: permisos inadecuados para el semáforo PC_LLENAS", 1);
+        if ((exit_unlink = sem_unlink("PC_MUTEX")) && errno != ENOENT)
+            cerrar_con_error("Error: permisos inadecuados para el semáforo PC_MUTEX", 1);
 
-    /*
-     * Utilizamos la función sem_open para crear los semáforos (opción O_CREAT). Les damos todos los permisos para
-     * el usuario, y ninguno para el grupo y para otros.
-     * vacias empieza con el valor inicial N: todo el buffer está inicialmente vacío.
-     */
-    if ((vacias = sem_open("PC_VACIAS", O_CREAT, 0700, N)) == SEM_FAILED)
-        cerrar_con_error("Error: no se ha podido crear el semaforo PC_VACIAS", 1);
+        if ((exit_unlink = sem_unlink("PC_LLENAS")) && errno != ENOENT)
+            cerrar_con_error("Error: permisos inadecuados para el semáforo PC_LLENAS", 1);
 
-    // mutex se inicia con 1, pues al comenzar, la región crítica no está ocupada
-    if ((mutex = sem_open("PC_MUTEX", O_CREAT, 0700, 1)) == SEM_FAILED)
-        cerrar_con_error("Error: no se ha podido crear el semaforo PC_MUTEX", 1);
+        /*
+         * Utilizamos la función sem_open para crear los semáforos (opción O_CREAT). Les damos todos los permisos para
+         * el usuario, y ninguno para el grupo y para otros.
+         * vacias empieza con el valor inicial N: todo el buffer está inicialmente vacío.
+         */
+        if ((vacias = sem_open("PC_VACIAS", O_CREAT, 0700, capacidad)) == SEM_FAILED)
+            cerrar_con_error("Error: no se ha podido crear el semaforo PC_VACIAS", 1);
+
+        // mutex se inicia con 1, pues al comenzar, la región crítica no está ocupada
+        if ((mutex = sem_open("PC_MUTEX", O_CREAT, 0700, 1)) == SEM_FAILED)
+            cerrar_con_error("Error: no se ha podido crear el semaforo PC_MUTEX", 1);
+
+        // llenas se inicia a 0, pues al comenzar, no hay ninguna posición del buffer ocupada
+        if ((llenas = sem_open("PC_LLENAS", O_CREAT, 0700, 0)) == SEM_FAILED)
+            cerrar_con_error("Error: no se ha podido crear el semaforo PC_LLENAS", 1);
+    }
 
-    // llenas se inicia a 0, pues al comenzar, no hay ninguna posición del buffer ocupada
-    if ((llenas = sem_open("PC_LLENAS", O_CREAT, 0700, 0)) == SEM_FAILED)
-        cerrar_con_error("Error: no se ha podido crear el semaforo PC_LLENAS", 1);
+    if (!rendimiento){
+        printf("Se procede a iniciar los procesos productor y consumidor. Se utilizará el código de colores:\n");
+        printf("%s\tPRODUCTOR%s\n", VERDE, RESET);
+        printf("%s\tCONSUMIDOR%s\n\n\n", AZUL, RESET);
+    }
 
-    printf("Se procede a iniciar los procesos productor y consumidor. Se utilizará el código de colores:\n");
-    printf("%s\tPRODUCTOR%s\n", VERDE, RESET);
-    printf("%s\tCONSUMIDOR%s\n\n\n", AZUL, RESET);
+    // Medimos el tiempo que tardan los hijos en transferir todos los items
+    clock_gettime(CLOCK_MONOTONIC, &t_ini);
 
 
     /*
@@ -167,6 +328,11 @@ int main(int argc, char * argv[]){
     // Tampoco usará los semáforos
     cerrar_semaforos(vacias, mutex, llenas);
 
+    // Es el padre quien vuelca los contadores de ambos hijos al recibir SIGUSR2 (los hijos mantienen la acción por
+    // defecto, pues se crean antes)
+    if (contadores != NULL && contadores_senal(contadores) == -1)
+        cerrar_con_error("Error: no se ha podido instalar el volcado de los contadores", 1);
+
     // El proceso queda atrapado en un bucle hasta que todos sus hijos hayan finalizado (waitpid devolverá -1)
     while((exit_wait = waitpid(-1, &status, 0)) != -1){
         /*
@@ -182,11 +348,27 @@ int main(int argc, char * argv[]){
         }
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &t_fin);
+
     // Se destruyen los semáforos empleados (pues se sabe que todos los hijos han finalizado)
     destruir_semaforos();
 
+    // Se informa del rendimiento obtenido: items transferidos por segundo entre productor y consumidor. En el modo
+    // rendimiento se imprime en formato CSV, junto con las latencias y los cambios de contexto.
+    segundos = (t_fin.tv_sec - t_ini.tv_sec) + (t_fin.tv_nsec - t_ini.tv_nsec) / 1e9;
+    if (rendimiento)
+        medidas_informe(medidas, "prod_cons_2", modo == MODO_SPSC? "spsc" : "sem", lote, tam_elem, n_iter, segundos);
+    else
+        printf("\nModo %s, lote %d, registros de %zu B: %ld items en %.3f s -> %.0f items/s\n",
+               modo == MODO_SPSC? "spsc" : "sem", lote, tam_elem, n_iter, segundos, n_iter / segundos);
+    medidas_destruir(medidas);
+    if (contadores != NULL){
+        contadores_volcar(contadores, STDERR_FILENO);
+        contadores_destruir(contadores);
+    }
+
     // Se cierra el programa
-    printf("\n\n\n\nFinalizando ejecucion del problema del productor-consumidor...\n");
+    if (!rendimiento) printf("\n\n\n\nFinalizando ejecucion del problema del productor-consumidor...\n");
     exit(EXIT_SUCCESS);
 }
 
@@ -194,170 +376,290 @@ int main(int argc, char * argv[]){
 
 /*
  * Función ejecutada por el productor, que introduce nuevos elementos en el buffer por el final.
- * Para asegurar que no se produzcan carreras críticas, emplea los semáforos vacias, mutex y llenas.
+ * Para asegurar que no se produzcan carreras críticas, emplea los semáforos vacias, mutex y llenas, o bien el
+ * buffer circular SPSC en el modo MODO_SPSC.
  * Los mensajes del productor aparecen en color verde y en el lado izquierdo de la terminal.
  */
 void producir(){
     int final = 0;        // Almacena la posición donde se debe insertar el próximo item (el buffer es una cola FIFO)
-    sem_t * vacias;       // Semáforo que representa el número de posiciones vacías en el buffer
-    sem_t * mutex;        // Semáforo que salvaguarda el acceso al buffer (solo toma los valores 0 y 1)
-    sem_t * llenas;       // Semáforo que representa el número de posiciones llenas en el buffer
-    char item;            // Variable que almacena un elemento producido
-    int i=0;              // Contador de iteraciones
+    sem_t * vacias = NULL;       // Semáforo que representa el número de posiciones vacías en el buffer
+    sem_t * mutex = NULL;        // Semáforo que salvaguarda el acceso al buffer (solo toma los valores 0 y 1)
+    sem_t * llenas = NULL;       // Semáforo que representa el número de posiciones llenas en el buffer
+    char * registro;      // Hueco del buffer donde se genera cada item
+    int n;                // Número de elementos del lote actual
+    int hechos;           // Elementos del lote actual ya insertados
+    int k;                // Posiciones vacías reservadas en cada entrada a la región crítica
+    int i=0, j;           // Contadores de iteraciones (i cuenta items)
+    uint64_t t;           // Comienzo de la espera por el mutex o de la región crítica que se está midiendo
+
+    cont = contadores_hilo(contadores, "productor", 0);     // Contadores del productor (NULL si no se llevan)
 
     // El productor abre los semáforos para tener acceso a ellos, pero no los inicializa
     // Para cada semáforo se indica su nombre y 0 como segundo argumento, indicando que no se está creando
-    vacias = sem_open("PC_VACIAS", 0);
-    mutex = sem_open("PC_MUTEX", 0);
-    llenas = sem_open("PC_LLENAS", 0);
+    if (modo == MODO_SEM){
+        vacias = sem_open("PC_VACIAS", 0);
+        mutex = sem_open("PC_MUTEX", 0);
+        llenas = sem_open("PC_LLENAS", 0);
+    }
 
     srand(time(NULL));          // Establecemos una semilla para la generación de números aleatorios
 
-    while (i < N_ITER){         // Máximo de 100 iteraciones
-        // Imprimimos en el log con color verde. Se muestran también los contenidos del buffer y la posicioń final
-        // de la cola, donde el productor insertará el próximo item
-        printf("%s**INICIO ITERACION %d** Final de cola = %d\t\t\t\t\t\t\t\t\t\t", VERDE, i, final);
-        log_buffer(1);
+    while (i < n_iter){         // Máximo de 100 iteraciones (N_ITER_RENDIMIENTO en el modo rendimiento)
+        if (!rendimiento){
+            // Imprimimos en el log con color verde. Se muestran también los contenidos del buffer y la posicioń
+            // final de la cola, donde el productor insertará el próximo item
+            printf("%s**INICIO ITERACION %d** Final de cola = %d\t\t\t\t\t\t\t\t\t\t", VERDE, i, final);
+            log_buffer(1);
+
+            // Esperamos un número de segundos aleatorio entre 0 y 4
+            sleep(rand() % espera_max);
+        }
+
+        // Se crea un lote de hasta 'lote' elementos, que serán almacenados en posiciones consecutivas a partir del
+        // final del buffer
+        n = lote < n_iter - i? lote : n_iter - i;
+
+        if (modo == MODO_SPSC){
+            // No hay región crítica: el productor es el único que escribe en el final del anillo. Solo se bloquea
+            // (en un futex) si el buffer está lleno.
+            for (j = 0; j < n; j++) insertar_anillo();
+            contadores_items(cont, n);
+            final = (final + n) % capacidad;
+            i += n;
+            continue;
+        }
+
+        for (hechos = 0; hechos < n; hechos += k){
+            // sem_wait decrementa en 1 el valor de un semáforo, si este era >0
+            // En caso contrario, bloquea al proceso hasta que el semáforo pase a tener un valor positivo. En ese
+            // punto, lo decrementa y desbloquea al proceso.
+            // Con esperar_semaforo_n se reservan de una vez todas las posiciones vacías disponibles (hasta las que
+            // falten por insertar del lote), de forma que solo se bloquea si no hay ninguna.
+            k = esperar_semaforo_n(vacias, n - hechos, 1);
+            // Los k huecos reservados pertenecen al productor hasta que publique los items, y la posición final solo
+            // la modifica él. Por tanto, los items se generan directamente en el buffer fuera de la región crítica.
+            for (j = 0; j < k; j++){
+                registro = buffer_hueco_insertar(buffer, j);
+                produce_item(registro, buffer_posicion(buffer, registro));
+            }
+            t = contadores_inicio(cont);
+            sem_wait(mutex);            // Se solicita acceso a la región crítica (una vez por cada k items)
+            t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
+            insert_items(k);            // Región crítica: se publican los k items al final del buffer
+            contadores_tiempo(cont, CONTADORES_SECCION, t);
+            // sem_post incrementa en 1 el valor de un semáforo. Si el consumidor estaba bloqueado por la función
+            // sem_wait, esperando a que el semáforo cambiara, será despertado
+            sem_post(mutex);            // Se deja la región crítica
+            senalar_semaforo_n(llenas, k);      // Se registra que han quedado k posiciones libres menos
+        }
 
-        // Esperamos un número de segundos aleatorio entre 0 y 4
-        sleep(rand() % 5);
-
-        // Se crea un nuevo elemento, que será almacenado en la posición final del buffer
-        item = produce_item(final);
-        // sem_wait decrementa en 1 el valor de un semáforo, si este era >0
-        // En caso contrario, bloquea al proceso hasta que el semáforo pase a tener un valor positivo. En ese punto,
-        // lo decrementa y desbloquea al proceso.
-        sem_wait(vacias);           // Se disminuye el valor de vacías, pues se guardará un item
-        sem_wait(mutex);            // Se solicita acceso a la región crítica
-        insert_item(&final, item);          // Región crítica: se almacena el item en la posición final del buffer
-        // sem_post incrementa en 1 el valor de un semáforo. Si el consumidor estaba bloqueado por la función
-        // sem_wait, esperando a que el semáforo cambiara, será despertado
-        sem_post(mutex);            // Se deja la región crítica
-        sem_post(llenas);           // Se registra que ha quedado una posición libre menos
-
-        i++;       // Cambiamos de iteración
+        contadores_items(cont, n);
+        final = (final + n) % capacidad;
+        i += n;       // Cambiamos de iteración
     }
 
+    /*
+     * Ya no se insertarán más items: el productor cierra el buffer y despierta al consumidor, que retira los que
+     * queden y termina al encontrarlo cerrado y vacío, sin contar de antemano los que va a consumir. En el modo
+     * MODO_SEM, el cierre se anuncia con una unidad adicional de llenas, que no corresponde a ningún item; en el modo
+     * SPSC, se despierta a todos los procesos dormidos en el futex aviso_item.
+     */
+    buffer_cerrar(buffer);
+    if (modo == MODO_SPSC){
+        atomic_fetch_add(&anillo->aviso_item, 1);
+        despertar_futex(&anillo->aviso_item, INT_MAX);
+    }
+    else sem_post(llenas);
+
     // Una vez el productor finaliza su trabajo, cierra la región de memoria asociada al buffer y los semáforos
-    cerrar_mem_compartida((void *) buffer);
+    cerrar_mem_compartida();
     cerrar_semaforos(vacias, mutex, llenas);
 
-    printf("\n%sFinalizando productor...%s\n", VERDE, RESET);
+    if (!rendimiento) printf("\n%sFinalizando productor...%s\n", VERDE, RESET);
     exit(EXIT_SUCCESS);         // El proceso finaliza su ejecución
 }
 
 /*
  * Función ejecutada por el consumidor, que elimina (sobreescribe con un espacio ' ') elementos preexistentes en el
  * buffer por el inicio.
- * Para asegurar que no se produzcan carreras críticas, emplea los semáforos vacias, mutex y llenas.
+ * Para asegurar que no se produzcan carreras críticas, emplea los semáforos vacias, mutex y llenas, o bien el
+ * buffer circular SPSC en el modo MODO_SPSC.
  * Los mensajes del consumidor aparecen en color azul y en el lado derecho de la terminal.
  */
 void consumir(){
     int inicio = 0;       // Almacena la posición del próximo item a ser eliminado (el buffer es una cola FIFO)
-    sem_t * vacias;       // Semáforo que representa el número de posiciones vacías en el buffer
-    sem_t * mutex;        // Semáforo que salvaguarda el acceso al buffer (solo toma los valores 0 y 1)
-    sem_t * llenas;       // Semáforo que representa el número de posiciones llenas en el buffer
-    char item;            // Variable que almacena un elemento consumido, para imprimir su valor
-    int i=0;              // Contador de iteraciones
+    sem_t * vacias = NULL;       // Semáforo que representa el número de posiciones vacías en el buffer
+    sem_t * mutex = NULL;        // Semáforo que salvaguarda el acceso al buffer (solo toma los valores 0 y 1)
+    sem_t * llenas = NULL;       // Semáforo que representa el número de posiciones llenas en el buffer
+    int k;                // Número de elementos retirados en cada entrada a la región crítica
+    int i=0, j;           // Contadores de iteraciones (i cuenta items)
+    int fin = 0;          // !0 cuando el buffer está cerrado y vacío
+    uint64_t t;           // Comienzo de la espera por el mutex o de la región crítica que se está midiendo
+
+    cont = contadores_hilo(contadores, "consumidor", 0);    // Contadores del consumidor (NULL si no se llevan)
 
     // El consumidor abre los semáforos para tener acceso a ellos, pero no los inicializa
     // Para cada semáforo se indica su nombre y 0 como segundo argumento, indicando que no se está creando
-    vacias = sem_open("PC_VACIAS", 0);
-    mutex = sem_open("PC_MUTEX", 0);
-    llenas = sem_open("PC_LLENAS", 0);
+    if (modo == MODO_SEM){
+        vacias = sem_open("PC_VACIAS", 0);
+        mutex = sem_open("PC_MUTEX", 0);
+        llenas = sem_open("PC_LLENAS", 0);
+    }
 
     srand(time(NULL));          // Establecemos una semilla para la generación de números aleatorios
 
-    while (i < N_ITER){     // Máximo de 100 iteraciones
-        // El consumidor imprime un mensaje avisando de que va a iniciar una nueva ejecución
-        // Muestra el inicio de la cola (de donde eliminará un elemento) y los contenidos del buffer
-        printf("\t\t\t\t\t\t%s**INICIO ITERACION %d** Inicio de cola = %d\t\t\t\t", AZUL, i, inicio);
-        log_buffer(0);
-
-        // Esperamos un número de segundos aleatorio entre 0 y 4
-        sleep(rand() % 5);
-
-        // sem_wait decrementa en 1 el valor de un semáforo, si este era >0
-        // En caso contrario, bloquea al proceso hasta que el semáforo pase a tener un valor positivo. En ese punto,
-        // lo decrementa y desbloquea al proceso.
-        sem_wait(llenas);           // Si no hay ningún elemento en el buffer, el consumidor se bloquea
-                                    // Si hay algún elemento, reduce la cuenta
-        sem_wait(mutex);            // Solicita acceso a la región crítica
-        item = remove_item(&inicio);
-                // Región crítica: se elimina un item de la posición inicio y se almacena en la variable item
-                // También se incrementa inicio
-        sem_post(mutex);            // Se abandona la región crítica, permitiendo el acceso al productor si este
-                                    // estaba bloqueado esperando
-        sem_post(vacias);           // Se incrementa el contador de posiciones vacías, pues una ha quedado libre
-        consume_item(item);         // Se imprime el valor del elemento eliminado (sobreescrito por ' ')
-
-        sleep(rand() % 5);      // Dormimos de nuevo al proceso para provocar más variaciones
-
-        i++;                        // Se pasa a la siguiente iteración
+    while (!fin){           // Hasta que el productor cierre el buffer y no queden items
+        if (!rendimiento){
+            // El consumidor imprime un mensaje avisando de que va a iniciar una nueva ejecución
+            // Muestra el inicio de la cola (de donde eliminará un elemento) y los contenidos del buffer
+            printf("\t\t\t\t\t\t%s**INICIO ITERACION %d** Inicio de cola = %d\t\t\t\t", AZUL, i, inicio);
+            log_buffer(0);
+
+            // Esperamos un número de segundos aleatorio entre 0 y 4
+            sleep(rand() % espera_max);
+        }
+
+        // Como mucho se retira un lote
+        if (modo == MODO_SPSC){
+            // El consumidor es el único que avanza el inicio del anillo. Solo se bloquea si el buffer está vacío, y
+            // extraer_anillo solo devuelve 0 si además está cerrado
+            for (k = 0; k < lote && extraer_anillo(); k++);
+            fin = k < lote;
+        }
+        else {
+            // sem_wait decrementa en 1 el valor de un semáforo, si este era >0
+            // En caso contrario, bloquea al proceso hasta que el semáforo pase a tener un valor positivo. En ese
+            // punto, lo decrementa y desbloquea al proceso.
+            k = esperar_semaforo_n(llenas, lote, 0);    // Si no hay ningún elemento en el buffer, se bloquea
+                                                        // Si hay alguno, reserva todos los que pueda (hasta lote)
+            // La unidad con la que el productor anuncia el cierre es la última que señala en llenas. Con el buffer
+            // cerrado, la cuenta solo cambia por el consumidor: si se han tomado más unidades que items quedan, una
+            // es la del cierre, así que se retiran los que queden y se termina
+            if (buffer_cerrado(buffer) && k > buffer->cuenta){
+                k = buffer->cuenta;
+                fin = 1;
+            }
+            // Hasta que el consumidor libere sus huecos, el productor no puede sobreescribir los k items reservados,
+            // y la posición inicio solo la modifica el consumidor. Por tanto, se leen en el propio buffer fuera de
+            // la región crítica.
+            for (j = 0; j < k; j++) consume_item(buffer_hueco_extraer(buffer, j));
+            t = contadores_inicio(cont);
+            sem_wait(mutex);            // Solicita acceso a la región crítica
+            t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
+            remove_items(k);
+                    // Región crítica: se eliminan k items a partir de la posición inicio (se sobreescriben por ' ')
+                    // También se incrementa inicio
+            contadores_tiempo(cont, CONTADORES_SECCION, t);
+            sem_post(mutex);            // Se abandona la región crítica, permitiendo el acceso al productor si este
+                                        // estaba bloqueado esperando
+            senalar_semaforo_n(vacias, k);  // Se incrementa el contador de posiciones vacías en k
+        }
+
+        // Dormimos de nuevo al proceso para provocar más variaciones
+        if (!rendimiento) sleep(rand() % espera_max);
+
+        contadores_items(cont, k);
+        inicio = (inicio + k) % capacidad;
+        i += k;                     // Se pasa a la siguiente iteración
     }
 
     // Una vez el consumidor finaliza su trabajo, cierra la región de memoria asociada al buffer y los semáforos
     cerrar_mem_compartida();
     cerrar_semaforos(vacias, mutex, llenas);
 
-    printf("\n\t\t\t\t\t\t%sFinalizando consumidor...%s\n", AZUL, RESET);
+    if (!rendimiento) printf("\n\t\t\t\t\t\t%sFinalizando consumidor...%s\n", AZUL, RESET);
     exit(EXIT_SUCCESS);         // El consumidor finaliza su ejecución
 }
 
 /*
  * Función que genera un elemento de la forma 'a' + pos, siendo pos igual a la posición que ocupará la letra en el
  * buffer. Como este tiene 15 posiciones, se generarán las letras minúsculas de la 'a' a la 'o'.
+ * El item se escribe directamente en su hueco del buffer: es un registro de tam_elem bytes relleno con esa letra.
+ * Además, se sella el hueco con el instante de generación para medir la latencia de traspaso.
  * Esta función es empleada por el productor.
+ * @param registro: Hueco del buffer en el que se genera el elemento.
  * @param pos: Posición que ocupará el elemento dentro del buffer.
  */
-char produce_item(int pos){
+void produce_item(char * registro, int pos){
     // Por cuestiones de seguridad (por ejemplo, si se incrementara el tamaño del buffer a un N > 26), empleamos
     // el módulo por el número de letras del abecedario, 26, de forma que se reiniciaría la secuencia.
-    return 'a' + pos % 26;
+    registro_rellenar(registro, tam_elem, 'a' + pos % 26);
+    medidas_sellar(medidas, pos);
 }
 
 /*
- * Función que coloca una letra en el buffer. Se insertará en la última posición, puesto que se trata de una cola FIFO.
+ * Función que publica el siguiente item del final del buffer, que ya fue generado en su hueco por produce_item.
+ * Se insertará en la última posición, puesto que se trata de una cola FIFO.
  * Esta función es empleada por el productor.
- * @param final: Posición en la cual se introducirá el carácter, y que a continuación será incrementada.
- * @param letra: Carácter a colocar en el buffer.
  */
-void insert_item(int * final, char letra){
-    buffer[*final] = letra;         // Se almacena el nuevo elemento.
+void insert_item(){
+    char * registro = buffer_hueco_insertar(buffer, 0);     // Hueco en el que se generó el item
 
     // Se imprime un mensaje de aviso junto a los contenidos del buffer
     // Se emplea el color verde, puesto que esta función solo es empleada por el productor.
-    printf("%sPosición %d -> item %c%s\t\t\t\t\t\t\t\t\t\t\t\t\t", VERDE, *final, letra, RESET);
-    log_buffer(1);
+    if (!rendimiento){
+        printf("%sPosición %d -> item %c%s\t\t\t\t\t\t\t\t\t\t\t\t\t",
+               VERDE, buffer_posicion(buffer, registro), *registro, RESET);
+        log_buffer(1);
+    }
+
+    // Incrementamos el valor de final (el módulo se encarga de no sobrepasar el límite de tamaño)
+    buffer_confirmar_insercion(buffer, 1);
+}
 
-    // Incrementamos el valor de final, realizando el módulo por el número de posiciones del buffer para no
-    // sobrepasar el límite de tamaño
-    *final = (*final + 1) % N;
+/*
+ * Función que retira un item del buffer, que ya fue leído en su hueco por consume_item. Dado que se implementa como
+ * una cola FIFO, se elimina del comienzo. Su primera letra se reemplaza por un espacio en blanco.
+ * Esta función es empleada por el consumidor.
+ */
+void remove_item(){
+    char * registro = buffer_hueco_extraer(buffer, 0);      // Registro situado en la posición inicio
+
+    *registro = ' ';                            // Reemplazamos el valor de esa posición por un espacio en blanco
+    buffer_confirmar_extraccion(buffer, 1);     // Incrementamos inicio (con módulo N)
+}
+
+/*
+ * Función que publica un lote de items al final del buffer, en posiciones consecutivas. Forma parte de la región
+ * crítica: se llama una sola vez por lote, tras haber reservado n posiciones vacías y generado los items en ellas.
+ * Esta función es empleada por el productor.
+ * @param n: Número de items a publicar.
+ */
+void insert_items(int n){
+    int j;          // Variable de iteración
+
+    for (j = 0; j < n; j++) insert_item();
 }
 
 /*
- * Función que retira una letra del buffer. Dado que se implementa como una cola FIFO, se elimina del comienzo.
- * Dicha letra es devuelta por la función y reemplazada por un espacio en blanco.
+ * Función que retira un lote de items del inicio del buffer. Forma parte de la región crítica: se llama una sola
+ * vez por lote, tras haber reservado n posiciones llenas y leído los items en ellas.
  * Esta función es empleada por el consumidor.
- * @param inicio: Posición de la cual se eliminará la letra.
+ * @param n: Número de items a retirar.
  */
-char remove_item(int * inicio){
-    char item;         // Letra que contenía el buffer en la posición inicio.
+void remove_items(int n){
+    int j;          // Variable de iteración
 
-    item = buffer[*inicio];          // Leemos el elemento que había en el buffer
-    buffer[*inicio] = ' ';           // Reemplazamos el valor de esa posición por un espacio en blanco
-    *inicio = (*inicio + 1) % N;     // Incrementamos inicio utilizando un módulo para no sobrepasar el límite (15)
-    return item;                     // Devolvemos el elemento leído
+    for (j = 0; j < n; j++) remove_item();
 }
 
 /*
- * Función que muestra el carácter que fue retirado del buffer por la función remove_item.
+ * Función que lee en el propio buffer un item que el consumidor va a retirar: registra su latencia de traspaso,
+ * comprueba que el registro esté completo y muestra su letra.
  * Esta función es empleada por el consumidor, que imprime en color azul.
- * @param item: Elemento a imprimir y que fue previamente retirado del buffer.
+ * @param registro: Registro del buffer que contiene el item.
  */
-void consume_item(char item){
-    printf("\t\t\t\t\t\t%sConsumido item %c%s\t\t\t\t\t\t\t", AZUL, item, RESET);
-    log_buffer(0);       // Imprimimos también los contenidos del buffer (0 indica que este proceso es el consumidor)
+void consume_item(char * registro){
+    // El hueco no puede volver a sellarse hasta que el consumidor lo libere, así que el sello es el de este item
+    medidas_latencia(medidas, buffer_posicion(buffer, registro));
+
+    if (!registro_comprobar(registro, tam_elem))
+        cerrar_con_error("Error: se ha consumido un registro corrupto\n", 0);
+
+    if (!rendimiento){
+        printf("\t\t\t\t\t\t%sConsumido item %c%s\t\t\t\t\t\t\t", AZUL, *registro, RESET);
+        log_buffer(0);   // Imprimimos también los contenidos del buffer (0 indica que este proceso es el consumidor)
+    }
 }
 
 /*
@@ -371,9 +673,10 @@ void log_buffer(int proceso){
 
     // Dependiendo del argumento proceso, se imprime en verde o en azul. Siempre se activa la cursiva.
     printf("%s%sbuffer = [", proceso? VERDE : AZUL, CURSIVA);
-    for (i = 0; i < N - 1; i++)
-        printf("%c ", *(buffer + i));           // Leemos uno a uno los caracteres contenidos en el buffer
-    printf("%c]%s%s\n", *(buffer + i), RESET, RESET_CURS);
+    for (i = 0; i < capacidad - 1; i++)
+        // Leemos uno a uno los registros contenidos en el buffer (su primer carácter)
+        printf("%c ", *(char *) buffer_registro(buffer, i));
+    printf("%c]%s%s\n", *(char *) buffer_registro(buffer, i), RESET, RESET_CURS);
     // No utilizamos \n hasta el final para tratar de que el buffer se imprima de forma atómica
 }
 
@@ -381,11 +684,51 @@ void log_buffer(int proceso){
  * Función que cierra una región de memoria para el proceso que la llama.
  */
 void cerrar_mem_compartida(){
-    // Utilizamos munmap, indicando el puntero a la región y el tamaño de esta (N caracteres)
-    if (munmap((void *) buffer, (size_t) N * sizeof(char)) == -1)
+    // Utilizamos munmap, indicando el puntero a la región y el tamaño de esta (el buffer de N registros, precedido
+    // de la estructura anillo en el modo SPSC)
+    if (munmap(region, tam_region) == -1)
         cerrar_con_error("Error: no se ha podido cerrar la proyección del área compartida entre los procesos", 1);
 }
 
+/*
+ * Función que decrementa un semáforo tantas veces como sea posible sin bloquearse, hasta un máximo de n. Solo la
+ * primera decrementación puede bloquear al proceso (sem_wait); el resto se intentan con sem_trywait, que retorna
+ * con error si el semáforo ya vale 0. Los semáforos POSIX no ofrecen una espera por n unidades, por lo que así se
+ * reservan de una vez todas las posiciones disponibles para un lote.
+ * Si se llevan contadores, la primera unidad se intenta tomar antes con sem_trywait: si el semáforo vale 0, el
+ * proceso ha encontrado el buffer lleno (productor) o vacío (consumidor), y se mide lo que tarda sem_wait.
+ * @param sem: Semáforo a decrementar.
+ * @param n: Número máximo de unidades a tomar (n >= 1).
+ * @param lleno: !0 si el semáforo cuenta huecos vacíos (esperar en él es encontrar el buffer lleno).
+ * @return: Número de unidades tomadas (entre 1 y n).
+ */
+int esperar_semaforo_n(sem_t * sem, int n, int lleno){
+    int k = 1;          // Unidades tomadas
+    uint64_t t;         // Comienzo de la espera
+
+    if (cont == NULL) sem_wait(sem);
+    else if (sem_trywait(sem)){
+        if (lleno) contadores_lleno(cont);
+        else contadores_vacio(cont);
+        t = contadores_inicio(cont);
+        sem_wait(sem);
+        contadores_tiempo(cont, CONTADORES_ESPERA, t);
+    }
+    while (k < n && !sem_trywait(sem)) k++;
+    return k;
+}
+
+/*
+ * Función que incrementa un semáforo n veces (tantas como unidades se reservaron con esperar_semaforo_n).
+ * @param sem: Semáforo a incrementar.
+ * @param n: Número de unidades a devolver.
+ */
+void senalar_semaforo_n(sem_t * sem, int n){
+    int j;          // Variable de iteración
+
+    for (j = 0; j < n; j++) sem_post(sem);
+}
+
 /*
  * Función auxiliar que cierra los semáforos empleados por un proceso.
  * Esta función es utilizada por el proceso padre, así como por el productor y el consumidor.
@@ -394,6 +737,8 @@ void cerrar_mem_compartida(){
  * @param llenas: Semáforo que representa el número de posiciones usadas en el buffer y tiene nombre "PC_LLENAS".
  */
 void cerrar_semaforos(sem_t * vacias, sem_t * mutex, sem_t * llenas){
+    if (modo != MODO_SEM) return;           // En el modo SPSC no se abren semáforos
+
     // Si sem_close falla, imprimimos errno y cortamos la ejecución.
     if (sem_close(vacias)) cerrar_con_error("No se pudo cerrar el semaforo PC_VACIAS", 1);
     if (sem_close(mutex)) cerrar_con_error("No se pudo cerrar el semaforo PC_MUTEX", 1);
@@ -404,11 +749,130 @@ void cerrar_semaforos(sem_t * vacias, sem_t * mutex, sem_t * llenas){
  * Función auxiliar que destruye los semáforos empleados en el programa.
  */
 void destruir_semaforos(){
+    if (modo != MODO_SEM) return;           // En el modo SPSC no se crean semáforos
+
     if (sem_unlink("PC_VACIAS")) cerrar_con_error("No se pudo destruir el semáforo PC_VACIAS", 1);
     if (sem_unlink("PC_MUTEX")) cerrar_con_error("No se pudo destruir el semáforo PC_MUTEX", 1);
     if (sem_unlink("PC_LLENAS")) cerrar_con_error("No se pudo destruir el semáforo PC_LLENAS", 1);
 }
 
+/*
+ * Función que genera un nuevo item al final del buffer circular SPSC. Es empleada únicamente por el productor.
+ * Como solo hay un productor, el índice final no necesita protegerse: se escribe el registro en su hueco y después
+ * se publica el nuevo final con semántica release, de forma que el consumidor que lo lea (acquire) verá también el
+ * registro completo.
+ * Si el buffer está lleno, el productor se marca como dormido y se bloquea en el futex aviso_hueco hasta que el
+ * consumidor libere una posición.
+ */
+void insertar_anillo(){
+    char * registro;            // Hueco del buffer en el que se genera el item
+    uint64_t final = atomic_load_explicit(&anillo->final, memory_order_relaxed);   // Solo lo escribe este proceso
+    uint32_t aviso;             // Valor de la palabra futex antes de comprobar si seguimos sin hueco
+    uint64_t t;                 // Comienzo de la espera en el futex
+
+    while (final - atomic_load_explicit(&anillo->inicio, memory_order_acquire) == capacidad){
+        /*
+         * El buffer está lleno. Antes de dormir, leemos el valor de la palabra futex y anunciamos que vamos a dormir.
+         * Después volvemos a comprobar el inicio: si el consumidor liberó un hueco entre medias, o bien lo vemos aquí,
+         * o bien él ve productor_dormido a 1 e incrementa aviso_hueco, con lo que FUTEX_WAIT retorna de inmediato.
+         */
+        aviso = atomic_load(&anillo->aviso_hueco);
+        atomic_store(&anillo->productor_dormido, 1);
+        if (final - atomic_load(&anillo->inicio) == capacidad){
+            contadores_lleno(cont);
+            t = contadores_inicio(cont);
+            esperar_futex(&anillo->aviso_hueco, aviso);
+            contadores_tiempo(cont, CONTADORES_ESPERA, t);
+        }
+        atomic_store(&anillo->productor_dormido, 0);
+    }
+
+    registro = buffer_registro(buffer, final % capacidad);
+    produce_item(registro, final % capacidad);          // Se genera el nuevo elemento directamente en su hueco
+
+    if (!rendimiento){
+        printf("%sPosición %d -> item %c%s\t\t\t\t\t\t\t\t\t\t\t\t\t", VERDE, (int) (final % capacidad), *registro,
+               RESET);
+        log_buffer(1);
+    }
+
+    // Publicamos el nuevo final. La barrera seq_cst ordena esta escritura con la lectura de consumidor_dormido
+    // (patrón de Dekker), evitando que el consumidor se duerma sin que nadie lo despierte.
+    atomic_store_explicit(&anillo->final, final + 1, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&anillo->consumidor_dormido, memory_order_relaxed)){
+        atomic_fetch_add(&anillo->aviso_item, 1);
+        despertar_futex(&anillo->aviso_item, 1);
+    }
+}
+
+/*
+ * Función que consume en el propio buffer el item del inicio del buffer circular SPSC y lo retira, dejando un
+ * espacio en blanco en su lugar.
+ * Es empleada únicamente por el consumidor. Si el buffer está vacío, el consumidor se bloquea en el futex aviso_item
+ * hasta que el productor inserte un elemento o cierre el buffer.
+ * @return: 1 si se ha retirado un item, 0 si el buffer está cerrado y vacío (ya no llegarán más).
+ */
+int extraer_anillo(){
+    uint64_t inicio = atomic_load_explicit(&anillo->inicio, memory_order_relaxed);     // Solo lo escribe este proceso
+    uint32_t aviso;             // Valor de la palabra futex antes de comprobar si seguimos sin items
+    uint64_t t;                 // Comienzo de la espera en el futex
+    char * registro;            // Registro del buffer que contiene el item
+
+    while (atomic_load_explicit(&anillo->final, memory_order_acquire) == inicio){
+        // Si el buffer está cerrado, el productor ya publicó su último final antes de cerrarlo: si aún no hay items,
+        // no llegarán más
+        if (buffer_cerrado(buffer) && atomic_load_explicit(&anillo->final, memory_order_acquire) == inicio) return 0;
+        // Buffer vacío. Mismo protocolo que el productor, pero sobre aviso_item y consumidor_dormido. El productor
+        // incrementa aviso_item después de cerrar el buffer, así que tampoco se pierde el aviso del cierre
+        aviso = atomic_load(&anillo->aviso_item);
+        atomic_store(&anillo->consumidor_dormido, 1);
+        if (atomic_load(&anillo->final) == inicio && !buffer_cerrado(buffer)){
+            contadores_vacio(cont);
+            t = contadores_inicio(cont);
+            esperar_futex(&anillo->aviso_item, aviso);
+            contadores_tiempo(cont, CONTADORES_ESPERA, t);
+        }
+        atomic_store(&anillo->consumidor_dormido, 0);
+    }
+
+    registro = buffer_registro(buffer, inicio % capacidad);
+    consume_item(registro);                     // Leemos el elemento en el propio buffer
+    *registro = ' ';                            // Reemplazamos el valor de esa posición por un espacio en blanco
+
+    // Publicamos el nuevo inicio (release: el productor no sobreescribirá la posición antes de que la hayamos leído)
+    atomic_store_explicit(&anillo->inicio, inicio + 1, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&anillo->productor_dormido, memory_order_relaxed)){
+        atomic_fetch_add(&anillo->aviso_hueco, 1);
+        despertar_futex(&anillo->aviso_hueco, 1);
+    }
+    return 1;
+}
+
+/*
+ * Función que bloquea al proceso en una palabra futex mientras esta conserve el valor indicado. Si la palabra ya ha
+ * cambiado, el kernel retorna inmediatamente (EAGAIN). Se usa FUTEX_WAIT sin la variante privada, pues la palabra
+ * está en una región compartida entre procesos.
+ * @param palabra: Dirección de la palabra futex (en la región compartida).
+ * @param valor: Valor esperado de la palabra.
+ */
+void esperar_futex(_Atomic uint32_t * palabra, uint32_t valor){
+    if (syscall(SYS_futex, (uint32_t *) palabra, FUTEX_WAIT, valor, NULL, NULL, 0) == -1
+            && errno != EAGAIN && errno != EINTR)
+        cerrar_con_error("Error en la espera sobre un futex", 1);
+}
+
+/*
+ * Función que despierta a (como mucho) n procesos bloqueados en una palabra futex.
+ * @param palabra: Dirección de la palabra futex (en la región compartida).
+ * @param n: Número máximo de procesos a despertar (INT_MAX para todos).
+ */
+void despertar_futex(_Atomic uint32_t * palabra, int n){
+    if (syscall(SYS_futex, (uint32_t *) palabra, FUTEX_WAKE, n, NULL, NULL, 0) == -1)
+        cerrar_con_error("Error al despertar a un proceso bloqueado en un futex", 1);
+}
+
 /*
  * Función auxiliar que imprime un mensaje de error y finaliza la ejecución.
  * @param mensaje: descripción personalizada del error que será imprimido.
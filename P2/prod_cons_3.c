@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -8,6 +9,12 @@
 #include <semaphore.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include "../comun/buffer.h"
+#include "../comun/medidas.h"
+#include "../comun/config.h"
+#include "../comun/afinidad.h"
+#include "../comun/contadores.h"
 
 
 /*
@@ -21,11 +28,36 @@
  * En este ejercicio el consumidor se crea antes que el productor.
  *
  * Debe compilarse con la opción -pthread.
+ *
+ * El buffer es un buffer de registros (módulo comun/buffer): el productor genera cada item directamente en su hueco y
+ * el consumidor lo lee en el propio buffer, sin copias intermedias. Al terminar, el productor cierra el buffer y
+ * despierta al consumidor, que retira items hasta encontrarlo cerrado y vacío.
+ *
+ * Uso: ./prod_cons_3 [-r] [-l lote] [-t tam_elem] [-a politica] [--parámetro=valor ...]
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, se realizan N_ITER_RENDIMIENTO iteraciones y se
+ *      imprime una línea CSV (módulo comun/medidas) con los items/s, los percentiles de la latencia de traspaso y
+ *      los cambios de contexto.
+ *  -l: número máximo de items que se transfieren en cada entrada a la región crítica (1 por defecto, como mucho
+ *      MAX_LOTE).
+ *  -t: tamaño en bytes de cada registro del buffer (1 por defecto).
+ *  -a: política de colocación de los hilos en las CPUs (módulo comun/afinidad): ninguna (por defecto), compacta,
+ *      dispersa o parejas (productor y consumidor en hilos hardware hermanos del mismo núcleo). Con cualquiera de las
+ *      tres últimas, el buffer se reserva en el nodo NUMA del consumidor y la política se añade a la variante del CSV.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra): capacidad (N por defecto), items (los que genera el
+ * productor), tam_elem (como -t), lote (como -l), espera_max (las esperas duran de 0 a espera_max - 1 segundos) y
+ * contadores (con 1, se vuelcan en JSON por la salida de errores, al acabar y al recibir SIGUSR2, los contadores del
+ * productor y del consumidor del módulo comun/contadores: esperas en los semáforos, tiempo en la región crítica, veces
+ * que encontraron el buffer lleno o vacío e items procesados). También se pueden fijar con las variables de entorno
+ * SOII_CAPACIDAD, etc.
  */
 
 
-#define N 15                        // Tamaño del buffer compartido entre productor y consumidor
+#define N 15                        // Tamaño por defecto del buffer compartido entre productor y consumidor
 #define N_ITER 100                  // Número de iteraciones de cada hilo
+#define N_ITER_RENDIMIENTO 1000000  // Número de iteraciones de cada hilo en el modo rendimiento
+#define ESPERA_MAX 5                // Las esperas aleatorias duran entre 0 y ESPERA_MAX - 1 segundos
+#define MAX_LOTE 512                // Tamaño máximo de un lote de items (opción -l)
 
 #define VERDE "\033[32m"            // Color en el que imprimirá el productor
 #define AZUL "\033[34m"             // Color en el que imprimirá el consumidor
@@ -41,18 +73,27 @@ void * producir(void * arg);
 // Función del consumidor
 void * consumir(void * arg);
 
-// Función de generación de un item (productor)
-char produce_item(int pos);
+// Función de generación de un item en su hueco del buffer (productor)
+void produce_item(char * registro, int pos);
 // Función de inserción de un item en el buffer (productor)
-void insert_item(int * final, char letra);
+void insert_item();
 // Función de eliminación de un item del buffer (consumidor)
-char remove_item(int * inicio);
-// Función de impresión de un item eliminado (consumidor)
-void consume_item(char item);
+void remove_item();
+// Función de inserción de un lote de items en el buffer (productor)
+void insert_items(int n);
+// Función de eliminación de un lote de items del buffer (consumidor)
+void remove_items(int n);
+// Función de lectura de un item en su hueco del buffer (consumidor)
+void consume_item(char * registro);
 
 // Función de impresión del contenido del buffer
 void log_buffer(int hilo);
 
+// Función que decrementa un semáforo entre 1 y n veces, bloqueándose solo para la primera
+int esperar_semaforo_n(sem_t * sem, int n, int lleno, struct contadores_hilo * cont);
+// Función que incrementa un semáforo n veces
+void senalar_semaforo_n(sem_t * sem, int n);
+
 // Función de cierre de semáforos con sem_close
 void cerrar_semaforos(sem_t * vacias, sem_t * mutex, sem_t * llenas);
 // Función de destrucción de semáforos con sem_unlink
@@ -61,7 +102,28 @@ void destruir_semaforos();
 // Función auxiliar de finalización con error
 void cerrar_con_error(char * mensaje, int ver_errno);
 
-char * buffer = NULL;                      // Área de memoria compartida: un buffer de caracteres (cola FIFO)
+struct buffer * buffer = NULL;             // Buffer de registros compartido por los hilos (cola FIFO)
+size_t tam_elem = sizeof(char);            // Tamaño en bytes de cada registro del buffer
+int rendimiento = 0;                       // !0 para ejecutar sin esperas ni mensajes y medir items/s
+long n_iter = N_ITER;                      // Número de items que genera el productor
+int lote = 1;                              // Número máximo de items por entrada a la región crítica
+int capacidad = N;                         // Tamaño del buffer compartido
+int espera_max = ESPERA_MAX;               // Límite (exclusivo) en segundos de las esperas aleatorias
+int afinidad = AFINIDAD_NINGUNA;           // Política de colocación de los hilos en las CPUs
+int instrumentar = 0;                      // !0 para llevar y volcar los contadores del productor y del consumidor
+struct contadores * contadores = NULL;     // Contadores de instrumentación (NULL si no se llevan)
+
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"capacidad", &capacidad, CONFIG_INT, 1, CONFIG_MAX_CAPACIDAD, "Tamaño del buffer compartido"},
+    {"items", &n_iter, CONFIG_LONG, 1, LONG_MAX, "Items que genera el productor (N_ITER_RENDIMIENTO con -r)"},
+    {"tam_elem", &tam_elem, CONFIG_SIZE, 1, CONFIG_MAX_TAM_ELEM, "Tamaño en bytes de cada registro (como -t)"},
+    {"lote", &lote, CONFIG_INT, 1, MAX_LOTE, "Items por entrada a la región crítica (como -l)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+    {"contadores", &instrumentar, CONFIG_INT, 0, 1, "Con 1, vuelca en JSON los contadores de cada hilo"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
+struct medidas * medidas = NULL;           // Latencias de traspaso de los items (un sello por hueco del buffer)
 
 
 
@@ -74,19 +136,61 @@ int main(int argc, char * argv[]){
     sem_t * vacias;       // Semáforo que representa el número de posiciones vacías en el buffer
     sem_t * mutex;        // Semáforo que salvaguarda el acceso al buffer (solo toma los valores 0 y 1)
     sem_t * llenas;       // Semáforo que representa el número de posiciones llenas en el buffer
+    int opcion;                     // Opción leída con getopt
+    struct timespec t_ini, t_fin;   // Instantes de comienzo y final de la ejecución de los hilos
+    double segundos;                // Duración de la ejecución de los hilos
+    void * region;                  // Memoria dinámica reservada para el buffer
+    pthread_attr_t atributos;       // Atributos de creación de los hilos (afinidad)
+    char variante[32];              // Variante del CSV del modo rendimiento
+
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: modo rendimiento, tamaño de lote y tamaño de los registros
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "rl:t:a:")) != -1){
+        switch (opcion){
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "items")) n_iter = N_ITER_RENDIMIENTO;
+                break;
+            case 'l':
+                if ((lote = atoi(optarg)) < 1 || lote > MAX_LOTE)
+                    cerrar_con_error("Error: el tamaño de lote debe estar entre 1 y MAX_LOTE\n", 0);
+                break;
+            case 't':
+                if ((tam_elem = strtoul(optarg, NULL, 10)) == 0)
+                    cerrar_con_error("Error: el tamaño de los registros debe ser de al menos 1 byte\n", 0);
+                break;
+            case 'a':
+                if ((afinidad = afinidad_politica(optarg)) == -1)
+                    cerrar_con_error("Error: la política de afinidad debe ser ninguna, compacta, dispersa o parejas\n",
+                                     0);
+                break;
+            default:
+                cerrar_con_error("Uso: ./prod_cons_3 [-r] [-l lote] [-t tam_elem] "
+                                 "[-a ninguna|compacta|dispersa|parejas] [--parámetro=valor ...]\n", 0);
+        }
+    }
 
     srand(time(NULL));          // Establecemos una semilla para la generación de números aleatorios
 
-    // Ahora la región de memoria no tiene por qué reservarse con mmap, puesto que los hilos comparten directamente
-    // el espacio de direcciones. Únicamente reservamos un espacio de memoria dinámica con malloc. Este podrá ser
-    // utilizado por el hilo productor y el consumidor.
-    if ((buffer = (char *) malloc(N * sizeof(char))) == NULL)
+    // Ahora la región de memoria no tiene por qué compartirse entre procesos, puesto que los hilos comparten
+    // directamente el espacio de direcciones. Únicamente reservamos un espacio de memoria privado, que podrá ser
+    // utilizado por el hilo productor y el consumidor. Si se ha indicado una política de afinidad, sus páginas se
+    // colocan en el nodo NUMA del consumidor, que es quien lee los items.
+    if ((region = afinidad_reservar(buffer_tam_region(capacidad, tam_elem), afinidad == AFINIDAD_NINGUNA? -1 :
+                                    afinidad_nodo(afinidad_cpu(afinidad, AFINIDAD_CONSUMIDOR, 0, 1)))) == NULL)
         // Imprimimos un mensaje de error y finalizamos el programa (sin mostrar errno)
         cerrar_con_error("Error: no se ha podido reservar memoria para el buffer", 0);
 
-    // En el buffer, el carácter ' ' indicará que la posición está vacía. Inicializamos así toda la región, esto es,
-    // los N * sizeof(char) bytes.
-    memset(buffer, ' ', (size_t) N * sizeof(char));
+    // En el buffer, el carácter ' ' indicará que la posición está vacía. Inicializamos así todos los registros.
+    buffer = buffer_iniciar(region, capacidad, tam_elem, BUFFER_FIFO, ' ');
+
+    if ((medidas = medidas_crear(n_iter, capacidad)) == NULL)
+        cerrar_con_error("Error: no se ha podido reservar memoria para las medidas", 1);
+    // Con --contadores=1, cada hilo lleva sus contadores, que se vuelcan al acabar o al recibir SIGUSR2
+    if (instrumentar && ((contadores = contadores_crear("prod_cons_3", N_HILOS)) == NULL ||
+                         contadores_senal(contadores) == -1))
+        cerrar_con_error("Error: no se han podido preparar los contadores", 1);
 
     // Destruimos los semáforos si ya existían previamente, como medida de precaución
     // Si no hay ningún error, a continuación los creamos y les damos valores iniciales (N, 0 y 1)
@@ -108,7 +212,7 @@ int main(int argc, char * argv[]){
      * el usuario, y ninguno para el grupo y para otros.
      * vacias empieza con el valor inicial N: todo el buffer está inicialmente vacío.
      */
-    if ((vacias = sem_open("PC_VACIAS", O_CREAT, 0700, N)) == SEM_FAILED)
+    if ((vacias = sem_open("PC_VACIAS", O_CREAT, 0700, capacidad)) == SEM_FAILED)
         cerrar_con_error("Error: no se ha podido crear el semaforo PC_VACIAS", 1);
 
     // mutex se inicia con 1, pues al comenzar, la región crítica no está ocupada
@@ -119,9 +223,14 @@ int main(int argc, char * argv[]){
     if ((llenas = sem_open("PC_LLENAS", O_CREAT, 0700, 0)) == SEM_FAILED)
         cerrar_con_error("Error: no se ha podido crear el semaforo PC_LLENAS", 1);
 
-    printf("Se procede a iniciar los hilos productor y consumidor. Se utilizará el código de colores:\n");
-    printf("%s\tPRODUCTOR%s\n", VERDE, RESET);
-    printf("%s\tCONSUMIDOR%s\n\n\n", AZUL, RESET);
+    if (!rendimiento){
+        printf("Se procede a iniciar los hilos productor y consumidor. Se utilizará el código de colores:\n");
+        printf("%s\tPRODUCTOR%s\n", VERDE, RESET);
+        printf("%s\tCONSUMIDOR%s\n\n\n", AZUL, RESET);
+    }
+
+    // Medimos el tiempo que tardan los hilos en transferir todos los items
+    clock_gettime(CLOCK_MONOTONIC, &t_ini);
 
     /*
      * Al crear el consumidor antes que el productor, aseguramos que ambos procesos empiecen aproximadamente a la vez.
@@ -131,9 +240,19 @@ int main(int argc, char * argv[]){
      */
 
 
+    // Los atributos de los hilos solo se modifican para fijar su CPU, si se ha indicado una política de afinidad (con
+    // la política ninguna, afinidad_cpu devuelve -1 y afinidad_atributos no los cambia)
+    if ((error = pthread_attr_init(&atributos)) != 0 ||
+        (error = afinidad_atributos(&atributos, afinidad_cpu(afinidad, AFINIDAD_CONSUMIDOR, 0, 1))) != 0){
+        fprintf(stderr, "Error %d al preparar los atributos del hilo consumidor: %s\n", error, strerror(error));
+        cerrar_semaforos(vacias, mutex, llenas);
+        destruir_semaforos();
+        exit(EXIT_FAILURE);
+    }
+
     // Creamos el hilo consumidor. Guardamos su identificador en el array hilos
-    // No usamos ninguna configuración especial. El hilo ejecutará la función consumir, a la que no pasamos argumentos
-    if ((error = pthread_create(&hilos[0], NULL, consumir, NULL)) != 0){
+    // El hilo ejecutará la función consumir, a la que no pasamos argumentos
+    if ((error = pthread_create(&hilos[0], &atributos, consumir, NULL)) != 0){
         // Si hay algún error, imprimimos su causa y cerramos el programa tras cerrar y destruir los semáforos
         fprintf(stderr, "Error %d al crear el hilo consumidor: %s\n", error, strerror(error));
         cerrar_semaforos(vacias, mutex, llenas);
@@ -141,8 +260,16 @@ int main(int argc, char * argv[]){
         exit(EXIT_FAILURE);
     }
 
-    // Hacemos lo mismo para el proceso productor, que ejecutará producir
-    if ((error = pthread_create(&hilos[1], NULL, producir, NULL)) != 0){
+    // Hacemos lo mismo para el proceso productor, que ejecutará producir (en su propia CPU)
+    pthread_attr_destroy(&atributos);
+    if ((error = pthread_attr_init(&atributos)) != 0 ||
+        (error = afinidad_atributos(&atributos, afinidad_cpu(afinidad, AFINIDAD_PRODUCTOR, 0, 1))) != 0){
+        fprintf(stderr, "Error %d al preparar los atributos del hilo productor: %s\n", error, strerror(error));
+        cerrar_semaforos(vacias, mutex, llenas);
+        destruir_semaforos();
+        exit(EXIT_FAILURE);
+    }
+    if ((error = pthread_create(&hilos[1], &atributos, producir, NULL)) != 0){
         // Si hay algún error, imprimimos su causa y cerramos el programa tras cerrar y destruir los semáforos
         fprintf(stderr, "Error %d al crear el hilo consumidor: %s\n", error, strerror(error));
         cerrar_semaforos(vacias, mutex, llenas);
@@ -150,6 +277,8 @@ int main(int argc, char * argv[]){
         exit(EXIT_FAILURE);
     }
 
+    pthread_attr_destroy(&atributos);
+
     // El padre ya puede cerrar sus semáforos, que no usará
     cerrar_semaforos(vacias, mutex, llenas);
 
@@ -173,12 +302,29 @@ int main(int argc, char * argv[]){
         }
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &t_fin);
+
     // Una vez han finalizado los hilos hijos, el hilo padre destruye los semáforos. Después, termina su
     // ejecución. No es necesario cerrar la memoria compartida, pero sí liberar la memoria reservada
     destruir_semaforos();
-    free(buffer);
+    afinidad_liberar(buffer, buffer_tam_region(capacidad, tam_elem));
+
+    // Se informa del rendimiento obtenido: items transferidos por segundo entre productor y consumidor. En el modo
+    // rendimiento se imprime en formato CSV, junto con las latencias y los cambios de contexto.
+    segundos = (t_fin.tv_sec - t_ini.tv_sec) + (t_fin.tv_nsec - t_ini.tv_nsec) / 1e9;
+    // La variante del CSV incluye la política de afinidad, si se ha indicado alguna (por ejemplo, hilos/parejas)
+    snprintf(variante, sizeof(variante), "hilos%s%s", afinidad == AFINIDAD_NINGUNA? "" : "/",
+             afinidad == AFINIDAD_NINGUNA? "" : afinidad_nombre(afinidad));
+    if (rendimiento) medidas_informe(medidas, "prod_cons_3", variante, lote, tam_elem, n_iter, segundos);
+    else printf("\nAfinidad %s, lote %d, registros de %zu B: %ld items en %.3f s -> %.0f items/s\n",
+                afinidad_nombre(afinidad), lote, tam_elem, n_iter, segundos, n_iter / segundos);
+    medidas_destruir(medidas);
+    if (contadores != NULL){
+        contadores_volcar(contadores, STDERR_FILENO);
+        contadores_destruir(contadores);
+    }
 
-    printf("\n\n\n\nFinalizando ejecucion del problema del productor-consumidor...\n");
+    if (!rendimiento) printf("\n\n\n\nFinalizando ejecucion del problema del productor-consumidor...\n");
     exit(EXIT_SUCCESS);
 }
 
@@ -192,11 +338,16 @@ int main(int argc, char * argv[]){
  */
 void * producir(void * arg){
     int final = 0;        // Almacena la posición donde se debe insertar el próximo item (el buffer es una cola FIFO)
-    char item;            // Variable que almacena un elemento producido
-    int i=0;              // Contador de iteraciones
+    char * registro;      // Hueco del buffer donde se genera cada item
+    int n;                // Número de elementos del lote actual
+    int hechos;           // Elementos del lote actual ya insertados
+    int k;                // Posiciones vacías reservadas en cada entrada a la región crítica
+    int i=0, j;           // Contadores de iteraciones (i cuenta items)
     sem_t * vacias;       // Semáforo que representa el número de posiciones vacías en el buffer
     sem_t * mutex;        // Semáforo que salvaguarda el acceso al buffer (solo toma los valores 0 y 1)
     sem_t * llenas;       // Semáforo que representa el número de posiciones llenas en el buffer
+    uint64_t t;           // Comienzo de la espera por el mutex o de la región crítica que se está midiendo
+    struct contadores_hilo * cont = contadores_hilo(contadores, "productor", 0);   // Contadores (NULL si no se llevan)
 
 
     // El productor abre los semáforos para tener acceso a ellos, pero no los inicializa
@@ -206,35 +357,60 @@ void * producir(void * arg){
     llenas = sem_open("PC_LLENAS", 0);
 
 
-    while (i < N_ITER){         // Máximo de 100 iteraciones
-        // Imprimimos en el log con color verde. Se muestran también los contenidos del buffer y la posicioń final
-        // de la cola, donde el productor insertará el próximo item
-        printf("%s**INICIO ITERACION %d** Final de cola = %d\t\t\t\t\t\t\t\t\t\t", VERDE, i, final);
-        log_buffer(1);
+    while (i < n_iter){         // Máximo de 100 iteraciones (N_ITER_RENDIMIENTO en el modo rendimiento)
+        if (!rendimiento){
+            // Imprimimos en el log con color verde. Se muestran también los contenidos del buffer y la posicioń
+            // final de la cola, donde el productor insertará el próximo item
+            printf("%s**INICIO ITERACION %d** Final de cola = %d\t\t\t\t\t\t\t\t\t\t", VERDE, i, final);
+            log_buffer(1);
 
-        // Esperamos un número de segundos aleatorio entre 0 y 4
-        sleep(rand() % 5);      // La semilla se establece en el hilo padre
+            // Esperamos un número de segundos aleatorio entre 0 y 4
+            sleep(rand() % espera_max);      // La semilla se establece en el hilo padre
+        }
 
-        // Se crea un nuevo elemento, que será almacenado en la posición final del buffer
-        item = produce_item(final);
-        // sem_wait decrementa en 1 el valor de un semáforo, si este era >0
-        // En caso contrario, bloquea al hilo hasta que el semáforo pase a tener un valor positivo. En ese punto,
-        // lo decrementa y desbloquea al hilo.
-        sem_wait(vacias);           // Se disminuye el valor de vacías, pues se guardará un item
-        sem_wait(mutex);            // Se solicita acceso a la región crítica
-        insert_item(&final, item);          // Región crítica: se almacena el item en la posición final del buffer
-        // sem_post incrementa en 1 el valor de un semáforo. Si el consumidor estaba bloqueado por la función
-        // sem_wait, esperando a que el semáforo cambiara, será despertado
-        sem_post(mutex);            // Se deja la región crítica
-        sem_post(llenas);           // Se registra que ha quedado una posición libre menos
-
-        i++;       // Cambiamos de iteración
+        // Se crea un lote de hasta 'lote' elementos, que serán almacenados en posiciones consecutivas a partir del
+        // final del buffer
+        n = lote < n_iter - i? lote : n_iter - i;
+
+        for (hechos = 0; hechos < n; hechos += k){
+            // sem_wait decrementa en 1 el valor de un semáforo, si este era >0
+            // En caso contrario, bloquea al hilo hasta que el semáforo pase a tener un valor positivo. En ese
+            // punto, lo decrementa y desbloquea al hilo.
+            // Con esperar_semaforo_n se reservan de una vez todas las posiciones vacías disponibles (hasta las que
+            // falten por insertar del lote), de forma que solo se bloquea si no hay ninguna.
+            k = esperar_semaforo_n(vacias, n - hechos, 1, cont);
+            // Los k huecos reservados pertenecen al productor hasta que publique los items, y la posición final solo
+            // la modifica él. Por tanto, los items se generan directamente en el buffer fuera de la región crítica.
+            for (j = 0; j < k; j++){
+                registro = buffer_hueco_insertar(buffer, j);
+                produce_item(registro, buffer_posicion(buffer, registro));
+            }
+            t = contadores_inicio(cont);
+            sem_wait(mutex);            // Se solicita acceso a la región crítica (una vez por cada k items)
+            t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
+            insert_items(k);            // Región crítica: se publican los k items al final del buffer
+            contadores_tiempo(cont, CONTADORES_SECCION, t);
+            // sem_post incrementa en 1 el valor de un semáforo. Si el consumidor estaba bloqueado por la función
+            // sem_wait, esperando a que el semáforo cambiara, será despertado
+            sem_post(mutex);            // Se deja la región crítica
+            senalar_semaforo_n(llenas, k);      // Se registra que han quedado k posiciones libres menos
+        }
+
+        contadores_items(cont, n);
+        final = (final + n) % capacidad;
+        i += n;       // Cambiamos de iteración
     }
 
+    // Ya no se insertarán más items: el productor cierra el buffer y lo anuncia con una unidad adicional de llenas,
+    // que no corresponde a ningún item. El consumidor retira los que queden y termina al encontrarlo cerrado y vacío,
+    // sin contar de antemano los que va a consumir
+    buffer_cerrar(buffer);
+    sem_post(llenas);
+
     // Una vez el productor finaliza su trabajo, cierra los semáforos
     cerrar_semaforos(vacias, mutex, llenas);
 
-    printf("\n%sFinalizando productor...%s\n", VERDE, RESET);
+    if (!rendimiento) printf("\n%sFinalizando productor...%s\n", VERDE, RESET);
     // En el ejercicio 2 empleábamos la función exit() para cerrar la ejecución. Ahora, dado que empleamos hilos,
     // cerramos empleando pthread_exit, para que el proceso continúe ejecutándose.
     pthread_exit((void *) "Hilo finalizado correctamente");
@@ -249,11 +425,14 @@ void * producir(void * arg){
  */
 void * consumir(void * arg){
     int inicio = 0;       // Almacena la posición del próximo item a ser eliminado (el buffer es una cola FIFO)
-    char item;            // Variable que almacena un elemento consumido, para imprimir su valor
-    int i=0;              // Contador de iteraciones
+    int k;                // Número de elementos retirados en cada entrada a la región crítica
+    int i=0, j;           // Contadores de iteraciones (i cuenta items)
+    int fin = 0;          // !0 cuando el buffer está cerrado y vacío
     sem_t * vacias;       // Semáforo que representa el número de posiciones vacías en el buffer
     sem_t * mutex;        // Semáforo que salvaguarda el acceso al buffer (solo toma los valores 0 y 1)
     sem_t * llenas;       // Semáforo que representa el número de posiciones llenas en el buffer
+    uint64_t t;           // Comienzo de la espera por el mutex o de la región crítica que se está midiendo
+    struct contadores_hilo * cont = contadores_hilo(contadores, "consumidor", 0);  // Contadores (NULL si no se llevan)
 
 
     // El productor abre los semáforos para tener acceso a ellos, pero no los inicializa
@@ -263,37 +442,56 @@ void * consumir(void * arg){
     llenas = sem_open("PC_LLENAS", 0);
 
 
-    while (i < N_ITER){     // Máximo de 100 iteraciones
-        // El consumidor imprime un mensaje avisando de que va a iniciar una nueva ejecución
-        // Muestra el inicio de la cola (de donde eliminará un elemento) y los contenidos del buffer
-        printf("\t\t\t\t\t\t%s**INICIO ITERACION %d** Inicio de cola = %d\t\t\t\t", AZUL, i, inicio);
-        log_buffer(0);
+    while (!fin){           // Hasta que el productor cierre el buffer y no queden items
+        if (!rendimiento){
+            // El consumidor imprime un mensaje avisando de que va a iniciar una nueva ejecución
+            // Muestra el inicio de la cola (de donde eliminará un elemento) y los contenidos del buffer
+            printf("\t\t\t\t\t\t%s**INICIO ITERACION %d** Inicio de cola = %d\t\t\t\t", AZUL, i, inicio);
+            log_buffer(0);
 
-        // Esperamos un número de segundos aleatorio entre 0 y 4
-        sleep(rand() % 5);     // La semilla se establece en el hilo padre
+            // Esperamos un número de segundos aleatorio entre 0 y 4
+            sleep(rand() % espera_max);     // La semilla se establece en el hilo padre
+        }
 
         // sem_wait decrementa en 1 el valor de un semáforo, si este era >0
         // En caso contrario, bloquea al hilo hasta que el semáforo pase a tener un valor positivo. En ese punto,
         // lo decrementa y desbloquea al hilo.
-        sem_wait(llenas);           // Si no hay ningún elemento en el buffer, el consumidor se bloquea
-                                    // Si hay algún elemento, reduce la cuenta
+        // Como mucho se retira un lote
+        k = esperar_semaforo_n(llenas, lote, 0, cont);
+                                    // Si no hay ningún elemento en el buffer, el consumidor se bloquea
+                                    // Si hay alguno, reserva todos los que pueda (hasta un lote)
+        // La unidad con la que el productor anuncia el cierre es la última que señala en llenas. Con el buffer
+        // cerrado, la cuenta solo cambia por el consumidor: si se han tomado más unidades que items quedan, una es la
+        // del cierre, así que se retiran los que queden y se termina
+        if (buffer_cerrado(buffer) && k > buffer->cuenta){
+            k = buffer->cuenta;
+            fin = 1;
+        }
+        // Hasta que el consumidor libere sus huecos, el productor no puede sobreescribir los k items reservados, y la
+        // posición inicio solo la modifica el consumidor. Por tanto, se leen en el propio buffer fuera de la región
+        // crítica.
+        for (j = 0; j < k; j++) consume_item(buffer_hueco_extraer(buffer, j));
+        t = contadores_inicio(cont);
         sem_wait(mutex);            // Solicita acceso a la región crítica
-        item = remove_item(&inicio);
-                // Región crítica: se elimina un item de la posición inicio y se almacena en la variable item
+        t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
+        remove_items(k);
+                // Región crítica: se eliminan k items a partir de la posición inicio (se sobreescriben por ' ')
+        contadores_tiempo(cont, CONTADORES_SECCION, t);
         sem_post(mutex);            // Se abandona la región crítica, permitiendo el acceso al productor si este
                                     // estaba bloqueado esperando
-        sem_post(vacias);           // Se incrementa el contador de posiciones vacías, pues una ha quedado libre
-        consume_item(item);         // Se imprime el valor del elemento eliminado (sobreescrito por ' ')
+        senalar_semaforo_n(vacias, k);      // Se incrementa el contador de posiciones vacías en k
 
-        sleep(rand() % 5);
+        if (!rendimiento) sleep(rand() % espera_max);
 
-        i++;                        // Se pasa a la siguiente iteración
+        contadores_items(cont, k);
+        inicio = (inicio + k) % capacidad;
+        i += k;                     // Se pasa a la siguiente iteración
     }
 
     // Una vez el consumidor finaliza su trabajo, cierra los semáforos
     cerrar_semaforos(vacias, mutex, llenas);
 
-    printf("\n\t\t\t\t\t\t%sFinalizando consumidor...%s\n", AZUL, RESET);
+    if (!rendimiento) printf("\n\t\t\t\t\t\t%sFinalizando consumidor...%s\n", AZUL, RESET);
     // En el ejercicio 2 empleábamos la función exit() para cerrar la ejecución. Ahora, dado que empleamos hilos,
     // cerramos empleando pthread_exit, para que el proceso continúe ejecutándose.
     pthread_exit((void *) "Hilo finalizado correctamente");
@@ -304,57 +502,92 @@ void * consumir(void * arg){
 /*
  * Función que genera un elemento de la forma 'a' + pos, siendo pos igual a la posición que ocupará la letra en el
  * buffer. Como este tiene 15 posiciones, se generarán las letras minúsculas de la 'a' a la 'o'.
+ * El item se escribe directamente en su hueco del buffer: es un registro de tam_elem bytes relleno con esa letra.
+ * Además, se sella el hueco con el instante de generación para medir la latencia de traspaso.
  * Esta función es empleada por el productor.
+ * @param registro: Hueco del buffer en el que se genera el elemento.
  * @param pos: Posición que ocupará el elemento dentro del buffer.
  */
-char produce_item(int pos){
+void produce_item(char * registro, int pos){
     // Por cuestiones de seguridad (por ejemplo, si se incrementara el tamaño del buffer a un N > 26), empleamos
     // el módulo por el número de letras del abecedario, 26, de forma que se reiniciaría la secuencia.
-    return 'a' + pos % 26;
+    registro_rellenar(registro, tam_elem, 'a' + pos % 26);
+    medidas_sellar(medidas, pos);
 }
 
 /*
- * Función que coloca una letra en el buffer. Se insertará en la última posición, puesto que se trata de una cola FIFO.
+ * Función que publica el siguiente item del final del buffer, que ya fue generado en su hueco por produce_item.
+ * Se insertará en la última posición, puesto que se trata de una cola FIFO.
  * Esta función es empleada por el productor.
- * @param final: Posición en la cual se introducirá el carácter, y que a continuación será incrementada.
- * @param letra: Carácter a colocar en el buffer.
  */
-void insert_item(int * final, char letra){
-    buffer[*final] = letra;         // Se almacena el nuevo elemento.
+void insert_item(){
+    char * registro = buffer_hueco_insertar(buffer, 0);     // Hueco en el que se generó el item
 
     // Se imprime un mensaje de aviso junto a los contenidos del buffer
     // Se emplea el color verde, puesto que esta función solo es empleada por el productor.
-    printf("%sPosición %d -> item %c%s\t\t\t\t\t\t\t\t\t\t\t\t\t", VERDE, *final, letra, RESET);
-    log_buffer(1);
+    if (!rendimiento){
+        printf("%sPosición %d -> item %c%s\t\t\t\t\t\t\t\t\t\t\t\t\t",
+               VERDE, buffer_posicion(buffer, registro), *registro, RESET);
+        log_buffer(1);
+    }
 
-    // Incrementamos el valor de final, realizando el módulo por el número de posiciones del buffer para no
-    // sobrepasar el límite de tamaño
-    *final = (*final + 1) % N;
+    // Incrementamos el valor de final (el módulo se encarga de no sobrepasar el límite de tamaño)
+    buffer_confirmar_insercion(buffer, 1);
 }
 
 /*
- * Función que retira una letra del buffer. Dado que se implementa como una cola FIFO, se elimina del comienzo.
- * Dicha letra es devuelta por la función y reemplazada por un espacio en blanco.
+ * Función que retira un item del buffer, que ya fue leído en su hueco por consume_item. Dado que se implementa como
+ * una cola FIFO, se elimina del comienzo. Su primera letra se reemplaza por un espacio en blanco.
  * Esta función es empleada por el consumidor.
- * @param inicio: Posición de la cual se eliminará la letra.
  */
-char remove_item(int * inicio){
-    char item;         // Letra que contenía el buffer en la posición inicio.
+void remove_item(){
+    char * registro = buffer_hueco_extraer(buffer, 0);      // Registro situado en la posición inicio
 
-    item = buffer[*inicio];          // Leemos el elemento que había en el buffer
-    buffer[*inicio] = ' ';           // Reemplazamos el valor de esa posición por un espacio en blanco
-    *inicio = (*inicio + 1) % N;     // Incrementamos inicio utilizando un módulo para no sobrepasar el límite (15)
-    return item;                     // Devolvemos el elemento leído
+    *registro = ' ';                            // Reemplazamos el valor de esa posición por un espacio en blanco
+    buffer_confirmar_extraccion(buffer, 1);     // Incrementamos inicio (con módulo N)
 }
 
 /*
- * Función que muestra el carácter que fue retirado del buffer por la función remove_item.
+ * Función que publica un lote de items al final del buffer, en posiciones consecutivas. Forma parte de la región
+ * crítica: se llama una sola vez por lote, tras haber reservado n posiciones vacías y generado los items en ellas.
+ * Esta función es empleada por el productor.
+ * @param n: Número de items a publicar.
+ */
+void insert_items(int n){
+    int j;          // Variable de iteración
+
+    for (j = 0; j < n; j++) insert_item();
+}
+
+/*
+ * Función que retira un lote de items del inicio del buffer. Forma parte de la región crítica: se llama una sola
+ * vez por lote, tras haber reservado n posiciones llenas y leído los items en ellas.
+ * Esta función es empleada por el consumidor.
+ * @param n: Número de items a retirar.
+ */
+void remove_items(int n){
+    int j;          // Variable de iteración
+
+    for (j = 0; j < n; j++) remove_item();
+}
+
+/*
+ * Función que lee en el propio buffer un item que el consumidor va a retirar: registra su latencia de traspaso,
+ * comprueba que el registro esté completo y muestra su letra.
  * Esta función es empleada por el consumidor, que imprime en color azul.
- * @param item: Elemento a imprimir y que fue previamente retirado del buffer.
+ * @param registro: Registro del buffer que contiene el item.
  */
-void consume_item(char item){
-    printf("\t\t\t\t\t\t%sConsumido item %c%s\t\t\t\t\t\t\t", AZUL, item, RESET);
-    log_buffer(0);       // Imprimimos también los contenidos del buffer (0 indica que este hilo es el consumidor)
+void consume_item(char * registro){
+    // El hueco no puede volver a sellarse hasta que el consumidor lo libere, así que el sello es el de este item
+    medidas_latencia(medidas, buffer_posicion(buffer, registro));
+
+    if (!registro_comprobar(registro, tam_elem))
+        cerrar_con_error("Error: se ha consumido un registro corrupto\n", 0);
+
+    if (!rendimiento){
+        printf("\t\t\t\t\t\t%sConsumido item %c%s\t\t\t\t\t\t\t", AZUL, *registro, RESET);
+        log_buffer(0);       // Imprimimos también los contenidos del buffer (0 indica que este hilo es el consumidor)
+    }
 }
 
 /*
@@ -367,9 +600,10 @@ void log_buffer(int hilo){
 
     // Dependiendo del argumento hilo, se imprime en verde o en azul. Siempre se activa la cursiva.
     printf("%s%sbuffer = [", hilo? VERDE : AZUL, CURSIVA);
-    for (i = 0; i < N - 1; i++)
-        printf("%c ", *(buffer + i));           // Leemos uno a uno los caracteres contenidos en el buffer
-    printf("%c]%s%s\n", *(buffer + i), RESET, RESET_CURS);
+    for (i = 0; i < capacidad - 1; i++)
+        // Leemos uno a uno los registros contenidos en el buffer (su primer carácter)
+        printf("%c ", *(char *) buffer_registro(buffer, i));
+    printf("%c]%s%s\n", *(char *) buffer_registro(buffer, i), RESET, RESET_CURS);
     // No utilizamos \n hasta el final para tratar de que el buffer se imprima de forma atómica
 }
 
@@ -377,12 +611,50 @@ void log_buffer(int hilo){
  * Función que cierra una región de memoria para el hilo que la llama.
  */
 void cerrar_mem_compartida(){
-    // Utilizamos munmap, indicando el puntero a la región y el tamaño de esta (N caracteres)
-    if (munmap((void *) buffer, (size_t) N * sizeof(char)) == -1)
+    // Utilizamos munmap, indicando el puntero a la región y el tamaño de esta (el buffer de N registros)
+    if (munmap((void *) buffer, buffer_tam_region(capacidad, tam_elem)) == -1)
         cerrar_con_error("Error: no se ha podido cerrar la proyección del área compartida entre los procesos", 1);
 }
 
 
+/*
+ * Función que decrementa un semáforo tantas veces como sea posible sin bloquearse, hasta un máximo de n. Solo la
+ * primera decrementación puede bloquear al hilo (sem_wait); el resto se intentan con sem_trywait.
+ * Si se llevan contadores, la primera unidad se intenta tomar antes con sem_trywait: si el semáforo vale 0, el hilo
+ * ha encontrado el buffer lleno (productor) o vacío (consumidor), y se mide lo que tarda sem_wait.
+ * @param sem: Semáforo a decrementar.
+ * @param n: Número máximo de unidades a tomar (n >= 1).
+ * @param lleno: !0 si el semáforo cuenta huecos vacíos (esperar en él es encontrar el buffer lleno).
+ * @param cont: Contadores del hilo (NULL si no se llevan).
+ * @return: Número de unidades tomadas (entre 1 y n).
+ */
+int esperar_semaforo_n(sem_t * sem, int n, int lleno, struct contadores_hilo * cont){
+    int k = 1;          // Unidades tomadas
+    uint64_t t;         // Comienzo de la espera
+
+    if (cont == NULL) sem_wait(sem);
+    else if (sem_trywait(sem)){
+        if (lleno) contadores_lleno(cont);
+        else contadores_vacio(cont);
+        t = contadores_inicio(cont);
+        sem_wait(sem);
+        contadores_tiempo(cont, CONTADORES_ESPERA, t);
+    }
+    while (k < n && !sem_trywait(sem)) k++;
+    return k;
+}
+
+/*
+ * Función que incrementa un semáforo n veces (tantas como unidades se reservaron con esperar_semaforo_n).
+ * @param sem: Semáforo a incrementar.
+ * @param n: Número de unidades a devolver.
+ */
+void senalar_semaforo_n(sem_t * sem, int n){
+    int j;          // Variable de iteración
+
+    for (j = 0; j < n; j++) sem_post(sem);
+}
+
 /*
  * Función auxiliar que cierra los semáforos empleados por un proceso.
  * Esta función es utilizada por el proceso padre, así como por el productor y el consumidor.
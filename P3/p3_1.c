@@ -1,9 +1,24 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "../comun/buffer.h"
+#include "../comun/medidas.h"
+#include "../comun/bitacora.h"
+#include "../comun/config.h"
+#include "../comun/afinidad.h"
+#include "../comun/cache.h"
+#include "../comun/contadores.h"
 
 /*
  * Xiana Carrera Alonso
@@ -19,17 +34,78 @@
  * Este programa es una adaptación de la solución propuesta por Tanenbaum en Sistemas Operativos Modernos y que fue
  * analizada en clases de teoría.
  * La compilación debe incluir la opción -pthread.
+ *
+ * El buffer es un buffer de registros (módulo comun/buffer): cada item se escribe y se lee directamente en su hueco.
+ *
+ * Como alternativa al mutex y las variables de condición, se ofrece un modo sin cerrojos (MPMC) basado en dos pilas de
+ * Treiber sobre los N huecos del buffer: la pila de items, con los huecos ocupados en orden LIFO, y la pila de huecos
+ * libres. Cada cima es una palabra atómica de 64 bits que guarda el índice del hueco superior junto a una etiqueta que
+ * se incrementa en cada operación, evitando el problema ABA. Los productores toman un hueco libre, escriben el
+ * registro y lo apilan en la pila de items; los consumidores lo desapilan, lo leen y devuelven el hueco. Solo se
+ * acude al kernel (futex) cuando una de las pilas está vacía, es decir, cuando el buffer está lleno o vacío.
+ *
+ * Con muchos hilos, el único buffer (y su cuenta y su mutex) es el punto de contención de todos ellos. El modo
+ * fragmentado lo divide en num_f fragmentos, cada uno con su propia pila LIFO de capacidad registros, su mutex y su
+ * variable de condición de buffer lleno. El productor i inserta siempre en el fragmento i % num_f (los productores
+ * forman así grupos) y el consumidor i tiene como fragmento propio el i % num_f: lo vacía primero y,
+ * solo cuando lo encuentra vacío, roba items de los demás, recorriéndolos a partir del siguiente al suyo. Si todos los
+ * fragmentos están vacíos, el consumidor duerme en un futex común que los productores incrementan al insertar,
+ * siguiendo el mismo patrón que las pilas sin cerrojos. Así, casi todas las operaciones quedan dentro de un fragmento
+ * y solo compiten entre sí los hilos de un mismo grupo.
+ *
+ * En todos los modos, los consumidores no tienen un número fijo de items que retirar: cuando terminan todos los
+ * productores, el hilo principal cierra el buffer (o todos los fragmentos) y despierta a todos los consumidores que
+ * esperan por él (difundiendo en condc o despertando a todos los hilos del futex de la pila de items o de los
+ * fragmentos). Cada consumidor retira items hasta encontrar el buffer cerrado y vacío, de modo que los consumidores
+ * rápidos retiran más items y no es necesario conocer de antemano el total que se va a producir.
+ *
+ * Uso: ./p3_1 [-m condvar|lockfree|fragmentado] [-p productores] [-c consumidores] [-r] [-l lote] [-t tam_elem]
+ *             [-a politica] [-f fragmentos]
+ *  -m: mecanismo de sincronización (mutex y variables de condición, por defecto, pilas sin cerrojos o fragmentos con
+ *      robo de items entre consumidores).
+ *  -p: número de hilos productores (P por defecto, como mucho MAX_HILOS).
+ *  -c: número de hilos consumidores (C por defecto, como mucho MAX_HILOS).
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, cada productor genera ITEMS_BY_P_RENDIMIENTO items
+ *      y al final se imprime una línea CSV (módulo comun/medidas) con los items/s, los percentiles de latencia de
+ *      traspaso (desde que un item se guarda en su hueco hasta que se retira) y los cambios de contexto.
+ *  -l: número máximo de items que un hilo inserta o retira en cada entrada a la región crítica (1 por defecto, como
+ *      mucho MAX_LOTE). Así, el mutex se adquiere una vez por lote y no una vez por item.
+ *  -t: tamaño en bytes de cada registro del buffer (1 por defecto).
+ *  -a: política de colocación de los hilos en las CPUs (módulo comun/afinidad): ninguna (por defecto), compacta,
+ *      dispersa o parejas. Con cualquiera de las tres últimas, el buffer se reserva en el nodo NUMA de los
+ *      consumidores y, en el modo rendimiento, la política se añade a la variante del CSV.
+ *  -f: número de fragmentos del modo fragmentado (por defecto, uno por CPU, sin pasar del número de productores; como
+ *      mucho MAX_FRAGMENTOS). Con una política de afinidad, cada fragmento se reserva en el nodo NUMA de su primer
+ *      consumidor.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra): --capacidad (tamaño del buffer, N por defecto), --items
+ * (items de cada productor), --productores y --consumidores (como -p y -c), --lote (como -l), --tam_elem (como -t),
+ * --fragmentos (como -f), --espera_max (las esperas duran de 0 a espera_max - 1 segundos) y --contadores (con 1, se
+ * vuelcan en JSON por la salida de errores, al acabar y al recibir SIGUSR2, los contadores de cada hilo del módulo
+ * comun/contadores: esperas por el mutex y por las variables de condición o futex, tiempo en la región crítica, veces
+ * que encontró el buffer lleno o vacío e items procesados). También se leen de las variables SOII_NOMBRE.
  */
 
-#define P 25          // Número de productores
-#define C 14          // Número de consumidores
+#define P 25          // Número de productores por defecto
+#define C 14          // Número de consumidores por defecto
+#define MAX_HILOS 1024     // Número máximo de productores y de consumidores (opciones -p y -c)
 
 #define PROD 1       // Código de los productores
 #define CONS 2       // Código de los consumidores
 
-#define N 10                       // Tamaño del buffer
+#define N 10                       // Tamaño por defecto del buffer
 #define ITEMS_BY_P 20              // Items producidos por cada productor
-#define SLEEP_MAX_TIME 4           // Máximo tiempo de bloqueo por un sleep
+#define ITEMS_BY_P_RENDIMIENTO 20000    // Items producidos por cada productor en el modo rendimiento
+#define MAX_LOTE 512               // Tamaño máximo de un lote de items (opción -l)
+#define SLEEP_MAX_TIME 4           // Máximo tiempo de bloqueo por un sleep (por defecto)
+
+#define MODO_CONDVAR 0             // Sincronización con el mutex y las variables de condición condc y condp
+#define MODO_LOCKFREE 1            // Sincronización con las pilas sin cerrojos (atómicos y futex)
+#define MODO_FRAGMENTADO 2         // Sincronización con un mutex y una variable de condición por fragmento, con robo
+
+#define MAX_FRAGMENTOS 64          // Número máximo de fragmentos del buffer (opción -f)
+
+#define NODO_NULO UINT32_MAX       // Índice que marca el final de una pila (pila vacía)
 
 #define VERDE "\033[32m"           // Color en el que imprimirán los productores
 #define AZUL "\033[34m"            // Color en el que imprimirán los consumidores
@@ -39,10 +115,38 @@
 #define RESET_CURS "\033[23m"      // Reseteado de cursiva
 
 
-// Función de impresión del buffer con un código de colores para productores (verde) y consumidores (azul)
-void log_buffer(int hilo);
+/*
+ * Pila de Treiber sin cerrojos sobre los huecos del buffer. La cima guarda en los 32 bits bajos el índice del hueco
+ * superior (NODO_NULO si está vacía) y en los 32 altos una etiqueta que cambia en cada operación, de modo que un
+ * compare-and-swap falla si otro hilo ha desapilado y vuelto a apilar el mismo hueco entre medias (ABA).
+ * Cada pila ocupa su propia línea de caché (módulo comun/cache), para que productores y consumidores no se invaliden
+ * mutuamente al operar sobre pilas distintas.
+ */
+struct pila {
+    CACHE_ALINEADO _Atomic uint64_t cima;   // (etiqueta << 32) | índice del hueco superior
+    _Atomic uint32_t aviso;         // Palabra futex en la que duermen los hilos que encuentran la pila vacía
+    _Atomic uint32_t dormidos;      // Número de hilos que están (o van a estar) bloqueados en aviso
+};
+
+/*
+ * Fragmento del buffer en el modo fragmentado: una pila LIFO independiente con su propio mutex, que usan los
+ * productores de su grupo, su consumidor propio y los consumidores que roban de él. Cada fragmento empieza en una línea
+ * de caché, para que los mutexes de fragmentos distintos no se invaliden entre sí.
+ */
+struct fragmento {
+    CACHE_ALINEADO pthread_mutex_t mutex;   // Mutex de acceso al buffer del fragmento
+    pthread_cond_t condp;           // Variable de condicion de buffer lleno (productores del grupo)
+    struct buffer * buffer;         // Pila LIFO del fragmento, con capacidad registros
+    int base;                       // Primer hueco del fragmento en las medidas de latencia (indice * capacidad)
+    long robados;                   // Items retirados por consumidores de otros fragmentos
+};
+
+
+// Función de formato de una instantánea del buffer con un código de colores para productores (verde) y consumidores
+// (azul). La utiliza el hilo escritor de la bitácora
+size_t log_buffer(const struct bitacora_registro * registro, char * destino, size_t tam);
 // Función de impresión de un mensaje junto (opcionalmente) al contenido del buffer en una línea
-// Su propósito es permitir imprimir de forma casi atómica y sin interferencias entre hilos
+// Deja el mensaje en la bitácora, de forma que el hilo nunca espera por la consola
 void imprimir(char * cadena, int ver_buffer);
 
 // Función auxiliar que inicializa los mutexes y variables de condicion
@@ -61,77 +165,301 @@ char produce_item(int id);
 void insert_item(char letra, int id);
 // Función de eliminación de un item del buffer (consumidores)
 char remove_item(int id);
+// Función de inserción de un lote de items en el buffer (productores)
+int insert_items(char * letras, int n, int id);
+// Función de eliminación de un lote de items del buffer (consumidores)
+int remove_items(char * items, int max, int id);
 // Función de impresión de un item eliminado (consumidores)
 void consume_item(char item, int id);
 
+// Función de inserción de un lote de items en el fragmento del productor (productores, modo MODO_FRAGMENTADO)
+int insertar_fragmento(struct fragmento * fragmento, char * letras, int n, int id, struct contadores_hilo * cont);
+// Función de eliminación de un lote de items del fragmento propio o, si está vacío, de otro (consumidores)
+int extraer_fragmentos(char * items, int max, int id, struct contadores_hilo * cont);
+// Función que retira un lote de items de un fragmento si no está vacío (0 si lo está)
+int extraer_fragmento(struct fragmento * fragmento, char * items, int max, int id, struct contadores_hilo * cont);
+
+// Función de inserción de un item en la pila de items sin cerrojos (productores, modo MODO_LOCKFREE)
+void insertar_pila(char letra, int id, struct contadores_hilo * cont);
+// Función de eliminación de un item de la pila de items sin cerrojos (consumidores, modo MODO_LOCKFREE)
+int extraer_pila(char * item, int id, struct contadores_hilo * cont);
+// Función que desapila un hueco de una pila sin cerrojos, bloqueándose en su futex mientras esté vacía
+uint32_t tomar_nodo(struct pila * pila, struct contadores_hilo * cont);
+// Función que apila un hueco en una pila sin cerrojos y despierta a un hilo bloqueado en ella, si lo hay
+void entregar_nodo(struct pila * pila, uint32_t nodo);
+// Función que intenta desapilar un hueco de una pila sin cerrojos (NODO_NULO si está vacía)
+uint32_t desapilar(struct pila * pila);
+// Función que apila un hueco en una pila sin cerrojos
+void apilar(struct pila * pila, uint32_t nodo);
+// Función de espera sobre una palabra futex
+void esperar_futex(_Atomic uint32_t * palabra, uint32_t valor);
+// Función que despierta a n hilos bloqueados en una palabra futex
+void despertar_futex(_Atomic uint32_t * palabra, int n);
+
 // Función de ejecución de los hilos productores
 void * producir(void * ptr_id);
 // Función de ejecución de los hilos consumidores
 void * consumir(void * ptr_id);
+// Función que cierra el buffer (o los fragmentos) y despierta a todos los consumidores que esperan por él
+void cerrar_buffer();
 
 
-// Función que encapsula la creación de un hilo, que ejecutará una funcion con un argumento entero
-void crear_hilo(pthread_t * hilo, void * funcion, int arg);
+// Función que encapsula la creación de un hilo, que ejecutará una funcion con un argumento entero, colocándolo en
+// una CPU según su rol (productor o consumidor) y la política de afinidad
+void crear_hilo(pthread_t * hilo, void * funcion, int arg, int rol);
 // Función que ejecuta pthread_join sobre un hilo y comprueba que finalice correctamente
 void esperar_hilo(pthread_t hilo);
 
 
-pthread_mutex_t mutex;             // Mutex de acceso a la región crítica
-pthread_mutex_t mutex_impr;        // Mutex de impresión por consola
-pthread_cond_t condc, condp;       // Variables de condicion (buffer vacío y lleno)
-
-
-char * buffer = NULL;       // Buffer de caracteres compartido por productor y consumidor
-int cuenta = 0;             // Número de elementos guardados en el buffer
+/*
+ * Objetos de sincronización de todos los hilos, cada uno en su propia línea de caché (módulo comun/cache). El mutex lo
+ * escriben todos los hilos al entrar y salir de la región crítica, condc la usan sobre todo los consumidores y condp
+ * los productores. Como variables globales contiguas, cada lock invalidaba también las variables de condición y los
+ * datos de solo lectura que tenían al lado (buffer, tam_elem, etc.).
+ */
+struct {
+    CACHE_ALINEADO pthread_mutex_t mutex;   // Mutex de acceso a la región crítica
+    CACHE_ALINEADO pthread_cond_t condc;    // Variable de condicion de buffer vacío
+    CACHE_ALINEADO pthread_cond_t condp;    // Variable de condicion de buffer lleno
+} sinc;
+
+struct bitacora * bitacora = NULL; // Bitácora asíncrona por la que se imprimen los mensajes de los hilos
+int instrumentar = 0;               // !0 para llevar y volcar los contadores de cada hilo
+struct contadores * contadores = NULL;  // Contadores de instrumentación (NULL si no se llevan)
+long descartados = 0;              // Mensajes que la bitácora no pudo imprimir por no dar abasto la consola
+
+
+struct buffer * buffer = NULL;      // Buffer de registros compartido por productor y consumidor (pila LIFO)
+size_t tam_elem = sizeof(char);     // Tamaño en bytes de cada registro del buffer
+
+int rendimiento = 0;                // !0 para ejecutar sin esperas ni mensajes y medir items/s
+int items_por_p = ITEMS_BY_P;       // Items producidos por cada productor
+int lote = 1;                       // Número máximo de items por entrada a la región crítica
+struct medidas * medidas = NULL;    // Latencias de traspaso (un sello por hueco del buffer)
+
+int modo = MODO_CONDVAR;            // Mecanismo de sincronización empleado
+int num_p = P;                      // Número de hilos productores
+int num_c = C;                      // Número de hilos consumidores
+int capacidad = N;                  // Tamaño del buffer
+int espera_max = SLEEP_MAX_TIME;    // Límite (exclusivo) en segundos de las esperas aleatorias
+int afinidad = AFINIDAD_NINGUNA;    // Política de colocación de los hilos en las CPUs
+
+struct pila items;                  // Huecos ocupados por items, en orden LIFO (solo en el modo MODO_LOCKFREE)
+struct pila huecos;                 // Huecos libres del buffer (solo en el modo MODO_LOCKFREE)
+_Atomic uint32_t * siguiente = NULL;    // Hueco situado debajo de cada hueco en la pila a la que pertenece
+
+int num_f = 0;                      // Número de fragmentos (0 para elegirlo según las CPUs)
+struct fragmento * fragmentos = NULL;   // Fragmentos del buffer (solo en el modo MODO_FRAGMENTADO)
+// Consumidores que han encontrado vacíos todos los fragmentos (solo en el modo MODO_FRAGMENTADO)
+struct {
+    CACHE_ALINEADO _Atomic uint32_t aviso;  // Palabra futex en la que duermen
+    _Atomic uint32_t dormidos;              // Número de consumidores que están (o van a estar) bloqueados en aviso
+} sin_items;
+
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"capacidad", &capacidad, CONFIG_INT, 1, CONFIG_MAX_CAPACIDAD, "Tamaño del buffer (o de cada fragmento)"},
+    {"items", &items_por_p, CONFIG_INT, 1, INT_MAX / MAX_HILOS,
+     "Items de cada productor (con -r, ITEMS_BY_P_RENDIMIENTO)"},
+    {"productores", &num_p, CONFIG_INT, 1, MAX_HILOS, "Número de hilos productores (como -p)"},
+    {"consumidores", &num_c, CONFIG_INT, 1, MAX_HILOS, "Número de hilos consumidores (como -c)"},
+    {"lote", &lote, CONFIG_INT, 1, MAX_LOTE, "Items por entrada a la región crítica (como -l)"},
+    {"tam_elem", &tam_elem, CONFIG_SIZE, 1, CONFIG_MAX_TAM_ELEM, "Tamaño en bytes de cada registro (como -t)"},
+    {"fragmentos", &num_f, CONFIG_INT, 1, MAX_FRAGMENTOS, "Fragmentos del modo fragmentado (como -f)"},
+    {"contadores", &instrumentar, CONFIG_INT, 0, 1, "Con 1, vuelca en JSON los contadores de cada hilo"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
 
 
 
 int main(int argc, char * argv[]){
-    pthread_t consumidores[C];              // Identificadores de los hilos consumidores
-    pthread_t productores[P];               // Identificadores de los hilos productores
+    pthread_t consumidores[MAX_HILOS];      // Identificadores de los hilos consumidores
+    pthread_t productores[MAX_HILOS];       // Identificadores de los hilos productores
     int i;                                  // Variables de iteración
+    int opcion;                             // Opción leída con getopt
+    struct timespec t_ini, t_fin;           // Instantes de comienzo y final de la ejecución de los hilos
+    double segundos;                        // Duración de la ejecución de los hilos
+    void * region;                          // Memoria dinámica reservada para el buffer
+    char variante[64];                      // Variante del CSV del modo rendimiento
+    char mecanismo[32];                     // Nombre del mecanismo (con el número de fragmentos, si los hay)
+    long robados = 0;                       // Items retirados de un fragmento ajeno (modo MODO_FRAGMENTADO)
+
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: mecanismo de sincronización, número de hilos, modo rendimiento, tamaño de lote y de los registros
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "m:p:c:rl:t:a:f:")) != -1){
+        switch (opcion){
+            case 'm':
+                if (!strcmp(optarg, "condvar")) modo = MODO_CONDVAR;
+                else if (!strcmp(optarg, "lockfree")) modo = MODO_LOCKFREE;
+                else if (!strcmp(optarg, "fragmentado")) modo = MODO_FRAGMENTADO;
+                else {
+                    fprintf(stderr, "Error: el mecanismo de sincronización debe ser condvar, lockfree o fragmentado\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'p':
+                if ((num_p = atoi(optarg)) < 1 || num_p > MAX_HILOS){
+                    fprintf(stderr, "Error: el número de productores debe estar entre 1 y MAX_HILOS\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                if ((num_c = atoi(optarg)) < 1 || num_c > MAX_HILOS){
+                    fprintf(stderr, "Error: el número de consumidores debe estar entre 1 y MAX_HILOS\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "items")) items_por_p = ITEMS_BY_P_RENDIMIENTO;
+                break;
+            case 'l':
+                if ((lote = atoi(optarg)) < 1 || lote > MAX_LOTE){
+                    fprintf(stderr, "Error: el tamaño de lote debe estar entre 1 y MAX_LOTE\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'a':
+                if ((afinidad = afinidad_politica(optarg)) == -1){
+                    fprintf(stderr, "Error: la política de afinidad debe ser ninguna, compacta, dispersa o parejas\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'f':
+                if ((num_f = atoi(optarg)) < 1 || num_f > MAX_FRAGMENTOS){
+                    fprintf(stderr, "Error: el número de fragmentos debe estar entre 1 y MAX_FRAGMENTOS\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                if ((tam_elem = strtoul(optarg, NULL, 10)) == 0){
+                    fprintf(stderr, "Error: el tamaño de los registros debe ser de al menos 1 byte\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Uso: ./p3_1 [-m condvar|lockfree|fragmentado] [-p productores] [-c consumidores] [-r] "
+                                "[-l lote] [-t tam_elem] [-a ninguna|compacta|dispersa|parejas] [-f fragmentos] "
+                                "[--parámetro=valor ...]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
 
     srand(time(NULL));      // Fijamos una semilla de generación de valores aleatorios
 
-    // En primer lugar, se reserva memoria para el buffer compartido entre procesos. Tendrá un máximo de N chars.
-    if ((buffer = (char *) malloc(N * sizeof(char))) == NULL){
-        fprintf(stderr, "Error: no se pudo reservar memoria para el buffer\n");
+    // Por defecto, el modo fragmentado usa un fragmento por CPU. Nunca hay más fragmentos que productores, para que
+    // todos los grupos tengan alguno
+    if (!num_f && (num_f = sysconf(_SC_NPROCESSORS_ONLN)) < 1) num_f = 1;
+    if (num_f > MAX_FRAGMENTOS) num_f = MAX_FRAGMENTOS;
+    if (num_f > num_p) num_f = num_p;
+
+    // En primer lugar, se reserva memoria para el buffer compartido entre hilos, de capacidad registros. Si se ha
+    // indicado una política de afinidad, sus páginas se colocan en el nodo NUMA del primer consumidor, que es quien
+    // lee los items. En el modo fragmentado, en cambio, cada fragmento reserva su propio buffer al inicializarse
+    if (modo != MODO_FRAGMENTADO){
+        if ((region = afinidad_reservar(buffer_tam_region(capacidad, tam_elem), afinidad == AFINIDAD_NINGUNA? -1 :
+                                        afinidad_nodo(afinidad_cpu(afinidad, AFINIDAD_CONSUMIDOR, 0, num_c)))) == NULL){
+            fprintf(stderr, "Error: no se pudo reservar memoria para el buffer\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Inicializamos todo el buffer con el carácter '_', que representa una posición vacía
+        buffer = buffer_iniciar(region, capacidad, tam_elem, BUFFER_LIFO, '_');
+    }
+
+    // Con --contadores=1, cada hilo lleva sus contadores, que se vuelcan al acabar o al recibir SIGUSR2
+    if (instrumentar && ((contadores = contadores_crear("p3_1", 2 * MAX_HILOS)) == NULL ||
+                         contadores_senal(contadores) == -1)){
+        perror("Error: no se pudieron preparar los contadores");
         exit(EXIT_FAILURE);
     }
 
-    // Inicializamos todo el buffer con el carácter '_', que representa una posición vacía
-    memset(buffer, '_', (size_t) N * sizeof(char));
+    // Se sella un hueco por cada registro de cada fragmento (el buffer único equivale a un solo fragmento)
+    if ((medidas = medidas_crear((long) items_por_p * num_p, capacidad * (modo == MODO_FRAGMENTADO? num_f : 1)))
+            == NULL){
+        perror("Error: no se pudo reservar memoria para las medidas");
+        exit(EXIT_FAILURE);
+    }
 
-    printf("**************************** PROBLEMA DEL PRODUCTOR-CONSUMIDOR ***************************************\n");
-    printf("Preparado buffer de caracteres. Contenido inicial: buffer = [");
-    for (i = 0; i < N - 1; i++)
-        printf("%c ", *(buffer + i));           // Leemos uno a uno los caracteres contenidos en el buffer
-    printf("%c]\n", *(buffer + i));
-    printf("Número de items inicial: cuenta = %d\n\n\n", cuenta);
+    if (!rendimiento){
+        printf("**************************** PROBLEMA DEL PRODUCTOR-CONSUMIDOR ***************************************\n");
+        if (modo == MODO_FRAGMENTADO)
+            printf("Preparados %d fragmentos con buffers vacíos de %d registros de %zu B\n\n\n", num_f, capacidad,
+                   tam_elem);
+        else {
+            printf("Preparado buffer de registros de %zu B. Contenido inicial: buffer = [", tam_elem);
+            for (i = 0; i < capacidad - 1; i++)
+                // Leemos uno a uno los registros contenidos en el buffer (su primer carácter)
+                printf("%c ", *(char *) buffer_registro(buffer, i));
+            printf("%c]\n", *(char *) buffer_registro(buffer, i));
+            printf("Número de items inicial: cuenta = %d\n\n\n", buffer->cuenta);
+        }
 
-    printf("Se empleará el siguiente código de colores:\n");
-    printf("\t%sPRODUCTORES%s\n", VERDE, RESET);
-    printf("\t%sCONSUMIDORES%s\n", AZUL, RESET);
-    printf("\t%sFINALIZACIÓN DE PROCESOS%s\n\n\n", ROJO, RESET);
+        printf("Se empleará el siguiente código de colores:\n");
+        printf("\t%sPRODUCTORES%s\n", VERDE, RESET);
+        printf("\t%sCONSUMIDORES%s\n", AZUL, RESET);
+        printf("\t%sFINALIZACIÓN DE PROCESOS%s\n\n\n", ROJO, RESET);
+    }
 
-    // Se inicializan los mutexes y las variables de condicion
+    // Se inicializan los mutexes y las variables de condicion (y, en el modo sin cerrojos, las pilas; en el
+    // fragmentado, los fragmentos)
     inicializar();
 
-    // Creamos C consumidores y P productores. Cada uno de ellos será denotado por el valor de la variable i en el
-    // momento de su creación. Guardamos su identificador en los arrays consumidores[] y productores[]
-    for (i = 0; i < C; i++) crear_hilo(&consumidores[i], consumir, i);
-    for (i = 0; i < P; i++) crear_hilo(&productores[i], producir, i);
+    // Medimos el tiempo que tardan los hilos en transferir todos los items
+    clock_gettime(CLOCK_MONOTONIC, &t_ini);
+
+    // Creamos num_c consumidores y num_p productores. Cada uno de ellos será denotado por el valor de la variable i en
+    // el momento de su creación. Guardamos su identificador en los arrays consumidores[] y productores[]
+    for (i = 0; i < num_c; i++) crear_hilo(&consumidores[i], consumir, i, AFINIDAD_CONSUMIDOR);
+    for (i = 0; i < num_p; i++) crear_hilo(&productores[i], producir, i, AFINIDAD_PRODUCTOR);
+
+    // El hilo principal espera a que finalicen todos los hilos que ha creado antes de continuar. Cuando terminan los
+    // productores, cierra el buffer para que los consumidores, tras retirar los items que queden, terminen también
+    for (i = 0; i < num_p; i++) esperar_hilo(productores[i]);
+    cerrar_buffer();
+    for (i = 0; i < num_c; i++) esperar_hilo(consumidores[i]);
 
-    // El hilo principal espera a que finalicen todos los hilos que ha creado antes de continuar
-    for (i = 0; i < C; i++) esperar_hilo(consumidores[i]);
-    for (i = 0; i < P; i++) esperar_hilo(productores[i]);
+    clock_gettime(CLOCK_MONOTONIC, &t_fin);
+
+    // Antes de destruir los fragmentos, se cuentan los items que los consumidores robaron de fragmentos ajenos
+    for (i = 0; i < num_f && modo == MODO_FRAGMENTADO; i++) robados += fragmentos[i].robados;
 
     // Se destruyen los mutexes y las variables de condicion
     destruir();
 
-    free(buffer);       // Liberamos también la memoria reservada para el buffer
+    // Liberamos también la memoria reservada para el buffer (la de los fragmentos la libera destruir)
+    if (modo != MODO_FRAGMENTADO) afinidad_liberar(buffer, buffer_tam_region(capacidad, tam_elem));
+
+    // Se informa del rendimiento obtenido: items transferidos por segundo entre todos los productores y consumidores
+    segundos = (t_fin.tv_sec - t_ini.tv_sec) + (t_fin.tv_nsec - t_ini.tv_nsec) / 1e9;
+    // El modo fragmentado se identifica junto a su número de fragmentos (por ejemplo, fragmentado/4)
+    if (modo == MODO_FRAGMENTADO) snprintf(mecanismo, sizeof(mecanismo), "fragmentado/%d", num_f);
+    else snprintf(mecanismo, sizeof(mecanismo), "%s", modo == MODO_LOCKFREE? "lockfree" : "condvar");
+    // La variante del CSV incluye la política de afinidad, si se ha indicado alguna (por ejemplo, condvar/compacta)
+    snprintf(variante, sizeof(variante), "%s%s%s", mecanismo,
+             afinidad == AFINIDAD_NINGUNA? "" : "/", afinidad == AFINIDAD_NINGUNA? "" : afinidad_nombre(afinidad));
+    if (rendimiento){
+        medidas_informe(medidas, "p3_1", variante, lote, tam_elem, (long) items_por_p * num_p, segundos);
+        if (modo == MODO_FRAGMENTADO) fprintf(stderr, "# p3_1,%s: %ld items robados\n", mecanismo, robados);
+    }
+    else {
+        printf("\nModo %s, afinidad %s, %d productores y %d consumidores, lote %d, registros de %zu B: %d items en "
+               "%.3f s -> %.0f items/s\n", mecanismo, afinidad_nombre(afinidad), num_p, num_c, lote, tam_elem,
+               items_por_p * num_p, segundos, items_por_p * num_p / segundos);
+        if (modo == MODO_FRAGMENTADO) printf("Items robados de fragmentos ajenos: %ld\n", robados);
+    }
+    medidas_destruir(medidas);
+    if (contadores != NULL){
+        contadores_volcar(contadores, STDERR_FILENO);
+        contadores_destruir(contadores);
+    }
 
-    printf("\n\n\nFinalizando problema del productor-consumidor...\n\n");
+    if (!rendimiento){
+        if (descartados) printf("\nMensajes descartados por la bitácora: %ld\n", descartados);
+        printf("\n\n\nFinalizando problema del productor-consumidor...\n\n");
+    }
     exit(EXIT_SUCCESS);
 }
 
@@ -145,15 +473,21 @@ int main(int argc, char * argv[]){
  */
 void * producir(void * ptr_id){
     int id = (intptr_t) ptr_id;    // Identificador del hilo (lo pasamos a entero de forma segura con el tipo intptr_t)
-    char item;                     // Item producido que se guardará en el buffer
+    char items[MAX_LOTE];          // Lote de items producidos que se guardarán en el buffer
     char cadena[100];              // Cadena donde se guardará la información que vaya a imprimir el hilo, para poder
                                    // manejarla de la forma más atómica posible
     int tam_cad = sizeof(cadena);       // Tamaño en bytes que ocupa la cadena
-    int i;                         // Contador de iteraciones
+    int n;                         // Número de items del lote actual
+    int hechos;                    // Items del lote actual ya insertados
+    int k;                         // Items insertados en cada entrada a la región crítica
+    int i, j;                      // Contadores de iteraciones (i cuenta items)
+    struct contadores_hilo * cont = contadores_hilo(contadores, "productor", id);   // Contadores del hilo
+    uint64_t t;                    // Comienzo de la espera o de la región crítica que se está midiendo
 
-    // Cada productor realiza un número fijo de iteraciones: 20, una por cada item que produzca
+    // Cada productor realiza un número fijo de iteraciones: 20, una por cada item que produzca (o una por cada lote,
+    // si se ha indicado la opción -l)
 
-    for (i = 0; i < ITEMS_BY_P; i++){
+    for (i = 0; i < items_por_p; i += n){
         // Para imprimir, construimos el mensaje y lo almacenamos en cadena. Después, se la pasamos a la función
         // imprimir
         // Como segundo argumento de snprintf pasamos el número máximo de bytes a almacenar, esto es, el tamaño de la
@@ -162,14 +496,15 @@ void * producir(void * ptr_id){
                  "%s[%d] **INICIO ITERACION %d**%s\n", VERDE, id, i, RESET);
         imprimir(cadena, 0);     // No imprimimos el buffer al estar fuera de la región crítica (puede desactualizarse)
 
-        // Se crea un nuevo elemento y se almacena en la variable item
+        // Se crea un lote de nuevos elementos y se almacena en el array items
         // Cada hilo producirá siempre el mismo elemento, cuyo valor dependerá de su identificador. Será una letra
         // del abecedario que podrá ir en mayúsculas (identificadores impares) o en minúsculas (identificadores pares)
-        item = produce_item(id);
+        n = lote < items_por_p - i? lote : items_por_p - i;
+        for (j = 0; j < n; j++) items[j] = produce_item(id);
 
         // Esperamos un núemro de segundos aleatorio de entre 0 y 4 para dar más variedad a las situaciones que
         // se pueden producir (buffer lleno, buffer vacío y situaciones intermedias).
-        sleep(((int) rand()) % SLEEP_MAX_TIME);
+        if (!rendimiento) sleep(((int) rand()) % espera_max);
 
         /*
          * A continuación, el productor se prepara para ejecutar la región crítica. Para ello, solicita acceso
@@ -181,49 +516,76 @@ void * producir(void * ptr_id){
          * uno y solo uno de los hilos bloqueados por el mutex (a través de pthread_mutex_unlock).
          */
 
-        pthread_mutex_lock(&mutex);
-        /*
-         * Los productores no podrán continuar si el buffer está lleno. En ese caso, ejecutan pthread_cond_wait,
-         * de modo que quedan bloqueados de forma asociada a la variable de condición condp. Cuando un consumidor
-         * elimine un item, llamará a pthread_cond_signal y despertará a uno de los productores dormidos por
-         * esta condición (y solo a uno).
-         * Además, al ejecutar pthread_cond_wait el productor libera el mutex, de forma que permite que otro hilo
-         * entre en la región crítica, con la esperanza de que sea un consumidor que pueda desbloquearlo.
-         * Tras salir de pthread_cond_wait tendrá que volver a comprobar si el buffer está lleno por si alguna
-         * interrupción hubiera provocado que otro productor lo hubiera llenado después de despertar.
-         */
-        while(esta_buffer_lleno()){
-            snprintf(cadena, tam_cad,
-                     "%s[%d] se bloquea por la variable de condicion%s\n", VERDE, id, RESET);
-            imprimir(cadena, 0);
-            pthread_cond_wait(&condp, &mutex);
+        // En el modo sin cerrojos no hay región crítica: cada item toma un hueco libre y se apila por separado. El
+        // productor solo se bloquea (en un futex) si no quedan huecos libres.
+        if (modo == MODO_LOCKFREE){
+            for (j = 0; j < n; j++) insertar_pila(items[j], id, cont);
+        }
+        // En el modo fragmentado, el lote se inserta en el fragmento del grupo del productor, que solo comparte con
+        // los demás productores del grupo y con los consumidores que extraen de él
+        else if (modo == MODO_FRAGMENTADO){
+            for (hechos = 0; hechos < n; hechos += k)
+                k = insertar_fragmento(&fragmentos[id % num_f], items + hechos, n - hechos, id, cont);
+        }
+        // En otro caso, el lote se inserta en tantas entradas a la región crítica como sean necesarias según el
+        // espacio libre
+        else for (hechos = 0; hechos < n; hechos += k){
+            // Si se llevan contadores, se mide la espera por el mutex, cada espera por la variable de condición y el
+            // tiempo que se pasa en la región crítica (cada medida empieza donde acaba la anterior)
+            t = contadores_inicio(cont);
+            pthread_mutex_lock(&sinc.mutex);
+            t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
+            /*
+             * Los productores no podrán continuar si el buffer está lleno. En ese caso, ejecutan pthread_cond_wait,
+             * de modo que quedan bloqueados de forma asociada a la variable de condición condp. Cuando un consumidor
+             * elimine un item, llamará a pthread_cond_signal y despertará a uno de los productores dormidos por
+             * esta condición (y solo a uno).
+             * Además, al ejecutar pthread_cond_wait el productor libera el mutex, de forma que permite que otro hilo
+             * entre en la región crítica, con la esperanza de que sea un consumidor que pueda desbloquearlo.
+             * Tras salir de pthread_cond_wait tendrá que volver a comprobar si el buffer está lleno por si alguna
+             * interrupción hubiera provocado que otro productor lo hubiera llenado después de despertar.
+             */
+            while(esta_buffer_lleno()){
+                snprintf(cadena, tam_cad,
+                         "%s[%d] se bloquea por la variable de condicion%s\n", VERDE, id, RESET);
+                imprimir(cadena, 0);
+                contadores_lleno(cont);
+                pthread_cond_wait(&sinc.condp, &sinc.mutex);
+                t = contadores_tiempo(cont, CONTADORES_ESPERA, t);
+            }
+            /**************************************** REGIÓN CRÍTICA *******************************************/
+            k = insert_items(items + hechos, n - hechos, id);   // Se introducen tantos items del lote como quepan en
+                                                                // el buffer y se actualiza cuenta
+            /************************************** FIN DE LA REGIÓN CRÍTICA **********************************/
+            // Si se ha insertado más de un item, puede haber varios consumidores que ya pueden continuar
+            if (k == 1) pthread_cond_signal(&sinc.condc);
+            else pthread_cond_broadcast(&sinc.condc);
+            contadores_tiempo(cont, CONTADORES_SECCION, t);
+            /*
+             * El productor ejecuta pthread_cond_signal para despertar a un consumidor que estuviera dormido por causa
+             * de que el buffer estuviera vacío. En ese caso, habría quedado bloqueado por la función pthread_cond_wait
+             * asociada a la variable de condición condc. Cuando se ejecuta signal, el planificador del sistema operativo
+             * escoge uno de los consumidores así bloqueados y lo despierta. En ese momento, tratará de readquirir el
+             * mutex, compitiendo con todos aquellos hilos que estén intentando acceder a él. No obstante, ninguno podrá
+             * tomarlo hasta que el productor ejecute pthread_mutex_unlock.
+             * Se llama a signal en lugar de broadcast porque tras actuar un consumidor, el buffer volverá a quedar vacío
+             * si no interviene otro productor. Es decir, por cada productor, un consumidor puede continuar su ejecución.
+             * Si no había ningún consumidor dormido por la variable de condición, la señal se pierde y no tiene efecto.
+             * Si se han insertado varios items de un lote, en cambio, pueden continuar varios consumidores: broadcast.
+             */
+
+            pthread_mutex_unlock(&sinc.mutex);      // El productor abandona la región crítica. Libera el mutex para
+            // permitir que otro hilo pueda acceder a ella. Si había uno o varios bloqueados por pthread_mutex_lock, el
+            // sistema operativo escogerá a uno de ellos y le concederá el mutex para que pueda continuar. Si no había
+            // ninguno, el mutex queda libre para que lo use el primero que ejecute pthread_mutex_lock.
         }
-        /**************************************** REGIÓN CRÍTICA *******************************************/
-        insert_item(item, id);      // Se introduce el item en la región crítica y se actualiza cuenta
-        /************************************** FIN DE LA REGIÓN CRÍTICA **********************************/
-        pthread_cond_signal(&condc);
-        /*
-         * El productor ejecuta pthread_cond_signal para despertar a un consumidor que estuviera dormido por causa
-         * de que el buffer estuviera vacío. En ese caso, habría quedado bloqueado por la función pthread_cond_wait
-         * asociada a la variable de condición condc. Cuando se ejecuta signal, el planificador del sistema operativo
-         * escoge uno de los consumidores así bloqueados y lo despierta. En ese momento, tratará de readquirir el
-         * mutex, compitiendo con todos aquellos hilos que estén intentando acceder a él. No obstante, ninguno podrá
-         * tomarlo hasta que el productor ejecute pthread_mutex_unlock.
-         * Se llama a signal en lugar de broadcast porque tras actuar un consumidor, el buffer volverá a quedar vacío
-         * si no interviene otro productor. Es decir, por cada productor, un consumidor puede continuar su ejecución.
-         * Si no había ningún consumidor dormido por la variable de condición, la señal se pierde y no tiene efecto.
-         */
-
-        pthread_mutex_unlock(&mutex);           // El productor abandona la región crítica. Libera el mutex para
-        // permitir que otro hilo pueda acceder a ella. Si había uno o varios bloqueados por pthread_mutex_lock, el
-        // sistema operativo escogerá a uno de ellos y le concederá el mutex para que pueda continuar. Si no había
-        // ninguno, el mutex queda libre para que lo use el primero que ejecute pthread_mutex_lock.
 
 
         // Se imprime una cadena con el identificador del hilo, el número de iteraciones pendientes. No imprimimos
         // el buffer al estar fuera de la región crítica
+        contadores_items(cont, n);
         snprintf(cadena, tam_cad,
-                "%s[%d] Me quedan %d iteraciones%s\n", VERDE, id, ITEMS_BY_P - i - 1, RESET);
+                "%s[%d] Me quedan %d iteraciones%s\n", VERDE, id, items_por_p - i - n, RESET);
         imprimir(cadena, 0);
     }
 
@@ -250,22 +612,21 @@ void * producir(void * ptr_id){
  */
 void * consumir(void * ptr_id){
     int id = (intptr_t) ptr_id;    // Identificador del hilo (lo pasamos a entero de forma segura con el tipo intptr_t)
-    char item;                     // Item consumido. Será mostrado por pantalla.
+    char items[MAX_LOTE];          // Items consumidos. Serán mostrados por pantalla.
     char cadena[100];              // Cadena donde se guardará la información que vaya a imprimir el hilo, para poder
                                    // manejarla de la forma más atómica posible
     int tam_cad = sizeof(cadena);       // Tamaño en bytes que ocupa la cadena
-    int num_iters;                 // Número de iteraciones que tendrá que ejecutar cada consumidor
-    int i;                         // Contador de iteraciones
+    int k;                         // Items retirados en cada entrada a la región crítica
+    int i, j;                      // Contadores de iteraciones (i cuenta items)
+    struct contadores_hilo * cont = contadores_hilo(contadores, "consumidor", id);  // Contadores del hilo
+    uint64_t t;                    // Comienzo de la espera o de la región crítica que se está midiendo
 
     /*
-     * El número de iteraciones totales (ITEMS_BY_P * P = 20 * P) se divide de forma equitativa entre los consumidores.
-     * No obstante, habría problemas en caso de que C no fuese divisor de ITEMS_BY_P * P. En ese caso, el resto de la
-     * división se asigna como iteraciones extra para el primer consumidor (el de identificador 0). Es decir, a este
-     * le corresponde el cociente y el resto. Los demás llevarán a cabo ITEMS_BY_P * P iteraciones (el cociente).
+     * Los items totales (ITEMS_BY_P * P = 20 * P) no se dividen de antemano entre los consumidores. Cada uno retira
+     * lotes mientras haya items, y termina cuando encuentra el buffer cerrado (ya no quedan productores) y vacío. Así,
+     * el total retirado entre todos los consumidores es exactamente el producido.
      */
-    num_iters = !id? (ITEMS_BY_P * P / C) + (ITEMS_BY_P * P % C) : ITEMS_BY_P * P / C;
-
-    for (i = 0; i < num_iters; i++){
+    for (i = 0; ; i += k){
         // Para imprimir, construimos el mensaje y lo almacenamos en cadena. Después, se la pasamos a la función
         // imprimir.
         // Como segundo argumento de snprintf pasamos el número máximo de bytes a almacenar, esto es, el tamaño de la
@@ -283,57 +644,84 @@ void * consumir(void * ptr_id){
          * al productor. Cuando el otro hilo salga de la región crítica, tendrá la responsabilidad de despertar a
          * uno y solo uno de los hilos bloqueados por el mutex (a través de pthread_mutex_unlock).
          */
-        pthread_mutex_lock(&mutex);
-        /*
-         * Los consumidores no podrán actuar si el buffer está vacío. En ese caso, ejecutan pthread_cond_wait,
-         * de modo que quedan bloqueados de forma asociada a la variable de condición condc. La responsabilidad de
-         * despertarlos recaerá sobre los productores, que irán ejecutando pthread_cond_signal a medida que
-         * inserten elementos en el buffer, alertando de que la condición de parada ya no se cumple.
-         * Además, al ejecutar pthread_cond_wait el consumidor libera el mutex, de forma que permite que otro hilo
-         * entre en la región crítica, con la esperanza de que sea un productor que pueda desbloquearlo.
-         * Tras salir de pthread_cond_wait tendrá que volver a comprobar si el buffer está vacío por si alguna
-         * interrupción hubiera provocado que otro consumidor lo hubiera vaciado después de despertar el primero.
-         */
-        while (esta_buffer_vacio()){
-            snprintf(cadena, tam_cad,
-                    "\t\t\t\t\t\t%s[%d] se bloquea por la variable de condicion%s\n", AZUL, id, RESET);
-            imprimir(cadena, 0);
-            pthread_cond_wait(&condc, &mutex);
+        if (modo == MODO_LOCKFREE){
+            // En el modo sin cerrojos se desapila el lote item a item. El consumidor solo se bloquea (en un futex) si
+            // la pila de items está vacía, y extraer_pila solo devuelve 0 si además el buffer está cerrado.
+            for (k = 0; k < lote && extraer_pila(&items[k], id, cont); k++);
+        }
+        else if (modo == MODO_FRAGMENTADO){
+            // En el modo fragmentado se retira el lote del fragmento propio o, si está vacío, se roba de otro. El
+            // consumidor solo se bloquea (en un futex) si todos los fragmentos están vacíos, y no retira nada si
+            // además están cerrados.
+            k = extraer_fragmentos(items, lote, id, cont);
+        }
+        else {
+            t = contadores_inicio(cont);
+            pthread_mutex_lock(&sinc.mutex);
+            t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
+            /*
+             * Los consumidores no podrán actuar si el buffer está vacío. En ese caso, ejecutan pthread_cond_wait,
+             * de modo que quedan bloqueados de forma asociada a la variable de condición condc. La responsabilidad de
+             * despertarlos recaerá sobre los productores, que irán ejecutando pthread_cond_signal a medida que
+             * inserten elementos en el buffer, alertando de que la condición de parada ya no se cumple.
+             * Además, al ejecutar pthread_cond_wait el consumidor libera el mutex, de forma que permite que otro hilo
+             * entre en la región crítica, con la esperanza de que sea un productor que pueda desbloquearlo.
+             * Tras salir de pthread_cond_wait tendrá que volver a comprobar si el buffer está vacío por si alguna
+             * interrupción hubiera provocado que otro consumidor lo hubiera vaciado después de despertar el primero.
+             * Si el buffer está cerrado no se espera: ya no se insertarán más items, y si está vacío no se retira
+             * ninguno (k = 0).
+             */
+            while (esta_buffer_vacio() && !buffer_cerrado(buffer)){
+                snprintf(cadena, tam_cad,
+                        "\t\t\t\t\t\t%s[%d] se bloquea por la variable de condicion%s\n", AZUL, id, RESET);
+                imprimir(cadena, 0);
+                contadores_vacio(cont);
+                pthread_cond_wait(&sinc.condc, &sinc.mutex);
+                t = contadores_tiempo(cont, CONTADORES_ESPERA, t);
+            }
+            /**************************************** REGIÓN CRÍTICA *******************************************/
+            // Se eliminan del buffer hasta un lote de items y se actualiza cuenta
+            k = remove_items(items, lote, id);
+            /************************************** FIN DE LA REGIÓN CRÍTICA **********************************/
+            // Si se ha retirado más de un item, puede haber varios productores que ya pueden continuar
+            if (k == 1) pthread_cond_signal(&sinc.condp);
+            else if (k > 1) pthread_cond_broadcast(&sinc.condp);
+            contadores_tiempo(cont, CONTADORES_SECCION, t);
+            /*
+             * El consumidor ejecuta pthread_cond_signal para despertar a un productor que estuviera dormido por causa
+             * de que el buffer estuviera lleno. En ese caso, habría quedado bloqueado por la función pthread_cond_wait
+             * asociada a la variable de condición condp. Cuando se ejecuta signal, el planificador del sistema operativo
+             * escoge uno de los productores así bloqueados y lo despierta. En ese momento, tratará de readquirir el
+             * mutex, compitiendo con todos aquellos hilos que estén intentando acceder a él. No obstante, ninguno podrá
+             * tomarlo hasta que el consumidor en cuestión ejecute pthread_mutex_unlock.
+             * Se ejecuta signal en lugar de broadcast porque tras actuar un productor, el buffer volverá a quedar lleno
+             * si no interviene otro consumidor. Es decir, por cada consumidor, un productor puede continuar su ejecución.
+             * Si no había ningún productor dormido por la variable de condición, la señal se pierde y no tiene efecto.
+             * Si se han retirado varios items de un lote, en cambio, pueden continuar varios productores: broadcast.
+             */
+            pthread_mutex_unlock(&sinc.mutex);
         }
-        /**************************************** REGIÓN CRÍTICA *******************************************/
-        item = remove_item(id);      // Se elimina un item del buffer y se actualiza cuenta
-        /************************************** FIN DE LA REGIÓN CRÍTICA **********************************/
-        pthread_cond_signal(&condp);
-        /*
-         * El consumidor ejecuta pthread_cond_signal para despertar a un productor que estuviera dormido por causa
-         * de que el buffer estuviera lleno. En ese caso, habría quedado bloqueado por la función pthread_cond_wait
-         * asociada a la variable de condición condp. Cuando se ejecuta signal, el planificador del sistema operativo
-         * escoge uno de los productores así bloqueados y lo despierta. En ese momento, tratará de readquirir el
-         * mutex, compitiendo con todos aquellos hilos que estén intentando acceder a él. No obstante, ninguno podrá
-         * tomarlo hasta que el consumidor en cuestión ejecute pthread_mutex_unlock.
-         * Se ejecuta signal en lugar de broadcast porque tras actuar un productor, el buffer volverá a quedar lleno
-         * si no interviene otro consumidor. Es decir, por cada consumidor, un productor puede continuar su ejecución.
-         * Si no había ningún productor dormido por la variable de condición, la señal se pierde y no tiene efecto.
-         */
-        pthread_mutex_unlock(&mutex);
+
+        // Si no se ha retirado ningún item, el buffer está cerrado y vacío: el consumidor termina
+        if (k == 0) break;
 
         // Esperamos un núemro de segundos aleatorio de entre 0 y 4 para dar más variedad a las situaciones que
         // se pueden producir (buffer lleno, buffer vacío y situaciones intermedias).
-        sleep(((int) rand()) % SLEEP_MAX_TIME);
+        if (!rendimiento) sleep(((int) rand()) % espera_max);
 
-        // Mostramos por pantalla el item consumido, junto al identificador del consumidor que lo ha eliminado
-        consume_item(item, id);
+        // Mostramos por pantalla los items consumidos, junto al identificador del consumidor que los ha eliminado
+        contadores_items(cont, k);
+        for (j = 0; j < k; j++) consume_item(items[j], id);
 
-        // Imprimimos un mensaje indicando el número de iteraciones que le quedan por ejecutar a este hilo, así como
-        // su identificador. No imprimimos el buffer al estar fuera de la región crítica
-        snprintf(cadena, tam_cad,
-                "\t\t\t\t\t\t%s[%d] Me quedan %d iteraciones%s\n", AZUL, id, num_iters - i - 1, RESET);
+        // Imprimimos un mensaje indicando los items que lleva retirados este hilo, así como su identificador. No
+        // imprimimos el buffer al estar fuera de la región crítica
+        snprintf(cadena, tam_cad, "\t\t\t\t\t\t%s[%d] Llevo %d items retirados%s\n", AZUL, id, i + k, RESET);
         imprimir(cadena, 0);
     }
 
-    // Se imprime un mensaje de finalización en rojo
+    // Se imprime un mensaje de finalización en rojo, con los items que ha retirado este consumidor
     snprintf(cadena, tam_cad,
-            "\n\t\t\t\t\t\t%s[%d] Finalizando consumidor...%s\n", ROJO, id, RESET);
+            "\n\t\t\t\t\t\t%s[%d] Finalizando consumidor (%d items)...%s\n", ROJO, id, i, RESET);
     imprimir(cadena, 0);            // En este caso, pasamos un 0 para no mostrar el buffer
 
     // En el ejercicio 2 empleábamos la función exit() para cerrar la ejecución. Ahora, dado que empleamos hilos,
@@ -341,19 +729,48 @@ void * consumir(void * ptr_id){
     pthread_exit((void *) "Hilo finalizado correctamente");
 }
 
+/*
+ * Función que ejecuta el hilo principal cuando han terminado todos los productores: cierra el buffer (en el modo
+ * fragmentado, todos los fragmentos) y despierta a todos los consumidores que esperan por él, que retirarán los items
+ * que queden y terminarán al encontrarlo cerrado y vacío. Como ya no quedan productores, nadie espera por condp ni
+ * por la pila de huecos.
+ * En los modos con futex, la palabra se incrementa después de cerrar: el consumidor que la leyó antes de dormir
+ * retorna de inmediato de FUTEX_WAIT, y el que la lee después ve también el buffer cerrado (ver tomar_nodo).
+ */
+void cerrar_buffer(){
+    int i;          // Variable de iteración
+
+    if (modo == MODO_FRAGMENTADO){
+        for (i = 0; i < num_f; i++) buffer_cerrar(fragmentos[i].buffer);
+        atomic_fetch_add(&sin_items.aviso, 1);
+        despertar_futex(&sin_items.aviso, INT_MAX);
+    }
+    else if (modo == MODO_LOCKFREE){
+        buffer_cerrar(buffer);
+        atomic_fetch_add(&items.aviso, 1);
+        despertar_futex(&items.aviso, INT_MAX);
+    }
+    else {
+        pthread_mutex_lock(&sinc.mutex);
+        buffer_cerrar(buffer);
+        pthread_cond_broadcast(&sinc.condc);
+        pthread_mutex_unlock(&sinc.mutex);
+    }
+}
+
 
 // Función que verifica si el buffer ha llegado a su máximo de capacidad
 // El propósito de definir esta función es, principalmente, ayudar a la legibilidad del código
 // Devuelve 1 si es así y 0 en caso contrario.
 int esta_buffer_lleno(){
-    return cuenta == N;
+    return buffer_lleno(buffer);
 }
 
 // Función que verfica si el buffer tiene algún elemento
 // El propósito de definir esta función es, principalmente, ayudar a la legibilidad del código
 // Devuelve 1 si está vacío, y 0 si hay elementos en él
 int esta_buffer_vacio(){
-    return !cuenta;
+    return buffer_vacio(buffer);
 }
 
 
@@ -375,8 +792,8 @@ char produce_item(int id){
 
 /*
  * Función que coloca una letra en el buffer. Se insertará en la posición superior, puesto que se trata de una pila
- * LIFO.
- * Dicha posición vendrá dada por la variable compartida cuenta.
+ * LIFO. El registro (tam_elem bytes con el valor de la letra) se escribe directamente en su hueco.
+ * Dicha posición vendrá dada por el número de registros presentes en el buffer (buffer->cuenta).
  * Esta función es empleada por los productores y forma parte de la región crítica.
  * No se comprueba que el buffer no esté lleno; este es un prerrequisito a corroborar de forma externa.
  * @param letra: Carácter a colocar en el buffer.
@@ -384,44 +801,91 @@ char produce_item(int id){
  */
 void insert_item(char letra, int id){
     char cadena[100];                // Línea a imprimir en el log.
+    void * hueco;                    // Primera posición libre del buffer
 
-    buffer[cuenta] = letra;         // Se almacena el nuevo elemento en la primera posición libre del buffer.
+    // Se almacena el nuevo elemento en la primera posición libre del buffer, y se sella el instante en que se guarda
+    hueco = buffer_hueco_insertar(buffer, 0);
+    registro_rellenar(hueco, tam_elem, letra);
+    medidas_sellar(medidas, buffer_posicion(buffer, hueco));
 
     // Incrementamos el valor de cuenta para reflejar el nuevo elemento
-    cuenta++;
+    buffer_confirmar_insercion(buffer, 1);
 
     // Preparamos la línea con snprintf y luego la imprimimos de forma atómica llamando a imprimir
     snprintf(cadena, sizeof(cadena),
              "%s[%d] Guardado item %c en %d -> cuenta = %d%s  \t\t\t\t\t\t\t\t\t",
-             VERDE, id, letra, cuenta - 1, cuenta, RESET);
+             VERDE, id, letra, buffer->cuenta - 1, buffer->cuenta, RESET);
     imprimir(cadena, PROD);         // Con el 2º argumento mostramos el buffer en verde
 
 }
 
 /*
  * Función que retira una letra del buffer. Como se implementa como una cola LIFO, se borra de la posición superior.
- * Dicha letra es devuelta por la función y reemplazada por un guion bajo '_'.
+ * Antes se comprueba que el registro esté completo. Su letra es devuelta por la función y reemplazada por un guion
+ * bajo '_'.
  * Esta función es empleada por los consumidores y forma parte de la región crítica.
  * @param id: identificador del hilo (solo usado a efectos de impresión)
  */
 char remove_item(int id){
-    char item;                   // Letra que contenía el buffer en la posición inicio.
+    char * registro;             // Registro situado en la parte superior de la pila
+    char item;                   // Letra que contenía el buffer en esa posición
     char cadena[100];            // Línea que se imprimirá
 
     // Como cuenta indica el número de posiciones ocupadas, el último elemento estará en cuenta - 1
-    item = buffer[cuenta - 1];          // Guardamos el item
-    buffer[cuenta - 1] = '_';           // Borramos la posición
-    cuenta--;                           // Decrementamos el número de items presentes en el buffer
+    registro = buffer_hueco_extraer(buffer, 0);
+    medidas_latencia(medidas, buffer_posicion(buffer, registro));
+    if (!registro_comprobar(registro, tam_elem)){
+        fprintf(stderr, "Error: se ha consumido un registro corrupto\n");
+        exit(EXIT_FAILURE);
+    }
+    item = *registro;                   // Guardamos el item
+    *registro = '_';                    // Borramos la posición
+    buffer_confirmar_extraccion(buffer, 1);     // Decrementamos el número de items presentes en el buffer
 
     // Indicamos que se ha retirado un elemento (lo imprimimos desde la región crítica para que quede constancia
     // inmediata)
     snprintf(cadena, sizeof(cadena),
-             "\t\t\t\t\t\t%s[%d] Retirado item %c, cuenta = %d %s\t\t\t\t", AZUL, id, item, cuenta, RESET);
+             "\t\t\t\t\t\t%s[%d] Retirado item %c, cuenta = %d %s\t\t\t\t", AZUL, id, item, buffer->cuenta, RESET);
     imprimir(cadena, CONS);             // Con el 2º argumento mostramos el buffer en azul
 
     return item;                        // Devolvemos el elemento leído
 }
 
+/*
+ * Función que coloca un lote de letras en la parte superior de la pila, tantas como quepan en el buffer (al menos
+ * una, pues debe comprobarse de forma externa que no esté lleno).
+ * Esta función es empleada por los productores y forma parte de la región crítica, que se ejecuta una sola vez para
+ * todo el lote.
+ * @param letras: Caracteres a colocar en el buffer.
+ * @param n: Número de caracteres que se desea colocar.
+ * @param id: Identificador del hilo (solo usado a efectos de impresión).
+ * @return: Número de caracteres efectivamente colocados (el mínimo entre n y las posiciones libres).
+ */
+int insert_items(char * letras, int n, int id){
+    int j;                          // Variable de iteración
+
+    if (n > capacidad - buffer->cuenta) n = capacidad - buffer->cuenta;
+    for (j = 0; j < n; j++) insert_item(letras[j], id);
+    return n;
+}
+
+/*
+ * Función que retira un lote de letras de la parte superior de la pila, tantas como haya en el buffer hasta un máximo
+ * (al menos una, pues debe comprobarse de forma externa que no esté vacío).
+ * Esta función es empleada por los consumidores y forma parte de la región crítica.
+ * @param items: Array donde se guardarán las letras retiradas.
+ * @param max: Número máximo de letras a retirar.
+ * @param id: Identificador del hilo (solo usado a efectos de impresión).
+ * @return: Número de letras retiradas (el mínimo entre max y cuenta).
+ */
+int remove_items(char * items, int max, int id){
+    int j;                          // Variable de iteración
+
+    if (max > buffer->cuenta) max = buffer->cuenta;
+    for (j = 0; j < max; j++) items[j] = remove_item(id);
+    return max;
+}
+
 
 /*
  * Función que muestra el carácter que fue retirado del buffer por la función remove_item.
@@ -443,94 +907,492 @@ void consume_item(char item, int id){
 
 
 /*
- * Función que imprime los contenidos del buffer en una línea. Es empleada por los productores, que imprimen en verde,
- * y por los consumidores, que imprimen en azul. Toda la cadena aparece en cursiva.
- * @param hilo: Valdrá PROD (1) si se trata de un hilo productor, y CONS (2) si es un consumidor.
+ * Función que coloca un lote de letras en la parte superior de la pila del fragmento de un productor, tantas como
+ * quepan. Mientras el fragmento esté lleno, el productor espera en su variable de condición, en la que solo duermen
+ * los productores del mismo grupo. Al salir de la región crítica, si hay consumidores dormidos porque todos los
+ * fragmentos estaban vacíos, despierta a tantos como items haya insertado.
+ * Esta función es empleada por los productores en el modo fragmentado.
+ * @param fragmento: Fragmento del grupo del productor.
+ * @param letras: Caracteres a colocar en el buffer.
+ * @param n: Número de caracteres que se desea colocar.
+ * @param id: Identificador del hilo (solo usado a efectos de impresión).
+ * @param cont: Contadores del hilo (NULL si no se llevan).
+ * @return: Número de caracteres efectivamente colocados (el mínimo entre n y las posiciones libres del fragmento).
+ */
+int insertar_fragmento(struct fragmento * fragmento, char * letras, int n, int id, struct contadores_hilo * cont){
+    char cadena[100];               // Línea a imprimir en el log
+    void * hueco;                   // Primera posición libre del fragmento
+    int j;                          // Variable de iteración
+    uint64_t t = contadores_inicio(cont);   // Comienzo de la espera o de la región crítica que se está midiendo
+
+    pthread_mutex_lock(&fragmento->mutex);
+    t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
+    while (buffer_lleno(fragmento->buffer)){
+        snprintf(cadena, sizeof(cadena), "%s[%d] se bloquea por la variable de condicion del fragmento %d%s\n",
+                 VERDE, id, (int) (fragmento - fragmentos), RESET);
+        imprimir(cadena, 0);
+        contadores_lleno(cont);
+        pthread_cond_wait(&fragmento->condp, &fragmento->mutex);
+        t = contadores_tiempo(cont, CONTADORES_ESPERA, t);
+    }
+    /**************************************** REGIÓN CRÍTICA DEL FRAGMENTO ******************************************/
+    if (n > capacidad - fragmento->buffer->cuenta) n = capacidad - fragmento->buffer->cuenta;
+    for (j = 0; j < n; j++){
+        hueco = buffer_hueco_insertar(fragmento->buffer, 0);
+        registro_rellenar(hueco, tam_elem, letras[j]);
+        medidas_sellar(medidas, fragmento->base + buffer_posicion(fragmento->buffer, hueco));
+        buffer_confirmar_insercion(fragmento->buffer, 1);
+
+        // Otros fragmentos pueden estar cambiando, así que no se muestra el contenido del buffer
+        snprintf(cadena, sizeof(cadena), "%s[%d] Guardado item %c en el fragmento %d -> cuenta = %d%s\n",
+                 VERDE, id, letras[j], (int) (fragmento - fragmentos), fragmento->buffer->cuenta, RESET);
+        imprimir(cadena, 0);
+    }
+    /************************************** FIN DE LA REGIÓN CRÍTICA ************************************************/
+    contadores_tiempo(cont, CONTADORES_SECCION, t);
+    pthread_mutex_unlock(&fragmento->mutex);
+
+    // Como en entregar_nodo, la barrera seq_cst empareja con la del consumidor que se anota en sin_items.dormidos
+    // antes de volver a recorrer los fragmentos: o él ve los items, o nosotros le vemos a él y le despertamos
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sin_items.dormidos, memory_order_relaxed)){
+        atomic_fetch_add(&sin_items.aviso, 1);
+        despertar_futex(&sin_items.aviso, n);
+    }
+    return n;
+}
+
+/*
+ * Función que retira un lote de letras del fragmento propio de un consumidor o, si está vacío, de alguno de los
+ * demás, recorridos a partir del siguiente al propio para que los consumidores de distintos fragmentos no roben
+ * todos del mismo. Si todos están vacíos, el consumidor se anota en sin_items.dormidos, vuelve a recorrerlos y, si
+ * siguen vacíos, duerme en el futex sin_items.aviso hasta que un productor inserte items (ver tomar_nodo). Si los
+ * fragmentos ya estaban cerrados antes de ese segundo recorrido, no se insertarán más items y no se espera.
+ * Esta función es empleada por los consumidores en el modo fragmentado.
+ * @param items: Array donde se guardarán las letras retiradas.
+ * @param max: Número máximo de letras a retirar.
+ * @param id: Identificador del hilo.
+ * @param cont: Contadores del hilo (NULL si no se llevan).
+ * @return: Número de letras retiradas (0 solo si los fragmentos están cerrados y vacíos).
+ */
+int extraer_fragmentos(char * items, int max, int id, struct contadores_hilo * cont){
+    int propio = id % num_f;        // Fragmento propio del consumidor
+    uint32_t aviso;                 // Valor de la palabra futex antes de volver a recorrer los fragmentos
+    int cerrados;                   // !0 si los fragmentos ya estaban cerrados antes de volver a recorrerlos
+    uint64_t t;                     // Comienzo de la espera en el futex
+    int k = 0;                      // Items retirados
+    int i;                          // Variable de iteración
+
+    // Primero se recorren los fragmentos sin anotarse: en el caso habitual, el propio tiene items
+    for (i = 0; i < num_f && !k; i++) k = extraer_fragmento(&fragmentos[(propio + i) % num_f], items, max, id, cont);
+    while (!k){
+        aviso = atomic_load(&sin_items.aviso);
+        atomic_fetch_add(&sin_items.dormidos, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        // Todos los fragmentos se cierran a la vez, cuando ya no quedan productores
+        cerrados = buffer_cerrado(fragmentos[propio].buffer);
+        for (i = 0; i < num_f && !k; i++)
+            k = extraer_fragmento(&fragmentos[(propio + i) % num_f], items, max, id, cont);
+        if (!k && cerrados){
+            atomic_fetch_sub(&sin_items.dormidos, 1);
+            break;
+        }
+        if (!k){
+            contadores_vacio(cont);
+            t = contadores_inicio(cont);
+            esperar_futex(&sin_items.aviso, aviso);
+            contadores_tiempo(cont, CONTADORES_ESPERA, t);
+        }
+        atomic_fetch_sub(&sin_items.dormidos, 1);
+    }
+    return k;
+}
+
+/*
+ * Función que retira un lote de letras de la parte superior de la pila de un fragmento, tantas como haya hasta un
+ * máximo, sin esperar si está vacío. Si el fragmento no es el propio del consumidor, los items se cuentan como
+ * robados. Como se liberan huecos, se despierta a los productores del grupo que esperaban por el fragmento lleno.
+ * @param fragmento: Fragmento del que se retiran los items.
+ * @param items: Array donde se guardarán las letras retiradas.
+ * @param max: Número máximo de letras a retirar.
+ * @param id: Identificador del hilo.
+ * @param cont: Contadores del hilo (NULL si no se llevan).
+ * @return: Número de letras retiradas (0 si el fragmento estaba vacío).
+ */
+int extraer_fragmento(struct fragmento * fragmento, char * items, int max, int id, struct contadores_hilo * cont){
+    char cadena[100];               // Línea a imprimir en el log
+    char * registro;                // Registro situado en la parte superior de la pila
+    int indice = fragmento - fragmentos;    // Índice del fragmento
+    int j;                          // Variable de iteración
+    uint64_t t = contadores_inicio(cont);   // Comienzo de la espera por el mutex o de la región crítica
+
+    pthread_mutex_lock(&fragmento->mutex);
+    t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
+    /**************************************** REGIÓN CRÍTICA DEL FRAGMENTO ******************************************/
+    if (max > fragmento->buffer->cuenta) max = fragmento->buffer->cuenta;
+    for (j = 0; j < max; j++){
+        registro = buffer_hueco_extraer(fragmento->buffer, 0);
+        medidas_latencia(medidas, fragmento->base + buffer_posicion(fragmento->buffer, registro));
+        if (!registro_comprobar(registro, tam_elem)){
+            fprintf(stderr, "Error: se ha consumido un registro corrupto\n");
+            exit(EXIT_FAILURE);
+        }
+        items[j] = *registro;
+        *registro = '_';
+        buffer_confirmar_extraccion(fragmento->buffer, 1);
+
+        snprintf(cadena, sizeof(cadena), "\t\t\t\t\t\t%s[%d] Retirado item %c del fragmento %d%s, cuenta = %d%s\n",
+                 AZUL, id, items[j], indice, indice == id % num_f? "" : " (robado)", fragmento->buffer->cuenta, RESET);
+        imprimir(cadena, 0);
+    }
+    if (indice != id % num_f) fragmento->robados += max;
+    /************************************** FIN DE LA REGIÓN CRÍTICA ************************************************/
+    // Como en el modo con un solo buffer, con más de un hueco liberado puede haber varios productores que continúen
+    if (max == 1) pthread_cond_signal(&fragmento->condp);
+    else if (max > 1) pthread_cond_broadcast(&fragmento->condp);
+    contadores_tiempo(cont, CONTADORES_SECCION, t);
+    pthread_mutex_unlock(&fragmento->mutex);
+    return max;
+}
+
+
+/*
+ * Función que coloca una letra en el buffer en el modo sin cerrojos. El productor toma un hueco de la pila de huecos
+ * libres (bloqueándose si el buffer está lleno), escribe en él el registro y lo apila en la pila de items, de forma
+ * que será el primero en ser retirado (LIFO).
+ * Esta función es empleada por los productores y no requiere ninguna región crítica.
+ * @param letra: Carácter a colocar en el buffer.
+ * @param id: Identificador del hilo (solo usado a efectos de impresión).
+ * @param cont: Contadores del hilo (NULL si no se llevan).
+ */
+void insertar_pila(char letra, int id, struct contadores_hilo * cont){
+    char cadena[100];                // Línea a imprimir en el log
+    uint32_t nodo;                   // Hueco del buffer en el que se escribe el item
+
+    nodo = tomar_nodo(&huecos, cont);
+    registro_rellenar(buffer_registro(buffer, nodo), tam_elem, letra);
+    medidas_sellar(medidas, nodo);
+    entregar_nodo(&items, nodo);     // Al apilarlo (release), el registro queda visible para los consumidores
+
+    // El buffer puede estar cambiando mientras se imprime, así que no se muestra su contenido
+    snprintf(cadena, sizeof(cadena), "%s[%d] Guardado item %c en %u%s\n", VERDE, id, letra, nodo, RESET);
+    imprimir(cadena, 0);
+}
+
+/*
+ * Función que retira una letra del buffer en el modo sin cerrojos. El consumidor desapila el hueco superior de la
+ * pila de items (bloqueándose si el buffer está vacío y no se ha cerrado), comprueba y lee el registro, lo borra con
+ * un guion bajo '_' y devuelve el hueco a la pila de huecos libres.
+ * Esta función es empleada por los consumidores y no requiere ninguna región crítica.
+ * @param item: Dirección donde se guarda la letra retirada.
+ * @param id: Identificador del hilo (solo usado a efectos de impresión).
+ * @param cont: Contadores del hilo (NULL si no se llevan).
+ * @return: 1 si se ha retirado una letra, 0 si el buffer está cerrado y vacío.
+ */
+int extraer_pila(char * item, int id, struct contadores_hilo * cont){
+    char * registro;                 // Registro del hueco desapilado
+    char cadena[100];                // Línea a imprimir en el log
+    uint32_t nodo;                   // Hueco del buffer que contiene el item
+
+    if ((nodo = tomar_nodo(&items, cont)) == NODO_NULO) return 0;
+    medidas_latencia(medidas, nodo);
+    registro = buffer_registro(buffer, nodo);
+    if (!registro_comprobar(registro, tam_elem)){
+        fprintf(stderr, "Error: se ha consumido un registro corrupto\n");
+        exit(EXIT_FAILURE);
+    }
+    *item = *registro;
+    *registro = '_';
+    entregar_nodo(&huecos, nodo);    // A partir de aquí, un productor puede reutilizar el hueco
+
+    snprintf(cadena, sizeof(cadena), "\t\t\t\t\t\t%s[%d] Retirado item %c de %u%s\n", AZUL, id, *item, nodo, RESET);
+    imprimir(cadena, 0);
+
+    return 1;
+}
+
+/*
+ * Función que desapila un hueco de una de las pilas sin cerrojos. Si la pila está vacía, el hilo se anota en
+ * dormidos y se bloquea en el futex aviso hasta que otro hilo apile un hueco.
+ * Antes de dormir se lee el valor de aviso y, tras anotarse, se vuelve a intentar desapilar: si otro hilo apiló un
+ * hueco entre medias, o bien lo vemos en ese segundo intento, o bien él ve dormidos mayor que 0 e incrementa aviso,
+ * con lo que FUTEX_WAIT retorna de inmediato. Las barreras seq_cst de ambos lados (patrón de Dekker) garantizan que
+ * no se pierda ningún aviso.
+ * Cada vez que el hilo duerme, se anota en sus contadores que ha encontrado el buffer lleno (pila de huecos vacía) o
+ * vacío (pila de items vacía), junto al tiempo que pasa en el futex.
+ * La pila de items deja de esperar cuando el buffer se cierra (cerrar_buffer), que lo hace después de que terminen
+ * todos los productores. El cierre se comprueba antes del segundo intento: si el buffer ya estaba cerrado y la pila
+ * sigue vacía, no se apilarán más items.
+ * @param pila: Pila de la que se desapila (items para los consumidores, huecos para los productores).
+ * @param cont: Contadores del hilo (NULL si no se llevan).
+ * @return: Índice del hueco desapilado (NODO_NULO si la pila es la de items y el buffer está cerrado y vacío).
+ */
+uint32_t tomar_nodo(struct pila * pila, struct contadores_hilo * cont){
+    uint32_t nodo;              // Hueco desapilado
+    uint32_t aviso;             // Valor de la palabra futex antes de volver a intentarlo
+    uint64_t t;                 // Comienzo de la espera en el futex
+    int cerrada;                // !0 si la pila de items ya no va a recibir más huecos
+
+    while ((nodo = desapilar(pila)) == NODO_NULO){
+        aviso = atomic_load(&pila->aviso);
+        atomic_fetch_add(&pila->dormidos, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        cerrada = pila == &items && buffer_cerrado(buffer);
+        if ((nodo = desapilar(pila)) == NODO_NULO && !cerrada){
+            if (pila == &huecos) contadores_lleno(cont);
+            else contadores_vacio(cont);
+            t = contadores_inicio(cont);
+            esperar_futex(&pila->aviso, aviso);
+            contadores_tiempo(cont, CONTADORES_ESPERA, t);
+        }
+        atomic_fetch_sub(&pila->dormidos, 1);
+        if (nodo != NODO_NULO || cerrada) break;
+    }
+    return nodo;
+}
+
+/*
+ * Función que apila un hueco en una de las pilas sin cerrojos y, si hay algún hilo bloqueado esperando por ella,
+ * despierta exactamente a uno. Como cada hueco apilado solo puede satisfacer a un hilo, no hay estampidas.
+ * @param pila: Pila en la que se apila (items para los productores, huecos para los consumidores).
+ * @param nodo: Índice del hueco.
+ */
+void entregar_nodo(struct pila * pila, uint32_t nodo){
+    apilar(pila, nodo);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pila->dormidos, memory_order_relaxed)){
+        atomic_fetch_add(&pila->aviso, 1);
+        despertar_futex(&pila->aviso, 1);
+    }
+}
+
+/*
+ * Función que intenta desapilar el hueco superior de una pila de Treiber. La nueva cima es el hueco que estaba
+ * debajo (siguiente[nodo]) con la etiqueta incrementada. Si otro hilo modifica la cima entre la lectura y el
+ * compare-and-swap, este falla, recarga la cima y se vuelve a intentar.
+ * Aunque el hueco haya sido reutilizado y siguiente[nodo] contenga un valor obsoleto, la etiqueta habrá cambiado y el
+ * compare-and-swap fallará, así que ese valor nunca llega a publicarse.
+ * @param pila: Pila de la que se desapila.
+ * @return: Índice del hueco desapilado, o NODO_NULO si la pila está vacía.
+ */
+uint32_t desapilar(struct pila * pila){
+    uint64_t cima = atomic_load_explicit(&pila->cima, memory_order_acquire);    // Cima leída
+    uint64_t nueva;             // Cima que se intenta publicar
+    uint32_t nodo;              // Hueco superior
+
+    do {
+        if ((nodo = (uint32_t) cima) == NODO_NULO) return NODO_NULO;
+        nueva = (((cima >> 32) + 1) << 32) | atomic_load_explicit(&siguiente[nodo], memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&pila->cima, &cima, nueva, memory_order_acquire,
+                                                    memory_order_acquire));
+    return nodo;
+}
+
+/*
+ * Función que apila un hueco en una pila de Treiber: se enlaza con la cima actual y se publica como nueva cima con
+ * semántica release, de forma que quien lo desapile (acquire) verá también el registro escrito en él.
+ * @param pila: Pila en la que se apila.
+ * @param nodo: Índice del hueco.
+ */
+void apilar(struct pila * pila, uint32_t nodo){
+    uint64_t cima = atomic_load_explicit(&pila->cima, memory_order_relaxed);    // Cima leída
+    uint64_t nueva;             // Cima que se intenta publicar
+
+    do {
+        atomic_store_explicit(&siguiente[nodo], (uint32_t) cima, memory_order_relaxed);
+        nueva = (((cima >> 32) + 1) << 32) | nodo;
+    } while (!atomic_compare_exchange_weak_explicit(&pila->cima, &cima, nueva, memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+/*
+ * Función que bloquea al hilo en una palabra futex mientras esta conserve el valor indicado. Si la palabra ya ha
+ * cambiado, el kernel retorna inmediatamente (EAGAIN). Como la palabra solo la usan hilos del mismo proceso, se usa la
+ * variante privada.
+ * @param palabra: Dirección de la palabra futex.
+ * @param valor: Valor esperado de la palabra.
+ */
+void esperar_futex(_Atomic uint32_t * palabra, uint32_t valor){
+    if (syscall(SYS_futex, (uint32_t *) palabra, FUTEX_WAIT_PRIVATE, valor, NULL, NULL, 0) == -1
+            && errno != EAGAIN && errno != EINTR){
+        perror("Error en la espera sobre un futex");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Función que despierta a (como mucho) n hilos bloqueados en una palabra futex.
+ * @param palabra: Dirección de la palabra futex.
+ * @param n: Número máximo de hilos a despertar.
+ */
+void despertar_futex(_Atomic uint32_t * palabra, int n){
+    if (syscall(SYS_futex, (uint32_t *) palabra, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0) == -1){
+        perror("Error al despertar a un hilo bloqueado en un futex");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/*
+ * Función que da formato a la instantánea del buffer guardada en un registro de la bitácora, en una línea. La ejecuta
+ * el hilo escritor de la bitácora al volcar los mensajes de los productores, que imprimen en verde, y de los
+ * consumidores, que imprimen en azul. Toda la cadena aparece en cursiva.
+ * @param registro: Registro de la bitácora. Su tipo valdrá PROD (1) si lo escribió un hilo productor, y CONS (2) si
+ *                  fue un consumidor. Sus datos contienen el primer carácter de cada registro del buffer.
+ * @param destino: Cadena donde se escribe la línea.
+ * @param tam: Tamaño máximo de la línea.
+ * @return: Número de caracteres escritos.
  */
-void log_buffer(int hilo){
+size_t log_buffer(const struct bitacora_registro * registro, char * destino, size_t tam){
+    size_t n;       // Caracteres escritos
     int i;          // Variable de iteración
 
-    // Dependiendo del argumento hilo, se imprime en verde o en azul. Siempre se activa la cursiva.
-    printf("%s%sbuffer = [", hilo == PROD? VERDE : AZUL, CURSIVA);
-    for (i = 0; i < N - 1; i++)
-        printf("%c ", *(buffer + i));           // Leemos uno a uno los caracteres contenidos en el buffer
-    printf("%c]%s%s\n", *(buffer + i), RESET, RESET_CURS);
-    // No utilizamos \n hasta el final para tratar de que el buffer se imprima de forma atómica
+    // Dependiendo del tipo del registro, se imprime en verde o en azul. Siempre se activa la cursiva.
+    n = snprintf(destino, tam, "%s%sbuffer = [", registro->tipo == PROD? VERDE : AZUL, CURSIVA);
+    for (i = 0; i < registro->tam_datos && n < tam; i++)
+        n += snprintf(destino + n, tam - n, i < registro->tam_datos - 1? "%c " : "%c", registro->datos[i]);
+    if (n < tam) n += snprintf(destino + n, tam - n, "]%s%s\n", RESET, RESET_CURS);
+    return n < tam? n : tam - 1;
 }
 
 /*
- * Función de impresión que busca asegurar que esta tenga lugar de forma atómica entre hilos. Para ello,
- * no se permite que varios hilos empleen esta función a la vez (para lo cual se utiliza un mutex, mutex_impr) y
- * se añade una pequeña espera antes de terminarla, para tratar de que el hilo complete su uso de la consola.
+ * Función de impresión que no bloquea nunca al hilo que la llama. En lugar de escribir en la consola, deja el mensaje
+ * en el anillo propio del hilo dentro de la bitácora (módulo comun/bitacora), y el hilo escritor de esta se encarga
+ * de volcarlo junto a los de los demás hilos, ordenados según el instante en que se escribieron. Si la consola no da
+ * abasto, el mensaje se descarta y se contabiliza.
  * La impresión corresponde a una sola línea y consta de un mensaje seguido opcionalmente del contenido del buffer.
+ * Como el buffer puede cambiar antes de que se vuelque el mensaje, se guarda una instantánea de su contenido (el
+ * primer carácter de cada registro) en el momento de la llamada, que se realiza desde la región crítica. La bitácora
+ * guarda como mucho BITACORA_TAM_DATOS bytes, así que de un buffer mayor solo se muestran los primeros registros.
  * @param cadena: Mensaje inicial a imprimir antes del buffer.
  * @param ver_buffer: 0 para no incluir el buffer en la línea, !0 para añadirlo (1 para imprimir como productor y 2
  *                    para imprimir como consumidor).
  */
 void imprimir(char * cadena, int ver_buffer){
-    // Adquirimos el mutex de impresión. Así, definimos el empleo de la consola como una región crítica (al fin y al
-    // cabo, se está empleando un recurso compartido). Únicamente un hilo podrá utilizarla de forma simultánea.
-    pthread_mutex_lock(&mutex_impr);
-    printf("%s", cadena);
-    // Si se ha solicitado, se imprime el buffer en la misma línea
-    // Pasamos ver_buffer a log_buffer para que se tenga en cuenta si se trata del productor (1) o del consumidor (2)
-    if (ver_buffer) log_buffer(ver_buffer);
-
-    usleep(150);     // Dormimos al hilo algunos microsegundos para tratar de que dé tiempo a imprimir y las
-                     // llamadas a printf procedentes de distintos hilos no se mezclen por consola
-
-    // Se libera el mutex de impresión, permitiendo que un (y solamente un) hilo que estuviera esperando para imprimir
-    // pueda salir de pthread_mutex_lock y ejecutar los printf.
-    pthread_mutex_unlock(&mutex_impr);
+    char instantanea[BITACORA_TAM_DATOS];   // Primer carácter de cada registro del buffer
+    int n = capacidad < BITACORA_TAM_DATOS? capacidad : BITACORA_TAM_DATOS;     // Registros de la instantánea
+    int i;                                  // Variable de iteración
+
+    // En el modo rendimiento no se imprime nada
+    if (rendimiento) return;
+
+    if (ver_buffer)
+        for (i = 0; i < n; i++) instantanea[i] = *(char *) buffer_registro(buffer, i);
+    bitacora_escribir(bitacora, cadena, ver_buffer, ver_buffer? instantanea : NULL, n);
 }
 
-// Función auxiliar que inicializa los mutexes y variables de condicion
+// Función auxiliar que inicializa los mutexes y variables de condicion, así como las pilas sin cerrojos o los
+// fragmentos
 void inicializar(){
+    int i;          // Variable de iteración
+    void * region;  // Memoria reservada para el buffer de un fragmento
+
     // Antes de poder emplear los mutexes en las funciones pthread_mutex_lock, pthread_mutex_unlock, etc., deben ser
     // inicializados. Para ello, utilizamos la función pthread_mutex_init
     // Dejamos el segundo argumento a NULL para emplear la configuración de atributos por defecto.
-    if (pthread_mutex_init(&mutex, NULL)){
+    if (pthread_mutex_init(&sinc.mutex, NULL)){
         fprintf(stderr, "Error en la inicializacion del mutex de la region critica\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_init(&mutex_impr, NULL)){
-        fprintf(stderr, "Error en la inicializacion del mutex de impresion\n");
+    // Los mensajes de los hilos se imprimen a través de la bitácora, que vuelca en la salida estándar lo que ya haya
+    // escrito printf (de ahí el fflush). En el modo rendimiento no se imprime nada, así que no es necesaria
+    fflush(stdout);
+    if (!rendimiento && (bitacora = bitacora_crear(STDOUT_FILENO, log_buffer)) == NULL){
+        fprintf(stderr, "Error en la creacion de la bitacora\n");
         exit(EXIT_FAILURE);
     }
     // De forma análoga, inicializamos las variables de condición empleando pthread_cond_init, indicando los atributos
     // por defecto.
-    if (pthread_cond_init(&condc, NULL)){
+    if (pthread_cond_init(&sinc.condc, NULL)){
         fprintf(stderr, "Error en la inicializacion de la variable de condicion del buffer vacio\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_cond_init(&condp, NULL)){
+    if (pthread_cond_init(&sinc.condp, NULL)){
         fprintf(stderr, "Error en la inicializacion de la variable de condicion del buffer lleno\n");
         exit(EXIT_FAILURE);
     }
+
+    // En el modo sin cerrojos, la pila de items empieza vacía y la de huecos contiene todos los huecos del buffer
+    // (0 en la cima, de forma que el primer item se guarda en la posición 0). Las etiquetas empiezan en 0.
+    if (modo == MODO_LOCKFREE){
+        atomic_init(&items.cima, (uint64_t) NODO_NULO);
+        atomic_init(&items.aviso, 0);
+        atomic_init(&items.dormidos, 0);
+        if ((siguiente = malloc((size_t) capacidad * sizeof(siguiente[0]))) == NULL){
+            fprintf(stderr, "Error: no se pudo reservar memoria para las pilas sin cerrojos\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < capacidad; i++)
+            atomic_init(&siguiente[i], i < capacidad - 1? (uint32_t) i + 1 : NODO_NULO);
+        atomic_init(&huecos.cima, 0);
+        atomic_init(&huecos.aviso, 0);
+        atomic_init(&huecos.dormidos, 0);
+    }
+
+    // En el modo fragmentado, cada fragmento tiene su propio buffer, vacío, reservado (con una política de afinidad)
+    // en el nodo NUMA de su primer consumidor, que es quien más items leerá de él
+    if (modo == MODO_FRAGMENTADO){
+        if ((fragmentos = cache_reservar(num_f, sizeof(struct fragmento))) == NULL){
+            fprintf(stderr, "Error: no se pudo reservar memoria para los fragmentos\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < num_f; i++){
+            if ((region = afinidad_reservar(buffer_tam_region(capacidad, tam_elem), afinidad == AFINIDAD_NINGUNA? -1 :
+                                            afinidad_nodo(afinidad_cpu(afinidad, AFINIDAD_CONSUMIDOR, i, num_c))))
+                    == NULL){
+                fprintf(stderr, "Error: no se pudo reservar memoria para el buffer de un fragmento\n");
+                exit(EXIT_FAILURE);
+            }
+            fragmentos[i].buffer = buffer_iniciar(region, capacidad, tam_elem, BUFFER_LIFO, '_');
+            fragmentos[i].base = i * capacidad;
+            if (pthread_mutex_init(&fragmentos[i].mutex, NULL) || pthread_cond_init(&fragmentos[i].condp, NULL)){
+                fprintf(stderr, "Error en la inicializacion de la sincronizacion de un fragmento\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        atomic_init(&sin_items.aviso, 0);
+        atomic_init(&sin_items.dormidos, 0);
+    }
 }
 
 // Función auxiliar que destruye los mutexes y variables de condicion
 void destruir(){
+    int i;          // Variable de iteración
+
     // Una vez ha finalizado el uso de los mutexes y de las variables de condición, se pueden destruir con seguridad.
     // Llamar a destruir las desinicializará. Tenemos la seguridad de que todos los mutexes están desbloqueados y las
     // variables de condición, liberadas, pues todos los hilos han finalizado correctamente (en caso contrario,
     // estas funciones podrían dar error)
-    if (pthread_cond_destroy(&condc)){
+    if (pthread_cond_destroy(&sinc.condc)){
         fprintf(stderr, "Error en la destruccion de la variable de condicion del buffer vacio\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_cond_destroy(&condp)){
+    if (pthread_cond_destroy(&sinc.condp)){
         fprintf(stderr, "Error en la destruccion de la variable de condicion del buffer lleno\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_destroy(&mutex)){
+    if (pthread_mutex_destroy(&sinc.mutex)){
         fprintf(stderr, "Error en la destruccion del mutex de la region critica\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_destroy(&mutex_impr)){
-        fprintf(stderr, "Error en la destruccion del mutex de impresion\n");
-        exit(EXIT_FAILURE);
+    // La bitácora vuelca los mensajes pendientes antes de cerrarse
+    if (bitacora != NULL){
+        descartados = bitacora_descartados(bitacora);
+        bitacora_cerrar(bitacora);
+        bitacora = NULL;
     }
+    free(siguiente);        // Enlaces de las pilas sin cerrojos (NULL en los demás modos)
+    siguiente = NULL;
+    // Fragmentos (NULL salvo en el modo MODO_FRAGMENTADO), con sus buffers
+    for (i = 0; fragmentos != NULL && i < num_f; i++){
+        if (pthread_cond_destroy(&fragmentos[i].condp) || pthread_mutex_destroy(&fragmentos[i].mutex)){
+            fprintf(stderr, "Error en la destruccion de la sincronizacion de un fragmento\n");
+            exit(EXIT_FAILURE);
+        }
+        afinidad_liberar(fragmentos[i].buffer, buffer_tam_region(capacidad, tam_elem));
+    }
+    free(fragmentos);
+    fragmentos = NULL;
 }
 
 
@@ -539,17 +1401,27 @@ void destruir(){
  * @param hilo: puntero al pthread_t donde se guardará el identificador del hilo creado
  * @param funcion: funcion que ejecutará el hilo nada más crearse
  * @param arg: argumento que se le pasará a la función del hilo craedo
+ * @param rol: AFINIDAD_CONSUMIDOR o AFINIDAD_PRODUCTOR, para elegir su CPU según la política de afinidad
  */
-void crear_hilo(pthread_t * hilo, void * funcion, int arg){
+void crear_hilo(pthread_t * hilo, void * funcion, int arg, int rol){
+    pthread_attr_t atributos;   // Atributos de creación del hilo
     int error;          // Comprobación de errores
 
+    // Los atributos por defecto solo se modifican para fijar la CPU del hilo, si se ha indicado una política de
+    // afinidad con la opción -a (con la política ninguna, afinidad_cpu devuelve -1 y no se cambian)
+    if ((error = pthread_attr_init(&atributos)) != 0 ||
+        (error = afinidad_atributos(&atributos, afinidad_cpu(afinidad, rol, arg, num_c))) != 0){
+        fprintf(stderr, "Error %s al preparar los atributos de un hilo\n", strerror(error));
+        exit(EXIT_FAILURE);
+    }
+
     // El argumento debe enviarse como un puntero a void, y no como un entero. Para realizar una conversión segura,
     // pasamos primero el dato a intptr_t y después a un puntero a void.
-    // Pasamos NULL como segundo argumento para no modificar los atributos por defecto del hilo
-    if ((error = pthread_create(hilo, NULL, funcion, (void *) (intptr_t) arg)) != 0){
+    if ((error = pthread_create(hilo, &atributos, funcion, (void *) (intptr_t) arg)) != 0){
         fprintf(stderr, "Error en la creación de un hilo\n");
         exit(EXIT_FAILURE);
     }
+    pthread_attr_destroy(&atributos);
 }
 
 /*
@@ -1,10 +1,24 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "../comun/buffer.h"
+#include "../comun/medidas.h"
+#include "../comun/bitacora.h"
+#include "../comun/config.h"
+#include "../comun/afinidad.h"
+#include "../comun/cache.h"
+#include "../comun/contadores.h"
 
 /*
  * Xiana Carrera Alonso
@@ -13,20 +27,59 @@
  *
  * Este programa implementa el problema del productor-consumidor resuelto utilizando mutexes, pero sin emplear
  * variables de condicion. Se basa en el envío de señales entre hilos a través de pthread_kill.
+ * Todos los hilos tienen SIGUSR1 bloqueada y la esperan con sigwait tras anotarse como en pausa con el mutex
+ * adquirido. Quien avisa busca a los hilos en pausa también con el mutex adquirido, así que una señal enviada antes
+ * de que el hilo llegue a sigwait queda pendiente y sigwait retorna de inmediato: ningún aviso puede perderse.
  * Los cambios se encuentran, principalmente, en las funciones producir() y consumir(), así como en la definición
  * de variables globales y en el main.
+ * El buffer es un buffer de registros (módulo comun/buffer): cada item se escribe y se lee directamente en su hueco.
+ *
+ * Como alternativa a las señales, se ofrece un mecanismo de aviso basado en futex: cada hilo tiene su propia palabra
+ * futex, y los hilos que esperan por una misma condición (un item para los consumidores, un hueco para los
+ * productores) forman una cola FIFO protegida por el mutex. Quien cambia el estado del buffer saca de la cola a un
+ * único hilo y lo despierta con FUTEX_WAKE sobre su palabra, en lugar de enviar una señal a cada hilo en pausa. Como
+ * el hilo se encola con el mutex adquirido, ningún aviso puede perderse entre la liberación del mutex y la espera.
+ * En ambos casos se cuentan los avisos enviados, los despertares y cuántos de estos son inútiles (el hilo vuelve a
+ * encontrar el buffer lleno o vacío), para comparar ambos mecanismos.
+ *
+ * Los consumidores no se reparten de antemano los items: cuando terminan todos los productores, el hilo principal
+ * cierra el buffer y despierta a todos los consumidores en espera, y cada uno retira items hasta encontrarlo cerrado
+ * y vacío.
+ *
+ * Uso: ./p3_2_v1 [-m senales|futex] [-r] [-t tam_elem] [-a politica]
+ *  -m: mecanismo de aviso entre hilos (señales con pthread_kill, por defecto, o futex).
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, cada productor genera ITEMS_BY_P_RENDIMIENTO items
+ *      y al final se imprime una línea CSV (módulo comun/medidas) con los items/s, los percentiles de latencia de
+ *      traspaso y los cambios de contexto.
+ *  -t: tamaño en bytes de cada registro del buffer (1 por defecto).
+ *  -a: política de colocación de los hilos en las CPUs (módulo comun/afinidad): ninguna (por defecto), compacta,
+ *      dispersa o parejas. Con cualquiera de las tres últimas, el buffer se reserva en el nodo NUMA de los
+ *      consumidores y, en el modo rendimiento, la política se añade a la variante del CSV.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra): --capacidad (tamaño del buffer, N por defecto), --items
+ * (items de cada productor), --productores y --consumidores (P y C por defecto), --tam_elem (como -t), --espera_max
+ * (las esperas duran de 0 a espera_max - 1 segundos) y --contadores (con 1, se vuelcan en JSON por la salida de
+ * errores, al acabar y al recibir SIGUSR2, los contadores de cada hilo del módulo comun/contadores: esperas por el
+ * mutex, esperas mientras el buffer sigue lleno o vacío (sigwait hasta la señal o espera en el futex), tiempo en
+ * la región crítica, veces que encontraron el buffer lleno o vacío e items procesados). También se leen de las
+ * variables SOII_NOMBRE.
  * Debe compilarse con la opción -pthread.
  */
 
-#define P 5          // Número de productores
-#define C 4          // Número de consumidores
+#define P 5          // Número de productores por defecto
+#define C 4          // Número de consumidores por defecto
+#define MAX_HILOS 1024     // Número máximo de productores y de consumidores
 
 #define PROD 1       // Código de los productores
 #define CONS 2       // Código de los consumidores
 
-#define N 10                       // Tamaño del buffer
+#define N 10                       // Tamaño por defecto del buffer
 #define ITEMS_BY_P 20              // Items producidos por cada productor
-#define SLEEP_MAX_TIME 4           // Máximo tiempo de bloqueo por un sleep
+#define ITEMS_BY_P_RENDIMIENTO 20000    // Items producidos por cada productor en el modo rendimiento
+#define SLEEP_MAX_TIME 4           // Máximo tiempo de bloqueo por un sleep (por defecto)
+
+#define MODO_SENALES 0             // Avisos con pthread_kill(SIGUSR1) a todos los hilos en pausa
+#define MODO_FUTEX 1               // Avisos con FUTEX_WAKE a un único hilo por cada cambio en el buffer
 
 #define VERDE "\033[32m"           // Color en el que imprimirán los productores
 #define AZUL "\033[34m"            // Color en el que imprimirán los consumidores
@@ -36,15 +89,30 @@
 #define RESET_CURS "\033[23m"      // Reseteado de cursiva
 
 
-// Función de impresión del buffer con un código de colores para productores (verde) y consumidores (azul)
-void log_buffer(int hilo);
+/*
+ * Cola de hilos que esperan por una misma condición en el modo MODO_FUTEX. Cada hilo duerme en su propia palabra
+ * futex, de forma que se puede despertar exactamente al primero de la cola. Salvo las palabras, que el hilo avisado
+ * lee sin el mutex, todos los campos se protegen con el mutex de la región crítica.
+ */
+struct espera {
+    struct cache_palabra * aviso;   // Palabra futex de cada hilo (indexada por su identificador), en su propia línea
+    int * cola;                     // Identificadores de los hilos en espera (buffer circular)
+    int tam;                        // Número de hilos que pueden esperar (tamaño de aviso y de cola)
+    int inicio;                     // Posición del primer hilo de la cola
+    int n;                          // Número de hilos en la cola
+};
+
+
+// Función de formato de una instantánea del buffer con un código de colores para productores (verde) y consumidores
+// (azul). La utiliza el hilo escritor de la bitácora
+size_t log_buffer(const struct bitacora_registro * registro, char * destino, size_t tam);
 // Función de impresión de un mensaje junto (opcionalmente) al contenido del buffer en una línea
-// Su propósito es permitir imprimir de forma casi atómica y sin interferencias entre hilos
+// Deja el mensaje en la bitácora, de forma que el hilo nunca espera por la consola
 void imprimir(char * cadena, int ver_buffer);
 
-// Función auxiliar que inicializa los mutexes y variables de condicion
+// Función auxiliar que inicializa los mutexes
 void inicializar();
-// Función auxiliar que destruye los mutexes y variables de condicion
+// Función auxiliar que destruye los mutexes
 void destruir();
 
 // Función que comprueba si el buffer tiene N elementos
@@ -61,86 +129,251 @@ char remove_item(int id);
 // Función de impresión de un item eliminado (consumidores)
 void consume_item(char item, int id);
 
+// Función que encola al hilo, libera el mutex, espera en su palabra futex hasta recibir un aviso y vuelve a adquirir
+// el mutex
+void esperar_aviso(struct espera * espera, int id);
+// Función que saca de la cola al primer hilo en espera y marca su aviso (con el mutex adquirido)
+int preparar_aviso(struct espera * espera);
+// Función de espera sobre una palabra futex
+void esperar_futex(_Atomic uint32_t * palabra, uint32_t valor);
+// Función que despierta a un hilo bloqueado en una palabra futex
+void despertar_futex(_Atomic uint32_t * palabra);
+
 // Función de ejecución de los hilos productores
 void * producir(void * ptr_id);
 // Función de ejecución de los hilos consumidores
 void * consumir(void * ptr_id);
+// Función que cierra el buffer y despierta a todos los consumidores que esperan por él
+void cerrar_buffer();
 
 
-// Función que encapsula la creación de un hilo, que ejecutará una funcion con un argumento entero
-void crear_hilo(pthread_t * hilo, void * funcion, int arg);
+// Función que encapsula la creación de un hilo, que ejecutará una funcion con un argumento entero, colocándolo en
+// una CPU según su rol (productor o consumidor) y la política de afinidad
+void crear_hilo(pthread_t * hilo, void * funcion, int arg, int rol);
 // Función que ejecuta pthread_join sobre un hilo y comprueba que finalice correctamente
 void esperar_hilo(pthread_t hilo);
 
-// Función de manejo de señales que únicamente retorna, para evitar la finalización del proceso al recibir señales
-static void handler(int numero_de_senhal){ return; }
-
-pthread_mutex_t mutex;             // Mutex de acceso a la región crítica
-pthread_mutex_t mutex_impr;        // Mutex de impresión por consola
-pthread_cond_t condc, condp;       // Variables de condicion (buffer vacío y lleno)
-
-
-char * buffer = NULL;       // Buffer de caracteres compartido por productor y consumidor
-int cuenta = 0;             // Número de elementos guardados en el buffer
-
-pthread_t consumidores[C];      // Identificadores de los hilos consumidores
-int esperando_C[C];             // Array booleano que indica si un hilo consumidor está en pausa o no
-pthread_t productores[P];       // Identificadores de los hilos productores
-int esperando_P[C];             // Array booleano que indica si un hilo productor está en pausa o no
+// Objetos de sincronización de todos los hilos, cada uno en su propia línea de caché (módulo comun/cache), para que
+// los lock y unlock no invaliden los datos de solo lectura que los rodean
+struct {
+    CACHE_ALINEADO pthread_mutex_t mutex;   // Mutex de acceso a la región crítica
+} sinc;
+
+struct bitacora * bitacora = NULL; // Bitácora asíncrona por la que se imprimen los mensajes de los hilos
+long descartados = 0;              // Mensajes que la bitácora no pudo imprimir por no dar abasto la consola
+
+int modo = MODO_SENALES;           // Mecanismo de aviso entre hilos
+sigset_t senal_aviso;              // Conjunto con SIGUSR1, la señal que esperan los hilos en pausa (modo MODO_SENALES)
+struct espera espera_C;            // Espera de los consumidores (buffer vacío)
+struct espera espera_P;            // Espera de los productores (buffer lleno)
+long avisos = 0;                   // Señales enviadas o FUTEX_WAKE realizados (protegido por mutex)
+long despertares = 0;              // Veces que un hilo ha vuelto de una espera (protegido por mutex)
+long despertares_inutiles = 0;     // Despertares tras los que el buffer seguía lleno o vacío (protegido por mutex)
+
+
+struct buffer * buffer = NULL;      // Buffer de registros compartido por productor y consumidor (pila LIFO)
+size_t tam_elem = sizeof(char);     // Tamaño en bytes de cada registro del buffer
+
+int rendimiento = 0;                // !0 para ejecutar sin esperas ni mensajes y medir items/s
+int items_por_p = ITEMS_BY_P;       // Items producidos por cada productor
+struct medidas * medidas = NULL;    // Latencias de traspaso (un sello por hueco del buffer)
+
+int num_p = P;                      // Número de hilos productores
+int num_c = C;                      // Número de hilos consumidores
+int capacidad = N;                  // Tamaño del buffer
+int espera_max = SLEEP_MAX_TIME;    // Límite (exclusivo) en segundos de las esperas aleatorias
+int afinidad = AFINIDAD_NINGUNA;    // Política de colocación de los hilos en las CPUs
+int instrumentar = 0;               // !0 para llevar y volcar los contadores de cada hilo
+struct contadores * contadores = NULL;  // Contadores de instrumentación (NULL si no se llevan)
+
+// Los arrays por hilo se reservan en el main, una vez conocidos num_p y num_c
+pthread_t * consumidores;       // Identificadores de los hilos consumidores
+int * esperando_C;              // Array booleano que indica si un hilo consumidor está en pausa o no
+pthread_t * productores;        // Identificadores de los hilos productores
+int * esperando_P;              // Array booleano que indica si un hilo productor está en pausa o no
+
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"capacidad", &capacidad, CONFIG_INT, 1, CONFIG_MAX_CAPACIDAD, "Tamaño del buffer"},
+    {"items", &items_por_p, CONFIG_INT, 1, INT_MAX / MAX_HILOS,
+     "Items de cada productor (con -r, ITEMS_BY_P_RENDIMIENTO)"},
+    {"productores", &num_p, CONFIG_INT, 1, MAX_HILOS, "Número de hilos productores"},
+    {"consumidores", &num_c, CONFIG_INT, 1, MAX_HILOS, "Número de hilos consumidores"},
+    {"tam_elem", &tam_elem, CONFIG_SIZE, 1, CONFIG_MAX_TAM_ELEM, "Tamaño en bytes de cada registro (como -t)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+    {"contadores", &instrumentar, CONFIG_INT, 0, 1, "Con 1, vuelca en JSON los contadores de cada hilo"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
 
 
 int main(int argc, char * argv[]){
     int i;                                  // Variables de iteración
+    int opcion;                             // Opción leída con getopt
+    struct timespec t_ini, t_fin;           // Instantes de comienzo y final de la ejecución de los hilos
+    double segundos;                        // Duración de la ejecución de los hilos
+    void * region;                          // Memoria dinámica reservada para el buffer
+    char variante[64];                      // Variante del CSV del modo rendimiento
+
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: mecanismo de aviso, modo rendimiento y tamaño de los registros
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "m:rt:a:")) != -1){
+        switch (opcion){
+            case 'm':
+                if (!strcmp(optarg, "senales")) modo = MODO_SENALES;
+                else if (!strcmp(optarg, "futex")) modo = MODO_FUTEX;
+                else {
+                    fprintf(stderr, "Error: el mecanismo de aviso debe ser senales o futex\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "items")) items_por_p = ITEMS_BY_P_RENDIMIENTO;
+                break;
+            case 'a':
+                if ((afinidad = afinidad_politica(optarg)) == -1){
+                    fprintf(stderr, "Error: la política de afinidad debe ser ninguna, compacta, dispersa o parejas\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                if ((tam_elem = strtoul(optarg, NULL, 10)) == 0){
+                    fprintf(stderr, "Error: el tamaño de los registros debe ser de al menos 1 byte\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Uso: ./p3_2_v1 [-m senales|futex] [-r] [-t tam_elem] "
+                                "[-a ninguna|compacta|dispersa|parejas] [--parámetro=valor ...]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
 
     srand(time(NULL));      // Fijamos una semilla de generación de valores aleatorios
 
-    // En primer lugar, se reserva memoria para el buffer compartido entre procesos. Tendrá un máximo de N chars.
-    if ((buffer = (char *) malloc(N * sizeof(char))) == NULL){
+    // En primer lugar, se reserva memoria para el buffer compartido entre hilos, de capacidad registros. Si se ha
+    // indicado una política de afinidad, sus páginas se colocan en el nodo NUMA del primer consumidor, que es quien
+    // lee los items
+    if ((region = afinidad_reservar(buffer_tam_region(capacidad, tam_elem), afinidad == AFINIDAD_NINGUNA? -1 :
+                                    afinidad_nodo(afinidad_cpu(afinidad, AFINIDAD_CONSUMIDOR, 0, num_c)))) == NULL){
         fprintf(stderr, "Error: no se pudo reservar memoria para el buffer\n");
         exit(EXIT_FAILURE);
     }
 
     // Inicializamos todo el buffer con el carácter '_', que representa una posición vacía
-    memset(buffer, '_', (size_t) N * sizeof(char));
-    memset(esperando_C, 0, (size_t) C * sizeof(int));
-    memset(esperando_P, 0, (size_t) P * sizeof(int));
+    buffer = buffer_iniciar(region, capacidad, tam_elem, BUFFER_LIFO, '_');
 
-    // Preparamos un gestor para la señal SIGUSR1 (será heredado por los hilos hijo)
-    if (signal(SIGUSR1, handler) == SIG_ERR){
-        perror("Error al crear el gestor de SIGHUP\n");
+    if ((medidas = medidas_crear((long) items_por_p * num_p, capacidad)) == NULL){
+        perror("Error: no se pudo reservar memoria para las medidas");
         exit(EXIT_FAILURE);
     }
 
-    printf("**************************** PROBLEMA DEL PRODUCTOR-CONSUMIDOR ***************************************\n");
-    printf("Preparado buffer de caracteres. Contenido inicial: buffer = [");
-    for (i = 0; i < N - 1; i++)
-        printf("%c ", *(buffer + i));           // Leemos uno a uno los caracteres contenidos en el buffer
-    printf("%c]\n", *(buffer + i));
-    printf("Número de items inicial: cuenta = %d\n\n\n", cuenta);
+    // Con --contadores=1, cada hilo lleva sus contadores, que se vuelcan al acabar o al recibir SIGUSR2
+    if (instrumentar && ((contadores = contadores_crear("p3_2_v1", 2 * MAX_HILOS)) == NULL ||
+                         contadores_senal(contadores) == -1)){
+        perror("Error: no se pudieron preparar los contadores");
+        exit(EXIT_FAILURE);
+    }
 
-    printf("Se empleará el siguiente código de colores:\n");
-    printf("\t%sPRODUCTORES%s\n", VERDE, RESET);
-    printf("\t%sCONSUMIDORES%s\n", AZUL, RESET);
-    printf("\t%sFINALIZACIÓN DE PROCESOS%s\n\n\n", ROJO, RESET);
+    // Arrays por hilo: identificadores, indicadores de pausa y, para el modo MODO_FUTEX, palabras y colas de espera.
+    // calloc los deja a 0 (ningún hilo en pausa ni avisado)
+    consumidores = calloc(num_c, sizeof(pthread_t));
+    productores = calloc(num_p, sizeof(pthread_t));
+    esperando_C = calloc(num_c, sizeof(int));
+    esperando_P = calloc(num_p, sizeof(int));
+    // Las palabras futex de cada hilo se separan en líneas de caché distintas: un aviso a un hilo no debe invalidar
+    // la palabra en la que espera otro
+    espera_C = (struct espera) {cache_reservar(num_c, sizeof(struct cache_palabra)), calloc(num_c, sizeof(int)), num_c,
+                                0, 0};
+    espera_P = (struct espera) {cache_reservar(num_p, sizeof(struct cache_palabra)), calloc(num_p, sizeof(int)), num_p,
+                                0, 0};
+    if (consumidores == NULL || productores == NULL || esperando_C == NULL || esperando_P == NULL ||
+        espera_C.aviso == NULL || espera_C.cola == NULL || espera_P.aviso == NULL || espera_P.cola == NULL){
+        fprintf(stderr, "Error: no se pudo reservar memoria para los hilos\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // Se inicializan los mutexes y las variables de condicion
+    // Bloqueamos SIGUSR1 antes de crear los hilos, que heredan la máscara: la señal queda pendiente hasta que el hilo
+    // al que va dirigida la recoge con sigwait
+    sigemptyset(&senal_aviso);
+    sigaddset(&senal_aviso, SIGUSR1);
+    if ((errno = pthread_sigmask(SIG_BLOCK, &senal_aviso, NULL))){
+        perror("Error al bloquear SIGUSR1");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!rendimiento){
+        printf("**************************** PROBLEMA DEL PRODUCTOR-CONSUMIDOR ***************************************\n");
+        printf("Preparado buffer de registros de %zu B. Contenido inicial: buffer = [", tam_elem);
+        for (i = 0; i < capacidad - 1; i++)
+            // Leemos uno a uno los registros contenidos en el buffer (su primer carácter)
+            printf("%c ", *(char *) buffer_registro(buffer, i));
+        printf("%c]\n", *(char *) buffer_registro(buffer, i));
+        printf("Número de items inicial: cuenta = %d\n\n\n", buffer->cuenta);
+
+        printf("Se empleará el siguiente código de colores:\n");
+        printf("\t%sPRODUCTORES%s\n", VERDE, RESET);
+        printf("\t%sCONSUMIDORES%s\n", AZUL, RESET);
+        printf("\t%sFINALIZACIÓN DE PROCESOS%s\n\n\n", ROJO, RESET);
+    }
+
+    // Se inicializan los mutexes
     inicializar();
 
-    // Creamos C consumidores y P productores. Cada uno de ellos será denotado por el valor de la variable i en el
-    // momento de su creación. Guardamos su identificador en los arrays consumidores[] y productores[]
-    for (i = 0; i < C; i++) crear_hilo(&consumidores[i], consumir, i);
-    for (i = 0; i < P; i++) crear_hilo(&productores[i], producir, i);
+    // Medimos el tiempo que tardan los hilos en transferir todos los items
+    clock_gettime(CLOCK_MONOTONIC, &t_ini);
+
+    // Creamos num_c consumidores y num_p productores. Cada uno de ellos será denotado por el valor de la variable i en
+    // el momento de su creación. Guardamos su identificador en los arrays consumidores[] y productores[]
+    for (i = 0; i < num_c; i++) crear_hilo(&consumidores[i], consumir, i, AFINIDAD_CONSUMIDOR);
+    for (i = 0; i < num_p; i++) crear_hilo(&productores[i], producir, i, AFINIDAD_PRODUCTOR);
 
-    // El hilo principal espera a que finalicen todos los hilos que ha creado antes de continuar
-    for (i = 0; i < C; i++) esperar_hilo(consumidores[i]);
-    for (i = 0; i < P; i++) esperar_hilo(productores[i]);
+    // El hilo principal espera a que finalicen todos los hilos que ha creado antes de continuar. Cuando terminan los
+    // productores, cierra el buffer para que los consumidores, tras retirar los items que queden, terminen también
+    for (i = 0; i < num_p; i++) esperar_hilo(productores[i]);
+    cerrar_buffer();
+    for (i = 0; i < num_c; i++) esperar_hilo(consumidores[i]);
 
-    // Se destruyen los mutexes y las variables de condicion
+    clock_gettime(CLOCK_MONOTONIC, &t_fin);
+
+    // Se destruyen los mutexes
     destruir();
 
-    free(buffer);       // Liberamos también la memoria reservada para el buffer
+    // Liberamos también la memoria reservada para el buffer y los arrays por hilo
+    afinidad_liberar(buffer, buffer_tam_region(capacidad, tam_elem));
+    free(consumidores);
+    free(productores);
+    free(esperando_C);
+    free(esperando_P);
+    free(espera_C.aviso);
+    free(espera_C.cola);
+    free(espera_P.aviso);
+    free(espera_P.cola);
+
+    // En el modo rendimiento se imprime la línea CSV con los items/s, las latencias y los cambios de contexto, y por la
+    // salida de error un comentario con los despertares (en el modo normal, solo estos últimos)
+    segundos = (t_fin.tv_sec - t_ini.tv_sec) + (t_fin.tv_nsec - t_ini.tv_nsec) / 1e9;
+    // La variante del CSV incluye la política de afinidad, si se ha indicado alguna (por ejemplo, futex/compacta)
+    snprintf(variante, sizeof(variante), "%s%s%s", modo == MODO_FUTEX? "futex" : "senales",
+             afinidad == AFINIDAD_NINGUNA? "" : "/", afinidad == AFINIDAD_NINGUNA? "" : afinidad_nombre(afinidad));
+    if (rendimiento){
+        medidas_informe(medidas, "p3_2_v1", variante, 1, tam_elem, (long) items_por_p * num_p, segundos);
+        fprintf(stderr, "# p3_2_v1,%s: %ld avisos, %ld despertares, %ld inutiles\n",
+                modo == MODO_FUTEX? "futex" : "senales", avisos, despertares, despertares_inutiles);
+    }
+    else printf("\nAvisos con %s: %ld avisos, %ld despertares, %ld inútiles\n",
+                modo == MODO_FUTEX? "futex" : "señales", avisos, despertares, despertares_inutiles);
+    medidas_destruir(medidas);
+    if (contadores != NULL){
+        contadores_volcar(contadores, STDERR_FILENO);
+        contadores_destruir(contadores);
+    }
 
-    printf("\n\n\nFinalizando problema del productor-consumidor...\n\n");
+    if (!rendimiento){
+        if (descartados) printf("\nMensajes descartados por la bitácora: %ld\n", descartados);
+        printf("\n\n\nFinalizando problema del productor-consumidor...\n\n");
+    }
     exit(EXIT_SUCCESS);
 }
 
@@ -158,11 +391,15 @@ int main(int argc, char * argv[]){
      char cadena[100];              // Cadena donde se guardará la información que vaya a imprimir el hilo, para poder
                                     // manejarla de la forma más atómica posible
      int tam_cad = sizeof(cadena);       // Tamaño en bytes que ocupa la cadena
+     int avisar;                    // Consumidor a despertar, o -1 si no hay ninguno (modo MODO_FUTEX)
+     int senal;                     // Señal recogida por sigwait (modo MODO_SENALES)
      int i, j;                      // Contadores de iteraciones
+     uint64_t t;                    // Comienzo de la espera o de la región crítica que se está midiendo
+     struct contadores_hilo * cont = contadores_hilo(contadores, "productor", id);   // Contadores del hilo
 
      // Cada productor realiza un número fijo de iteraciones: 20, una por cada item que produzca
 
-     for (i = 0; i < ITEMS_BY_P; i++){
+     for (i = 0; i < items_por_p; i++){
          // Para imprimir, construimos el mensaje y lo almacenamos en cadena. Después, se la pasamos a la función
          // imprimir
          // Como segundo argumento de snprintf pasamos el número máximo de bytes a almacenar, esto es, el tamaño de la
@@ -178,7 +415,7 @@ int main(int argc, char * argv[]){
 
          // Esperamos un núemro de segundos aleatorio de entre 0 y 4 para dar más variedad a las situaciones que
          // se pueden producir (buffer lleno, buffer vacío y situaciones intermedias).
-         sleep(((int) rand()) % SLEEP_MAX_TIME);
+         if (!rendimiento) sleep(((int) rand()) % espera_max);
 
          /*
           * A continuación, el productor se prepara para ejecutar la región crítica. Para ello, solicita acceso
@@ -190,19 +427,23 @@ int main(int argc, char * argv[]){
           * uno y solo uno de los hilos bloqueados por el mutex (a través de pthread_mutex_unlock).
           */
 
-         pthread_mutex_lock(&mutex);
+         // Si se llevan contadores, se mide la espera por el mutex, cada espera mientras el buffer sigue lleno y el
+         // tiempo que se pasa en la región crítica (cada medida empieza donde acaba la anterior)
+         t = contadores_inicio(cont);
+         pthread_mutex_lock(&sinc.mutex);
+         t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
 
          /*
           * Los productores no podrán actuar si el buffer está lleno. En ese caso, se comportan de modo similar a como
           * lo harían si dispusieran de una variable de condición:
-          * 1) Liberan el mutex para permitir que otro proceso pueda entrar en la región crítica, con la esperanza de
-          *     que sea un productor que introduzca un elemento.
-          * 2) Se marcan a sí mismos como "hilos en pausa" activando su posición correspondiente en el array
-          *      esperando_P. Cada hilo escribe únicamente en la posición de su identificador, de modo que no hay
-          *      problemas de variables compartidas.
-          * 3) Se autobloquean con pause()
-          * 4) Cuando un consumidor introduzca un item, despertará al menos a un productor.
-          * 5) Dicho productor indicará en esperando_CPque ya no está en pausa y tratará de acceder al mutex.
+          * 1) Se marcan a sí mismos como "hilos en pausa" activando su posición correspondiente en el array
+          *      esperando_P. Cada hilo escribe únicamente en la posición de su identificador, y lo hace con el mutex
+          *      adquirido, de modo que quien avise después lo encontrará marcado.
+          * 2) Liberan el mutex para permitir que otro proceso pueda entrar en la región crítica, con la esperanza de
+          *     que sea un consumidor que retire un elemento.
+          * 3) Se autobloquean con sigwait hasta recibir SIGUSR1 (si ya llegó, sigwait retorna de inmediato)
+          * 4) Cuando un consumidor retire un item, despertará al menos a un productor.
+          * 5) Dicho productor tratará de acceder al mutex e indicará en esperando_P que ya no está en pausa.
           * 6) Acto seguido, volverá a corroborar si buffer está lleno (por si se hubiera vuelto a completar
           *      tras una interrupción, o la señal recibida por el hilo viniera del sistema y no de un productor).
           */
@@ -210,34 +451,50 @@ int main(int argc, char * argv[]){
              snprintf(cadena, tam_cad,
                      "%s[%d] cede el mutex por estar el buffer lleno%s\n", VERDE, id, RESET);
              imprimir(cadena, 0);
-             pthread_mutex_unlock(&mutex);   // Se libera el mutex
-             esperando_P[id] = 1;            // El productor se marca a sí mismo como pausado
-             pause();                        // Queda en pausa
-             esperando_P[id] = 0;            // Tras despertar y ejecutar el handler, se marca como despierto
-             // Nótese que interrupciones en estos puntos no serían relevantes, pues sencillamente las señales no
-             // tendrían efecto. El hecho de pausar los hilos responde únicamente a cuestiones de eficiencia.
-             pthread_mutex_lock(&mutex);     // El hilo trata de volver a acceder a la región crítica.
+             contadores_lleno(cont);
+             if (modo == MODO_FUTEX) esperar_aviso(&espera_P, id);
+             else {
+                 esperando_P[id] = 1;            // El productor se marca a sí mismo como pausado
+                 pthread_mutex_unlock(&sinc.mutex);   // Se libera el mutex
+                 sigwait(&senal_aviso, &senal);  // Queda en pausa hasta recibir SIGUSR1
+                 pthread_mutex_lock(&sinc.mutex);     // El hilo trata de volver a acceder a la región crítica.
+                 esperando_P[id] = 0;            // Tras despertar y recuperar el mutex, se marca como despierto
+             }
+             t = contadores_tiempo(cont, CONTADORES_ESPERA, t);
+             despertares++;
+             if (esta_buffer_lleno()) despertares_inutiles++;
          }
          /**************************************** REGIÓN CRÍTICA *******************************************/
          insert_item(item, id);      // Se introduce el item en la región crítica y se actualiza cuenta
          /************************************** FIN DE LA REGIÓN CRÍTICA **********************************/
-         for (j = 0; j < C; j++){       // El productor busca un consumidor dormido y si hay alguno, lo despierta
-            if (esperando_C[j]){ pthread_kill(consumidores[j], SIGUSR1); }
-            // Es necesario despertarlos a todos y no solo a uno porque si tuviera lugar una interrupción en un
-            // momento inadecuado, un hilo podría estar despierto pero con su posición en esperando_P a 1. Dado que
-            // una vez despiertos, todos los hilos competirán por el mutex, solo acabará avanzando uno. El resto
-            // seguirán esperando. Por tanto, se cumple la exclusión mutua.
-        }
-        pthread_mutex_unlock(&mutex);           // El productor abandona la región crítica. Libera el mutex para
-        // permitir que otro hilo pueda acceder a ella. Si había uno o varios bloqueados por pthread_mutex_lock, el
-        // sistema operativo escogerá a uno de ellos y le concederá el mutex para que pueda continuar. Si no había
-        // ninguno, el mutex queda libre para que lo use el primero que ejecute pthread_mutex_lock.
+         contadores_tiempo(cont, CONTADORES_SECCION, t);
+         contadores_items(cont, 1);
+         // Con futex, basta con despertar a un único consumidor (el item solo puede retirarlo uno), y se hace después
+         // de liberar el mutex para que no vuelva a bloquearse en él nada más despertar
+         if (modo == MODO_FUTEX){
+             avisar = preparar_aviso(&espera_C);
+             pthread_mutex_unlock(&sinc.mutex);
+             if (avisar >= 0) despertar_futex(&espera_C.aviso[avisar].valor);
+         }
+         else {
+             for (j = 0; j < num_c; j++){       // El productor busca un consumidor dormido y si hay alguno, lo despierta
+                 if (esperando_C[j]){ pthread_kill(consumidores[j], SIGUSR1); avisos++; }
+                 // Es necesario despertarlos a todos y no solo a uno porque si tuviera lugar una interrupción en un
+                 // momento inadecuado, un hilo podría estar despierto pero con su posición en esperando_P a 1. Dado que
+                 // una vez despiertos, todos los hilos competirán por el mutex, solo acabará avanzando uno. El resto
+                 // seguirán esperando. Por tanto, se cumple la exclusión mutua.
+             }
+             pthread_mutex_unlock(&sinc.mutex);      // El productor abandona la región crítica. Libera el mutex para
+             // permitir que otro hilo pueda acceder a ella. Si había uno o varios bloqueados por pthread_mutex_lock, el
+             // sistema operativo escogerá a uno de ellos y le concederá el mutex para que pueda continuar. Si no había
+             // ninguno, el mutex queda libre para que lo use el primero que ejecute pthread_mutex_lock.
+         }
 
 
         // Se imprime una cadena con el identificador del hilo, el número de iteraciones pendientes. No imprimimos
         // el buffer al estar fuera de la región crítica
         snprintf(cadena, tam_cad,
-                "%s[%d] Me quedan %d iteraciones%s\n", VERDE, id, ITEMS_BY_P - i - 1, RESET);
+                "%s[%d] Me quedan %d iteraciones%s\n", VERDE, id, items_por_p - i - 1, RESET);
         imprimir(cadena, 0);
     }
 
@@ -267,18 +524,17 @@ void * consumir(void * ptr_id){
     char cadena[100];              // Cadena donde se guardará la información que vaya a imprimir el hilo, para poder
                                    // manejarla de la forma más atómica posible
     int tam_cad = sizeof(cadena);       // Tamaño en bytes que ocupa la cadena
-    int num_iters;                 // Número de iteraciones que tendrá que ejecutar cada consumidor
+    int avisar;                    // Productor a despertar, o -1 si no hay ninguno (modo MODO_FUTEX)
+    int senal;                     // Señal recogida por sigwait (modo MODO_SENALES)
     int i, j;                      // Contadores de iteraciones
+    uint64_t t;                    // Comienzo de la espera o de la región crítica que se está midiendo
+    struct contadores_hilo * cont = contadores_hilo(contadores, "consumidor", id);   // Contadores del hilo
 
     /*
-     * El número de iteraciones totales (ITEMS_BY_P * P = 20 * P) se divide de forma equitativa entre los consumidores.
-     * No obstante, habría problemas en caso de que C no fuese divisor de ITEMS_BY_P * P. En ese caso, el resto de la
-     * división se asigna como iteraciones extra para el primer consumidor (el de identificador 0). Es decir, a este
-     * le corresponde el cociente y el resto. Los demás llevarán a cabo ITEMS_BY_P * P iteraciones (el cociente).
+     * Los items totales (ITEMS_BY_P * P = 20 * P) no se dividen de antemano entre los consumidores: cada uno retira
+     * items mientras los haya, y termina cuando encuentra el buffer cerrado (ya no quedan productores) y vacío.
      */
-    num_iters = !id? (ITEMS_BY_P * P / C) + (ITEMS_BY_P * P % C) : ITEMS_BY_P * P / C;
-
-    for (i = 0; i < num_iters; i++){
+    for (i = 0; ; i++){
         // Para imprimir, construimos el mensaje y lo almacenamos en cadena. Después, se la pasamos a la función
         // imprimir.
         // Como segundo argumento de snprintf pasamos el número máximo de bytes a almacenar, esto es, el tamaño de la
@@ -296,63 +552,88 @@ void * consumir(void * ptr_id){
          * al productor. Cuando el otro hilo salga de la región crítica, tendrá la responsabilidad de despertar a
          * uno y solo uno de los hilos bloqueados por el mutex (a través de pthread_mutex_unlock).
          */
-        pthread_mutex_lock(&mutex);
+        // Si se llevan contadores, se mide la espera por el mutex, cada espera mientras el buffer sigue vacío y el
+        // tiempo que se pasa en la región crítica (cada medida empieza donde acaba la anterior)
+        t = contadores_inicio(cont);
+        pthread_mutex_lock(&sinc.mutex);
+        t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
 
         /*
          * Los consumidores no podrán actuar si el buffer está vacío. En ese caso, se comportan de modo similar a como
          * lo harían si dispusieran de una variable de condición:
-         * 1) Liberan el mutex para permitir que otro proceso pueda entrar en la región crítica, con la esperanza de
+         * 1) Se marcan a sí mismos como "hilos en pausa" activando su posición correspondiente en el array
+         *      esperando_C. Cada hilo escribe únicamente en la posición de su identificador, y lo hace con el mutex
+         *      adquirido, de modo que quien avise después lo encontrará marcado.
+         * 2) Liberan el mutex para permitir que otro proceso pueda entrar en la región crítica, con la esperanza de
          *     que sea un productor que introduzca un elemento.
-         * 2) Se marcan a sí mismos como "hilos en pausa" activando su posición correspondiente en el array
-         *      esperando_C. Cada hilo escribe únicamente en la posición de su identificador, de modo que no hay
-         *      problemas de variables compartidas.
-         * 3) Se autobloquean con pause()
+         * 3) Se autobloquean con sigwait hasta recibir SIGUSR1 (si ya llegó, sigwait retorna de inmediato)
          * 4) Cuando un productor introduzca un item, despertará al menos a un consumidor.
-         * 5) Dicho consumidor indicará en esperando_C que ya no está en pausa y tratará de acceder al mutex.
+         * 5) Dicho consumidor tratará de acceder al mutex e indicará en esperando_C que ya no está en pausa.
          * 6) Acto seguido, volverá a corroborar si el buffer está vacío (por si se hubiera vuelto a quedar sin
          *      items tras una interrupción, o la señal recibida por el hilo viniera del sistema y no de un productor).
+         * Si el buffer está cerrado no se espera, pues ya no se insertarán más items.
          */
-        while (esta_buffer_vacio()){
+        while (esta_buffer_vacio() && !buffer_cerrado(buffer)){
             snprintf(cadena, tam_cad,
                     "\t\t\t\t\t\t%s[%d] cede el mutex por estar el buffer vacio%s\n", AZUL, id, RESET);
             imprimir(cadena, 0);
-            pthread_mutex_unlock(&mutex);   // Se libera el mutex
-            esperando_C[id] = 1;            // El productor se marca a sí mismo como pausado
-            pause();                        // Queda en pausa
-            esperando_C[id] = 0;            // Tras despertar y ejecutar el handler, se marca como despierto
-            // Nótese que interrupciones en estos puntos no serían relevantes, pues sencillamente las señales no
-            // tendrían efecto. El hecho de pausar los hilos responde únicamente a cuestiones de eficiencia.
-            pthread_mutex_lock(&mutex);     // El hilo trata de volver a acceder a la región crítica.
+            contadores_vacio(cont);
+            if (modo == MODO_FUTEX) esperar_aviso(&espera_C, id);
+            else {
+                esperando_C[id] = 1;            // El consumidor se marca a sí mismo como pausado
+                pthread_mutex_unlock(&sinc.mutex);   // Se libera el mutex
+                sigwait(&senal_aviso, &senal);  // Queda en pausa hasta recibir SIGUSR1
+                pthread_mutex_lock(&sinc.mutex);     // El hilo trata de volver a acceder a la región crítica.
+                esperando_C[id] = 0;            // Tras despertar y recuperar el mutex, se marca como despierto
+            }
+            t = contadores_tiempo(cont, CONTADORES_ESPERA, t);
+            despertares++;
+            if (esta_buffer_vacio() && !buffer_cerrado(buffer)) despertares_inutiles++;
+        }
+        // Si el buffer sigue vacío, es que está cerrado: el consumidor termina
+        if (esta_buffer_vacio()){
+            pthread_mutex_unlock(&sinc.mutex);
+            break;
         }
         /**************************************** REGIÓN CRÍTICA *******************************************/
         item = remove_item(id);      // Se elimina un item del buffer y se actualiza cuenta
         /************************************** FIN DE LA REGIÓN CRÍTICA **********************************/
-        for (j = 0; j < P; j++){        // El consumidor busca a un productor dormido y si hay alguno, lo despierta.
-            if (esperando_P[j]){ pthread_kill(productores[j], SIGUSR1);}
-            // Es necesario despertarlos a todos y no solo a uno porque si tuviera lugar una interrupción en un
-            // momento inadecuado, un hilo podría estar despierto pero con su posición en esperando_P a 1. Dado que
-            // una vez despiertos, todos los hilos competirán por el mutex, solo acabará avanzando uno. El resto
-            // seguirán esperando. Por tanto, se cumple la exclusión mutua.
+        contadores_tiempo(cont, CONTADORES_SECCION, t);
+        contadores_items(cont, 1);
+        // Con futex, basta con despertar a un único productor (el hueco solo puede ocuparlo uno)
+        if (modo == MODO_FUTEX){
+            avisar = preparar_aviso(&espera_P);
+            pthread_mutex_unlock(&sinc.mutex);
+            if (avisar >= 0) despertar_futex(&espera_P.aviso[avisar].valor);
+        }
+        else {
+            for (j = 0; j < num_p; j++){        // El consumidor busca a un productor dormido y si hay alguno, lo despierta.
+                if (esperando_P[j]){ pthread_kill(productores[j], SIGUSR1); avisos++; }
+                // Es necesario despertarlos a todos y no solo a uno porque si tuviera lugar una interrupción en un
+                // momento inadecuado, un hilo podría estar despierto pero con su posición en esperando_P a 1. Dado que
+                // una vez despiertos, todos los hilos competirán por el mutex, solo acabará avanzando uno. El resto
+                // seguirán esperando. Por tanto, se cumple la exclusión mutua.
+            }
+            pthread_mutex_unlock(&sinc.mutex);       // El consumidor abandona la región crítica
         }
-        pthread_mutex_unlock(&mutex);       // El consumidor abandona la región crítica
 
         // Esperamos un núemro de segundos aleatorio de entre 0 y 4 para dar más variedad a las situaciones que
         // se pueden producir (buffer lleno, buffer vacío y situaciones intermedias).
-        sleep(((int) rand()) % SLEEP_MAX_TIME);
+        if (!rendimiento) sleep(((int) rand()) % espera_max);
 
         // Mostramos por pantalla el item consumido, junto al identificador del consumidor que lo ha eliminado
         consume_item(item, id);
 
-        // Imprimimos un mensaje indicando el número de iteraciones que le quedan por ejecutar a este hilo, así como
-        // su identificador. No imprimimos el buffer al estar fuera de la región crítica
+        // Imprimimos un mensaje indicando el número de items que lleva retirados este hilo, así como su
+        // identificador. No imprimimos el buffer al estar fuera de la región crítica
         snprintf(cadena, tam_cad,
-                "\t\t\t\t\t\t%s[%d] Me quedan %d iteraciones%s\n", AZUL, id, num_iters - i - 1, RESET);
+                "\t\t\t\t\t\t%s[%d] Llevo %d items retirados%s\n", AZUL, id, i + 1, RESET);
         imprimir(cadena, 0);
     }
 
-    // Se imprime un mensaje de finalización en rojo
+    // Se imprime un mensaje de finalización en rojo, con los items que ha retirado este consumidor
     snprintf(cadena, tam_cad,
-            "\n\t\t\t\t\t\t%s[%d] Finalizando consumidor...%s\n", ROJO, id, RESET);
+            "\n\t\t\t\t\t\t%s[%d] Finalizando consumidor (%d items)...%s\n", ROJO, id, i, RESET);
     imprimir(cadena, 0);            // En este caso, pasamos un 0 para no mostrar el buffer
 
     // En el ejercicio 2 empleábamos la función exit() para cerrar la ejecución. Ahora, dado que empleamos hilos,
@@ -361,18 +642,108 @@ void * consumir(void * ptr_id){
 }
 
 
+/*
+ * Función que ejecuta el hilo principal cuando han terminado todos los productores: cierra el buffer y despierta a
+ * todos los consumidores que esperan por él, que retirarán los items que queden y terminarán al encontrarlo cerrado
+ * y vacío. Como ya no quedan productores, nadie espera por un hueco.
+ * Tanto en la cola del modo MODO_FUTEX como en esperando_C, los consumidores se anotan con el mutex adquirido, así que
+ * basta con avisar una vez a todos los anotados: los que aún no lo estén encontrarán el buffer cerrado al comprobarlo.
+ */
+void cerrar_buffer(){
+    int avisar;         // Consumidor a despertar, o -1 si no queda ninguno en la cola (modo MODO_FUTEX)
+    int j;              // Variable de iteración
+
+    pthread_mutex_lock(&sinc.mutex);
+    buffer_cerrar(buffer);
+    if (modo == MODO_FUTEX)
+        while ((avisar = preparar_aviso(&espera_C)) >= 0) despertar_futex(&espera_C.aviso[avisar].valor);
+    else
+        for (j = 0; j < num_c; j++)
+            if (esperando_C[j]){ pthread_kill(consumidores[j], SIGUSR1); avisos++; }
+    pthread_mutex_unlock(&sinc.mutex);
+}
+
+
+/*
+ * Función que sustituye a la pareja sigwait + pthread_kill en el modo MODO_FUTEX. Se llama con el mutex adquirido y
+ * el buffer lleno (productores) o vacío (consumidores).
+ * El hilo pone a 0 su palabra futex y se añade al final de la cola antes de liberar el mutex. Cualquier hilo que
+ * cambie después el estado del buffer lo hará con el mutex adquirido, así que lo encontrará en la cola: si le toca, le
+ * pone la palabra a 1 y, si ya estaba dormido, FUTEX_WAKE lo despierta; si aún no había llegado a dormir, FUTEX_WAIT
+ * retorna de inmediato al no valer ya 0. Como con sigwait, ningún aviso puede perderse.
+ * Al volver, el hilo tiene otra vez el mutex y debe comprobar de nuevo el estado del buffer.
+ * @param espera: Cola de la condición (espera_P para productores y espera_C para consumidores).
+ * @param id: Identificador del hilo.
+ */
+void esperar_aviso(struct espera * espera, int id){
+    atomic_store(&espera->aviso[id].valor, 0);
+    espera->cola[(espera->inicio + espera->n++) % espera->tam] = id;
+    pthread_mutex_unlock(&sinc.mutex);
+
+    // Un FUTEX_WAKE destinado a una espera anterior puede llegar tarde: se vuelve a dormir mientras no haya aviso
+    while (!atomic_load(&espera->aviso[id].valor)) esperar_futex(&espera->aviso[id].valor, 0);
+
+    pthread_mutex_lock(&sinc.mutex);
+}
+
+/*
+ * Función que, con el mutex adquirido, saca de la cola al hilo que lleva más tiempo esperando y marca su aviso. El
+ * hilo que la llama debe despertarlo después con despertar_futex sobre su palabra (preferiblemente tras liberar el
+ * mutex, para que no vuelva a bloquearse en él nada más despertar).
+ * @param espera: Cola de la condición.
+ * @return: Identificador del hilo a despertar, o -1 si no hay nadie esperando.
+ */
+int preparar_aviso(struct espera * espera){
+    int id;             // Hilo a despertar
+
+    if (!espera->n) return -1;
+    id = espera->cola[espera->inicio];
+    espera->inicio = (espera->inicio + 1) % espera->tam;
+    espera->n--;
+    atomic_store(&espera->aviso[id].valor, 1);
+    avisos++;
+    return id;
+}
+
+/*
+ * Función que bloquea al hilo en una palabra futex mientras esta conserve el valor indicado. Si la palabra ya ha
+ * cambiado, el kernel retorna inmediatamente (EAGAIN). Como la palabra solo la usan hilos del mismo proceso, se usa la
+ * variante privada.
+ * @param palabra: Dirección de la palabra futex.
+ * @param valor: Valor esperado de la palabra.
+ */
+void esperar_futex(_Atomic uint32_t * palabra, uint32_t valor){
+    if (syscall(SYS_futex, (uint32_t *) palabra, FUTEX_WAIT_PRIVATE, valor, NULL, NULL, 0) == -1
+            && errno != EAGAIN && errno != EINTR){
+        perror("Error en la espera sobre un futex");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Función que despierta a (como mucho) un hilo bloqueado en una palabra futex.
+ * @param palabra: Dirección de la palabra futex.
+ */
+void despertar_futex(_Atomic uint32_t * palabra){
+    if (syscall(SYS_futex, (uint32_t *) palabra, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0) == -1){
+        perror("Error al despertar a un hilo bloqueado en un futex");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
 // Función que verifica si el buffer ha llegado a su máximo de capacidad
 // El propósito de definir esta función es, principalmente, ayudar a la legibilidad del código
 // Devuelve 1 si es así y 0 en caso contrario.
 int esta_buffer_lleno(){
-    return cuenta == N;
+    return buffer_lleno(buffer);
 }
 
 // Función que verfica si el buffer tiene algún elemento
 // El propósito de definir esta función es, principalmente, ayudar a la legibilidad del código
 // Devuelve 1 si está vacío, y 0 si hay elementos en él
 int esta_buffer_vacio(){
-    return !cuenta;
+    return buffer_vacio(buffer);
 }
 
 
@@ -394,8 +765,8 @@ char produce_item(int id){
 
 /*
  * Función que coloca una letra en el buffer. Se insertará en la posición superior, puesto que se trata de una pila
- * LIFO.
- * Dicha posición vendrá dada por la variable compartida cuenta.
+ * LIFO. El registro (tam_elem bytes con el valor de la letra) se escribe directamente en su hueco.
+ * Dicha posición vendrá dada por el número de registros presentes en el buffer (buffer->cuenta).
  * Esta función es empleada por los productores y forma parte de la región crítica.
  * No se comprueba que el buffer no esté lleno; este es un prerrequisito a corroborar de forma externa.
  * @param letra: Carácter a colocar en el buffer.
@@ -403,39 +774,51 @@ char produce_item(int id){
  */
 void insert_item(char letra, int id){
     char cadena[100];                // Línea a imprimir en el log.
+    void * hueco;                    // Primera posición libre del buffer
 
-    buffer[cuenta] = letra;         // Se almacena el nuevo elemento en la primera posición libre del buffer.
+    // Se almacena el nuevo elemento en la primera posición libre del buffer, y se sella el instante en que se guarda
+    hueco = buffer_hueco_insertar(buffer, 0);
+    registro_rellenar(hueco, tam_elem, letra);
+    medidas_sellar(medidas, buffer_posicion(buffer, hueco));
 
     // Incrementamos el valor de cuenta para reflejar el nuevo elemento
-    cuenta++;
+    buffer_confirmar_insercion(buffer, 1);
 
     // Preparamos la línea con snprintf y luego la imprimimos de forma atómica llamando a imprimir
     snprintf(cadena, sizeof(cadena),
              "%s[%d] Guardado item %c en %d -> cuenta = %d%s  \t\t\t\t\t\t\t\t\t",
-             VERDE, id, letra, cuenta - 1, cuenta, RESET);
+             VERDE, id, letra, buffer->cuenta - 1, buffer->cuenta, RESET);
     imprimir(cadena, PROD);         // Con el 2º argumento mostramos el buffer en verde
 
 }
 
 /*
  * Función que retira una letra del buffer. Como se implementa como una cola LIFO, se borra de la posición superior.
- * Dicha letra es devuelta por la función y reemplazada por un guion bajo '_'.
+ * Antes se comprueba que el registro esté completo. Su letra es devuelta por la función y reemplazada por un guion
+ * bajo '_'.
  * Esta función es empleada por los consumidores y forma parte de la región crítica.
  * @param id: identificador del hilo (solo usado a efectos de impresión)
  */
 char remove_item(int id){
-    char item;                   // Letra que contenía el buffer en la posición inicio.
+    char * registro;             // Registro situado en la parte superior de la pila
+    char item;                   // Letra que contenía el buffer en esa posición
     char cadena[100];            // Línea que se imprimirá
 
     // Como cuenta indica el número de posiciones ocupadas, el último elemento estará en cuenta - 1
-    item = buffer[cuenta - 1];          // Guardamos el item
-    buffer[cuenta - 1] = '_';           // Borramos la posición
-    cuenta--;                           // Decrementamos el número de items presentes en el buffer
+    registro = buffer_hueco_extraer(buffer, 0);
+    medidas_latencia(medidas, buffer_posicion(buffer, registro));
+    if (!registro_comprobar(registro, tam_elem)){
+        fprintf(stderr, "Error: se ha consumido un registro corrupto\n");
+        exit(EXIT_FAILURE);
+    }
+    item = *registro;                   // Guardamos el item
+    *registro = '_';                    // Borramos la posición
+    buffer_confirmar_extraccion(buffer, 1);     // Decrementamos el número de items presentes en el buffer
 
     // Indicamos que se ha retirado un elemento (lo imprimimos desde la región crítica para que quede constancia
     // inmediata)
     snprintf(cadena, sizeof(cadena),
-             "\t\t\t\t\t\t%s[%d] Retirado item %c, cuenta = %d    %s\t\t\t\t", AZUL, id, item, cuenta, RESET);
+             "\t\t\t\t\t\t%s[%d] Retirado item %c, cuenta = %d    %s\t\t\t\t", AZUL, id, item, buffer->cuenta, RESET);
     imprimir(cadena, CONS);             // Con el 2º argumento mostramos el buffer en azul
 
     return item;                        // Devolvemos el elemento leído
@@ -462,45 +845,51 @@ void consume_item(char item, int id){
 
 
 /*
- * Función que imprime los contenidos del buffer en una línea. Es empleada por los productores, que imprimen en verde,
- * y por los consumidores, que imprimen en azul. Toda la cadena aparece en cursiva.
- * @param hilo: Valdrá PROD (1) si se trata de un hilo productor, y CONS (2) si es un consumidor.
+ * Función que da formato a la instantánea del buffer guardada en un registro de la bitácora, en una línea. La ejecuta
+ * el hilo escritor de la bitácora al volcar los mensajes de los productores, que imprimen en verde, y de los
+ * consumidores, que imprimen en azul. Toda la cadena aparece en cursiva.
+ * @param registro: Registro de la bitácora. Su tipo valdrá PROD (1) si lo escribió un hilo productor, y CONS (2) si
+ *                  fue un consumidor. Sus datos contienen el primer carácter de cada registro del buffer.
+ * @param destino: Cadena donde se escribe la línea.
+ * @param tam: Tamaño máximo de la línea.
+ * @return: Número de caracteres escritos.
  */
-void log_buffer(int hilo){
+size_t log_buffer(const struct bitacora_registro * registro, char * destino, size_t tam){
+    size_t n;       // Caracteres escritos
     int i;          // Variable de iteración
 
-    // Dependiendo del argumento hilo, se imprime en verde o en azul. Siempre se activa la cursiva.
-    printf("%s%sbuffer = [", hilo == PROD? VERDE : AZUL, CURSIVA);
-    for (i = 0; i < N - 1; i++)
-        printf("%c ", *(buffer + i));           // Leemos uno a uno los caracteres contenidos en el buffer
-    printf("%c]%s%s\n", *(buffer + i), RESET, RESET_CURS);
-    // No utilizamos \n hasta el final para tratar de que el buffer se imprima de forma atómica
+    // Dependiendo del tipo del registro, se imprime en verde o en azul. Siempre se activa la cursiva.
+    n = snprintf(destino, tam, "%s%sbuffer = [", registro->tipo == PROD? VERDE : AZUL, CURSIVA);
+    for (i = 0; i < registro->tam_datos && n < tam; i++)
+        n += snprintf(destino + n, tam - n, i < registro->tam_datos - 1? "%c " : "%c", registro->datos[i]);
+    if (n < tam) n += snprintf(destino + n, tam - n, "]%s%s\n", RESET, RESET_CURS);
+    return n < tam? n : tam - 1;
 }
 
 /*
- * Función de impresión que busca asegurar que esta tenga lugar de forma atómica entre hilos. Para ello,
- * no se permite que varios hilos empleen esta función a la vez (para lo cual se utiliza un mutex, mutex_impr) y
- * se añade una pequeña espera antes de terminarla, para tratar de que el hilo complete su uso de la consola.
+ * Función de impresión que no bloquea nunca al hilo que la llama. En lugar de escribir en la consola, deja el mensaje
+ * en el anillo propio del hilo dentro de la bitácora (módulo comun/bitacora), y el hilo escritor de esta se encarga
+ * de volcarlo junto a los de los demás hilos, ordenados según el instante en que se escribieron. Si la consola no da
+ * abasto, el mensaje se descarta y se contabiliza.
  * La impresión corresponde a una sola línea y consta de un mensaje seguido opcionalmente del contenido del buffer.
+ * Como el buffer puede cambiar antes de que se vuelque el mensaje, se guarda una instantánea de su contenido (el
+ * primer carácter de cada registro) en el momento de la llamada, que se realiza desde la región crítica. La bitácora
+ * guarda como mucho BITACORA_TAM_DATOS bytes, así que de un buffer mayor solo se muestran los primeros registros.
  * @param cadena: Mensaje inicial a imprimir antes del buffer.
  * @param ver_buffer: 0 para no incluir el buffer en la línea, !0 para añadirlo (1 para imprimir como productor y 2
  *                    para imprimir como consumidor).
  */
 void imprimir(char * cadena, int ver_buffer){
-    // Adquirimos el mutex de impresión. Así, definimos el empleo de la consola como una región crítica (al fin y al
-    // cabo, se está empleando un recurso compartido). Únicamente un hilo podrá utilizarla de forma simultánea.
-    pthread_mutex_lock(&mutex_impr);
-    printf("%s", cadena);
-    // Si se ha solicitado, se imprime el buffer en la misma línea
-    // Pasamos ver_buffer a log_buffer para que se tenga en cuenta si se trata del productor (1) o del consumidor (2)
-    if (ver_buffer) log_buffer(ver_buffer);
-
-    usleep(150);     // Dormimos al hilo algunos microsegundos para tratar de que dé tiempo a imprimir y las
-                     // llamadas a printf procedentes de distintos hilos no se mezclen por consola
-
-    // Se libera el mutex de impresión, permitiendo que un (y solamente un) hilo que estuviera esperando para imprimir
-    // pueda salir de pthread_mutex_lock y ejecutar los printf.
-    pthread_mutex_unlock(&mutex_impr);
+    char instantanea[BITACORA_TAM_DATOS];   // Primer carácter de cada registro del buffer
+    int n = capacidad < BITACORA_TAM_DATOS? capacidad : BITACORA_TAM_DATOS;     // Registros de la instantánea
+    int i;                                  // Variable de iteración
+
+    // En el modo rendimiento no se imprime nada
+    if (rendimiento) return;
+
+    if (ver_buffer)
+        for (i = 0; i < n; i++) instantanea[i] = *(char *) buffer_registro(buffer, i);
+    bitacora_escribir(bitacora, cadena, ver_buffer, ver_buffer? instantanea : NULL, n);
 }
 
 // Función auxiliar que inicializa los mutexes
@@ -508,12 +897,15 @@ void inicializar(){
     // Antes de poder emplear los mutexes en las funciones pthread_mutex_lock, pthread_mutex_unlock, etc., deben ser
     // inicializados. Para ello, utilizamos la función pthread_mutex_init
     // Dejamos el segundo argumento a NULL para emplear la configuración de atributos por defecto.
-    if (pthread_mutex_init(&mutex, NULL)){
+    if (pthread_mutex_init(&sinc.mutex, NULL)){
         fprintf(stderr, "Error en la inicializacion del mutex de la region critica\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_init(&mutex_impr, NULL)){
-        fprintf(stderr, "Error en la inicializacion del mutex de impresion\n");
+    // Los mensajes de los hilos se imprimen a través de la bitácora, que vuelca en la salida estándar lo que ya haya
+    // escrito printf (de ahí el fflush). En el modo rendimiento no se imprime nada, así que no es necesaria
+    fflush(stdout);
+    if (!rendimiento && (bitacora = bitacora_crear(STDOUT_FILENO, log_buffer)) == NULL){
+        fprintf(stderr, "Error en la creacion de la bitacora\n");
         exit(EXIT_FAILURE);
     }
 }
@@ -523,13 +915,15 @@ void destruir(){
     // Una vez ha finalizado el uso de los mutexes, se pueden destruir con seguridad.
     // Tenemos la seguridad de que todos los mutexes están desbloqueados, pues todos los hilos han finalizado
     // correctamente (en caso contrario, pthread_mutex_destroy podría dar error)
-    if (pthread_mutex_destroy(&mutex)){
+    if (pthread_mutex_destroy(&sinc.mutex)){
         fprintf(stderr, "Error en la destruccion del mutex de la region critica\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_destroy(&mutex_impr)){
-        fprintf(stderr, "Error en la destruccion del mutex de impresion\n");
-        exit(EXIT_FAILURE);
+    // La bitácora vuelca los mensajes pendientes antes de cerrarse
+    if (bitacora != NULL){
+        descartados = bitacora_descartados(bitacora);
+        bitacora_cerrar(bitacora);
+        bitacora = NULL;
     }
 }
 
@@ -539,17 +933,27 @@ void destruir(){
  * @param hilo: puntero al pthread_t donde se guardará el identificador del hilo creado
  * @param funcion: funcion que ejecutará el hilo nada más crearse
  * @param arg: argumento que se le pasará a la función del hilo craedo
+ * @param rol: AFINIDAD_CONSUMIDOR o AFINIDAD_PRODUCTOR, para elegir su CPU según la política de afinidad
  */
-void crear_hilo(pthread_t * hilo, void * funcion, int arg){
+void crear_hilo(pthread_t * hilo, void * funcion, int arg, int rol){
+    pthread_attr_t atributos;   // Atributos de creación del hilo
     int error;          // Comprobación de errores
 
+    // Los atributos por defecto solo se modifican para fijar la CPU del hilo, si se ha indicado una política de
+    // afinidad con la opción -a (con la política ninguna, afinidad_cpu devuelve -1 y no se cambian)
+    if ((error = pthread_attr_init(&atributos)) != 0 ||
+        (error = afinidad_atributos(&atributos, afinidad_cpu(afinidad, rol, arg, num_c))) != 0){
+        fprintf(stderr, "Error %s al preparar los atributos de un hilo\n", strerror(error));
+        exit(EXIT_FAILURE);
+    }
+
     // El argumento debe enviarse como un puntero a void, y no como un entero. Para realizar una conversión segura,
     // pasamos primero el dato a intptr_t y después a un puntero a void.
-    // Pasamos NULL como segundo argumento para no modificar los atributos por defecto del hilo
-    if ((error = pthread_create(hilo, NULL, funcion, (void *) (intptr_t) arg)) != 0){
+    if ((error = pthread_create(hilo, &atributos, funcion, (void *) (intptr_t) arg)) != 0){
         fprintf(stderr, "Error en la creación de un hilo\n");
         exit(EXIT_FAILURE);
     }
+    pthread_attr_destroy(&atributos);
 }
 
 /*
@@ -1,11 +1,30 @@
 #define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/futex.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "../comun/buffer.h"
+#include "../comun/medidas.h"
+#include "../comun/bitacora.h"
+#include "../comun/config.h"
+#include "../comun/afinidad.h"
+#include "../comun/cache.h"
+#include "../comun/contadores.h"
 
 /*
  * Xiana Carrera Alonso
@@ -14,20 +33,68 @@
  *
  * Este programa implementa el problema del productor-consumidor resuelto utilizando mutexes, pero sin emplear
  * variables de condicion. Se basa en la emulación del comportamiento de una variable de control y en el uso de
- * pthread_yield.
+ * sched_yield.
  * Los cambios se encuentran, principalmente, en las funciones producir() y consumir().
+ * El buffer es un buffer de registros (módulo comun/buffer): cada item se escribe y se lee directamente en su hueco.
+ *
+ * La espera fuera del mutex mientras el buffer siga lleno o vacío sigue una política configurable. La original cede
+ * la CPU con sched_yield en cada comprobación, lo que mantiene ocupado un núcleo por hilo en espera. La adaptativa
+ * primero gira comprobando la condición con instrucciones de pausa y retroceso exponencial, después cede la CPU unas
+ * pocas veces y, por último, duerme en un futex hasta que otro hilo cambie el estado del buffer. El número de giros
+ * de cada hilo se adapta a la duración de sus esperas recientes: crece hasta el doble de lo que suelen durar cuando
+ * se resuelven girando y se reduce cuando acaban cediendo la CPU o durmiendo.
+ *
+ * Los consumidores no se reparten de antemano los items: cuando terminan todos los productores, el hilo principal
+ * cierra el buffer y despierta a todos los consumidores dormidos en el futex, y cada uno retira items hasta
+ * encontrarlo cerrado y vacío (mientras no lo esté, espera con la política elegida).
+ *
+ * Uso: ./p3_2_v2 [-e yield|adaptativa] [-r] [-t tam_elem] [-a politica]
+ *  -e: política de espera (sched_yield, por defecto, o adaptativa).
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, cada productor genera ITEMS_BY_P_RENDIMIENTO items
+ *      y al final se imprime una línea CSV (módulo comun/medidas) con los items/s, los percentiles de latencia de
+ *      traspaso y los cambios de contexto.
+ *  -t: tamaño en bytes de cada registro del buffer (1 por defecto).
+ *  -a: política de colocación de los hilos en las CPUs (módulo comun/afinidad): ninguna (por defecto), compacta,
+ *      dispersa o parejas. Con cualquiera de las tres últimas, el buffer se reserva en el nodo NUMA de los
+ *      consumidores y, en el modo rendimiento, la política se añade a la variante del CSV.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra): --capacidad (tamaño del buffer, N por defecto), --items
+ * (items de cada productor), --productores y --consumidores (P y C por defecto), --tam_elem (como -t), --espera_max
+ * (las esperas duran de 0 a espera_max - 1 segundos) y --contadores (con 1, se vuelcan en JSON por la salida de
+ * errores, al acabar y al recibir SIGUSR2, los contadores de cada hilo del módulo comun/contadores: esperas por el
+ * mutex, esperas mientras el buffer sigue lleno o vacío (giros, cesiones con sched_yield y aparcamiento en el
+ * futex), tiempo en la región crítica, veces que encontraron el buffer lleno o vacío e items procesados). También se
+ * leen de las variables SOII_NOMBRE.
  * Debe compilarse con la opción -pthread.
  */
 
-#define P 5          // Número de productores
-#define C 4          // Número de consumidores
+#define P 5          // Número de productores por defecto
+#define C 4          // Número de consumidores por defecto
+#define MAX_HILOS 1024     // Número máximo de productores y de consumidores
 
 #define PROD 1       // Código de los productores
 #define CONS 2       // Código de los consumidores
 
-#define N 10                       // Tamaño del buffer
+#define N 10                       // Tamaño por defecto del buffer
 #define ITEMS_BY_P 20              // Items producidos por cada productor
-#define SLEEP_MAX_TIME 4           // Máximo tiempo de bloqueo por un sleep
+#define ITEMS_BY_P_RENDIMIENTO 20000    // Items producidos por cada productor en el modo rendimiento
+#define SLEEP_MAX_TIME 4           // Máximo tiempo de bloqueo por un sleep (por defecto)
+
+#define ESPERA_YIELD 0             // Política de espera que cede la CPU con sched_yield en cada comprobación
+#define ESPERA_ADAPTATIVA 1        // Política de espera que gira, cede la CPU y, por último, duerme en un futex
+
+#define GIROS_INICIAL 1024         // Límite de giros con el que empieza cada hilo (política adaptativa)
+#define GIROS_MIN 16               // Límite mínimo de giros
+#define GIROS_MAX 65536            // Límite máximo de giros
+#define MAX_PAUSAS 64              // Máximo de pausas entre dos comprobaciones de la condición (retroceso exponencial)
+#define CESIONES 4                 // Veces que se cede la CPU antes de dormir en el futex
+
+// Instrucción que indica al procesador que el hilo está girando (libera recursos para el otro hilo del núcleo)
+#if defined(__x86_64__) || defined(__i386__)
+#define PAUSA_CPU() _mm_pause()
+#else
+#define PAUSA_CPU() atomic_signal_fence(memory_order_seq_cst)
+#endif
 
 #define VERDE "\033[32m"           // Color en el que imprimirán los productores
 #define AZUL "\033[34m"            // Color en el que imprimirán los consumidores
@@ -37,10 +104,22 @@
 #define RESET_CURS "\033[23m"      // Reseteado de cursiva
 
 
-// Función de impresión del buffer con un código de colores para productores (verde) y consumidores (azul)
-void log_buffer(int hilo);
+/*
+ * Punto de espera de la política adaptativa para una condición (buffer lleno o buffer vacío). Los hilos que agotan
+ * el giro y las cesiones de la CPU duermen en la palabra futex aviso, y quien cambia el estado del buffer despierta a
+ * uno de ellos si aparcados es mayor que 0.
+ */
+struct aparcamiento {
+    CACHE_ALINEADO _Atomic uint32_t aviso;  // Palabra futex en la que duermen los hilos (cada aparcamiento en su línea)
+    atomic_int aparcados;           // Número de hilos que están (o van a estar) dormidos en aviso
+};
+
+
+// Función de formato de una instantánea del buffer con un código de colores para productores (verde) y consumidores
+// (azul). La utiliza el hilo escritor de la bitácora
+size_t log_buffer(const struct bitacora_registro * registro, char * destino, size_t tam);
 // Función de impresión de un mensaje junto (opcionalmente) al contenido del buffer en una línea
-// Su propósito es permitir imprimir de forma casi atómica y sin interferencias entre hilos
+// Deja el mensaje en la bitácora, de forma que el hilo nunca espera por la consola
 void imprimir(char * cadena, int ver_buffer);
 
 // Función auxiliar que inicializa los mutexes y variables de condicion
@@ -52,6 +131,8 @@ void destruir();
 int esta_buffer_lleno();
 // Función que comprueba si el buffer tiene 0 elementos
 int esta_buffer_vacio();
+// Función que comprueba si un consumidor debe esperar (buffer vacío y aún no cerrado)
+int esperando_items();
 
 // Función de generación de un item (productores)
 char produce_item(int id);
@@ -62,71 +143,221 @@ char remove_item(int id);
 // Función de impresión de un item eliminado (consumidores)
 void consume_item(char item, int id);
 
+// Función que espera, según la política elegida, mientras se cumpla una condición sobre el buffer
+void esperar_mientras(int (* condicion)(), struct aparcamiento * aparcamiento, int * limite);
+// Función que ajusta el límite de giros de un hilo según cómo se resolvió su última espera
+void ajustar_limite(int * limite, int giros, int resuelta_girando);
+// Función que despierta a un hilo dormido en un punto de espera, si lo hay
+void avisar_aparcados(struct aparcamiento * aparcamiento);
+// Función de espera sobre una palabra futex
+void esperar_futex(_Atomic uint32_t * palabra, uint32_t valor);
+// Función que despierta a n hilos bloqueados en una palabra futex
+void despertar_futex(_Atomic uint32_t * palabra, int n);
+
 // Función de ejecución de los hilos productores
 void * producir(void * ptr_id);
 // Función de ejecución de los hilos consumidores
 void * consumir(void * ptr_id);
+// Función que cierra el buffer y despierta a todos los consumidores que esperan por él
+void cerrar_buffer();
 
 
-// Función que encapsula la creación de un hilo, que ejecutará una funcion con un argumento entero
-void crear_hilo(pthread_t * hilo, void * funcion, int arg);
+// Función que encapsula la creación de un hilo, que ejecutará una funcion con un argumento entero, colocándolo en
+// una CPU según su rol (productor o consumidor) y la política de afinidad
+void crear_hilo(pthread_t * hilo, void * funcion, int arg, int rol);
 // Función que ejecuta pthread_join sobre un hilo y comprueba que finalice correctamente
 void esperar_hilo(pthread_t hilo);
 
 
-pthread_mutex_t mutex;             // Mutex de acceso a la región crítica
-pthread_mutex_t mutex_impr;        // Mutex de impresión por consola
-
-char * buffer = NULL;       // Buffer de caracteres compartido por productor y consumidor
-int cuenta = 0;             // Número de elementos guardados en el buffer
+// Mutexes de todos los hilos, cada uno en su propia línea de caché (módulo comun/cache): los consumidores esperan
+// sobre todo en mutex_vacio y los productores en mutex_lleno, y ninguno debe invalidar los demás ni los datos de
+// solo lectura que los rodean
+struct {
+    CACHE_ALINEADO pthread_mutex_t mutex;           // Mutex de acceso a la región crítica
+    CACHE_ALINEADO pthread_mutex_t mutex_vacio;     // Mutex propio de esta implementación (buffer vacío)
+    CACHE_ALINEADO pthread_mutex_t mutex_lleno;     // Mutex propio de esta implementación (buffer lleno)
+} sinc;
+
+struct bitacora * bitacora = NULL; // Bitácora asíncrona por la que se imprimen los mensajes de los hilos
+long descartados = 0;              // Mensajes que la bitácora no pudo imprimir por no dar abasto la consola
+
+int politica = ESPERA_YIELD;        // Política de espera mientras el buffer siga lleno o vacío
+struct aparcamiento aparcamiento_P; // Productores dormidos por estar el buffer lleno (política adaptativa)
+struct aparcamiento aparcamiento_C; // Consumidores dormidos por estar el buffer vacío (política adaptativa)
+CACHE_ALINEADO atomic_long esperas_giro;   // Esperas resueltas girando (los contadores, lejos de los mutexes)
+atomic_long esperas_cesion;         // Esperas resueltas cediendo la CPU
+atomic_long esperas_futex;          // Esperas en las que el hilo llegó a dormir en el futex
+
+struct buffer * buffer = NULL;      // Buffer de registros compartido por productor y consumidor (pila LIFO)
+size_t tam_elem = sizeof(char);     // Tamaño en bytes de cada registro del buffer
+
+int rendimiento = 0;                // !0 para ejecutar sin esperas ni mensajes y medir items/s
+int items_por_p = ITEMS_BY_P;       // Items producidos por cada productor
+struct medidas * medidas = NULL;    // Latencias de traspaso (un sello por hueco del buffer)
+
+int num_p = P;                      // Número de hilos productores
+int num_c = C;                      // Número de hilos consumidores
+int capacidad = N;                  // Tamaño del buffer
+int espera_max = SLEEP_MAX_TIME;    // Límite (exclusivo) en segundos de las esperas aleatorias
+int afinidad = AFINIDAD_NINGUNA;    // Política de colocación de los hilos en las CPUs
+int instrumentar = 0;               // !0 para llevar y volcar los contadores de cada hilo
+struct contadores * contadores = NULL;  // Contadores de instrumentación (NULL si no se llevan)
+
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"capacidad", &capacidad, CONFIG_INT, 1, CONFIG_MAX_CAPACIDAD, "Tamaño del buffer"},
+    {"items", &items_por_p, CONFIG_INT, 1, INT_MAX / MAX_HILOS,
+     "Items de cada productor (con -r, ITEMS_BY_P_RENDIMIENTO)"},
+    {"productores", &num_p, CONFIG_INT, 1, MAX_HILOS, "Número de hilos productores"},
+    {"consumidores", &num_c, CONFIG_INT, 1, MAX_HILOS, "Número de hilos consumidores"},
+    {"tam_elem", &tam_elem, CONFIG_SIZE, 1, CONFIG_MAX_TAM_ELEM, "Tamaño en bytes de cada registro (como -t)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+    {"contadores", &instrumentar, CONFIG_INT, 0, 1, "Con 1, vuelca en JSON los contadores de cada hilo"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
 
 
 int main(int argc, char * argv[]){
-    pthread_t consumidores[C];              // Identificadores de los hilos consumidores
-    pthread_t productores[P];               // Identificadores de los hilos productores
+    pthread_t consumidores[MAX_HILOS];      // Identificadores de los hilos consumidores
+    pthread_t productores[MAX_HILOS];       // Identificadores de los hilos productores
     int i;                                  // Variables de iteración
+    int opcion;                             // Opción leída con getopt
+    struct timespec t_ini, t_fin;           // Instantes de comienzo y final de la ejecución de los hilos
+    double segundos;                        // Duración de la ejecución de los hilos
+    void * region;                          // Memoria dinámica reservada para el buffer
+    char variante[64];                      // Variante del CSV del modo rendimiento
+    struct rusage uso;                      // Uso de recursos del proceso (tiempo de CPU)
+    double cpu;                             // Segundos de CPU consumidos por todos los hilos
+
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: política de espera, modo rendimiento y tamaño de los registros
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "e:rt:a:")) != -1){
+        switch (opcion){
+            case 'e':
+                if (!strcmp(optarg, "yield")) politica = ESPERA_YIELD;
+                else if (!strcmp(optarg, "adaptativa")) politica = ESPERA_ADAPTATIVA;
+                else {
+                    fprintf(stderr, "Error: la política de espera debe ser yield o adaptativa\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "items")) items_por_p = ITEMS_BY_P_RENDIMIENTO;
+                break;
+            case 'a':
+                if ((afinidad = afinidad_politica(optarg)) == -1){
+                    fprintf(stderr, "Error: la política de afinidad debe ser ninguna, compacta, dispersa o parejas\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                if ((tam_elem = strtoul(optarg, NULL, 10)) == 0){
+                    fprintf(stderr, "Error: el tamaño de los registros debe ser de al menos 1 byte\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Uso: ./p3_2_v2 [-e yield|adaptativa] [-r] [-t tam_elem] "
+                                "[-a ninguna|compacta|dispersa|parejas] [--parámetro=valor ...]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
 
     srand(time(NULL));      // Fijamos una semilla de generación de valores aleatorios
 
-    // En primer lugar, se reserva memoria para el buffer compartido entre procesos. Tendrá un máximo de N chars.
-    if ((buffer = (char *) malloc(N * sizeof(char))) == NULL){
+    // En primer lugar, se reserva memoria para el buffer compartido entre hilos, de capacidad registros. Si se ha
+    // indicado una política de afinidad, sus páginas se colocan en el nodo NUMA del primer consumidor, que es quien
+    // lee los items
+    if ((region = afinidad_reservar(buffer_tam_region(capacidad, tam_elem), afinidad == AFINIDAD_NINGUNA? -1 :
+                                    afinidad_nodo(afinidad_cpu(afinidad, AFINIDAD_CONSUMIDOR, 0, num_c)))) == NULL){
         fprintf(stderr, "Error: no se pudo reservar memoria para el buffer\n");
         exit(EXIT_FAILURE);
     }
 
     // Inicializamos todo el buffer con el carácter '_', que representa una posición vacía
-    memset(buffer, '_', (size_t) N * sizeof(char));
+    buffer = buffer_iniciar(region, capacidad, tam_elem, BUFFER_LIFO, '_');
 
-    printf("**************************** PROBLEMA DEL PRODUCTOR-CONSUMIDOR ***************************************\n");
-    printf("Preparado buffer de caracteres. Contenido inicial: buffer = [");
-    for (i = 0; i < N - 1; i++)
-        printf("%c ", *(buffer + i));           // Leemos uno a uno los caracteres contenidos en el buffer
-    printf("%c]\n", *(buffer + i));
-    printf("Número de items inicial: cuenta = %d\n\n\n", cuenta);
+    if ((medidas = medidas_crear((long) items_por_p * num_p, capacidad)) == NULL){
+        perror("Error: no se pudo reservar memoria para las medidas");
+        exit(EXIT_FAILURE);
+    }
 
-    printf("Se empleará el siguiente código de colores:\n");
-    printf("\t%sPRODUCTORES%s\n", VERDE, RESET);
-    printf("\t%sCONSUMIDORES%s\n", AZUL, RESET);
-    printf("\t%sFINALIZACIÓN DE PROCESOS%s\n\n\n", ROJO, RESET);
+    // Con --contadores=1, cada hilo lleva sus contadores, que se vuelcan al acabar o al recibir SIGUSR2
+    if (instrumentar && ((contadores = contadores_crear("p3_2_v2", 2 * MAX_HILOS)) == NULL ||
+                         contadores_senal(contadores) == -1)){
+        perror("Error: no se pudieron preparar los contadores");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!rendimiento){
+        printf("**************************** PROBLEMA DEL PRODUCTOR-CONSUMIDOR ***************************************\n");
+        printf("Preparado buffer de registros de %zu B. Contenido inicial: buffer = [", tam_elem);
+        for (i = 0; i < capacidad - 1; i++)
+            // Leemos uno a uno los registros contenidos en el buffer (su primer carácter)
+            printf("%c ", *(char *) buffer_registro(buffer, i));
+        printf("%c]\n", *(char *) buffer_registro(buffer, i));
+        printf("Número de items inicial: cuenta = %d\n\n\n", buffer->cuenta);
+
+        printf("Se empleará el siguiente código de colores:\n");
+        printf("\t%sPRODUCTORES%s\n", VERDE, RESET);
+        printf("\t%sCONSUMIDORES%s\n", AZUL, RESET);
+        printf("\t%sFINALIZACIÓN DE PROCESOS%s\n\n\n", ROJO, RESET);
+    }
 
     // Se inicializan los mutexes y las variables de condicion
     inicializar();
 
-    // Creamos C consumidores y P productores. Cada uno de ellos será denotado por el valor de la variable i en el
-    // momento de su creación. Guardamos su identificador en los arrays consumidores[] y productores[]
-    for (i = 0; i < C; i++) crear_hilo(&consumidores[i], consumir, i);
-    for (i = 0; i < P; i++) crear_hilo(&productores[i], producir, i);
+    // Medimos el tiempo que tardan los hilos en transferir todos los items
+    clock_gettime(CLOCK_MONOTONIC, &t_ini);
+
+    // Creamos num_c consumidores y num_p productores. Cada uno de ellos será denotado por el valor de la variable i en
+    // el momento de su creación. Guardamos su identificador en los arrays consumidores[] y productores[]
+    for (i = 0; i < num_c; i++) crear_hilo(&consumidores[i], consumir, i, AFINIDAD_CONSUMIDOR);
+    for (i = 0; i < num_p; i++) crear_hilo(&productores[i], producir, i, AFINIDAD_PRODUCTOR);
+
+    // El hilo principal espera a que finalicen todos los hilos que ha creado antes de continuar. Cuando terminan los
+    // productores, cierra el buffer para que los consumidores, tras retirar los items que queden, terminen también
+    for (i = 0; i < num_p; i++) esperar_hilo(productores[i]);
+    cerrar_buffer();
+    for (i = 0; i < num_c; i++) esperar_hilo(consumidores[i]);
 
-    // El hilo principal espera a que finalicen todos los hilos que ha creado antes de continuar
-    for (i = 0; i < C; i++) esperar_hilo(consumidores[i]);
-    for (i = 0; i < P; i++) esperar_hilo(productores[i]);
+    clock_gettime(CLOCK_MONOTONIC, &t_fin);
 
     // Se destruyen los mutexes y las variables de condicion
     destruir();
 
-    free(buffer);       // Liberamos también la memoria reservada para el buffer
+    // Liberamos también la memoria reservada para el buffer
+    afinidad_liberar(buffer, buffer_tam_region(capacidad, tam_elem));
+
+    // En el modo rendimiento se imprime la línea CSV con los items/s, las latencias y los cambios de contexto, y por la
+    // salida de error un comentario con la forma en que se resolvieron las esperas y el tiempo de CPU consumido
+    segundos = (t_fin.tv_sec - t_ini.tv_sec) + (t_fin.tv_nsec - t_ini.tv_nsec) / 1e9;
+    getrusage(RUSAGE_SELF, &uso);
+    cpu = uso.ru_utime.tv_sec + uso.ru_stime.tv_sec + (uso.ru_utime.tv_usec + uso.ru_stime.tv_usec) / 1e6;
+    // La variante del CSV incluye la política de afinidad, si se ha indicado alguna (por ejemplo, adaptativa/compacta)
+    snprintf(variante, sizeof(variante), "%s%s%s", politica == ESPERA_ADAPTATIVA? "adaptativa" : "yield",
+             afinidad == AFINIDAD_NINGUNA? "" : "/", afinidad == AFINIDAD_NINGUNA? "" : afinidad_nombre(afinidad));
+    if (rendimiento){
+        medidas_informe(medidas, "p3_2_v2", variante, 1, tam_elem, (long) items_por_p * num_p, segundos);
+        fprintf(stderr, "# p3_2_v2,%s: esperas %ld girando, %ld cediendo, %ld en futex; %.3f s de CPU\n",
+                politica == ESPERA_ADAPTATIVA? "adaptativa" : "yield", atomic_load(&esperas_giro),
+                atomic_load(&esperas_cesion), atomic_load(&esperas_futex), cpu);
+    }
+    else printf("\nEspera %s: %ld girando, %ld cediendo, %ld en futex; %.3f s de CPU\n",
+                politica == ESPERA_ADAPTATIVA? "adaptativa" : "yield", atomic_load(&esperas_giro),
+                atomic_load(&esperas_cesion), atomic_load(&esperas_futex), cpu);
+    medidas_destruir(medidas);
+    if (contadores != NULL){
+        contadores_volcar(contadores, STDERR_FILENO);
+        contadores_destruir(contadores);
+    }
 
-    printf("\n\n\nFinalizando problema del productor-consumidor...\n\n");
+    if (!rendimiento){
+        if (descartados) printf("\nMensajes descartados por la bitácora: %ld\n", descartados);
+        printf("\n\n\nFinalizando problema del productor-consumidor...\n\n");
+    }
     exit(EXIT_SUCCESS);
 }
 
@@ -145,11 +376,14 @@ void * producir(void * ptr_id){
     char cadena[100];              // Cadena donde se guardará la información que vaya a imprimir el hilo, para poder
                                 // manejarla de la forma más atómica posible
     int tam_cad = sizeof(cadena);       // Tamaño en bytes que ocupa la cadena
-    int i, j;                      // Contadores de iteraciones
+    int i;                         // Contador de iteraciones
+    uint64_t t;                    // Comienzo de la espera o de la región crítica que se está midiendo
+    struct contadores_hilo * cont = contadores_hilo(contadores, "productor", id);   // Contadores del hilo
+    int limite = GIROS_INICIAL;    // Límite de giros de la espera adaptativa de este hilo
 
     // Cada productor realiza un número fijo de iteraciones: 20, una por cada item que produzca
 
-    for (i = 0; i < ITEMS_BY_P; i++){
+    for (i = 0; i < items_por_p; i++){
         // Para imprimir, construimos el mensaje y lo almacenamos en cadena. Después, se la pasamos a la función
         // imprimir
         // Como segundo argumento de snprintf pasamos el número máximo de bytes a almacenar, esto es, el tamaño de la
@@ -165,7 +399,7 @@ void * producir(void * ptr_id){
 
         // Esperamos un núemro de segundos aleatorio de entre 0 y 4 para dar más variedad a las situaciones que
         // se pueden producir (buffer lleno, buffer vacío y situaciones intermedias).
-        sleep(((int) rand()) % SLEEP_MAX_TIME);
+        if (!rendimiento) sleep(((int) rand()) % espera_max);
 
         /*
          * A continuación, el productor se prepara para ejecutar la región crítica. Para ello, solicita acceso
@@ -177,7 +411,11 @@ void * producir(void * ptr_id){
          * uno y solo uno de los hilos bloqueados por el mutex (a través de pthread_mutex_unlock).
          */
 
-        pthread_mutex_lock(&mutex);
+        // Si se llevan contadores, se mide la espera por el mutex, cada espera mientras el buffer sigue lleno y el
+        // tiempo que se pasa en la región crítica (cada medida empieza donde acaba la anterior)
+        t = contadores_inicio(cont);
+        pthread_mutex_lock(&sinc.mutex);
+        t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
 
         /*
          * La clave de esta implementación sin variables de condición se encuentra en este bucle. En él, se emula
@@ -185,7 +423,7 @@ void * producir(void * ptr_id){
          * 1) En primer lugar, se comprueba si el buffer está lleno. Si es así, se libera el mutex para posibilitar
          *     que un consumidor entre en la región crítica y cree un hueco en la pila.
          * 2) A continuación, el hilo vuelve a comprobar si la condición de que el buffer esté lleno se sigue
-         *     cumpliendo. Mientras eso ocurra, ejecutará pthread_yield para ceder su turno de la CPU, pues no
+         *     cumpliendo. Mientras eso ocurra, ejecutará sched_yield para ceder su turno de la CPU, pues no
          *     podrá avanzar. Empleamos dos bucles while anidados para minimizar las interferencias de este hilo
          *     con el mutex mientras no el buffer siga lleno.
          * 3) Cuando el buffer ya no esté lleno, el hilo dejará de ceder su turno y tratará de adquirir el mutex.
@@ -198,25 +436,32 @@ void * producir(void * ptr_id){
          */
         while(esta_buffer_lleno()){
             snprintf(cadena, tam_cad,
-                    "%s[%d] cede el mutex por estar el buffer lleno**%s\n", VERDE, id, i, RESET);
+                    "%s[%d] cede el mutex por estar el buffer lleno%s\n", VERDE, id, RESET);
             imprimir(cadena, 0);
-            pthread_mutex_unlock(&mutex);
-            while (esta_buffer_lleno()) pthread_yield();
-            pthread_mutex_lock(&mutex);
+            contadores_lleno(cont);
+            pthread_mutex_unlock(&sinc.mutex);
+            esperar_mientras(esta_buffer_lleno, &aparcamiento_P, &limite);
+            pthread_mutex_lock(&sinc.mutex);
+            t = contadores_tiempo(cont, CONTADORES_ESPERA, t);
         }
         /**************************************** REGIÓN CRÍTICA *******************************************/
         insert_item(item, id);      // Se introduce el item en la región crítica y se actualiza cuenta
         /************************************** FIN DE LA REGIÓN CRÍTICA **********************************/
-        pthread_mutex_unlock(&mutex);           // El productor abandona la región crítica. Libera el mutex para
+        contadores_tiempo(cont, CONTADORES_SECCION, t);
+        contadores_items(cont, 1);
+        pthread_mutex_unlock(&sinc.mutex);      // El productor abandona la región crítica. Libera el mutex para
         // permitir que otro hilo pueda acceder a ella. Si había uno o varios bloqueados por pthread_mutex_lock, el
         // sistema operativo escogerá a uno de ellos y le concederá el mutex para que pueda continuar. Si no había
         // ninguno, el mutex queda libre para que lo use el primero que ejecute pthread_mutex_lock.
 
+        // Con la política adaptativa, puede haber consumidores dormidos esperando a que el buffer deje de estar vacío
+        if (politica == ESPERA_ADAPTATIVA) avisar_aparcados(&aparcamiento_C);
+
 
         // Se imprime una cadena con el identificador del hilo, el número de iteraciones pendientes. No imprimimos
         // el buffer al estar fuera de la región crítica
         snprintf(cadena, tam_cad,
-                "%s[%d] Me quedan %d iteraciones%s\n", VERDE, id, ITEMS_BY_P - i - 1, RESET);
+                "%s[%d] Me quedan %d iteraciones%s\n", VERDE, id, items_por_p - i - 1, RESET);
         imprimir(cadena, 0);
     }
 
@@ -246,18 +491,16 @@ void * consumir(void * ptr_id){
     char cadena[100];              // Cadena donde se guardará la información que vaya a imprimir el hilo, para poder
                                    // manejarla de la forma más atómica posible
     int tam_cad = sizeof(cadena);       // Tamaño en bytes que ocupa la cadena
-    int num_iters;                 // Número de iteraciones que tendrá que ejecutar cada consumidor
-    int i, j;                      // Contadores de iteraciones
+    int i;                         // Contador de iteraciones
+    uint64_t t;                    // Comienzo de la espera o de la región crítica que se está midiendo
+    struct contadores_hilo * cont = contadores_hilo(contadores, "consumidor", id);   // Contadores del hilo
+    int limite = GIROS_INICIAL;    // Límite de giros de la espera adaptativa de este hilo
 
     /*
-     * El número de iteraciones totales (ITEMS_BY_P * P = 20 * P) se divide de forma equitativa entre los consumidores.
-     * No obstante, habría problemas en caso de que C no fuese divisor de ITEMS_BY_P * P. En ese caso, el resto de la
-     * división se asigna como iteraciones extra para el primer consumidor (el de identificador 0). Es decir, a este
-     * le corresponde el cociente y el resto. Los demás llevarán a cabo ITEMS_BY_P * P iteraciones (el cociente).
+     * Los items totales (ITEMS_BY_P * P = 20 * P) no se dividen de antemano entre los consumidores: cada uno retira
+     * items mientras los haya, y termina cuando encuentra el buffer cerrado (ya no quedan productores) y vacío.
      */
-    num_iters = !id? (ITEMS_BY_P * P / C) + (ITEMS_BY_P * P % C) : ITEMS_BY_P * P / C;
-
-    for (i = 0; i < num_iters; i++){
+    for (i = 0; ; i++){
         // Para imprimir, construimos el mensaje y lo almacenamos en cadena. Después, se la pasamos a la función
         // imprimir.
         // Como segundo argumento de snprintf pasamos el número máximo de bytes a almacenar, esto es, el tamaño de la
@@ -275,7 +518,11 @@ void * consumir(void * ptr_id){
          * al productor. Cuando el otro hilo salga de la región crítica, tendrá la responsabilidad de despertar a
          * uno y solo uno de los hilos bloqueados por el mutex (a través de pthread_mutex_unlock).
          */
-        pthread_mutex_lock(&mutex);
+        // Si se llevan contadores, se mide la espera por el mutex, cada espera mientras el buffer sigue vacío y el
+        // tiempo que se pasa en la región crítica (cada medida empieza donde acaba la anterior)
+        t = contadores_inicio(cont);
+        pthread_mutex_lock(&sinc.mutex);
+        t = contadores_tiempo(cont, CONTADORES_CERROJO, t);
 
         /*
          * La clave de esta implementación sin variables de condición se encuentra en este bucle. En él, se emula
@@ -283,7 +530,7 @@ void * consumir(void * ptr_id){
          * 1) En primer lugar, se comprueba si el buffer está vacío. Si es así, se libera el mutex para posibilitar
          *     que un productor entre en la región crítica y coloque un elemento en la pila.
          * 2) A continuación, el hilo vuelve a comprobar si la condición de que el buffer esté vacío se sigue
-         *     cumpliendo. Mientras eso ocurra, ejecutará pthread_yield para ceder su turno de la CPU, pues no
+         *     cumpliendo. Mientras eso ocurra, ejecutará sched_yield para ceder su turno de la CPU, pues no
          *     podrá avanzar. Empleamos dos bucles while anidados para minimizar las interferencias de este hilo
          *     con el mutex mientras no el buffer siga lleno.
          * 3) Cuando el buffer ya no esté lleno, el hilo dejará de ceder su turno y tratará de adquirir el mutex.
@@ -294,36 +541,49 @@ void * consumir(void * ptr_id){
          * respecto al vaciado y llenado. Cada hilo se responsabiliza de comprobar la condición para sí mismo
          * leyendo la variable cuenta.
          */
-        while(esta_buffer_vacio()){
+        // Si el buffer está cerrado no se espera, pues ya no se insertarán más items
+        while(esperando_items()){
             snprintf(cadena, tam_cad,
                     "\t\t\t\t\t\t%s[%d] cede el mutex por estar el buffer vacio%s\n", AZUL, id, RESET);
             imprimir(cadena, 0);
-            pthread_mutex_unlock(&mutex);
-            while (esta_buffer_vacio()) pthread_yield();
-            pthread_mutex_lock(&mutex);
+            contadores_vacio(cont);
+            pthread_mutex_unlock(&sinc.mutex);
+            esperar_mientras(esperando_items, &aparcamiento_C, &limite);
+            pthread_mutex_lock(&sinc.mutex);
+            t = contadores_tiempo(cont, CONTADORES_ESPERA, t);
+        }
+        // Si el buffer sigue vacío, es que está cerrado: el consumidor termina
+        if (esta_buffer_vacio()){
+            pthread_mutex_unlock(&sinc.mutex);
+            break;
         }
         /**************************************** REGIÓN CRÍTICA *******************************************/
         item = remove_item(id);      // Se elimina un item del buffer y se actualiza cuenta
         /************************************** FIN DE LA REGIÓN CRÍTICA **********************************/
-        pthread_mutex_unlock(&mutex);       // El consumidor abandona la región crítica
+        contadores_tiempo(cont, CONTADORES_SECCION, t);
+        contadores_items(cont, 1);
+        pthread_mutex_unlock(&sinc.mutex);       // El consumidor abandona la región crítica
+
+        // Con la política adaptativa, puede haber productores dormidos esperando a que el buffer deje de estar lleno
+        if (politica == ESPERA_ADAPTATIVA) avisar_aparcados(&aparcamiento_P);
 
         // Esperamos un núemro de segundos aleatorio de entre 0 y 4 para dar más variedad a las situaciones que
         // se pueden producir (buffer lleno, buffer vacío y situaciones intermedias).
-        sleep(((int) rand()) % SLEEP_MAX_TIME);
+        if (!rendimiento) sleep(((int) rand()) % espera_max);
 
         // Mostramos por pantalla el item consumido, junto al identificador del consumidor que lo ha eliminado
         consume_item(item, id);
 
-        // Imprimimos un mensaje indicando el número de iteraciones que le quedan por ejecutar a este hilo, así como
-        // su identificador. No imprimimos el buffer al estar fuera de la región crítica
+        // Imprimimos un mensaje indicando el número de items que lleva retirados este hilo, así como su
+        // identificador. No imprimimos el buffer al estar fuera de la región crítica
         snprintf(cadena, tam_cad,
-                "\t\t\t\t\t\t%s[%d] Me quedan %d iteraciones%s\n", AZUL, id, num_iters - i - 1, RESET);
+                "\t\t\t\t\t\t%s[%d] Llevo %d items retirados%s\n", AZUL, id, i + 1, RESET);
         imprimir(cadena, 0);
     }
 
-    // Se imprime un mensaje de finalización en rojo
+    // Se imprime un mensaje de finalización en rojo, con los items que ha retirado este consumidor
     snprintf(cadena, tam_cad,
-            "\n\t\t\t\t\t\t%s[%d] Finalizando consumidor...%s\n", ROJO, id, RESET);
+            "\n\t\t\t\t\t\t%s[%d] Finalizando consumidor (%d items)...%s\n", ROJO, id, i, RESET);
     imprimir(cadena, 0);            // En este caso, pasamos un 0 para no mostrar el buffer
 
     // En el ejercicio 2 empleábamos la función exit() para cerrar la ejecución. Ahora, dado que empleamos hilos,
@@ -336,16 +596,147 @@ void * consumir(void * ptr_id){
 // El propósito de definir esta función es, principalmente, ayudar a la legibilidad del código
 // Devuelve 1 si es así y 0 en caso contrario.
 int esta_buffer_lleno(){
-    return cuenta == N;
+    return buffer_lleno(buffer);
 }
 
 // Función que verfica si el buffer tiene algún elemento
 // El propósito de definir esta función es, principalmente, ayudar a la legibilidad del código
 // Devuelve 1 si está vacío, y 0 si hay elementos en él
 int esta_buffer_vacio(){
-    return !cuenta;
+    return buffer_vacio(buffer);
+}
+
+// Función que verifica si un consumidor debe seguir esperando: el buffer está vacío, pero aún no se ha cerrado
+// Devuelve 1 si es así y 0 en caso contrario (hay items, o ya no llegarán más)
+int esperando_items(){
+    return buffer_vacio(buffer) && !buffer_cerrado(buffer);
+}
+
+/*
+ * Función que ejecuta el hilo principal cuando han terminado todos los productores: cierra el buffer y despierta a
+ * todos los consumidores dormidos en el futex de aparcamiento_C, que retirarán los items que queden y terminarán al
+ * encontrarlo cerrado y vacío. Los que giran o ceden la CPU verán el cierre en su siguiente comprobación.
+ * La palabra se incrementa después de cerrar: el consumidor que la leyó antes de dormir retorna de inmediato de
+ * FUTEX_WAIT, y el que la lee después ve también el buffer cerrado (ver esperar_mientras).
+ */
+void cerrar_buffer(){
+    pthread_mutex_lock(&sinc.mutex);
+    buffer_cerrar(buffer);
+    pthread_mutex_unlock(&sinc.mutex);
+    atomic_fetch_add(&aparcamiento_C.aviso, 1);
+    despertar_futex(&aparcamiento_C.aviso, INT_MAX);
+}
+
+
+/*
+ * Función que espera, fuera de la región crítica, mientras se cumpla una condición sobre el buffer.
+ * Con la política yield cede la CPU con sched_yield en cada comprobación. Con la adaptativa:
+ *  1. Gira comprobando la condición, con un número de instrucciones de pausa entre comprobaciones que se duplica en
+ *     cada vuelta (hasta MAX_PAUSAS), mientras no se supere el límite de giros del hilo.
+ *  2. Cede la CPU con sched_yield, como mucho CESIONES veces.
+ *  3. Duerme en el futex del punto de espera. Antes de dormir se anota en aparcados y vuelve a comprobar la condición;
+ *     quien cambia el buffer la modifica antes de consultar aparcados (ambos separan la escritura de la lectura con una
+ *     barrera completa), de modo que uno de los dos ve al otro y no se pierde el aviso.
+ * Al volver, el hilo debe adquirir de nuevo el mutex y repetir la comprobación, pues otro hilo puede haberse
+ * adelantado.
+ * @param condicion: Función que devuelve !0 mientras haya que esperar (esta_buffer_lleno o esperando_items).
+ * @param aparcamiento: Punto de espera de la condición (aparcamiento_P o aparcamiento_C).
+ * @param limite: Límite de giros del hilo, que se ajusta al terminar la espera.
+ */
+void esperar_mientras(int (* condicion)(), struct aparcamiento * aparcamiento, int * limite){
+    int giros, pausas, k;          // Pausas realizadas, pausas de la vuelta actual y contador
+    uint32_t valor;                // Valor de la palabra futex antes de volver a comprobar la condición
+
+    if (politica == ESPERA_YIELD){
+        while (condicion()) sched_yield();
+        atomic_fetch_add_explicit(&esperas_cesion, 1, memory_order_relaxed);
+        return;
+    }
+
+    // 1. Giro con retroceso exponencial
+    for (giros = 0, pausas = 1; giros < *limite; giros += pausas, pausas = pausas < MAX_PAUSAS? 2 * pausas : pausas){
+        if (!condicion()){
+            ajustar_limite(limite, giros, 1);
+            atomic_fetch_add_explicit(&esperas_giro, 1, memory_order_relaxed);
+            return;
+        }
+        for (k = 0; k < pausas; k++) PAUSA_CPU();
+    }
+
+    // 2. Cesión de la CPU
+    for (k = 0; k < CESIONES; k++){
+        if (!condicion()){
+            ajustar_limite(limite, giros, 0);
+            atomic_fetch_add_explicit(&esperas_cesion, 1, memory_order_relaxed);
+            return;
+        }
+        sched_yield();
+    }
+
+    // 3. Espera en el futex
+    while (condicion()){
+        valor = atomic_load(&aparcamiento->aviso);
+        atomic_fetch_add(&aparcamiento->aparcados, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (condicion()) esperar_futex(&aparcamiento->aviso, valor);
+        atomic_fetch_sub(&aparcamiento->aparcados, 1);
+    }
+    ajustar_limite(limite, giros, 0);
+    atomic_fetch_add_explicit(&esperas_futex, 1, memory_order_relaxed);
 }
 
+/*
+ * Función que ajusta el límite de giros de un hilo según cómo se resolvió su última espera. Si se resolvió girando,
+ * el límite se acerca (con peso 1/8) al doble de los giros que hicieron falta; si hubo que ceder la CPU o dormir, el
+ * giro no sirvió y el límite se reduce en una cuarta parte. Así, cuando las esperas son cortas (otro hilo libera un
+ * hueco en otro núcleo) se gira lo justo, y cuando son largas (o hay un único núcleo) se pasa enseguida a dormir.
+ * @param limite: Límite de giros del hilo.
+ * @param giros: Giros realizados en la última espera.
+ * @param resuelta_girando: !0 si la espera terminó durante el giro.
+ */
+void ajustar_limite(int * limite, int giros, int resuelta_girando){
+    if (resuelta_girando) *limite += (2 * giros - *limite) / 8;
+    else *limite -= *limite / 4;
+
+    if (*limite < GIROS_MIN) *limite = GIROS_MIN;
+    else if (*limite > GIROS_MAX) *limite = GIROS_MAX;
+}
+
+/*
+ * Función que despierta a uno de los hilos dormidos en un punto de espera, si los hay. Se llama tras modificar el
+ * buffer y liberar el mutex. La barrera completa ordena la modificación de cuenta antes de la lectura de aparcados
+ * (ver esperar_mientras). Si no hay nadie dormido, no se hace ninguna llamada al sistema.
+ * @param aparcamiento: Punto de espera de la condición que puede haber dejado de cumplirse.
+ */
+void avisar_aparcados(struct aparcamiento * aparcamiento){
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&aparcamiento->aparcados, memory_order_relaxed) > 0){
+        atomic_fetch_add(&aparcamiento->aviso, 1);
+        despertar_futex(&aparcamiento->aviso, 1);
+    }
+}
+
+/*
+ * Función que bloquea al hilo en una palabra futex mientras esta conserve el valor indicado. Vuelve también si la
+ * espera se interrumpe por una señal o si la palabra ya había cambiado: quien la llama debe comprobar la condición.
+ * @param palabra: Palabra futex.
+ * @param valor: Valor que se espera que tenga la palabra.
+ */
+void esperar_futex(_Atomic uint32_t * palabra, uint32_t valor){
+    if (syscall(SYS_futex, palabra, FUTEX_WAIT_PRIVATE, valor, NULL, NULL, 0) == -1 && errno != EAGAIN &&
+        errno != EINTR){
+        perror("Error en la espera sobre el futex");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Función que despierta a (como mucho) n hilos bloqueados en una palabra futex (INT_MAX para todos)
+void despertar_futex(_Atomic uint32_t * palabra, int n){
+    if (syscall(SYS_futex, palabra, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0) == -1){
+        perror("Error al despertar un hilo del futex");
+        exit(EXIT_FAILURE);
+    }
+}
 
 /*
  * Función que genera un  carácter dependiente del identificador del hilo. En concreto, los hilos pares imprimen en
@@ -365,8 +756,8 @@ char produce_item(int id){
 
 /*
  * Función que coloca una letra en el buffer. Se insertará en la posición superior, puesto que se trata de una pila
- * LIFO.
- * Dicha posición vendrá dada por la variable compartida cuenta.
+ * LIFO. El registro (tam_elem bytes con el valor de la letra) se escribe directamente en su hueco.
+ * Dicha posición vendrá dada por el número de registros presentes en el buffer (buffer->cuenta).
  * Esta función es empleada por los productores y forma parte de la región crítica.
  * No se comprueba que el buffer no esté lleno; este es un prerrequisito a corroborar de forma externa.
  * @param letra: Carácter a colocar en el buffer.
@@ -374,39 +765,51 @@ char produce_item(int id){
  */
 void insert_item(char letra, int id){
     char cadena[100];                // Línea a imprimir en el log.
+    void * hueco;                    // Primera posición libre del buffer
 
-    buffer[cuenta] = letra;         // Se almacena el nuevo elemento en la primera posición libre del buffer.
+    // Se almacena el nuevo elemento en la primera posición libre del buffer, y se sella el instante en que se guarda
+    hueco = buffer_hueco_insertar(buffer, 0);
+    registro_rellenar(hueco, tam_elem, letra);
+    medidas_sellar(medidas, buffer_posicion(buffer, hueco));
 
     // Incrementamos el valor de cuenta para reflejar el nuevo elemento
-    cuenta++;
+    buffer_confirmar_insercion(buffer, 1);
 
     // Preparamos la línea con snprintf y luego la imprimimos de forma atómica llamando a imprimir
     snprintf(cadena, sizeof(cadena),
              "%s[%d] Guardado item %c en %d -> cuenta = %d%s  \t\t\t\t\t\t\t\t\t",
-             VERDE, id, letra, cuenta - 1, cuenta, RESET);
+             VERDE, id, letra, buffer->cuenta - 1, buffer->cuenta, RESET);
     imprimir(cadena, PROD);         // Con el 2º argumento mostramos el buffer en verde
 
 }
 
 /*
  * Función que retira una letra del buffer. Como se implementa como una cola LIFO, se borra de la posición superior.
- * Dicha letra es devuelta por la función y reemplazada por un guion bajo '_'.
+ * Antes se comprueba que el registro esté completo. Su letra es devuelta por la función y reemplazada por un guion
+ * bajo '_'.
  * Esta función es empleada por los consumidores y forma parte de la región crítica.
  * @param id: identificador del hilo (solo usado a efectos de impresión)
  */
 char remove_item(int id){
-    char item;                   // Letra que contenía el buffer en la posición inicio.
+    char * registro;             // Registro situado en la parte superior de la pila
+    char item;                   // Letra que contenía el buffer en esa posición
     char cadena[100];            // Línea que se imprimirá
 
     // Como cuenta indica el número de posiciones ocupadas, el último elemento estará en cuenta - 1
-    item = buffer[cuenta - 1];          // Guardamos el item
-    buffer[cuenta - 1] = '_';           // Borramos la posición
-    cuenta--;                           // Decrementamos el número de items presentes en el buffer
+    registro = buffer_hueco_extraer(buffer, 0);
+    medidas_latencia(medidas, buffer_posicion(buffer, registro));
+    if (!registro_comprobar(registro, tam_elem)){
+        fprintf(stderr, "Error: se ha consumido un registro corrupto\n");
+        exit(EXIT_FAILURE);
+    }
+    item = *registro;                   // Guardamos el item
+    *registro = '_';                    // Borramos la posición
+    buffer_confirmar_extraccion(buffer, 1);     // Decrementamos el número de items presentes en el buffer
 
     // Indicamos que se ha retirado un elemento (lo imprimimos desde la región crítica para que quede constancia
     // inmediata)
     snprintf(cadena, sizeof(cadena),
-             "\t\t\t\t\t\t%s[%d] Retirado item %c, cuenta = %d    %s\t\t\t\t", AZUL, id, item, cuenta, RESET);
+             "\t\t\t\t\t\t%s[%d] Retirado item %c, cuenta = %d    %s\t\t\t\t", AZUL, id, item, buffer->cuenta, RESET);
     imprimir(cadena, CONS);             // Con el 2º argumento mostramos el buffer en azul
 
     return item;                        // Devolvemos el elemento leído
@@ -433,45 +836,51 @@ void consume_item(char item, int id){
 
 
 /*
- * Función que imprime los contenidos del buffer en una línea. Es empleada por los productores, que imprimen en verde,
- * y por los consumidores, que imprimen en azul. Toda la cadena aparece en cursiva.
- * @param hilo: Valdrá PROD (1) si se trata de un hilo productor, y CONS (2) si es un consumidor.
+ * Función que da formato a la instantánea del buffer guardada en un registro de la bitácora, en una línea. La ejecuta
+ * el hilo escritor de la bitácora al volcar los mensajes de los productores, que imprimen en verde, y de los
+ * consumidores, que imprimen en azul. Toda la cadena aparece en cursiva.
+ * @param registro: Registro de la bitácora. Su tipo valdrá PROD (1) si lo escribió un hilo productor, y CONS (2) si
+ *                  fue un consumidor. Sus datos contienen el primer carácter de cada registro del buffer.
+ * @param destino: Cadena donde se escribe la línea.
+ * @param tam: Tamaño máximo de la línea.
+ * @return: Número de caracteres escritos.
  */
-void log_buffer(int hilo){
+size_t log_buffer(const struct bitacora_registro * registro, char * destino, size_t tam){
+    size_t n;       // Caracteres escritos
     int i;          // Variable de iteración
 
-    // Dependiendo del argumento hilo, se imprime en verde o en azul. Siempre se activa la cursiva.
-    printf("%s%sbuffer = [", hilo == PROD? VERDE : AZUL, CURSIVA);
-    for (i = 0; i < N - 1; i++)
-        printf("%c ", *(buffer + i));           // Leemos uno a uno los caracteres contenidos en el buffer
-    printf("%c]%s%s\n", *(buffer + i), RESET, RESET_CURS);
-    // No utilizamos \n hasta el final para tratar de que el buffer se imprima de forma atómica
+    // Dependiendo del tipo del registro, se imprime en verde o en azul. Siempre se activa la cursiva.
+    n = snprintf(destino, tam, "%s%sbuffer = [", registro->tipo == PROD? VERDE : AZUL, CURSIVA);
+    for (i = 0; i < registro->tam_datos && n < tam; i++)
+        n += snprintf(destino + n, tam - n, i < registro->tam_datos - 1? "%c " : "%c", registro->datos[i]);
+    if (n < tam) n += snprintf(destino + n, tam - n, "]%s%s\n", RESET, RESET_CURS);
+    return n < tam? n : tam - 1;
 }
 
 /*
- * Función de impresión que busca asegurar que esta tenga lugar de forma atómica entre hilos. Para ello,
- * no se permite que varios hilos empleen esta función a la vez (para lo cual se utiliza un mutex, mutex_impr) y
- * se añade una pequeña espera antes de terminarla, para tratar de que el hilo complete su uso de la consola.
+ * Función de impresión que no bloquea nunca al hilo que la llama. En lugar de escribir en la consola, deja el mensaje
+ * en el anillo propio del hilo dentro de la bitácora (módulo comun/bitacora), y el hilo escritor de esta se encarga
+ * de volcarlo junto a los de los demás hilos, ordenados según el instante en que se escribieron. Si la consola no da
+ * abasto, el mensaje se descarta y se contabiliza.
  * La impresión corresponde a una sola línea y consta de un mensaje seguido opcionalmente del contenido del buffer.
+ * Como el buffer puede cambiar antes de que se vuelque el mensaje, se guarda una instantánea de su contenido (el
+ * primer carácter de cada registro) en el momento de la llamada, que se realiza desde la región crítica. La bitácora
+ * guarda como mucho BITACORA_TAM_DATOS bytes, así que de un buffer mayor solo se muestran los primeros registros.
  * @param cadena: Mensaje inicial a imprimir antes del buffer.
  * @param ver_buffer: 0 para no incluir el buffer en la línea, !0 para añadirlo (1 para imprimir como productor y 2
  *                    para imprimir como consumidor).
  */
 void imprimir(char * cadena, int ver_buffer){
-    // Adquirimos el mutex de impresión. Así, definimos el empleo de la consola como una región crítica (al fin y al
-    // cabo, se está empleando un recurso compartido). Únicamente un hilo podrá utilizarla de forma simultánea.
-    pthread_mutex_lock(&mutex_impr);
-    printf("%s", cadena);
-    // Si se ha solicitado, se imprime el buffer en la misma línea
-    // Pasamos ver_buffer a log_buffer para que se tenga en cuenta si se trata del productor (1) o del consumidor (2)
-    if (ver_buffer) log_buffer(ver_buffer);
-
-    usleep(150);     // Dormimos al hilo algunos microsegundos para tratar de que dé tiempo a imprimir y las
-                     // llamadas a printf procedentes de distintos hilos no se mezclen por consola
-
-    // Se libera el mutex de impresión, permitiendo que un (y solamente un) hilo que estuviera esperando para imprimir
-    // pueda salir de pthread_mutex_lock y ejecutar los printf.
-    pthread_mutex_unlock(&mutex_impr);
+    char instantanea[BITACORA_TAM_DATOS];   // Primer carácter de cada registro del buffer
+    int n = capacidad < BITACORA_TAM_DATOS? capacidad : BITACORA_TAM_DATOS;     // Registros de la instantánea
+    int i;                                  // Variable de iteración
+
+    // En el modo rendimiento no se imprime nada
+    if (rendimiento) return;
+
+    if (ver_buffer)
+        for (i = 0; i < n; i++) instantanea[i] = *(char *) buffer_registro(buffer, i);
+    bitacora_escribir(bitacora, cadena, ver_buffer, ver_buffer? instantanea : NULL, n);
 }
 
 // Función auxiliar que inicializa los mutexes
@@ -479,20 +888,23 @@ void inicializar(){
     // Antes de poder emplear los mutexes en las funciones pthread_mutex_lock, pthread_mutex_unlock, etc., deben ser
     // inicializados. Para ello, utilizamos la función pthread_mutex_init
     // Dejamos el segundo argumento a NULL para emplear la configuración de atributos por defecto.
-    if (pthread_mutex_init(&mutex, NULL)){
+    if (pthread_mutex_init(&sinc.mutex, NULL)){
         fprintf(stderr, "Error en la inicializacion del mutex de la region critica\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_init(&mutex_impr, NULL)){
-        fprintf(stderr, "Error en la inicializacion del mutex de impresion\n");
+    // Los mensajes de los hilos se imprimen a través de la bitácora, que vuelca en la salida estándar lo que ya haya
+    // escrito printf (de ahí el fflush). En el modo rendimiento no se imprime nada, así que no es necesaria
+    fflush(stdout);
+    if (!rendimiento && (bitacora = bitacora_crear(STDOUT_FILENO, log_buffer)) == NULL){
+        fprintf(stderr, "Error en la creacion de la bitacora\n");
         exit(EXIT_FAILURE);
     }
     // Inicializamos también los dos mutexes propios a esta implementación
-    if (pthread_mutex_init(&mutex_vacio, NULL)){
+    if (pthread_mutex_init(&sinc.mutex_vacio, NULL)){
         fprintf(stderr, "Error en la inicializacion del mutex del buffer vacio\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_init(&mutex_lleno, NULL)){
+    if (pthread_mutex_init(&sinc.mutex_lleno, NULL)){
         fprintf(stderr, "Error en la inicializacion del mutex del buffer lleno\n");
         exit(EXIT_FAILURE);
     }
@@ -503,20 +915,22 @@ void destruir(){
     // Una vez ha finalizado el uso de los mutexes, se pueden destruir con seguridad.
     // Tenemos la seguridad de que todos los mutexes están desbloqueados, pues todos los hilos han finalizado
     // correctamente (en caso contrario, pthread_mutex_destroy podría dar error)
-    if (pthread_mutex_destroy(&mutex)){
+    if (pthread_mutex_destroy(&sinc.mutex)){
         fprintf(stderr, "Error en la destruccion del mutex de la region critica\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_destroy(&mutex_impr)){
-        fprintf(stderr, "Error en la destruccion del mutex de impresion\n");
-        exit(EXIT_FAILURE);
+    // La bitácora vuelca los mensajes pendientes antes de cerrarse
+    if (bitacora != NULL){
+        descartados = bitacora_descartados(bitacora);
+        bitacora_cerrar(bitacora);
+        bitacora = NULL;
     }
     // Destruimos también los mutexes propios de esta implementación
-    if (pthread_mutex_destroy(&mutex_vacio)){
+    if (pthread_mutex_destroy(&sinc.mutex_vacio)){
         fprintf(stderr, "Error en la destruccion del mutex del buffer vacio\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_mutex_destroy(&mutex_lleno)){
+    if (pthread_mutex_destroy(&sinc.mutex_lleno)){
         fprintf(stderr, "Error en la destruccion del mutex del buffer lleno\n");
         exit(EXIT_FAILURE);
     }
@@ -528,17 +942,27 @@ void destruir(){
  * @param hilo: puntero al pthread_t donde se guardará el identificador del hilo creado
  * @param funcion: funcion que ejecutará el hilo nada más crearse
  * @param arg: argumento que se le pasará a la función del hilo craedo
+ * @param rol: AFINIDAD_CONSUMIDOR o AFINIDAD_PRODUCTOR, para elegir su CPU según la política de afinidad
  */
-void crear_hilo(pthread_t * hilo, void * funcion, int arg){
+void crear_hilo(pthread_t * hilo, void * funcion, int arg, int rol){
+    pthread_attr_t atributos;   // Atributos de creación del hilo
     int error;          // Comprobación de errores
 
+    // Los atributos por defecto solo se modifican para fijar la CPU del hilo, si se ha indicado una política de
+    // afinidad con la opción -a (con la política ninguna, afinidad_cpu devuelve -1 y no se cambian)
+    if ((error = pthread_attr_init(&atributos)) != 0 ||
+        (error = afinidad_atributos(&atributos, afinidad_cpu(afinidad, rol, arg, num_c))) != 0){
+        fprintf(stderr, "Error %s al preparar los atributos de un hilo\n", strerror(error));
+        exit(EXIT_FAILURE);
+    }
+
     // El argumento debe enviarse como un puntero a void, y no como un entero. Para realizar una conversión segura,
     // pasamos primero el dato a intptr_t y después a un puntero a void.
-    // Pasamos NULL como segundo argumento para no modificar los atributos por defecto del hilo
-    if ((error = pthread_create(hilo, NULL, funcion, (void *) (intptr_t) arg)) != 0){
+    if ((error = pthread_create(hilo, &atributos, funcion, (void *) (intptr_t) arg)) != 0){
         fprintf(stderr, "Error en la creación de un hilo\n");
         exit(EXIT_FAILURE);
     }
+    pthread_attr_destroy(&atributos);
 }
 
 /*
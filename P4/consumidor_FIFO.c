@@ -3,6 +3,15 @@
 #include <mqueue.h>
 #include <unistd.h>
 #include <time.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include "../comun/buffer.h"
+#include "../comun/medidas.h"
+#include "../comun/ocupacion.h"
+#include "../comun/canal.h"
+#include "../comun/config.h"
+#include "../comun/contadores.h"
 
 /* Xiana Carrera Alonso
  * Sistemas Operativos II
@@ -15,6 +24,58 @@
  *
  * Para compilar se debe usar la opción -lrt.
  * El productor debe comezar a ejecutarse antes del consumidor.
+ *
+ * Cada item es un registro (módulo comun/buffer) cuyo tamaño fija el productor con la opción -t. El consumidor lo
+ * obtiene de los atributos de buz_items, recibe cada registro y comprueba que llegue completo. Tras el registro, cada
+ * mensaje lleva el instante en que el productor lo envió, a partir del cual se calcula la latencia de traspaso.
+ *
+ * Con la opción -m shm, se usa el canal de memoria compartida (módulo comun/canal) que crea el productor: el
+ * consumidor lee cada item directamente en su hueco del anillo compartido, sin copiarlo, y devuelve la orden
+ * incrementando el contador de créditos. El tamaño de los items se obtiene entonces de la cabecera del canal.
+ *
+ * Con la opción -l, cada mensaje de buz_items agrupa hasta lote items, y con -o cada orden concede varios huecos: el
+ * consumidor acumula los huecos que va liberando (uno por mensaje leído) y los devuelve en una sola orden, cuyo valor
+ * es el número de huecos, cuando tiene ordenes de ellos. Para no retener huecos mientras el productor espera, si tiene
+ * alguno pendiente no espera más de espera_us microsegundos (opción -w) a que llegue un mensaje antes de devolverlos.
+ *
+ * Con las opciones -n y -c pueden ejecutarse varios productores y varios consumidores a la vez (ver productor_FIFO).
+ * Cada consumidor lee de sus propios buzones, /BUZON_ITEMS_id y /BUZON_ORDENES_id, y devuelve en el segundo los
+ * huecos que libera, que puede aprovechar cualquier productor.
+ *
+ * El consumidor no necesita saber cuántos items le llegarán: termina al recibir el mensaje vacío con el que cada
+ * productor cierra su flujo de items (con el canal, cuando canal_recibir devuelve NULL). Antes de ese cierre habrá
+ * recibido todos los items pendientes, así que su buzón queda vacío sin tener que consultarlo. Después cierra a su vez
+ * las órdenes: en lugar de devolver los últimos huecos envía un mensaje vacío a buz_ordenes (con el canal, llama a
+ * canal_terminar_creditos), con el que el productor sabe que ya ha terminado.
+ *
+ * Uso: ./consumidor_FIFO [-m mq|shm] [-r] [-l lote] [-o ordenes] [-w espera_us] [-s periodo_ms]
+ *                        [-i id -n productores -c consumidores -d turno|carga|clave]
+ *  -m: transporte de las órdenes y los items: colas de mensajes POSIX (mq, por defecto) o canal de memoria compartida
+ *      (shm). Debe coincidir con el del productor.
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, se consumen DATOS_RENDIMIENTO items y al final se
+ *      imprime una línea CSV (módulo comun/medidas) con los items/s, los percentiles de latencia y los cambios de
+ *      contexto del consumidor. El productor debe ejecutarse también con -r.
+ *  -l: número máximo de items por mensaje (1 por defecto; solo con el transporte mq). Debe coincidir con el del
+ *      productor.
+ *  -o: número de huecos que se devuelven en cada orden (1 por defecto, hasta la capacidad y nunca más de CHAR_MAX;
+ *      solo con el transporte mq).
+ *  -w: máximo de microsegundos que se retienen huecos pendientes de devolver (ESPERA_LOTE_US por defecto).
+ *  -s: cada cuántos milisegundos se imprime por la salida de error la ocupación de los buzones (profundidad, máximo y
+ *      veces que se han llenado y vaciado). Al acabar se imprime una última vez.
+ *      Solo con el transporte mq.
+ *  -i: identificador del consumidor, entre 0 y consumidores - 1 (0 por defecto).
+ *  -n: número de productores (1 por defecto). Deben coincidir con los del productor.
+ *  -c: número de consumidores (1 por defecto, hasta MAX_CONSUMIDORES).
+ *  -d: política de reparto de los productores. El consumidor solo la usa para identificar la variante en el CSV.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra): --items (items de cada productor, como en el productor; solo
+ * fija la reserva inicial de las medidas de latencia, que se amplían si llegan más, pues el final lo marca el cierre
+ * del productor) y
+ * --espera_max (las esperas duran de 0 a espera_max - 1 segundos). La capacidad de los buzones o del canal la fija el
+ * productor, y el consumidor la lee al abrirlos. También se leen de las variables SOII_NOMBRE.
+ * Con --contadores=1, se registra cuánto espera el consumidor en mq_receive a que le lleguen items, cuántas veces
+ * encuentra vacío su buzón y cuántos items recibe (módulo comun/contadores). Los contadores se vuelcan en JSON por la
+ * salida de error al acabar y cada vez que el proceso recibe SIGUSR2.
  */
 
 // Colores para impresión por consola
@@ -22,40 +83,234 @@
 #define ROJO "\033[0;31m"
 #define RESET "\033[0m"
 
-#define MAX_BUFFER 5                         // Tamaño del buffer
-#define DATOS_A_CONSUMIR 50                  // Número de datos a producir/consumir
-#define MAX_SLEEP 3                          // Duración máxima de un sleep
+#define DATOS_A_CONSUMIR 50                  // Número de datos a producir/consumir (y máximo del historial)
+#define DATOS_RENDIMIENTO 30000              // Número de datos a producir/consumir en el modo rendimiento
+#define MAX_SLEEP 3                          // Duración máxima de un sleep (por defecto)
+
+#define NOMBRE_OCUPACION "/OCUPACION_BUZONES"    // Objeto de memoria compartida con la ocupación de los buzones
+#define COLA_ORDENES(j) (2 * (j))            // Índice de buz_ordenes del consumidor j en los contadores de ocupación
+#define COLA_ITEMS(j) (2 * (j) + 1)          // Índice de buz_items del consumidor j en los contadores de ocupación
+#define MAX_CONSUMIDORES (OCUPACION_MAX_COLAS / 2)  // Número máximo de consumidores (opción -c)
+#define TAM_NOMBRE 32                        // Tamaño máximo del nombre de un buzón
+#define MAX_LOTE 512                         // Número máximo de items por mensaje (opción -l)
+#define ESPERA_LOTE_US 1000                  // Retención por defecto de los huecos pendientes (opción -w)
+
+#define TRANSPORTE_MQ 0                      // Órdenes e items viajan por colas de mensajes POSIX
+#define TRANSPORTE_SHM 1                     // Órdenes e items viajan por un canal de memoria compartida
+#define NOMBRE_CANAL "/CANAL_ITEMS"          // Nombre del objeto de memoria compartida del canal
 
 
 mqd_t buz_ordenes;                   // Cola de entrada de mensajes para el productor
 mqd_t buz_items;                     // Cola de entrada de mensajes para el consumidor
-
-size_t tam_msg;                      // Tamaño de cada mensaje
+struct ocupacion * ocupacion = NULL; // Contadores de ocupación de los buzones
+uint64_t periodo_ocupacion = 0;      // Nanosegundos entre dos volcados de la ocupación (0 si no se vuelca)
+uint64_t proximo_volcado = 0;        // Instante del próximo volcado de la ocupación
+struct canal * canal = NULL;         // Canal de memoria compartida (solo con TRANSPORTE_SHM)
+int transporte = TRANSPORTE_MQ;      // Transporte de las órdenes y los items
+
+size_t tam_msg;                      // Tamaño de cada mensaje de buz_ordenes
+size_t tam_elem;                     // Tamaño de cada registro
+size_t tam_msg_items;                // Tamaño de cada item de buz_items (un registro y su sello de tiempo)
+int lote = 1;                        // Número máximo de items por mensaje de buz_items
+int ordenes = 1;                     // Número de huecos que se devuelven en cada orden
+long espera_lote = ESPERA_LOTE_US * 1000L;  // Nanosegundos que se retienen como mucho los huecos pendientes
+
+int rendimiento = 0;                 // !0 para ejecutar sin esperas ni mensajes y medir items/s
+int num_datos = DATOS_A_CONSUMIR;    // Número de datos a consumir (con un solo productor y un solo consumidor)
+int capacidad;                       // Número máximo de mensajes de cada buzón (o de huecos del canal)
+int espera_max = MAX_SLEEP;          // Límite (exclusivo) en segundos de las esperas aleatorias
+
+int id_consumidor = 0;               // Identificador de este consumidor
+int num_productores = 1;             // Número de productores
+int num_consumidores = 1;            // Número de consumidores
+const char * reparto = "turno";      // Política de reparto de los productores (solo para el CSV)
+int multiple = 0;                    // !0 si hay varios productores o varios consumidores
+struct medidas * medidas = NULL;     // Latencias de traspaso de los items
+int instrumentar = 0;                // !0 para registrar los contadores de instrumentación
+struct contadores * contadores = NULL;   // Contadores de instrumentación (NULL si no se registran)
+struct contadores_hilo * cont = NULL;    // Entrada del consumidor en los contadores
 
 char historial_buzon[DATOS_A_CONSUMIR];   // Historial de mensajes recibidos
 
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"items", &num_datos, CONFIG_INT, 1, INT_MAX, "Items de cada productor (con -r, DATOS_RENDIMIENTO)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+    {"contadores", &instrumentar, CONFIG_INT, 0, 1, "1 para volcar en JSON los contadores de instrumentación"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
+
 void consumir_item(char item, int iter);        // Funcion de consumición de mensajes
 void consumidor();                              // Función que implementa el consumidor
-void imprimir_historial_buzon();                // Función para la impresión del historial
+ssize_t recibir_lote(char * mensaje, int * pendientes, struct timespec * plazo);   // Recepción de un lote
+void devolver_huecos(int * pendientes, int fin);    // Función que devuelve al productor los huecos liberados
+int liberar_hueco(int * pendientes, struct timespec * plazo, int ultimo);  // Función que libera un hueco
+void imprimir_historial_buzon(int recibidos);   // Función para la impresión del historial
 long num_elementos_buzon(char buffer);          // Función para la comprobación del vaciado y llenado de buffers
+void nombre_buzon(char * nombre, const char * base);   // Función que da nombre a los buzones del consumidor
+
+
+int main(int argc, char * argv[]) {
+    struct mq_attr attr;            // Atributos de la cola
+    int opcion;                     // Opción leída con getopt
+    char nombre[TAM_NOMBRE];        // Nombre de un buzón
+
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: transporte, modo rendimiento, lotes, volcados de la ocupación y reparto entre varios procesos
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "m:rl:o:w:s:i:n:c:d:")) != -1){
+        switch (opcion){
+            case 'm':
+                if (!strcmp(optarg, "mq")) transporte = TRANSPORTE_MQ;
+                else if (!strcmp(optarg, "shm")) transporte = TRANSPORTE_SHM;
+                else {
+                    fprintf(stderr, "Error: el transporte debe ser mq o shm\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "items")) num_datos = DATOS_RENDIMIENTO;
+                break;
+            case 'l':
+                if ((lote = atoi(optarg)) < 1 || lote > MAX_LOTE){
+                    fprintf(stderr, "Error: el tamaño de lote debe estar entre 1 y MAX_LOTE\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'o':
+                if ((ordenes = atoi(optarg)) < 1){
+                    fprintf(stderr, "Error: los huecos por orden deben ser al menos 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                if (atol(optarg) < 0){
+                    fprintf(stderr, "Error: la espera de los lotes no puede ser negativa\n");
+                    exit(EXIT_FAILURE);
+                }
+                espera_lote = atol(optarg) * 1000L;
+                break;
+            case 's':
+                periodo_ocupacion = strtoull(optarg, NULL, 10) * 1000000ULL;
+                break;
+            case 'i':
+                id_consumidor = atoi(optarg);
+                break;
+            case 'n':
+                num_productores = atoi(optarg);
+                break;
+            case 'c':
+                num_consumidores = atoi(optarg);
+                break;
+            case 'd':
+                reparto = optarg;
+                break;
+            default:
+                fprintf(stderr, "Uso: ./consumidor_FIFO [-m mq|shm] [-r] [-l lote] [-o ordenes] [-w espera_us] "
+                                "[-s periodo_ms] [-i id -n productores -c consumidores -d turno|carga|clave] "
+                                "[--parámetro=valor ...]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (num_productores < 1 || num_consumidores < 1 || num_consumidores > MAX_CONSUMIDORES || id_consumidor < 0 ||
+        id_consumidor >= num_consumidores){
+        fprintf(stderr, "Error: el identificador del consumidor debe estar entre 0 y consumidores - 1\n");
+        exit(EXIT_FAILURE);
+    }
+    multiple = num_productores > 1 || num_consumidores > 1;
+    if ((lote > 1 || ordenes > 1 || multiple) && transporte == TRANSPORTE_SHM){
+        fprintf(stderr, "Error: los lotes y los procesos múltiples solo se admiten con el transporte mq\n");
+        exit(EXIT_FAILURE);
+    }
 
-
-int main() {
     srand(time(NULL));              // Semilla para la generación de números aleatorios
 
     tam_msg = sizeof(char);         // Cada mensaje contendrá un carácter
 
+    // Con varios productores, un consumidor puede llegar a recibir todos sus items. Si aun así llegan más (por ejemplo,
+    // porque el productor se lanzó con más items), las medidas se amplían al recibirlos
+    if ((medidas = medidas_crear(num_datos * num_productores, 0)) == NULL){
+        perror("No se ha podido reservar memoria para las medidas");
+        exit(EXIT_FAILURE);
+    }
+
+    // Con el canal de memoria compartida no se usan los buzones: se abre el canal que creó el productor y el tamaño
+    // de los items se obtiene de su cabecera (cada hueco es un registro seguido de su sello de tiempo)
+    if (transporte == TRANSPORTE_SHM){
+        if ((canal = canal_abrir(NOMBRE_CANAL)) == NULL){
+            perror("No se ha podido abrir el canal de memoria compartida");
+            exit(EXIT_FAILURE);
+        }
+        // canal_abrir espera a que el productor lo haya creado y rellenado su cabecera. Una vez proyectado, se borra
+        // el nombre: el productor ya no lo necesita, y así una ejecución posterior no puede abrir el de esta
+        canal_borrar(NOMBRE_CANAL);
+        tam_msg_items = canal->tam_hueco;
+        tam_elem = tam_msg_items - sizeof(uint64_t);
+        capacidad = canal->capacidad;
+        consumidor();
+        medidas_destruir(medidas);
+        canal_cerrar(canal);
+        exit(EXIT_SUCCESS);
+    }
+
     // Se abren los buffers de recepción del productor y del consumidor, respectivamente.ç
     // Ambos fueron previamente creados por el productor.
-    buz_ordenes = mq_open("/BUZON_ORDENES", O_WRONLY);      // En el buffer de ordenes, el consumidor solo escribe.
-    buz_items = mq_open("/BUZON_ITEMS", O_RDONLY);          // En el buffer de ordenes, el consumidor solo lee.
+    nombre_buzon(nombre, "/BUZON_ORDENES");
+    buz_ordenes = mq_open(nombre, O_WRONLY);      // En el buffer de ordenes, el consumidor solo escribe.
+    nombre_buzon(nombre, "/BUZON_ITEMS");
+    buz_items = mq_open(nombre, O_RDONLY);        // En el buffer de ordenes, el consumidor solo lee.
 
     if ((buz_ordenes == -1) || (buz_items == -1)) {     // Error en la apertura de algún buffer
         perror("No se ha podido abrir los buffers del programa");
         exit(EXIT_FAILURE);
     }
+    if ((ocupacion = ocupacion_abrir(NOMBRE_OCUPACION)) == NULL){
+        perror("No se han podido abrir los contadores de ocupación");
+        exit(EXIT_FAILURE);
+    }
+
+    // El tamaño de los items y la capacidad de los buzones los decide el productor al crear buz_items. Cada mensaje
+    // lleva lote items, cada uno con su sello de tiempo.
+    if (mq_getattr(buz_items, &attr) == -1){
+        perror("No se han podido leer los atributos del buffer de items");
+        exit(EXIT_FAILURE);
+    }
+    if (attr.mq_msgsize % lote || attr.mq_msgsize / lote <= (long) sizeof(uint64_t)){
+        fprintf(stderr, "Error: el tamaño de lote no coincide con el del productor\n");
+        exit(EXIT_FAILURE);
+    }
+    tam_msg_items = attr.mq_msgsize / lote;
+    tam_elem = tam_msg_items - sizeof(uint64_t);
+    capacidad = (int) attr.mq_maxmsg;
+    if (ordenes > capacidad){
+        fprintf(stderr, "Error: los huecos por orden no pueden superar la capacidad de los buzones (%d)\n", capacidad);
+        exit(EXIT_FAILURE);
+    }
+    // Cada orden es un único char con el número de huecos que concede, así que no puede pasar de CHAR_MAX
+    if (ordenes > CHAR_MAX){
+        fprintf(stderr, "Error: los huecos por orden no pueden superar %d\n", CHAR_MAX);
+        exit(EXIT_FAILURE);
+    }
+
+    // Los contadores de instrumentación solo tienen la entrada de este consumidor
+    if (instrumentar){
+        if ((contadores = contadores_crear("consumidor_FIFO", 1)) == NULL || contadores_senal(contadores) == -1){
+            perror("No se han podido crear los contadores de instrumentación");
+            exit(EXIT_FAILURE);
+        }
+        cont = contadores_hilo(contadores, "consumidor", id_consumidor);
+    }
 
     consumidor();                 // Bucle principal del consumidor
+    if (contadores != NULL){
+        contadores_volcar(contadores, STDERR_FILENO);
+        contadores_destruir(contadores);
+    }
+    if (periodo_ocupacion) ocupacion_volcar(ocupacion, stderr, "consumidor_FIFO");
+    ocupacion_cerrar(ocupacion);
+
+    medidas_destruir(medidas);
 
     // El consumidor cierra los buzones para sí mismo
     if (mq_close(buz_ordenes) || mq_close(buz_items)){
@@ -74,102 +329,274 @@ int main() {
 void consumir_item(char item, int iter){
     long nelem;                       // Número de elementos presentes en el buzón
 
-    sleep(rand() % MAX_SLEEP);      // Espera aleatoria de 0, 1 o 2 segundos para forzar vaciado y llenado
+    if (rendimiento) return;        // En el modo rendimiento no se espera, imprime ni guarda historial
+
+    sleep(rand() % espera_max);     // Espera aleatoria (de 0 a 2 segundos por defecto) para forzar vaciado y llenado
     if ((nelem = num_elementos_buzon('C')) == 0) printf("%sCola del consumidor vacía%s\n", AZUL, RESET);
-    else if (nelem == MAX_BUFFER) printf("%sCola del consumidor llena%s\n", ROJO, RESET);
+    else if (nelem == capacidad) printf("%sCola del consumidor llena%s\n", ROJO, RESET);
 
     printf("[ITER %02d] Consumido item %c\n", iter, item);            // Imprime el mensaje recibido
-    historial_buzon[iter] = item;    // Guarda una referencia en el historial de mensajes
+    // Guarda una referencia en el historial de mensajes (con varios productores pueden llegar más de los que caben)
+    if (iter < DATOS_A_CONSUMIR) historial_buzon[iter] = item;
 }
 
 /*
  * Función principal del consumidor.
- * En primer lugar, llena el buffer del productor enviando MAX_BUFFER mensajes.
- * Luego, entra en un bucle de procesado de mensajes de DATOS_A_CONSUMIR iteraciones.
+ * En primer lugar, llena el buffer del productor enviando capacidad mensajes.
+ * Luego, entra en un bucle de procesado de mensajes que acaba con el cierre de los productores (en el modo
+ * rendimiento, se mide el tiempo desde el envío de la primera orden hasta la recepción del último cierre).
+ * Con lotes, cada iteración procesa un item del último mensaje recibido, y solo se recibe otro al agotarlo. El hueco
+ * del mensaje se devuelve al productor una vez leídos todos sus items, agrupado con otros según la opción -o.
+ * El bucle no acaba tras un número fijo de items, sino al recibir la marca de fin (un mensaje vacío, que también
+ * ocupa un hueco) de todos los productores o, con el canal, cuando canal_recibir devuelve NULL.
  */
 void consumidor() {
     char item = ' ';            // Item para el envío de datos
-    int i;          // Variable de iteración
+    int i;          // Variable de iteración (items recibidos)
+    int finales = 0;    // Productores de los que se ha recibido la marca de fin
     long nelem;     // Número de elementos presentes en la cola
+    char * mensaje;     // Mensaje en el que se recibe cada lote (tam_elem bytes y el sello por item)
+    char * registro;    // Donde se lee cada item: el mensaje o, con el canal, su hueco en la memoria compartida
+    uint64_t sello;        // Instante en que el productor envió el item
+    uint64_t t_ini;        // Instante de comienzo del intercambio de mensajes
+    int n = 0;             // Items del mensaje actual que quedan por procesar
+    int pos = 0;           // Posición en el mensaje actual del próximo item
+    int pendientes = 0;    // Huecos liberados que aún no se han devuelto al productor
+    struct timespec plazo; // Instante en que deben devolverse los huecos pendientes
+    char variante[64];     // Variante del programa en el CSV
+
+    if ((mensaje = (char *) malloc(lote * tam_msg_items)) == NULL){
+        fprintf(stderr, "Error: no se ha podido reservar memoria para los items\n");
+        exit(EXIT_FAILURE);
+    }
 
-    /* Se envían MAX_BUFFER mensajes al buffer buz_ordenes (buffer de lectura del productor).
+    /* Se envían capacidad mensajes al buffer buz_ordenes (buffer de lectura del productor).
      * Los argumentos de la función mq_send son:
      * - Cola a donde se enviará el mensaje
      * - Puntero al mensaje
      * - Tamaño del mensaje
      * - Prioridad del mensaje
-     * El consumidor siempre usará prioridad 0 en sus mensajes (ya que el contenido es irrelevante: son mensajes
-     * que únicamente sirven de indicación al productor de que hay espacio en buz_items).
+     * El consumidor siempre usará prioridad 0 en sus mensajes (son mensajes que únicamente sirven de indicación al
+     * productor de que hay espacio en buz_items, y su valor es el número de huecos que conceden).
      */
-    for (i = 0; i < MAX_BUFFER; i++) mq_send(buz_ordenes, &item, tam_msg, 0);
-    printf("Ordenes enviadas. Se ha llenado el buffer del productor\n");
+    t_ini = medidas_ns();
+    if (transporte == TRANSPORTE_SHM) canal_enviar_creditos(canal, capacidad);     // Un crédito por hueco del canal
+    else {
+        item = 1;
+        ocupacion_enviados(ocupacion, COLA_ORDENES(id_consumidor), capacidad);
+        for (i = 0; i < capacidad; i++) mq_send(buz_ordenes, &item, tam_msg, 0);
+    }
+    if (!rendimiento) printf("Ordenes enviadas. Se ha llenado el buffer del productor\n");
 
     // En cada iteración del bucle principal, se recibe un mensaje enviado por el productor, se le devuelve el item
     // (como señal de que hay hueco en el buffer del consumidor para más items) y se procesa el mensaje recibido.
-    for (i = 0; i < DATOS_A_CONSUMIR; i++){
-        if ((nelem = num_elementos_buzon('C')) == 0) printf("%sCola del consumidor vacia%s\n", AZUL, RESET);
-        else if (nelem == MAX_BUFFER) printf("%sCola del consumidor llena%s\n", ROJO, RESET);
+    for (i = 0; finales < num_productores; ){
+        if (!rendimiento){
+            if ((nelem = num_elementos_buzon('C')) == 0) printf("%sCola del consumidor vacia%s\n", AZUL, RESET);
+            else if (nelem == capacidad) printf("%sCola del consumidor llena%s\n", ROJO, RESET);
+        }
 
         // Con mq_receive se retira el mensaje más antiguo de buz_items (pues el productor tampoco usa prioridades),
-        // y se almacena en item. El tamaño es el mismo que el de los mensajes enviado por el consumidor.
+        // y se almacena en registro. Su tamaño es el de un registro completo, tam_elem.
         // La prioridad del mensaje recibido se guardaría en el cuarto argumento. La ignoramos (NULL).
         // Si no hay mensajes, el consumidor se bloquea hasta que llege uno o lo despierte una señal.
-        mq_receive(buz_items, &item, tam_msg, NULL);
-        printf("[ITER %02d] Recibido item\n", i);       // Se notifica la recepción
-        mq_send(buz_ordenes, &item, tam_msg, 0);        // Se devuelve el item al productor
-        // El contenido del item no se modifica porque igualmente, el productor no lo leerá
-        printf("[ITER %02d] Enviada petición de un nuevo item\n", i);
-        consumir_item(item, i);         // Se imprime el mensaje y se guarda en un historial
+        // Con el canal, el registro se lee directamente en su hueco de la memoria compartida.
+        // Con lotes, solo se recibe un mensaje cuando se han procesado todos los items del anterior.
+        if (transporte == TRANSPORTE_SHM){
+            if ((registro = canal_recibir(canal)) == NULL){     // El productor ha terminado y no quedan items
+                finales++;
+                continue;
+            }
+        }
+        else {
+            if (n == 0){
+                n = recibir_lote(mensaje, &pendientes, &plazo) / tam_msg_items;
+                pos = 0;
+                if (n == 0){            // Marca de fin de un productor: solo hay que liberar su hueco
+                    finales++;
+                    liberar_hueco(&pendientes, &plazo, finales == num_productores);
+                    continue;
+                }
+            }
+            registro = mensaje + pos++ * tam_msg_items;
+        }
+        memcpy(&sello, registro + tam_elem, sizeof(sello));     // El sello va a continuación del registro
+        // No se sabe de antemano cuántos items llegarán: si las medidas se llenan, se duplica su capacidad
+        if (atomic_load(&medidas->n) >= medidas->max_muestras)
+            medidas = medidas_ampliar(medidas, 2 * medidas->max_muestras);
+        medidas_registrar(medidas, medidas_ns() - sello);
+        if (!registro_comprobar(registro, tam_elem)){
+            fprintf(stderr, "Error: se ha recibido un item corrupto\n");
+            exit(EXIT_FAILURE);
+        }
+        item = *registro;       // La letra del item es la que se imprime y se guarda en el historial
+        if (!rendimiento) printf("[ITER %02d] Recibido item\n", i);       // Se notifica la recepción
+        // Se devuelve el hueco al productor. Con el canal, el hueco se libera antes de conceder el crédito, que es lo
+        // que permite al productor volver a escribir en él. Con las colas, el hueco queda libre al terminar con el
+        // mensaje, y se devuelve cuando se han acumulado ordenes huecos (uno, por defecto)
+        if (transporte == TRANSPORTE_SHM){
+            canal_liberar(canal);
+            canal_enviar_creditos(canal, 1);
+            if (!rendimiento) printf("[ITER %02d] Enviada petición de un nuevo item\n", i);
+        }
+        else if (--n == 0 && liberar_hueco(&pendientes, &plazo, 0) && !rendimiento)
+            printf("[ITER %02d] Enviada petición de un nuevo item\n", i);
+        contadores_items(cont, 1);
+        consumir_item(item, i++);       // Se imprime el mensaje y se guarda en un historial
+    }
+
+    // Con el canal, se cierran los créditos tras haber concedido el último (con las colas, el cierre lo envía
+    // liberar_hueco al procesar la última marca de fin)
+    if (transporte == TRANSPORTE_SHM) canal_terminar_creditos(canal);
+
+    // En el modo rendimiento se imprime la línea CSV en lugar del historial. Con varios procesos, cada consumidor
+    // imprime la suya con los items que ha recibido, y la variante indica los procesos y la política de reparto. Si
+    // cada orden devuelve varios huecos (-o), la variante termina en _o seguido de su número.
+    if (rendimiento){
+        if (multiple) snprintf(variante, sizeof(variante), "mpmc_%dx%d_%s", num_productores, num_consumidores, reparto);
+        else strcpy(variante, transporte == TRANSPORTE_SHM? "shm" : "fifo");
+        if (ordenes > 1) snprintf(variante + strlen(variante), sizeof(variante) - strlen(variante), "_o%d", ordenes);
+        medidas_informe(medidas, "consumidor_FIFO", variante, lote, tam_elem, i, (medidas_ns() - t_ini) / 1e9);
+        free(mensaje);
+        return;
     }
 
     printf("\n\n\n");
 
     // Al acabar, el consumidor imprime todo el historial de mensajes en orden.
     printf("Finalizados envios y recepciones. Cola de items consumidos:\n");
-    imprimir_historial_buzon();
+    imprimir_historial_buzon(i);
 
-    // El consumidor se asegura de que su buffer de recepción quede vacío
-    if (num_elementos_buzon('C')) printf("\n\nLa cola de entrada del consumidor no esta vacia\n\n");
-    while (num_elementos_buzon('C')){
-        mq_receive(buz_items, &item, tam_msg, NULL);
-        printf("Recogido item de la cola de entrada del consumidor\n");
-    }
+    // Los productores envían su marca de fin después de todos sus items, así que el buffer de recepción ya está vacío
     printf("Buffer de entrada del consumidor vacio\n\n");
+
+    free(mensaje);
+}
+
+/* Función que recibe el siguiente mensaje de buz_items. Si hay huecos pendientes de devolver, se espera como mucho
+ * hasta su plazo con mq_timedreceive: si vence sin que llegue ningún mensaje, el productor podría estar esperando
+ * esos huecos, así que se le devuelven antes de volver a esperar, esta vez sin límite.
+ * Con los contadores de instrumentación, toda la espera se registra como espera por una condición, y se anota que el
+ * buzón estaba vacío si así lo indican los contadores de ocupación.
+ * @param mensaje: Buffer de lote * tam_msg_items bytes donde se recibe el mensaje.
+ * @param pendientes: Huecos pendientes de devolver (se pone a 0 si se devuelven).
+ * @param plazo: Instante (CLOCK_REALTIME) en que deben devolverse los huecos pendientes.
+ * @return: Tamaño en bytes del mensaje recibido.
+ */
+ssize_t recibir_lote(char * mensaje, int * pendientes, struct timespec * plazo){
+    ssize_t bytes;          // Tamaño del mensaje recibido
+    uint64_t t;             // Instante de comienzo de la espera (contadores de instrumentación)
+
+    if (cont != NULL && ocupacion_profundidad(ocupacion, COLA_ITEMS(id_consumidor)) == 0) contadores_vacio(cont);
+    t = contadores_inicio(cont);
+    if (*pendientes > 0){
+        if ((bytes = mq_timedreceive(buz_items, mensaje, lote * tam_msg_items, NULL, plazo)) != -1){
+            contadores_tiempo(cont, CONTADORES_ESPERA, t);
+            ocupacion_recibidos(ocupacion, COLA_ITEMS(id_consumidor), 1);
+            return bytes;
+        }
+        if (errno != ETIMEDOUT){
+            perror("Error en la recepción de un lote");
+            exit(EXIT_FAILURE);
+        }
+        devolver_huecos(pendientes, 0);
+    }
+    if ((bytes = mq_receive(buz_items, mensaje, lote * tam_msg_items, NULL)) == -1){
+        perror("Error en la recepción de un lote");
+        exit(EXIT_FAILURE);
+    }
+    contadores_tiempo(cont, CONTADORES_ESPERA, t);
+    ocupacion_recibidos(ocupacion, COLA_ITEMS(id_consumidor), 1);
+    return bytes;
+}
+
+/* Función que devuelve al productor, en una sola orden, los huecos de buz_items que el consumidor ha liberado. Tras
+ * la última marca de fin ya ningún productor necesita huecos, así que en su lugar se envía el cierre de las órdenes,
+ * un mensaje vacío.
+ * @param pendientes: Huecos pendientes de devolver (se pone a 0).
+ * @param fin: !0 para enviar el cierre de las órdenes.
+ */
+void devolver_huecos(int * pendientes, int fin){
+    char orden = (char) *pendientes;    // El valor de la orden es el número de huecos que concede
+
+    ocupacion_enviados(ocupacion, COLA_ORDENES(id_consumidor), 1);
+    mq_send(buz_ordenes, &orden, fin? 0 : tam_msg, 0);
+    *pendientes = 0;
+}
+
+/* Función que anota como libre el hueco del último mensaje procesado y, cuando se han acumulado ordenes huecos (uno,
+ * por defecto) o se trata del último mensaje, los devuelve al productor (tras el último, en forma de cierre).
+ * @param pendientes: Huecos pendientes de devolver.
+ * @param plazo: Instante (CLOCK_REALTIME) en que deben devolverse los huecos pendientes. Se fija con el primero.
+ * @param ultimo: !0 si no se recibirán más mensajes.
+ * @return: !0 si se han devuelto los huecos.
+ */
+int liberar_hueco(int * pendientes, struct timespec * plazo, int ultimo){
+    int devueltos = 0;
+
+    if ((*pendientes)++ == 0){      // Primer hueco pendiente: a partir de ahora se cuenta la espera máxima
+        clock_gettime(CLOCK_REALTIME, plazo);
+        plazo->tv_nsec += espera_lote % 1000000000L;
+        plazo->tv_sec += espera_lote / 1000000000L + plazo->tv_nsec / 1000000000L;
+        plazo->tv_nsec %= 1000000000L;
+    }
+    if (*pendientes >= ordenes || ultimo){
+        devolver_huecos(pendientes, ultimo);
+        devueltos = 1;
+    }
+    ocupacion_volcar_periodico(ocupacion, stderr, "consumidor_FIFO", periodo_ocupacion, &proximo_volcado);
+    return devueltos;
 }
 
 /* Función que muestra todos los mensajes recibidos por el consumidor a lo largo del programa, para facilitar la
  * comprobación de la validez del resultado.
+ * @param recibidos: número de mensajes recibidos (con varios productores, no se muestran más de DATOS_A_CONSUMIR).
  */
-void imprimir_historial_buzon(){
+void imprimir_historial_buzon(int recibidos){
     int i, j;
 
+    if (recibidos > DATOS_A_CONSUMIR) recibidos = DATOS_A_CONSUMIR;
     // Se imprime el historial en líneas de 10 mensajes
-    for (i = 0; i < DATOS_A_CONSUMIR; i += 10){
+    for (i = 0; i < recibidos; i += 10){
         printf("ITER -> ");         // Título de la línea (iteración)
         // En la condicion de finalizacion se comprueba que j no alcance el tamaño del historial
-        for (j = i; j < i + 10 && j < DATOS_A_CONSUMIR; j++) printf("%02d ", j);
+        for (j = i; j < i + 10 && j < recibidos; j++) printf("%02d ", j);
 
         printf("\nITEM -> ");       // Contenido de la línea (mensaje)
-        for (j = i; j < i + 10 && j < DATOS_A_CONSUMIR; j++) printf(" %c ", historial_buzon[j]);
+        for (j = i; j < i + 10 && j < recibidos; j++) printf(" %c ", historial_buzon[j]);
 
         printf("\n\n");
     }
 }
 
-/* Función que comprueba el número de elementos presentes en un buzón.
+/* Función que comprueba el número de elementos presentes en un buzón, leyendo los contadores de ocupación (sin
+ * llamadas al sistema).
+ * Con el canal de memoria compartida, se leen directamente los contadores de créditos e items.
  * @param buffer 'P' para analizar buz_ordenes, 'C' para analizar buz_items.
  * @return El número de items del buzón indicado o -1 en caso de entrada no definida.
  */
 long num_elementos_buzon(char buffer){
-    struct mq_attr attr;    // Estructura para almacenar la configuración de la cola de mensajes
+    if (transporte == TRANSPORTE_SHM){
+        if (buffer == 'P') return canal_creditos(canal);
+        if (buffer == 'C') return canal_items(canal);
+        return -1;
+    }
 
     switch(buffer){
         case 'P':
-            mq_getattr(buz_ordenes, &attr);     // Se leen los atributos de buz_ordenes
-            return attr.mq_curmsgs;             // Se accede al número de mensajes actuales
+            return ocupacion_profundidad(ocupacion, COLA_ORDENES(id_consumidor));  // Mensajes actuales de buz_ordenes
         case 'C':
-            mq_getattr(buz_items, &attr);
-            return attr.mq_curmsgs;
+            return ocupacion_profundidad(ocupacion, COLA_ITEMS(id_consumidor));
     }
     return -1;
 }
+
+/* Función que da nombre a los buzones del consumidor: el nombre base si solo hay uno, o el nombre base seguido de _id
+ * si hay varios.
+ * @param nombre: cadena de TAM_NOMBRE bytes donde se guarda el nombre.
+ * @param base: nombre base del buzón ("/BUZON_ORDENES" o "/BUZON_ITEMS").
+ */
+void nombre_buzon(char * nombre, const char * base){
+    if (num_consumidores > 1) snprintf(nombre, TAM_NOMBRE, "%s_%d", base, id_consumidor);
+    else snprintf(nombre, TAM_NOMBRE, "%s", base);
+}
@@ -3,6 +3,14 @@
 #include <mqueue.h>
 #include <unistd.h>
 #include <time.h>
+#include <string.h>
+#include <limits.h>
+#include "../comun/buffer.h"
+#include "../comun/medidas.h"
+#include "../comun/ocupacion.h"
+#include "../comun/canal.h"
+#include "../comun/config.h"
+#include "../comun/contadores.h"
 
 
 // Colores para mostrar la evolución de las prioridades de los mensajes
@@ -21,34 +29,160 @@
  *
  * Para compilar se debe usar la opción -lrt.
  * El productor debe comezar a ejecutarse antes del consumidor.
+ *
+ * Cada item es un registro (módulo comun/buffer) cuyo tamaño fija el productor con la opción -t. El consumidor lo
+ * obtiene de los atributos de buz_items, recibe cada registro y comprueba que llegue completo. Tras el registro, cada
+ * mensaje lleva el instante en que el productor lo envió, a partir del cual se calcula la latencia de traspaso.
+ *
+ * Con la opción -m shm, se usa la pila de memoria compartida (módulo comun/canal) que crea el productor: el
+ * consumidor desapila el último item publicado y lo lee en su hueco, sin copiarlo. En lugar de la prioridad, se
+ * muestra la iteración del productor, que viaja en el hueco tras el sello de tiempo (con las colas, ambas coinciden).
+ *
+ * El consumidor no cuenta los items: recibe hasta encontrar el cierre del productor (un mensaje vacío o, con la pila,
+ * NULL en canal_recibir), que llega después de todos los items, de modo que su buzón queda vacío sin consultarlo.
+ * Después cierra las órdenes: en lugar de devolver el hueco del cierre envía un mensaje vacío a buz_ordenes (con la
+ * pila, llama a canal_terminar_creditos), con el que el productor sabe que ya ha terminado.
+ *
+ * Uso: ./consumidor_LIFO [-m mq|shm] [-r] [-k items] [-s periodo_ms]
+ *  -m: transporte de las órdenes y los items: colas de mensajes POSIX con prioridades (mq, por defecto) o pila en un
+ *      canal de memoria compartida (shm). Debe coincidir con el del productor.
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, se consumen DATOS_RENDIMIENTO items y al final se
+ *      imprime una línea CSV (módulo comun/medidas) con los items/s, los percentiles de latencia y los cambios de
+ *      contexto del consumidor. El productor debe ejecutarse también con -r.
+ *  -k: número de items, igual que --items. Solo fija la reserva inicial de las medidas, que crecen si llegan más.
+ *  -s: cada cuántos milisegundos se imprime por la salida de error la ocupación de los buzones (profundidad, máximo y
+ *      veces que se han llenado y vaciado). Al acabar se imprime una última vez. Solo con el transporte mq.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra): --items (número de items, como -k y como en el productor;
+ * solo fija la reserva inicial de las medidas de latencia, que se amplían si llegan más) y --espera_max (las
+ * esperas duran de 0 a espera_max - 1 segundos). La capacidad de los buzones o de la pila la fija el productor, y el
+ * consumidor la lee al abrirlos. También se leen de las variables SOII_NOMBRE.
+ * Con --contadores=1, se registra cuánto espera el consumidor en mq_receive a que le lleguen items, cuántas veces
+ * encuentra vacío su buzón y cuántos items recibe (módulo comun/contadores). Los contadores se vuelcan en JSON por la
+ * salida de error al acabar y cada vez que el proceso recibe SIGUSR2. Solo con el transporte mq.
  */
 
 
-#define MAX_BUFFER 5                         // Tamaño del buffer
-#define DATOS_A_CONSUMIR 52                  // Número de datos a producir/consumir
-#define MAX_SLEEP 3                          // Duración máxima de un sleep
+#define DATOS_A_CONSUMIR 52                  // Número de datos a producir/consumir (y máximo del historial)
+#define DATOS_RENDIMIENTO 30000              // Número de datos por defecto en el modo rendimiento
+#define MAX_SLEEP 3                          // Duración máxima de un sleep (por defecto)
+
+#define NOMBRE_OCUPACION "/OCUPACION_BUZONES"    // Objeto de memoria compartida con la ocupación de los buzones
+#define COLA_ORDENES 0                       // Índice de buz_ordenes en los contadores de ocupación
+#define COLA_ITEMS 1                         // Índice de buz_items en los contadores de ocupación
+
+#define TRANSPORTE_MQ 0                      // Órdenes e items viajan por colas de mensajes POSIX con prioridades
+#define TRANSPORTE_SHM 1                     // Órdenes e items viajan por una pila de memoria compartida
+#define NOMBRE_CANAL "/PILA_ITEMS"           // Nombre del objeto de memoria compartida de la pila
 
 
 mqd_t buz_ordenes;                   // Pila de entrada de mensajes para el productor
 mqd_t buz_items;                     // Pila de entrada de mensajes para el consumidor
-
-size_t tam_msg;                      // Tamaño de cada mensaje
+struct ocupacion * ocupacion = NULL; // Contadores de ocupación de los buzones
+uint64_t periodo_ocupacion = 0;      // Nanosegundos entre dos volcados de la ocupación (0 si no se vuelca)
+uint64_t proximo_volcado = 0;        // Instante del próximo volcado de la ocupación
+struct canal * canal = NULL;         // Pila de memoria compartida (solo con TRANSPORTE_SHM)
+int transporte = TRANSPORTE_MQ;      // Transporte de las órdenes y los items
+
+size_t tam_msg;                      // Tamaño de cada mensaje de buz_ordenes
+size_t tam_elem;                     // Tamaño de cada registro
+size_t tam_msg_items;                // Tamaño de cada mensaje de buz_items (un registro y su sello de tiempo)
+
+int rendimiento = 0;                 // !0 para ejecutar sin esperas ni mensajes y medir items/s
+int num_datos = DATOS_A_CONSUMIR;    // Número de datos a consumir
+int capacidad;                       // Número máximo de mensajes de cada buzón (o de huecos de la pila)
+int espera_max = MAX_SLEEP;          // Límite (exclusivo) en segundos de las esperas aleatorias
+struct medidas * medidas = NULL;     // Latencias de traspaso de los items
+int instrumentar = 0;                // !0 para registrar los contadores de instrumentación
+struct contadores * contadores = NULL;   // Contadores de instrumentación (NULL si no se registran)
+struct contadores_hilo * cont = NULL;    // Entrada del consumidor en los contadores
 
 char consumiciones[DATOS_A_CONSUMIR];           // Historial de mensajes consumidos
 int prioridades[DATOS_A_CONSUMIR];              // Historial de la prioridad asociada a cada mensaje consumido
 
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"items", &num_datos, CONFIG_INT, 1, INT_MAX, "Número de items (como -k; con -r, DATOS_RENDIMIENTO)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+    {"contadores", &instrumentar, CONFIG_INT, 0, 1, "1 para volcar en JSON los contadores de instrumentación"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
+
 
 void consumir_item(char item, int iter, int prio);       // Funcion de consumición de mensajes
 void consumidor();                              // Función que implementa el consumidor
-void imprimir_historial_buzon();                // Función para la impresión del historial
+void imprimir_historial_buzon(int recibidos);   // Función para la impresión del historial
 long num_elementos_buzon(char buffer);          // Función para la comprobación del vaciado y llenado de buffers
 
 
-int main() {
+int main(int argc, char * argv[]) {
+    struct mq_attr attr;            // Atributos de la cola
+    int opcion;                     // Opción leída con getopt
+    int items_fijados;              // !0 si el número de items se ha indicado (con --items o -k)
+
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: transporte, modo rendimiento, número de items y periodo de los volcados de la ocupación
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    items_fijados = config_fijado(config, NUM_CONFIG, "items");
+    while ((opcion = getopt(argc, argv, "m:rk:s:")) != -1){
+        switch (opcion){
+            case 'm':
+                if (!strcmp(optarg, "mq")) transporte = TRANSPORTE_MQ;
+                else if (!strcmp(optarg, "shm")) transporte = TRANSPORTE_SHM;
+                else {
+                    fprintf(stderr, "Error: el transporte debe ser mq o shm\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                rendimiento = 1;
+                break;
+            case 'k':               // Forma abreviada de --items
+                if ((num_datos = atoi(optarg)) < 1){
+                    fprintf(stderr, "Error: el número de items debe ser positivo\n");
+                    exit(EXIT_FAILURE);
+                }
+                items_fijados = 1;
+                break;
+            case 's':
+                periodo_ocupacion = strtoull(optarg, NULL, 10) * 1000000ULL;
+                break;
+            default:
+                fprintf(stderr, "Uso: ./consumidor_LIFO [-m mq|shm] [-r] [-k items] [-s periodo_ms] "
+                                "[--parámetro=valor ...]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (rendimiento && !items_fijados) num_datos = DATOS_RENDIMIENTO;
+
     srand(time(NULL));              // Semilla para la generación de números aleatorios
 
     tam_msg = sizeof(char);         // Cada mensaje contendrá un carácter
 
+    if ((medidas = medidas_crear(num_datos, 0)) == NULL){
+        perror("No se ha podido reservar memoria para las medidas");
+        exit(EXIT_FAILURE);
+    }
+
+    // Con la pila de memoria compartida no se usan los buzones: se abre la que creó el productor y el tamaño de los
+    // items se obtiene de su cabecera (cada hueco es un registro seguido de su sello de tiempo y de su iteración)
+    if (transporte == TRANSPORTE_SHM){
+        if ((canal = canal_abrir(NOMBRE_CANAL)) == NULL){
+            perror("No se ha podido abrir la pila de memoria compartida");
+            exit(EXIT_FAILURE);
+        }
+        // canal_abrir espera a que el productor lo haya creado y rellenado su cabecera. Una vez proyectado, se borra
+        // el nombre: el productor ya no lo necesita, y así una ejecución posterior no puede abrir el de esta
+        canal_borrar(NOMBRE_CANAL);
+        tam_msg_items = canal->tam_hueco - sizeof(uint32_t);
+        tam_elem = tam_msg_items - sizeof(uint64_t);
+        capacidad = canal->capacidad;
+        consumidor();
+        medidas_destruir(medidas);
+        canal_cerrar(canal);
+        exit(EXIT_SUCCESS);
+    }
+
     // Se abren los buffers de recepción del productor y del consumidor, respectivamente.ç
     // Ambos fueron previamente creados por el productor.
     buz_ordenes = mq_open("/BUZON_ORDENES", O_WRONLY);      // En el buffer de ordenes, el consumidor solo escribe.
@@ -58,8 +192,39 @@ int main() {
         perror("No se ha podido abrir los buffers del programa");
         exit(EXIT_FAILURE);
     }
+    if ((ocupacion = ocupacion_abrir(NOMBRE_OCUPACION)) == NULL){
+        perror("No se han podido abrir los contadores de ocupación");
+        exit(EXIT_FAILURE);
+    }
+
+    // El tamaño de los items y la capacidad de los buzones los decide el productor al crear buz_items. Cada mensaje
+    // lleva además el sello de tiempo.
+    if (mq_getattr(buz_items, &attr) == -1){
+        perror("No se han podido leer los atributos del buffer de items");
+        exit(EXIT_FAILURE);
+    }
+    tam_msg_items = attr.mq_msgsize;
+    tam_elem = tam_msg_items - sizeof(uint64_t);
+    capacidad = (int) attr.mq_maxmsg;
+
+    // Los contadores de instrumentación solo tienen la entrada de este consumidor
+    if (instrumentar){
+        if ((contadores = contadores_crear("consumidor_LIFO", 1)) == NULL || contadores_senal(contadores) == -1){
+            perror("No se han podido crear los contadores de instrumentación");
+            exit(EXIT_FAILURE);
+        }
+        cont = contadores_hilo(contadores, "consumidor", 0);
+    }
 
     consumidor();                 // Bucle principal del consumidor
+    if (contadores != NULL){
+        contadores_volcar(contadores, STDERR_FILENO);
+        contadores_destruir(contadores);
+    }
+    if (periodo_ocupacion) ocupacion_volcar(ocupacion, stderr, "consumidor_LIFO");
+    ocupacion_cerrar(ocupacion);
+
+    medidas_destruir(medidas);
 
     // El consumidor cierra ambos buzones (el productor los cierra y elimina)
     if (mq_close(buz_ordenes) || mq_close(buz_items)){
@@ -79,13 +244,17 @@ int main() {
 void consumir_item(char item, int iter, int prio){
     long nelem;     // Número de elementos presentes en la cola
 
-    sleep(rand() % MAX_SLEEP);       // Espera aleatoria de 0, 1 o 2 segundos para forzar vaciado y llenado
+    if (rendimiento) return;        // En el modo rendimiento no se espera, imprime ni guarda historial
+
+    sleep(rand() % espera_max);      // Espera aleatoria (de 0 a 2 segundos por defecto) para forzar vaciado y llenado
     if ((nelem = num_elementos_buzon('C')) == 0) printf("%sCola del consumidor vacia%s\n", AZUL, RESET);
-    else if (nelem == MAX_BUFFER) printf("%sCola del consumidor llena%s\n", ROJO, RESET);
+    else if (nelem == capacidad) printf("%sCola del consumidor llena%s\n", ROJO, RESET);
 
     printf("[ITER %02d] Consumido item %c con prioridad %d\n", iter, item, prio);
-    consumiciones[iter] = item;         // Se guarda el contenido del mensaje
-    prioridades[iter] = prio;           // Se guarda la prioridad asociada al mensaje
+    if (iter < DATOS_A_CONSUMIR){
+        consumiciones[iter] = item;     // Se guarda el contenido del mensaje
+        prioridades[iter] = prio;       // Se guarda la prioridad asociada al mensaje
+    }
 }
 
 /* Función que muestra todos los mensajes recibidos por el consumidor a lo largo del programa, para facilitar la
@@ -94,22 +263,25 @@ void consumir_item(char item, int iter, int prio){
  * - Color predeterminado de la consola: primer mensaje
  * - Azul: prioridad menor que el item anterior
  * - Rojo: prioridad mayor que el item anterior
+ * @param recibidos: número de mensajes recibidos (no se muestran más de DATOS_A_CONSUMIR).
  */
-void imprimir_historial_buzon(){
+void imprimir_historial_buzon(int recibidos){
     int i, j;
     char * color;
 
+    if (recibidos > DATOS_A_CONSUMIR) recibidos = DATOS_A_CONSUMIR;
+
     // Se imprime el historial en líneas de 10 mensajes
-    for (i = 0; i < DATOS_A_CONSUMIR; i += 10){
+    for (i = 0; i < recibidos; i += 10){
         printf("ITER -> ");         // Título de la línea (iteración)
         // En la condicion de finalizacion se comprueba que j no alcance el tamaño del historial
-        for (j = i; j < i + 10 && j < DATOS_A_CONSUMIR; j++) printf("%02d ", j);
+        for (j = i; j < i + 10 && j < recibidos; j++) printf("%02d ", j);
 
         printf("\nITEM -> ");       // Contenido del mensaje
-        for (j = i; j < i + 10 && j < DATOS_A_CONSUMIR; j++) printf(" %c ", consumiciones[j]);
+        for (j = i; j < i + 10 && j < recibidos; j++) printf(" %c ", consumiciones[j]);
 
         printf("\nPRIO -> ");       // Prioridad del mensaje
-        for (j = i; j < i + 10 && j < DATOS_A_CONSUMIR; j++){
+        for (j = i; j < i + 10 && j < recibidos; j++){
 
             // No hay dos items con la misma prioridad por construcción del código
             if (j == 0) color = RESET;      // Color predeterminado
@@ -124,16 +296,29 @@ void imprimir_historial_buzon(){
 
 /*
  * Función principal del consumidor.
- * En primer lugar, llena el buffer del productor enviando MAX_BUFFER mensajes.
- * Luego, entra en un bucle de procesado de mensajes de DATOS_A_CONSUMIR iteraciones.
+ * En primer lugar, llena el buffer del productor enviando capacidad mensajes.
+ * Luego, entra en un bucle de procesado de mensajes que acaba con el cierre del productor (en el modo rendimiento, se
+ * mide el tiempo desde el envío de la primera orden hasta la recepción del cierre).
  */
 void consumidor() {
     char item = ' ';            // Item para el envío de datos
     int i;                      // Variable de iteración
     unsigned int prio;          // Prioridad de los mensajes recibidos
     long nelem;                 // Número de elementos presentes en la cola
+    char * mensaje;             // Mensaje en el que se recibe cada item (tam_elem bytes y el sello)
+    char * registro;            // Donde se lee cada item: el mensaje o, con la pila, su hueco en la memoria compartida
+    uint32_t iteracion;         // Iteración del item, que con la pila sustituye a la prioridad
+    uint64_t sello;                // Instante en que el productor envió el item
+    uint64_t t_ini;                // Instante de comienzo del intercambio de mensajes
+    ssize_t bytes;                 // Tamaño del mensaje recibido (0 para el cierre del productor)
+    uint64_t t;                    // Instante de comienzo de la espera (contadores de instrumentación)
+
+    if ((mensaje = (char *) malloc(tam_msg_items)) == NULL){
+        fprintf(stderr, "Error: no se ha podido reservar memoria para los items\n");
+        exit(EXIT_FAILURE);
+    }
 
-    /* Se envían MAX_BUFFER mensajes al buffer buz_ordenes (buffer de lectura del productor).
+    /* Se envían capacidad mensajes al buffer buz_ordenes (buffer de lectura del productor).
      * Los argumentos de la función mq_send son:
      * - Cola a donde se enviará el mensaje
      * - Puntero al mensaje
@@ -142,60 +327,125 @@ void consumidor() {
      * El consumidor siempre usará prioridad 0 en sus mensajes (ya que el contenido es irrelevante: son mensajes
      * que únicamente sirven de indicación al productor de que hay espacio en buz_items).
      */
-    for (i = 0; i < MAX_BUFFER; i++) mq_send(buz_ordenes, &item, tam_msg, 0);
-    printf("Ordenes enviadas. Se ha llenado el buffer del productor\n");
+    t_ini = medidas_ns();
+    if (transporte == TRANSPORTE_SHM) canal_enviar_creditos(canal, capacidad);     // Un crédito por hueco de la pila
+    else {
+        ocupacion_enviados(ocupacion, COLA_ORDENES, capacidad);
+        for (i = 0; i < capacidad; i++) mq_send(buz_ordenes, &item, tam_msg, 0);
+    }
+    if (!rendimiento) printf("Ordenes enviadas. Se ha llenado el buffer del productor\n");
 
-    for (i = 0; i < DATOS_A_CONSUMIR; i++){
-        if ((nelem = num_elementos_buzon('C')) == 0) printf("%sCola del consumidor vacia%s\n", AZUL, RESET);
-        else if (nelem == MAX_BUFFER) printf("%sCola del consumidor llena%s\n", ROJO, RESET);
+    for (i = 0; ; i++){
+        if (!rendimiento){
+            if ((nelem = num_elementos_buzon('C')) == 0) printf("%sCola del consumidor vacia%s\n", AZUL, RESET);
+            else if (nelem == capacidad) printf("%sCola del consumidor llena%s\n", ROJO, RESET);
+        }
 
         /* Con mq_receive se retira el mensaje de mayor prioridad que haya llegado a buz_items. En caso de empate, se
          * tomaría el más antiguo, pero por la implementación usada en el productor, todos los items tendrán una
          * prioridad distinta (e igual a la correspondiente iteración en la que se encuentre el productor).
          * Nótese que el orden en el que los mensajes llegan al consumidor no tiene por qué corresponderse con el
          * orden en el que el productor los envía.
-         * El contenido del item, que tiene tamaño tam_msg, se almacena en la variable item.
+         * El contenido del item, un registro de tamaño tam_elem, se almacena en registro.
          * La prioridad se guarda en prio.
          *
          * Si no había mensajes en buz_items, el consumidor se bloquea hasta que llege uno o lo despierte una señal.
+         * Con los contadores de instrumentación, la espera se registra como espera por una condición, y se anota que
+         * el buzón estaba vacío si así lo indican los contadores de ocupación.
+         *
+         * Con la pila de memoria compartida, se desapila el último hueco publicado y el item se lee en él.
+         *
+         * El bucle acaba al recibir el cierre del productor: un mensaje vacío o, con la pila, NULL.
          */
-        mq_receive(buz_items, &item, tam_msg, &prio);
-        printf("[ITER %02d] Recibido item\n", i);
-        mq_send(buz_ordenes, &item, tam_msg, 0);   // Se devuelve el item al productor
+        if (transporte == TRANSPORTE_SHM){
+            if ((registro = canal_recibir(canal)) == NULL) break;
+            memcpy(&iteracion, registro + tam_msg_items, sizeof(iteracion));
+            prio = iteracion;
+        }
+        else {
+            registro = mensaje;
+            if (cont != NULL && ocupacion_profundidad(ocupacion, COLA_ITEMS) == 0) contadores_vacio(cont);
+            t = contadores_inicio(cont);
+            if ((bytes = mq_receive(buz_items, registro, tam_msg_items, &prio)) == -1){
+                perror("Error en la recepción de un item");
+                exit(EXIT_FAILURE);
+            }
+            contadores_tiempo(cont, CONTADORES_ESPERA, t);
+            ocupacion_recibidos(ocupacion, COLA_ITEMS, 1);
+            if (bytes == 0) break;
+            contadores_items(cont, 1);
+        }
+        memcpy(&sello, registro + tam_elem, sizeof(sello));     // El sello va a continuación del registro
+        // No se sabe de antemano cuántos items llegarán: si las medidas se llenan, se duplica su capacidad
+        if (atomic_load(&medidas->n) >= medidas->max_muestras)
+            medidas = medidas_ampliar(medidas, 2 * medidas->max_muestras);
+        medidas_registrar(medidas, medidas_ns() - sello);
+        if (!registro_comprobar(registro, tam_elem)){
+            fprintf(stderr, "Error: se ha recibido un item corrupto\n");
+            exit(EXIT_FAILURE);
+        }
+        item = *registro;       // La letra del item es la que se imprime y se guarda en el historial
+        if (!rendimiento) printf("[ITER %02d] Recibido item\n", i);
+        // Con la pila, el hueco se libera antes de conceder el crédito, que es lo que permite al productor reutilizarlo
+        if (transporte == TRANSPORTE_SHM){
+            canal_liberar(canal);
+            canal_enviar_creditos(canal, 1);
+        }
+        else {
+            ocupacion_enviados(ocupacion, COLA_ORDENES, 1);
+            mq_send(buz_ordenes, &item, tam_msg, 0);   // Se devuelve el item al productor
+            ocupacion_volcar_periodico(ocupacion, stderr, "consumidor_LIFO", periodo_ocupacion, &proximo_volcado);
+        }
         // El contenido del item no se modifica porque igualmente, el productor no lo leerá
-        printf("[ITER %02d] Enviada petición de un nuevo item\n", i);
+        if (!rendimiento) printf("[ITER %02d] Enviada petición de un nuevo item\n", i);
         consumir_item(item, i, prio);               // Se imprime el mensaje y se guarda en un historial
     }
 
+    // Se cierran las órdenes. Con las colas, el cierre ocupa el hueco que liberó el mensaje vacío del productor
+    if (transporte == TRANSPORTE_SHM) canal_terminar_creditos(canal);
+    else {
+        ocupacion_enviados(ocupacion, COLA_ORDENES, 1);
+        mq_send(buz_ordenes, &item, 0, 0);
+    }
+
+    // En el modo rendimiento se imprime la línea CSV en lugar del historial
+    if (rendimiento){
+        medidas_informe(medidas, "consumidor_LIFO", transporte == TRANSPORTE_SHM? "lifo_shm" : "lifo", 1, tam_elem,
+                        i, (medidas_ns() - t_ini) / 1e9);
+        free(mensaje);
+        return;
+    }
+
     printf("\n\n\n");
 
     // Al acabar, el consumidor imprime todo el historial de mensajes en orden.
     printf("Finalizados envios y recepciones. Lista de items consumidos:\n");
-    imprimir_historial_buzon();
+    imprimir_historial_buzon(i);
 
-    // El consumidor se asegura de que su buffer de recepción quede vacío
-    if (num_elementos_buzon('C')) printf("\n\nEl buffer de entrada del consumidor no esta vacio\n\n");
-    while (num_elementos_buzon('C')){
-        mq_receive(buz_items, &item, tam_msg, NULL);
-        printf("Recogido item del buffer de entrada del consumidor\n");
-    }
+    // El cierre del productor es el último mensaje en recibirse, así que el buffer de recepción ya está vacío
     printf("Buffer de entrada del consumidor vacio\n\n");
+
+    free(mensaje);
 }
 
-/* Función que comprueba el número de elementos presentes en un buzón.
+/* Función que comprueba el número de elementos presentes en un buzón, leyendo los contadores de ocupación (sin
+ * llamadas al sistema).
+ * Con la pila de memoria compartida, se leen directamente los contadores de créditos e items.
  * @param buffer 'P' para analizar buz_ordenes, 'C' para analizar buz_items.
  * @return El número de items del buzón indicado o -1 en caso de entrada no definida.
  */
 long num_elementos_buzon(char buffer){
-    struct mq_attr attr;    // Estructura para almacenar la configuración de la cola de mensajes
+    if (transporte == TRANSPORTE_SHM){
+        if (buffer == 'P') return canal_creditos(canal);
+        if (buffer == 'C') return canal_items(canal);
+        return -1;
+    }
 
     switch(buffer){
         case 'P':
-            mq_getattr(buz_ordenes, &attr);     // Se leen los atributos de buz_ordenes
-            return attr.mq_curmsgs;             // Se accede al número de mensajes actuales
+            return ocupacion_profundidad(ocupacion, COLA_ORDENES);     // Mensajes actuales de buz_ordenes
         case 'C':
-            mq_getattr(buz_items, &attr);
-            return attr.mq_curmsgs;
+            return ocupacion_profundidad(ocupacion, COLA_ITEMS);
     }
     return -1;
 }
@@ -3,6 +3,15 @@
 #include <mqueue.h>
 #include <unistd.h>
 #include <time.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include "../comun/buffer.h"
+#include "../comun/medidas.h"
+#include "../comun/ocupacion.h"
+#include "../comun/canal.h"
+#include "../comun/config.h"
+#include "../comun/contadores.h"
 
 
 /* Xiana Carrera Alonso
@@ -16,6 +25,61 @@
  *
  * Para compilar se debe usar la opción -lrt.
  * El productor debe comezar a ejecutarse antes del consumidor.
+ *
+ * Cada item es un registro de tam_elem bytes (módulo comun/buffer), que se genera en su mensaje y se envía al
+ * consumidor tal cual. Tras el registro, el mensaje lleva el instante de envío (un uint64_t obtenido con
+ * medidas_ns), con el que el consumidor calcula la latencia de traspaso. Las órdenes del consumidor son mensajes de
+ * un solo carácter, cuyo valor es el número de huecos de buz_items que conceden.
+ *
+ * Con la opción -l, cada mensaje de buz_items agrupa hasta lote items (registro y sello, uno tras otro) y cada orden
+ * sirve para enviar un mensaje completo. El productor envía el lote cuando se llena, cuando genera el último item o
+ * cuando han pasado más de espera_us microsegundos (opción -w) desde que empezó a llenarlo. El plazo se respeta
+ * también mientras el productor está bloqueado esperando una orden (mq_timedreceive) o en su espera aleatoria, que se
+ * interrumpen para enviar los lotes que vencen.
+ *
+ * Con la opción -m shm, las colas de mensajes se sustituyen por un canal de memoria compartida (módulo comun/canal):
+ * los créditos (órdenes) son un contador atómico y cada item se genera directamente en su hueco del anillo compartido,
+ * sin copias en el núcleo. Los procesos solo hacen llamadas al sistema para bloquearse o despertar al otro.
+ *
+ * Al acabar, el productor cierra el flujo de items: con las colas, envía a cada consumidor un mensaje vacío (que
+ * también ocupa un hueco), y con el canal llama a canal_terminar_envios. El consumidor recibe los items que queden y
+ * termina al encontrar el cierre, sin necesidad de saber cuántos items le llegarán. A su vez, el consumidor cierra las
+ * órdenes (con un mensaje vacío en buz_ordenes o canal_terminar_creditos), y el productor recoge las que queden hasta
+ * encontrar ese cierre, en lugar de esperar un tiempo fijo a que el consumidor acabe.
+ *
+ * Con las opciones -n y -c pueden ejecutarse varios productores y varios consumidores a la vez. Cada consumidor j tiene
+ * su propio buzón de items y su propio buzón de órdenes (/BUZON_ITEMS_j y /BUZON_ORDENES_j), y cada productor elige
+ * para cada item un consumidor según la política de reparto (opción -d), tomando la orden del buzón de ese
+ * consumidor. Al acabar, cada productor envía a cada consumidor el mensaje vacío que marca el fin de sus items.
+ * El productor 0 crea todos los buzones, así que debe lanzarse antes que los demás, y estos antes que los consumidores.
+ *
+ * Uso: ./productor_FIFO [-m mq|shm] [-r] [-t tam_elem] [-l lote] [-w espera_us] [-s periodo_ms]
+ *                       [-i id -n productores -c consumidores -d turno|carga|clave]
+ *  -m: transporte de las órdenes y los items: colas de mensajes POSIX (mq, por defecto) o canal de memoria compartida
+ *      (shm). El consumidor debe usar el mismo.
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes y se producen DATOS_RENDIMIENTO items. El consumidor
+ *      debe ejecutarse también con -r.
+ *  -t: tamaño en bytes de cada item (1 por defecto). Sumado al sello de tiempo, no puede superar
+ *      /proc/sys/fs/mqueue/msgsize_max.
+ *  -l: número máximo de items por mensaje (1 por defecto, hasta MAX_LOTE; solo con el transporte mq). El consumidor
+ *      debe usar el mismo. El mensaje completo (lote * (tam_elem + 8) bytes) no puede superar msgsize_max.
+ *  -w: máximo de microsegundos que se retiene un lote incompleto antes de enviarlo (ESPERA_LOTE_US por defecto).
+ *  -s: cada cuántos milisegundos se imprime por la salida de error la ocupación de los buzones (profundidad, máximo y
+ *      veces que se han llenado y vaciado). Al acabar se imprime una última vez.
+ *      Solo con el transporte mq (con el canal, la ocupación se lee en sus propios contadores).
+ *  -i: identificador del productor, entre 0 y productores - 1 (0 por defecto).
+ *  -n: número de productores (1 por defecto). Solo con el transporte mq.
+ *  -c: número de consumidores (1 por defecto, hasta MAX_CONSUMIDORES). Solo con el transporte mq.
+ *  -d: política de reparto de los items entre los consumidores: por turno (turno, por defecto), al consumidor con
+ *      menos mensajes en su buzón de items (carga) o según un hash de la clave del item, su letra (clave). Con esta
+ *      última, todos los items de una misma clave llegan, en orden, al mismo consumidor.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra): --capacidad (mensajes de cada buzón o huecos del canal,
+ * MAX_BUFFER por defecto), --items (items de cada productor; el consumidor debe usar el mismo valor), --tam_elem (como
+ * -t) y --espera_max (las esperas duran de 0 a espera_max - 1 segundos). También se leen de las variables SOII_NOMBRE.
+ * Con --contadores=1, se registra cuánto espera el productor en mq_receive a que le lleguen órdenes, cuántas veces
+ * encuentra lleno el buzón de items (sin órdenes pendientes) y cuántos items envía (módulo comun/contadores). Los
+ * contadores se vuelcan en JSON por la salida de error al acabar y cada vez que el proceso recibe SIGUSR2.
  */
 
 
@@ -24,61 +88,267 @@
 #define ROJO "\033[0;31m"
 #define RESET "\033[0m"
 
-#define MAX_BUFFER 5                         // Tamaño del buffer
-#define DATOS_A_PRODUCIR 50                  // Número de datos a producir/consumir
-#define MAX_SLEEP 3                          // Duración máxima de un sleep
-
-
-mqd_t buz_ordenes;                   // Cola de entrada de mensajes para el productor
-mqd_t buz_items;                     // Cola de entrada de mensajes para el consumidor
-
-size_t tam_msg;                      // Tamaño de cada mensaje
-
-char historial_buzon[DATOS_A_PRODUCIR];   // Historial de mensajes enviados
-
-char producir_elemento(int iter);   // Función que genera un nuevo elemento
+#define MAX_BUFFER 5                         // Tamaño por defecto del buffer
+#define DATOS_A_PRODUCIR 50                  // Número de datos a producir/consumir (y máximo del historial)
+#define DATOS_RENDIMIENTO 30000              // Número de datos a producir/consumir en el modo rendimiento
+#define MAX_SLEEP 3                          // Duración máxima de un sleep (por defecto)
+#define NUM_CLAVES 5                         // Letras distintas de los items ('a' a 'e')
+
+#define NOMBRE_OCUPACION "/OCUPACION_BUZONES"    // Objeto de memoria compartida con la ocupación de los buzones
+#define COLA_ORDENES(j) (2 * (j))            // Índice de buz_ordenes del consumidor j en los contadores de ocupación
+#define COLA_ITEMS(j) (2 * (j) + 1)          // Índice de buz_items del consumidor j en los contadores de ocupación
+#define MAX_CONSUMIDORES (OCUPACION_MAX_COLAS / 2)  // Número máximo de consumidores (opción -c)
+#define TAM_NOMBRE 32                        // Tamaño máximo del nombre de un buzón
+
+#define REPARTO_TURNO 0                      // Los items se reparten por turno entre los consumidores
+#define REPARTO_CARGA 1                      // Cada item va al consumidor con menos mensajes en su buzón de items
+#define REPARTO_CLAVE 2                      // Cada item va al consumidor que indica un hash de su clave
+#define MAX_LOTE 512                         // Número máximo de items por mensaje (opción -l)
+#define ESPERA_LOTE_US 1000                  // Retención por defecto de un lote incompleto (opción -w)
+
+#define TRANSPORTE_MQ 0                      // Órdenes e items viajan por colas de mensajes POSIX
+#define TRANSPORTE_SHM 1                     // Órdenes e items viajan por un canal de memoria compartida
+#define NOMBRE_CANAL "/CANAL_ITEMS"          // Nombre del objeto de memoria compartida del canal
+
+
+mqd_t buz_ordenes[MAX_CONSUMIDORES]; // Colas de entrada de mensajes para el productor (una por consumidor)
+mqd_t buz_items[MAX_CONSUMIDORES];   // Colas de entrada de mensajes para cada consumidor
+struct ocupacion * ocupacion = NULL; // Contadores de ocupación de los buzones
+uint64_t periodo_ocupacion = 0;      // Nanosegundos entre dos volcados de la ocupación (0 si no se vuelca)
+uint64_t proximo_volcado = 0;        // Instante del próximo volcado de la ocupación
+struct canal * canal = NULL;         // Canal de memoria compartida (solo con TRANSPORTE_SHM)
+int transporte = TRANSPORTE_MQ;      // Transporte de las órdenes y los items
+
+size_t tam_msg;                      // Tamaño de cada mensaje de buz_ordenes
+size_t tam_elem = sizeof(char);      // Tamaño de cada registro
+size_t tam_msg_items;                // Tamaño de cada item de buz_items (un registro y su sello de tiempo)
+int lote = 1;                        // Número máximo de items por mensaje de buz_items
+uint64_t espera_lote = ESPERA_LOTE_US * 1000ULL;    // Nanosegundos que se retiene como mucho un lote incompleto
+
+int rendimiento = 0;                 // !0 para ejecutar sin esperas ni mensajes
+int num_datos = DATOS_A_PRODUCIR;    // Número de datos a producir
+int capacidad = MAX_BUFFER;          // Número máximo de mensajes de cada buzón (o de huecos del canal)
+int espera_max = MAX_SLEEP;          // Límite (exclusivo) en segundos de las esperas aleatorias
+
+int id_productor = 0;                // Identificador de este productor
+int num_productores = 1;             // Número de productores
+int num_consumidores = 1;            // Número de consumidores
+int reparto = REPARTO_TURNO;         // Política de reparto de los items entre los consumidores
+
+char * mensajes;                     // Lote en curso de cada consumidor (tam_elem bytes y el sello de tiempo por item)
+int n_lote[MAX_CONSUMIDORES];        // Items generados en el lote en curso de cada consumidor
+int con_hueco[MAX_CONSUMIDORES];     // !0 si el lote en curso de cada consumidor ya tiene su hueco en buz_items
+uint64_t t_lote[MAX_CONSUMIDORES];   // Instante en que se tomó el hueco del lote en curso de cada consumidor
+int huecos[MAX_CONSUMIDORES];        // Huecos concedidos por cada consumidor y aún no usados
+int instrumentar = 0;                // !0 para registrar los contadores de instrumentación
+struct contadores * contadores = NULL;   // Contadores de instrumentación (NULL si no se registran)
+struct contadores_hilo * cont = NULL;    // Entrada del productor en los contadores
+
+char historial_buzon[DATOS_A_PRODUCIR];   // Historial de mensajes enviados (los DATOS_A_PRODUCIR primeros)
+
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"capacidad", &capacidad, CONFIG_INT, 1, CONFIG_MAX_CAPACIDAD, "Mensajes de cada buzón o huecos del canal"},
+    {"items", &num_datos, CONFIG_INT, 1, INT_MAX, "Items de cada productor (con -r, DATOS_RENDIMIENTO)"},
+    {"tam_elem", &tam_elem, CONFIG_SIZE, 1, CONFIG_MAX_TAM_ELEM, "Tamaño en bytes de cada item (como -t)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+    {"contadores", &instrumentar, CONFIG_INT, 0, 1, "1 para volcar en JSON los contadores de instrumentación"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
+
+char producir_elemento(int iter, int consumidor);      // Función que genera un nuevo elemento
 void imprimir_historial_buzon();    // Función para la impresión del historial
 void productor();                   // Función que implementa el productor
-long num_elementos_buzon(char buffer);          // Función para la comprobación del vaciado y llenado de buffers
-
-
-int main() {
+long num_elementos_buzon(char buffer, int consumidor);  // Función para la comprobación del vaciado y llenado
+void nombre_buzon(char * nombre, const char * base, int consumidor);   // Función que da nombre a un buzón
+int elegir_consumidor(int iter);    // Función que aplica la política de reparto
+void tomar_hueco(int consumidor);   // Función que obtiene un hueco en el buzón de un consumidor
+void abrir_lote(int consumidor);    // Función que toma el hueco del próximo lote de un consumidor
+ssize_t recibir_orden(int consumidor, char * orden, uint64_t plazo);   // Recepción de una orden
+void enviar_lote(int consumidor);   // Función que envía el lote de un consumidor
+void devolver_huecos(int consumidor);   // Función que devuelve los huecos no usados de un consumidor
+void enviar_lotes_vencidos();       // Función que envía los lotes que han superado la espera máxima
+uint64_t plazo_lotes();             // Función que devuelve el instante en que vence el primer lote
+void esperar(unsigned segundos);    // Espera aleatoria que no retiene los lotes más de su plazo
+
+
+int main(int argc, char * argv[]) {
     struct mq_attr attr;            // Atributos de la cola
+    int opcion;                     // Opción leída con getopt
+
+    char nombre[TAM_NOMBRE];        // Nombre de un buzón
+    char nombres[OCUPACION_MAX_COLAS][OCUPACION_TAM_NOMBRE];   // Nombre de cada buzón en los contadores de ocupación
+    const char * nombres_colas[OCUPACION_MAX_COLAS];
+    int j;                          // Contador de consumidores
+
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: transporte, modo rendimiento, tamaño de los items, lotes, volcados de la ocupación y reparto entre
+    // varios procesos
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "m:rt:l:w:s:i:n:c:d:")) != -1){
+        switch (opcion){
+            case 'm':
+                if (!strcmp(optarg, "mq")) transporte = TRANSPORTE_MQ;
+                else if (!strcmp(optarg, "shm")) transporte = TRANSPORTE_SHM;
+                else {
+                    fprintf(stderr, "Error: el transporte debe ser mq o shm\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "items")) num_datos = DATOS_RENDIMIENTO;
+                break;
+            case 't':
+                if ((tam_elem = strtoul(optarg, NULL, 10)) == 0){
+                    fprintf(stderr, "Error: el tamaño de los items debe ser de al menos 1 byte\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'l':
+                if ((lote = atoi(optarg)) < 1 || lote > MAX_LOTE){
+                    fprintf(stderr, "Error: el tamaño de lote debe estar entre 1 y MAX_LOTE\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                if (atol(optarg) < 0){
+                    fprintf(stderr, "Error: la espera de los lotes no puede ser negativa\n");
+                    exit(EXIT_FAILURE);
+                }
+                espera_lote = atol(optarg) * 1000ULL;
+                break;
+            case 's':
+                periodo_ocupacion = strtoull(optarg, NULL, 10) * 1000000ULL;
+                break;
+            case 'i':
+                id_productor = atoi(optarg);
+                break;
+            case 'n':
+                num_productores = atoi(optarg);
+                break;
+            case 'c':
+                if ((num_consumidores = atoi(optarg)) < 1 || num_consumidores > MAX_CONSUMIDORES){
+                    fprintf(stderr, "Error: el número de consumidores debe estar entre 1 y MAX_CONSUMIDORES\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'd':
+                if (!strcmp(optarg, "turno")) reparto = REPARTO_TURNO;
+                else if (!strcmp(optarg, "carga")) reparto = REPARTO_CARGA;
+                else if (!strcmp(optarg, "clave")) reparto = REPARTO_CLAVE;
+                else {
+                    fprintf(stderr, "Error: la política de reparto debe ser turno, carga o clave\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Uso: ./productor_FIFO [-m mq|shm] [-r] [-t tam_elem] [-l lote] [-w espera_us] "
+                                "[-s periodo_ms] [-i id -n productores -c consumidores -d turno|carga|clave] "
+                                "[--parámetro=valor ...]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (num_productores < 1 || id_productor < 0 || id_productor >= num_productores){
+        fprintf(stderr, "Error: el identificador del productor debe estar entre 0 y productores - 1\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((lote > 1 || num_productores > 1 || num_consumidores > 1) && transporte == TRANSPORTE_SHM){
+        fprintf(stderr, "Error: los lotes y los procesos múltiples solo se admiten con el transporte mq\n");
+        exit(EXIT_FAILURE);
+    }
+    tam_msg_items = tam_elem + sizeof(uint64_t);
 
     srand(time(NULL));              // Semilla para la generación de números aleatorios
 
+    // Con el canal de memoria compartida, el productor lo crea con un hueco por cada posición del buffer, cada uno con
+    // espacio para un registro y su sello de tiempo. El consumidor obtendrá los tamaños de la cabecera del canal.
+    if (transporte == TRANSPORTE_SHM){
+        if ((canal = canal_crear(NOMBRE_CANAL, capacidad, tam_msg_items, CANAL_FIFO)) == NULL){
+            perror("Error - no se ha podido crear el canal de memoria compartida");
+            exit(EXIT_FAILURE);
+        }
+        productor();
+        canal_cerrar(canal);        // El objeto lo borra el consumidor en cuanto lo ha proyectado
+        exit(EXIT_SUCCESS);
+    }
 
-    // El productor se encarga de crear las colas de ambos programas. El consumidor únicamente tendrá que abrirlas
-    // (deberá comenzar a ejecutarse después del productor).
-
-    tam_msg = sizeof(char);           // Los mensajes serán de un solo carácter
-
-    attr.mq_maxmsg = MAX_BUFFER;      // Número máximo de mensajes en los buffers
-    attr.mq_msgsize = tam_msg;        // Tamaño de cada mensaje
-
-    // Se borran los buffers de entrada por si ya existían debido a una ejecución previa
-    mq_unlink("/BUZON_ORDENES");
-    mq_unlink("/BUZON_ITEMS");
-
-    // Se crean y abren los buffers de entrada del productor y del consumidor, respectivamente. Se conceden todos
-    // los permisos (777) y se utiliza la configuración establecida a través de attr.
-    // El productor escribirá en en el segundo y el consumidor en el primero. Por tanto, el productor los abre con
-    // permisos de solo lectura y solo escritura, respectivamente.
-    buz_ordenes = mq_open("/BUZON_ORDENES", O_CREAT|O_RDONLY, 0777, &attr);
-    buz_items = mq_open("/BUZON_ITEMS", O_CREAT|O_WRONLY, 0777, &attr);
+    // El productor (el 0, si hay varios) se encarga de crear las colas de ambos programas. Los consumidores y el
+    // resto de productores únicamente tendrán que abrirlas (deberán comenzar a ejecutarse después).
+
+    tam_msg = sizeof(char);           // Las órdenes serán de un solo carácter
+
+    for (j = 0; j < num_consumidores; j++){
+        attr.mq_maxmsg = capacidad;       // Número máximo de mensajes en los buffers
+        attr.mq_msgsize = tam_msg;        // Tamaño de cada mensaje (buz_ordenes)
+
+        // Se borran los buffers de entrada por si ya existían debido a una ejecución previa
+        nombre_buzon(nombre, "/BUZON_ORDENES", j);
+        if (id_productor == 0) mq_unlink(nombre);
+        /* Se crean y abren los buffers de entrada del productor y del consumidor, respectivamente. Se conceden todos
+         * los permisos (777) y se utiliza la configuración establecida a través de attr.
+         * El productor escribirá en en el segundo y el consumidor en el primero. Por tanto, el productor abre el
+         * segundo con permisos de solo escritura, y el primero de lectura y escritura: con varios productores, al
+         * acabar devuelve en él los huecos que no ha usado (ver productor).
+         * Los mensajes de buz_items ocupan lote registros completos, cada uno con su sello de tiempo; el consumidor
+         * obtendrá su tamaño con mq_getattr.
+         */
+        buz_ordenes[j] = id_productor == 0? mq_open(nombre, O_CREAT|O_RDWR, 0777, &attr) : mq_open(nombre, O_RDWR);
+        nombre_buzon(nombre, "/BUZON_ITEMS", j);
+        if (id_productor == 0) mq_unlink(nombre);
+        attr.mq_msgsize = lote * tam_msg_items;
+        buz_items[j] = id_productor == 0? mq_open(nombre, O_CREAT|O_WRONLY, 0777, &attr) : mq_open(nombre, O_WRONLY);
+
+        if ((buz_ordenes[j] == -1) || (buz_items[j] == -1)) {
+            perror ("Error - no es ha podido crear los buffers de entrada");
+            exit(EXIT_FAILURE);
+        }
+        // Con varios consumidores, los buzones se distinguen en los volcados por su número
+        if (num_consumidores > 1){
+            snprintf(nombres[COLA_ORDENES(j)], OCUPACION_TAM_NOMBRE, "ordenes_%d", j);
+            snprintf(nombres[COLA_ITEMS(j)], OCUPACION_TAM_NOMBRE, "items_%d", j);
+        }
+        else {
+            strcpy(nombres[COLA_ORDENES(j)], "ordenes");
+            strcpy(nombres[COLA_ITEMS(j)], "items");
+        }
+        nombres_colas[COLA_ORDENES(j)] = nombres[COLA_ORDENES(j)];
+        nombres_colas[COLA_ITEMS(j)] = nombres[COLA_ITEMS(j)];
+    }
 
-    if ((buz_ordenes == -1) || (buz_items == -1)) {
-        perror ("Error - no es ha podido crear los buffers de entrada");
+    // El productor crea también los contadores de ocupación de los buzones, que se actualizan en cada envío y
+    // recepción en lugar de consultar mq_getattr
+    if (id_productor == 0)
+        ocupacion = ocupacion_crear(NOMBRE_OCUPACION, 2 * num_consumidores, nombres_colas, capacidad);
+    else ocupacion = ocupacion_abrir(NOMBRE_OCUPACION);
+    if (ocupacion == NULL){
+        perror("Error - no se han podido crear los contadores de ocupación");
         exit(EXIT_FAILURE);
     }
 
+    // Los contadores de instrumentación solo tienen la entrada de este productor
+    if (instrumentar){
+        if ((contadores = contadores_crear("productor_FIFO", 1)) == NULL || contadores_senal(contadores) == -1){
+            perror("Error - no se han podido crear los contadores de instrumentación");
+            exit(EXIT_FAILURE);
+        }
+        cont = contadores_hilo(contadores, "productor", id_productor);
+    }
+
     productor();        // Funcion principal del productor
+    if (contadores != NULL){
+        contadores_volcar(contadores, STDERR_FILENO);
+        contadores_destruir(contadores);
+    }
+    if (periodo_ocupacion) ocupacion_volcar(ocupacion, stderr, "productor_FIFO");
+    ocupacion_cerrar(ocupacion);
 
     // El productor cierra los buzones
-    if (mq_close(buz_ordenes) || mq_close(buz_items)){
-        perror("Error al cerrar los buffers del programa");
-        exit(EXIT_FAILURE);
-    }
+    for (j = 0; j < num_consumidores; j++)
+        if (mq_close(buz_ordenes[j]) || mq_close(buz_items[j])){
+            perror("Error al cerrar los buffers del programa");
+            exit(EXIT_FAILURE);
+        }
 
     /* Dado que presumiblemente el productor acabará después del consumidor, ya que el primero tiene que vaciar
      * su buzón de recepción al acabar, el productor debería encargarse de eliminar los dos buzones mediante
@@ -95,21 +365,24 @@ int main() {
 /* Función a través de la cual el productor genera un mensaje a enviar al consumidor.
  * El contenido del mensaje se calcula en función de la iteración actual del proceso.
  * @param iter: iteración actual.
+ * @param consumidor: consumidor al que se enviará el mensaje.
  * @return: mensaje a enviar.
  */
-char producir_elemento(int iter){
+char producir_elemento(int iter, int consumidor){
     char item;                       // Item a enviar
     long nelem;                       // Número de elementos presentes en el buzón
 
-    sleep(rand() % MAX_SLEEP);       // Espera aleatoria de 0, 1 o 2 segundos para forzar vaciado y llenado
-    if ((nelem = num_elementos_buzon('P')) == 0) printf("%sCola del productor vacía%s\n", AZUL, RESET);
-    else if (nelem == MAX_BUFFER) printf("%sCola del productor llena%s\n", ROJO, RESET);
+    item = 'a' + (iter % NUM_CLAVES);           // Con NUM_CLAVES = 5, el mensaje será 'a', 'b', 'c', 'd' ó 'e'
+    if (rendimiento) return item;               // En el modo rendimiento no se espera, imprime ni guarda historial
+
+    esperar(rand() % espera_max);    // Espera aleatoria (de 0 a 2 segundos por defecto) para forzar vaciado y llenado
+    if ((nelem = num_elementos_buzon('P', consumidor)) == 0) printf("%sCola del productor vacía%s\n", AZUL, RESET);
+    else if (nelem == capacidad) printf("%sCola del productor llena%s\n", ROJO, RESET);
 
     // Tras recibir una orden (una indicación de que el consumidor tiene slots vacíos en su buffer de entrada),
     // el productor genera un nuevo mensaje.
     printf("[ITER %02d] Recibida orden\n", iter);
-    item = 'a' + (iter % MAX_BUFFER);           // Con MAX_BUFFER = 5, el mensaje será 'a', 'b', 'c', 'd' ó 'e'
-    historial_buzon[iter] = item;                    // Guarda el contenido en el historial de mensajes producidos
+    if (iter < DATOS_A_PRODUCIR) historial_buzon[iter] = item;  // Guarda el contenido en el historial de mensajes
     return item;
 }
 
@@ -119,54 +392,100 @@ char producir_elemento(int iter){
 void imprimir_historial_buzon(){
     int i, j;
 
+    int enviados = num_datos < DATOS_A_PRODUCIR? num_datos : DATOS_A_PRODUCIR;     // Mensajes del historial
+
     // Se imprime el historial en líneas de 10 mensajes
-    for (i = 0; i < DATOS_A_PRODUCIR; i += 10){
+    for (i = 0; i < enviados; i += 10){
         printf("ITER -> ");         // Título de la línea (iteración)
         // En la condicion de finalizacion se comprueba que j no alcance el tamaño del historial
-        for (j = i; j < i + 10 && j < DATOS_A_PRODUCIR; j++) printf("%02d ", j);
+        for (j = i; j < i + 10 && j < enviados; j++) printf("%02d ", j);
 
         printf("\nITEM -> ");       // Contenido de la línea (mensaje)
-        for (j = i; j < i + 10 && j < DATOS_A_PRODUCIR; j++) printf(" %c ", historial_buzon[j]);
+        for (j = i; j < i + 10 && j < enviados; j++) printf(" %c ", historial_buzon[j]);
 
         printf("\n\n");
     }
 }
 
 /* Función principal del productor.
- * En cada iteración, espera a recibir una orden (un mensaje vacío) del consumidor. A continuación, genera un nuevo
- * item y se lo envía.
- * Se llevan a cabo un total de DATOS_A_PRODUCIR iteraciones.
+ * En cada iteración, espera a recibir una orden del consumidor. A continuación, genera un nuevo item y se lo envía.
+ * Con lotes, cada orden recibida concede tantos huecos como indica su valor y cada hueco permite enviar un mensaje
+ * de hasta lote items: solo se usa un hueco al empezar un lote, y el mensaje se envía al completarlo, al superar la
+ * espera máxima o al acabar. Si el lote del consumidor vence durante la espera aleatoria, se envía y el item generado
+ * necesita un hueco nuevo.
+ * Con varios consumidores, cada item se envía al que indique la política de reparto, y los huecos y el lote en curso
+ * se llevan por separado para cada uno. Con varios procesos, al acabar se envía a cada consumidor un mensaje vacío
+ * como marca de fin (también con su hueco, para respetar el protocolo de órdenes). Con varios productores, los huecos
+ * que queden de la última orden de cada consumidor se le devuelven antes: si no, nadie más podría usarlos.
+ * Se llevan a cabo un total de DATOS_A_PRODUCIR iteraciones (DATOS_RENDIMIENTO en el modo rendimiento).
  */
 void productor() {
-    char item;          // Item donde se almacena el mensaje recibido del consumidor
-                        // También guardará el mensaje a enviar como respuesta
-    int i;              // Contador de iteraciones
+    char item;          // Item a enviar al consumidor
+    char orden;         // Orden recibida del consumidor (número de huecos concedidos)
+    char * registro;    // Donde se genera cada item: el mensaje o, con el canal, su hueco en la memoria compartida
+    uint64_t sello;     // Instante de envío del item
+    int i, j;           // Contadores de iteraciones y de consumidores
+    int c;              // Consumidor al que se envía el item
     long nelem;         // Número de elementos presentes en la cola
 
-    for (i = 0; i < DATOS_A_PRODUCIR; i++){
-        if ((nelem = num_elementos_buzon('C')) == 0) printf("%sCola del productor vacia%s\n", AZUL, RESET);
-        else if (nelem == MAX_BUFFER) printf("%sCola del productor llena%s\n", ROJO, RESET);
-
-        /* El productor lee un mensaje de su buffer de recepción, buz_ordenes, usando mq_receive. Se toma el mensaje
-         * de mayor prioridad y, en caso de empate, aquel que ha llegado antes al buffer.
-         * Los argumentos de la función son:
-         * - buz_ordenes: buffer de donde se leerá el mensaje.
-         * - item: puntero a la variable donde se almacenará el mensaje leído.
-         * - tam_msg: tamaño del mensaje a leer (será un carácter).
-         * - NULL: como este argumento se pasaría un puntero a un unsigned int donde guardar la prioridad del mensaje.
-         * No obstante, el consumidor siempre usará prioridad 0 en sus mensajes (ya que el contenido es irrelevante:
-         * lo realmente significativo es que haya mensajes, pero no se lee su contenido). Por tanto, este argumento
-         * se ignora (NULL).
+    if ((mensajes = (char *) malloc(num_consumidores * lote * tam_msg_items)) == NULL){
+        fprintf(stderr, "Error: no se ha podido reservar memoria para los items\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_datos; i++){
+        c = transporte == TRANSPORTE_SHM? 0 : elegir_consumidor(i);
+        if (!rendimiento){
+            if ((nelem = num_elementos_buzon('C', c)) == 0) printf("%sCola del productor vacia%s\n", AZUL, RESET);
+            else if (nelem == capacidad) printf("%sCola del productor llena%s\n", ROJO, RESET);
+        }
+
+        /* El productor lee un mensaje de su buffer de recepción, buz_ordenes, usando mq_receive (ver tomar_hueco).
+         * Solo se necesita un hueco al empezar cada lote, y solo se lee una orden si no quedan huecos de las
+         * anteriores.
          *
-         * Si no hay mensajes, el productor se bloquea hasta que llege uno o lo despierte una señal.
+         * Con el canal de memoria compartida, la orden es un crédito que se descuenta del contador compartido (el
+         * productor solo duerme en su futex si no queda ninguno).
          */
-        mq_receive(buz_ordenes, &item, tam_msg, NULL);
-        item = producir_elemento(i);            // El elemento producido se genera en base a la iteración actual
+        if (transporte == TRANSPORTE_SHM) canal_recibir_credito(canal);
+        else if (!con_hueco[c]) abrir_lote(c);
+        item = producir_elemento(i, c);         // El elemento producido se genera en base a la iteración actual
+        if (transporte == TRANSPORTE_MQ && !con_hueco[c]) abrir_lote(c);   // Su lote venció durante la espera
         // Se envía el elemento producido al buffer de entrada del consumidor (buz_items)
         // No es necesario usar distintas prioridades, pues en caso de igualdad la implementación es FIFO por defecto.
         // De esta forma, el consumidor leerá siempre el mensaje más antiguo que ha llegado a su buffer.
-        mq_send(buz_items, &item, tam_msg, 0);
-        printf("[ITER %02d] Enviado item %c\n", i, item);
+        // Con el canal, el crédito recibido garantiza que el hueco de envío ya no lo usa el consumidor
+        registro = transporte == TRANSPORTE_SHM? (char *) canal_hueco_envio(canal) :
+                   mensajes + (c * lote + n_lote[c]) * tam_msg_items;
+        registro_rellenar(registro, tam_elem, item);       // El registro se genera directamente en el mensaje
+        sello = medidas_ns();                               // Tras el registro se añade el instante de envío
+        memcpy(registro + tam_elem, &sello, sizeof(sello));
+        if (transporte == TRANSPORTE_SHM) canal_enviar(canal);
+        else {
+            if (++n_lote[c] == lote) enviar_lote(c);
+            // Los lotes (también el de este consumidor) se envían si han superado la espera máxima
+            if (lote > 1) enviar_lotes_vencidos();
+            ocupacion_volcar_periodico(ocupacion, stderr, "productor_FIFO", periodo_ocupacion, &proximo_volcado);
+        }
+        contadores_items(cont, 1);
+        if (!rendimiento) printf("[ITER %02d] Enviado item %c\n", i, item);
+    }
+
+    // Se envían los lotes incompletos y después la marca de fin de cada consumidor, que cierra su flujo de items. Con
+    // el canal, el cierre no ocupa ningún hueco: el consumidor recibirá NULL cuando haya leído todos los items
+    for (j = 0; j < num_consumidores && transporte == TRANSPORTE_MQ; j++)
+        if (n_lote[j]) enviar_lote(j);
+    for (j = 0; j < num_consumidores && transporte == TRANSPORTE_MQ; j++){
+        abrir_lote(j);
+        if (num_productores > 1 && huecos[j] > 0) devolver_huecos(j);
+        enviar_lote(j);             // n_lote[j] es 0: mensaje vacío
+    }
+    if (transporte == TRANSPORTE_SHM) canal_terminar_envios(canal);
+
+    // En el modo rendimiento no se imprime el historial ni se espera al consumidor: el resultado lo da él
+    if (rendimiento){
+        free(mensajes);
+        return;
     }
 
     printf("\n\n\n");
@@ -175,31 +494,237 @@ void productor() {
     printf("Finalizados envíos y recepciones. Cola de items producidos:\n");
     imprimir_historial_buzon();
 
-    // El productor se asegura de que su buffer de recepción quede vacío
-    printf("Espero 5 segundos a que el consumidor acabe...\n");
-    sleep(5);           // Espera a que el consumidor finalice por completo
-    if (num_elementos_buzon('P')) printf("\n\nLa cola de entrada del productor no esta vacia\n\n");
-    while (num_elementos_buzon('P')){
-        mq_receive(buz_ordenes, &item, tam_msg, NULL);
-        printf("Recogido item de la cola de entrada del productor\n");
+    // El productor se asegura de que su buffer de recepción quede vacío: recoge las órdenes que queden hasta
+    // encontrar el cierre del consumidor (un mensaje vacío o, con el canal, el fin de los créditos), que llega cuando
+    // este ha terminado. Con varios productores no se recogen: los buzones de órdenes son de todos, y las órdenes
+    // recogidas podrían ser las que otro productor necesita para enviar sus últimos items (el productor 0 borra los
+    // buzones, con lo que quede en ellos, al empezar la siguiente ejecución)
+    if (num_productores > 1){
+        free(mensajes);
+        return;
+    }
+    printf("Espero a que el consumidor acabe...\n");
+    for (j = 0; j < num_consumidores; j++){
+        if (transporte == TRANSPORTE_SHM)
+            while (canal_recibir_credito(canal) == 0) printf("Recogido item de la cola de entrada del productor\n");
+        else
+            while (recibir_orden(j, &orden, 0) > 0) printf("Recogido item de la cola de entrada del productor\n");
     }
     printf("Buffer de entrada del productor vacio\n\n");
+
+    free(mensajes);
 }
 
-/* Función que comprueba el número de elementos presentes en un buzón.
+/* Función que obtiene un hueco en el buzón de items de un consumidor. Si no quedan huecos de las órdenes anteriores,
+ * el productor lee una orden del buzón de órdenes de ese consumidor usando mq_receive. Se toma el mensaje de mayor
+ * prioridad y, en caso de empate, aquel que ha llegado antes al buffer.
+ * Los argumentos de la función son:
+ * - buz_ordenes: buffer de donde se leerá el mensaje.
+ * - orden: puntero a la variable donde se almacenará el mensaje leído.
+ * - tam_msg: tamaño del mensaje a leer (será un carácter).
+ * - NULL: como este argumento se pasaría un puntero a un unsigned int donde guardar la prioridad del mensaje.
+ * No obstante, el consumidor siempre usará prioridad 0 en sus mensajes (lo significativo es el número de
+ * huecos que concede cada uno). Por tanto, este argumento se ignora (NULL).
+ *
+ * Si no hay mensajes, el productor se bloquea hasta que llege uno o lo despierte una señal. Mientras tenga lotes
+ * incompletos de otros consumidores, la espera (mq_timedreceive) dura como mucho hasta que venza el primero: entonces
+ * se envían los vencidos y se vuelve a esperar. Con los contadores de instrumentación, la espera se registra como
+ * espera por una condición, y si el buzón de órdenes está vacío según los contadores de ocupación, el buzón de items
+ * del consumidor está lleno.
+ * @param consumidor: consumidor al que se enviará el mensaje.
+ */
+void tomar_hueco(int consumidor){
+    char orden;         // Orden recibida del consumidor (número de huecos concedidos)
+    uint64_t t;         // Instante de comienzo de la espera (contadores de instrumentación)
+
+    if (huecos[consumidor] == 0){
+        if (cont != NULL && ocupacion_profundidad(ocupacion, COLA_ORDENES(consumidor)) == 0) contadores_lleno(cont);
+        t = contadores_inicio(cont);
+        do enviar_lotes_vencidos();
+        while (recibir_orden(consumidor, &orden, plazo_lotes()) == -1);
+        contadores_tiempo(cont, CONTADORES_ESPERA, t);
+        huecos[consumidor] = orden;
+    }
+    huecos[consumidor]--;
+}
+
+/* Función que toma el hueco en el buzón de items de un consumidor que ocupará su próximo lote, y anota el instante a
+ * partir del cual se cuenta su espera máxima.
+ * @param consumidor: consumidor al que se enviará el lote.
+ */
+void abrir_lote(int consumidor){
+    tomar_hueco(consumidor);
+    con_hueco[consumidor] = 1;
+    if (lote > 1) t_lote[consumidor] = medidas_ns();
+}
+
+/* Función que recibe la siguiente orden del buzón de órdenes de un consumidor. Si es el mensaje vacío con el que el
+ * consumidor cierra las órdenes, no concede ningún hueco, pero solo puede llegar cuando el productor ya ha enviado
+ * todos sus items.
+ * @param consumidor: consumidor del que se recibe la orden.
+ * @param orden: donde se guarda el número de huecos concedidos.
+ * @param plazo: instante (medidas_ns) hasta el que se espera como mucho, o 0 para esperar sin límite.
+ * @return: tamaño de la orden recibida (0 si es el cierre), o -1 si ha vencido el plazo.
+ */
+ssize_t recibir_orden(int consumidor, char * orden, uint64_t plazo){
+    ssize_t bytes;          // Tamaño de la orden recibida
+    struct timespec limite; // Plazo para mq_timedreceive, que se expresa en CLOCK_REALTIME
+    uint64_t ahora;         // Instante actual (medidas_ns)
+
+    if (plazo == 0) bytes = mq_receive(buz_ordenes[consumidor], orden, tam_msg, NULL);
+    else {
+        ahora = medidas_ns();
+        clock_gettime(CLOCK_REALTIME, &limite);
+        if (plazo > ahora){
+            limite.tv_nsec += (plazo - ahora) % 1000000000ULL;
+            limite.tv_sec += (plazo - ahora) / 1000000000ULL + limite.tv_nsec / 1000000000L;
+            limite.tv_nsec %= 1000000000L;
+        }
+        bytes = mq_timedreceive(buz_ordenes[consumidor], orden, tam_msg, NULL, &limite);
+        if (bytes == -1 && errno == ETIMEDOUT) return -1;
+    }
+    if (bytes == -1){
+        perror("Error en la recepción de una orden");
+        exit(EXIT_FAILURE);
+    }
+    ocupacion_recibidos(ocupacion, COLA_ORDENES(consumidor), 1);
+    return bytes;
+}
+
+/* Función que envía el lote en curso de un consumidor (n_lote[consumidor] items) a su buzón de items, en el hueco
+ * que se tomó al abrirlo. El siguiente lote necesitará uno nuevo.
+ * @param consumidor: consumidor al que se envía el lote.
+ */
+void enviar_lote(int consumidor){
+    ocupacion_enviados(ocupacion, COLA_ITEMS(consumidor), 1);     // Antes del envío: nunca queda negativa
+    mq_send(buz_items[consumidor], mensajes + consumidor * lote * tam_msg_items, n_lote[consumidor] * tam_msg_items,
+            0);
+    n_lote[consumidor] = 0;
+    con_hueco[consumidor] = 0;
+}
+
+/* Función que devuelve al buzón de órdenes de un consumidor, como una orden más, los huecos que este productor ha
+ * recibido y no va a usar. Con varios productores, cada orden concede sus huecos a quien la recibe: si este productor
+ * acaba sin usarlos, los demás se quedarían sin ellos (y el consumidor los daría por ocupados para siempre). El buzón
+ * no puede estar lleno, pues estos huecos no están en ninguna de las órdenes que contiene.
+ * @param consumidor: consumidor al que pertenecen los huecos.
+ */
+void devolver_huecos(int consumidor){
+    char orden = (char) huecos[consumidor];     // El valor de la orden es el número de huecos que concede
+
+    ocupacion_enviados(ocupacion, COLA_ORDENES(consumidor), 1);
+    if (mq_send(buz_ordenes[consumidor], &orden, tam_msg, 0) == -1){
+        perror("Error al devolver los huecos no usados");
+        exit(EXIT_FAILURE);
+    }
+    huecos[consumidor] = 0;
+}
+
+/* Función que envía los lotes incompletos que llevan espera_lote nanosegundos o más abiertos.
+ */
+void enviar_lotes_vencidos(){
+    int j;
+
+    for (j = 0; j < num_consumidores; j++)
+        if (n_lote[j] && medidas_ns() - t_lote[j] >= espera_lote) enviar_lote(j);
+}
+
+/* Función que calcula cuándo vence el primero de los lotes incompletos.
+ * @return: instante (medidas_ns) en que vence, o 0 si no hay ningún lote con items.
+ */
+uint64_t plazo_lotes(){
+    uint64_t plazo = 0;
+    int j;
+
+    for (j = 0; j < num_consumidores; j++)
+        if (n_lote[j] && (plazo == 0 || t_lote[j] + espera_lote < plazo)) plazo = t_lote[j] + espera_lote;
+    return plazo;
+}
+
+/* Función que sustituye al sleep de la espera aleatoria. Si hay lotes incompletos, la espera se divide en tramos que
+ * acaban cuando vence el primero de ellos, y los vencidos se envían antes de seguir esperando.
+ * @param segundos: duración de la espera.
+ */
+void esperar(unsigned segundos){
+    uint64_t fin = medidas_ns() + segundos * 1000000000ULL;    // Instante en que acaba la espera
+    uint64_t ahora, hasta;
+    struct timespec tramo;
+
+    while ((ahora = medidas_ns()) < fin){
+        enviar_lotes_vencidos();
+        hasta = plazo_lotes();
+        if (hasta == 0 || hasta > fin) hasta = fin;
+        if (hasta > ahora){
+            tramo.tv_sec = (hasta - ahora) / 1000000000ULL;
+            tramo.tv_nsec = (hasta - ahora) % 1000000000ULL;
+            nanosleep(&tramo, NULL);
+        }
+    }
+    enviar_lotes_vencidos();
+}
+
+/* Función que elige el consumidor al que se enviará un item según la política de reparto:
+ * - turno: los consumidores se alternan, y cada productor empieza por uno distinto.
+ * - carga: el consumidor con menos mensajes en su buzón de items, según los contadores de ocupación (sin llamadas al
+ *   sistema). A igualdad, se sigue el turno.
+ * - clave: un hash de la clave del item, que es su letra (ver producir_elemento). Todos los items con la misma clave
+ *   van al mismo consumidor y, como los buzones son FIFO, le llegan en el orden en que el productor los generó.
+ * @param iter: iteración actual.
+ * @return: consumidor elegido.
+ */
+int elegir_consumidor(int iter){
+    int turno = (id_productor + iter) % num_consumidores;     // Consumidor al que le toca por turno
+    uint32_t clave = 'a' + (iter % NUM_CLAVES);                 // Clave del item
+    long profundidad, minimo = LONG_MAX;
+    int elegido = turno, j, c;
+
+    switch (reparto){
+        case REPARTO_CARGA:
+            for (j = 0; j < num_consumidores; j++){
+                c = (turno + j) % num_consumidores;
+                if ((profundidad = ocupacion_profundidad(ocupacion, COLA_ITEMS(c))) < minimo){
+                    minimo = profundidad;
+                    elegido = c;
+                }
+            }
+            return elegido;
+        case REPARTO_CLAVE:
+            return ((clave * 2654435761u) >> 16) % num_consumidores;     // Hash multiplicativo de Knuth
+        default:
+            return turno;
+    }
+}
+
+/* Función que da nombre al buzón de un consumidor: el nombre base si solo hay uno, o el nombre base seguido de
+ * _consumidor si hay varios.
+ * @param nombre: cadena de TAM_NOMBRE bytes donde se guarda el nombre.
+ * @param base: nombre base del buzón ("/BUZON_ORDENES" o "/BUZON_ITEMS").
+ * @param consumidor: consumidor al que pertenece el buzón.
+ */
+void nombre_buzon(char * nombre, const char * base, int consumidor){
+    if (num_consumidores > 1) snprintf(nombre, TAM_NOMBRE, "%s_%d", base, consumidor);
+    else snprintf(nombre, TAM_NOMBRE, "%s", base);
+}
+
+/* Función que comprueba el número de elementos presentes en un buzón, leyendo los contadores de ocupación (sin
+ * llamadas al sistema).
+ * Con el canal de memoria compartida, se leen directamente los contadores de créditos e items.
  * @param buffer 'P' para analizar buz_ordenes, 'C' para analizar buz_items.
+ * @param consumidor: consumidor al que pertenece el buzón.
  * @return El número de items del buzón indicado o -1 en caso de entrada no definida.
  */
-long num_elementos_buzon(char buffer){
-    struct mq_attr attr;    // Estructura para almacenar la configuración de la cola de mensajes
+long num_elementos_buzon(char buffer, int consumidor){
+    if (transporte == TRANSPORTE_SHM){
+        if (buffer == 'P') return canal_creditos(canal);
+        if (buffer == 'C') return canal_items(canal);
+        return -1;
+    }
 
     switch(buffer){
         case 'P':
-            mq_getattr(buz_ordenes, &attr);     // Se leen los atributos de buz_ordenes
-            return attr.mq_curmsgs;             // Se accede al número de mensajes actuales
+            return ocupacion_profundidad(ocupacion, COLA_ORDENES(consumidor));     // Mensajes actuales de buz_ordenes
         case 'C':
-            mq_getattr(buz_items, &attr);
-            return attr.mq_curmsgs;
+            return ocupacion_profundidad(ocupacion, COLA_ITEMS(consumidor));
     }
     return -1;
 }
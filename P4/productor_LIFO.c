@@ -3,6 +3,14 @@
 #include <mqueue.h>
 #include <unistd.h>
 #include <time.h>
+#include <string.h>
+#include <limits.h>
+#include "../comun/buffer.h"
+#include "../comun/medidas.h"
+#include "../comun/ocupacion.h"
+#include "../comun/canal.h"
+#include "../comun/config.h"
+#include "../comun/contadores.h"
 
 
 /* Xiana Carrera Alonso
@@ -16,6 +24,42 @@
  *
  * Para compilar se debe usar la opción -lrt.
  * El productor debe comezar a ejecutarse antes del consumidor.
+ *
+ * Cada item es un registro de tam_elem bytes (módulo comun/buffer), que se genera en su mensaje y se envía al
+ * consumidor tal cual. Tras el registro, el mensaje lleva el instante de envío (un uint64_t obtenido con
+ * medidas_ns), con el que el consumidor calcula la latencia de traspaso. Las órdenes del consumidor siguen siendo
+ * mensajes de un solo carácter.
+ *
+ * Con las colas de mensajes, el orden LIFO se obtiene enviando cada item con prioridad igual a su iteración, por lo
+ * que no pueden producirse más de MQ_PRIO_MAX items. Con la opción -m shm, los items se apilan en un canal de memoria
+ * compartida con orden LIFO (módulo comun/canal): el consumidor desapila siempre el último item publicado, sin
+ * prioridades ni límite en el número de items, y el contador de items hace de timbre para despertarlo. Cada hueco
+ * lleva, tras el sello de tiempo, la iteración del item, que el consumidor muestra en lugar de la prioridad.
+ *
+ * Tras el último item, el productor cierra el flujo de items: con las colas, envía un mensaje vacío con prioridad 0
+ * (que, como todos los items se enviaron antes, será el último en recibirse), y con la pila llama a
+ * canal_terminar_envios. El consumidor termina al encontrar el cierre y cierra a su vez las órdenes (un mensaje vacío
+ * o canal_terminar_creditos), que el productor recoge hasta encontrar ese cierre, sin esperar un tiempo fijo.
+ *
+ * Uso: ./productor_LIFO [-m mq|shm] [-r] [-k items] [-t tam_elem] [-s periodo_ms]
+ *  -m: transporte de las órdenes y los items: colas de mensajes POSIX con prioridades (mq, por defecto) o pila en un
+ *      canal de memoria compartida (shm). El consumidor debe usar el mismo.
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes y se producen DATOS_RENDIMIENTO items. El consumidor
+ *      debe ejecutarse también con -r.
+ *  -k: número de items, igual que --items (DATOS_A_PRODUCIR por defecto, o DATOS_RENDIMIENTO con -r). Con el
+ *      transporte mq, no puede superar MQ_PRIO_MAX.
+ *  -t: tamaño en bytes de cada item (1 por defecto). Sumado al sello de tiempo, no puede superar
+ *      /proc/sys/fs/mqueue/msgsize_max.
+ *  -s: cada cuántos milisegundos se imprime por la salida de error la ocupación de los buzones (profundidad, máximo y
+ *      veces que se han llenado y vaciado). Al acabar se imprime una última vez. Solo con el transporte mq.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra): --capacidad (mensajes de cada buzón o huecos de la pila,
+ * MAX_BUFFER por defecto), --items (número de items, como -k), --tam_elem (como -t) y --espera_max (las esperas
+ * duran de 0 a espera_max - 1 segundos). También se leen de las variables SOII_NOMBRE.
+ * Con --contadores=1, se registra cuánto espera el productor en mq_receive a que le lleguen órdenes, cuántas veces
+ * encuentra lleno el buzón de items (sin órdenes pendientes) y cuántos items envía (módulo comun/contadores). Los
+ * contadores se vuelcan en JSON por la salida de error al acabar y cada vez que el proceso recibe SIGUSR2. Solo con
+ * el transporte mq.
  */
 
 
@@ -24,17 +68,53 @@
 #define ROJO "\033[0;31m"
 #define RESET "\033[0m"
 
-#define MAX_BUFFER 5                         // Tamaño del buffer
-#define DATOS_A_PRODUCIR 52                  // Número de datos a producir/consumir
-#define MAX_SLEEP 3                          // Duración máxima de un sleep
+#define MAX_BUFFER 5                         // Tamaño por defecto del buffer
+#define DATOS_A_PRODUCIR 52                  // Número de datos a producir/consumir (y máximo del historial)
+#define DATOS_RENDIMIENTO 30000              // Número de datos por defecto en el modo rendimiento
+#define MAX_SLEEP 3                          // Duración máxima de un sleep (por defecto)
+#define NUM_CLAVES 5                         // Letras distintas de los items ('a' a 'e')
 
+#define NOMBRE_OCUPACION "/OCUPACION_BUZONES"    // Objeto de memoria compartida con la ocupación de los buzones
+#define COLA_ORDENES 0                       // Índice de buz_ordenes en los contadores de ocupación
+#define COLA_ITEMS 1                         // Índice de buz_items en los contadores de ocupación
 
-mqd_t buz_ordenes;                   // Cola de entrada de mensajes para el productor
-mqd_t buz_items;                     // Cola de entrada de mensajes para el consumidor
+#define TRANSPORTE_MQ 0                      // Órdenes e items viajan por colas de mensajes POSIX con prioridades
+#define TRANSPORTE_SHM 1                     // Órdenes e items viajan por una pila de memoria compartida
+#define NOMBRE_CANAL "/PILA_ITEMS"           // Nombre del objeto de memoria compartida de la pila
 
-size_t tam_msg;                      // Tamaño de cada mensaje
 
-char historial_buzon[DATOS_A_PRODUCIR];   // Historial de mensajes enviados
+mqd_t buz_ordenes;                   // Cola de entrada de mensajes para el productor
+mqd_t buz_items;                     // Cola de entrada de mensajes para el consumidor
+struct ocupacion * ocupacion = NULL; // Contadores de ocupación de los buzones
+uint64_t periodo_ocupacion = 0;      // Nanosegundos entre dos volcados de la ocupación (0 si no se vuelca)
+uint64_t proximo_volcado = 0;        // Instante del próximo volcado de la ocupación
+struct canal * canal = NULL;         // Pila de memoria compartida (solo con TRANSPORTE_SHM)
+int transporte = TRANSPORTE_MQ;      // Transporte de las órdenes y los items
+
+size_t tam_msg;                      // Tamaño de cada mensaje de buz_ordenes
+size_t tam_elem = sizeof(char);      // Tamaño de cada registro
+size_t tam_msg_items;                // Tamaño de cada mensaje de buz_items (un registro y su sello de tiempo)
+
+int rendimiento = 0;                 // !0 para ejecutar sin esperas ni mensajes
+int num_datos = DATOS_A_PRODUCIR;    // Número de datos a producir
+int capacidad = MAX_BUFFER;          // Número máximo de mensajes de cada buzón (o de huecos de la pila)
+int espera_max = MAX_SLEEP;          // Límite (exclusivo) en segundos de las esperas aleatorias
+
+int instrumentar = 0;                // !0 para registrar los contadores de instrumentación
+struct contadores * contadores = NULL;   // Contadores de instrumentación (NULL si no se registran)
+struct contadores_hilo * cont = NULL;    // Entrada del productor en los contadores
+
+char historial_buzon[DATOS_A_PRODUCIR];   // Historial de mensajes enviados (los DATOS_A_PRODUCIR primeros)
+
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"capacidad", &capacidad, CONFIG_INT, 1, CONFIG_MAX_CAPACIDAD, "Mensajes de cada buzón o huecos de la pila"},
+    {"items", &num_datos, CONFIG_INT, 1, INT_MAX, "Número de items (como -k; con -r, DATOS_RENDIMIENTO)"},
+    {"tam_elem", &tam_elem, CONFIG_SIZE, 1, CONFIG_MAX_TAM_ELEM, "Tamaño en bytes de cada item (como -t)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+    {"contadores", &instrumentar, CONFIG_INT, 0, 1, "1 para volcar en JSON los contadores de instrumentación"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
 
 
 char producir_elemento(int iter);               // Función que genera un nuevo elemento
@@ -42,18 +122,80 @@ void productor();                               // Función que implementa el pr
 void imprimir_historial_buzon();                // Función para la impresión del historial
 long num_elementos_buzon(char buffer);          // Función para la comprobación del vaciado y llenado de buffers
 
-int main() {
+int main(int argc, char * argv[]) {
     struct mq_attr attr;            // Atributos de la cola
+    int opcion;                     // Opción leída con getopt
+    int items_fijados;              // !0 si el número de items se ha indicado (con --items o -k)
+
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: transporte, modo rendimiento, número y tamaño de los items
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    items_fijados = config_fijado(config, NUM_CONFIG, "items");
+    while ((opcion = getopt(argc, argv, "m:rk:t:s:")) != -1){
+        switch (opcion){
+            case 's':
+                periodo_ocupacion = strtoull(optarg, NULL, 10) * 1000000ULL;
+                break;
+            case 'm':
+                if (!strcmp(optarg, "mq")) transporte = TRANSPORTE_MQ;
+                else if (!strcmp(optarg, "shm")) transporte = TRANSPORTE_SHM;
+                else {
+                    fprintf(stderr, "Error: el transporte debe ser mq o shm\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                rendimiento = 1;
+                break;
+            case 'k':               // Forma abreviada de --items
+                if ((num_datos = atoi(optarg)) < 1){
+                    fprintf(stderr, "Error: el número de items debe ser positivo\n");
+                    exit(EXIT_FAILURE);
+                }
+                items_fijados = 1;
+                break;
+            case 't':
+                if ((tam_elem = strtoul(optarg, NULL, 10)) == 0){
+                    fprintf(stderr, "Error: el tamaño de los items debe ser de al menos 1 byte\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Uso: ./productor_LIFO [-m mq|shm] [-r] [-k items] [-t tam_elem] [-s periodo_ms] "
+                                "[--parámetro=valor ...]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (rendimiento && !items_fijados) num_datos = DATOS_RENDIMIENTO;
+    // Con las colas, cada item necesita su propia prioridad
+    if (transporte == TRANSPORTE_MQ && num_datos > sysconf(_SC_MQ_PRIO_MAX)){
+        fprintf(stderr, "Error: con el transporte mq no pueden producirse más de %ld items (usa -m shm)\n",
+                sysconf(_SC_MQ_PRIO_MAX));
+        exit(EXIT_FAILURE);
+    }
+    tam_msg_items = tam_elem + sizeof(uint64_t);
 
     srand(time(NULL));              // Semilla para la generación de números aleatorios
 
+    // Con la pila de memoria compartida, el productor la crea con un hueco por cada posición del buffer, cada uno con
+    // espacio para un registro, su sello de tiempo y su iteración. El consumidor obtendrá los tamaños de la cabecera.
+    if (transporte == TRANSPORTE_SHM){
+        if ((canal = canal_crear(NOMBRE_CANAL, capacidad, tam_msg_items + sizeof(uint32_t), CANAL_LIFO)) == NULL){
+            perror("Error - no se ha podido crear la pila de memoria compartida");
+            exit(EXIT_FAILURE);
+        }
+        productor();
+        canal_cerrar(canal);        // El objeto lo borra el consumidor en cuanto lo ha proyectado
+        exit(EXIT_SUCCESS);
+    }
+
     // El productor se encarga de crear las colas de ambos programas. El consumidor únicamente tendrá que abrirlas
     // (deberá comenzar a ejecutarse después del productor).
 
-    tam_msg = sizeof(char);           // Los mensajes serán de un solo carácter
+    tam_msg = sizeof(char);           // Las órdenes serán de un solo carácter
 
-    attr.mq_maxmsg = MAX_BUFFER;      // Número máximo de mensajes en los buffers
-    attr.mq_msgsize = tam_msg;        // Tamaño de cada mensaje
+    attr.mq_maxmsg = capacidad;       // Número máximo de mensajes en los buffers
+    attr.mq_msgsize = tam_msg;        // Tamaño de cada mensaje (buz_ordenes)
 
     // Se borran los buffers de entrada por si ya existían debido a una ejecución previa
     mq_unlink("/BUZON_ORDENES");
@@ -63,7 +205,10 @@ int main() {
     // los permisos (777) y se utiliza la configuración establecida a través de attr.
     // El productor escribirá en en el segundo y el consumidor en el primero. Por tanto, el productor los abre con
     // permisos de solo lectura y solo escritura, respectivamente.
+    // Los mensajes de buz_items ocupan un registro completo y su sello de tiempo; el consumidor obtendrá su tamaño
+    // con mq_getattr.
     buz_ordenes = mq_open("/BUZON_ORDENES", O_CREAT|O_RDONLY, 0777, &attr);
+    attr.mq_msgsize = tam_msg_items;
     buz_items = mq_open("/BUZON_ITEMS", O_CREAT|O_WRONLY, 0777, &attr);
 
     if ((buz_ordenes == -1) || (buz_items == -1)) {
@@ -71,7 +216,30 @@ int main() {
         exit(EXIT_FAILURE);
     }
 
+    // El productor crea también los contadores de ocupación de ambos buzones, que se actualizan en cada envío y
+    // recepción en lugar de consultar mq_getattr
+    if ((ocupacion = ocupacion_crear(NOMBRE_OCUPACION, 2, (const char * []) {"ordenes", "items"}, capacidad))
+            == NULL){
+        perror("Error - no se han podido crear los contadores de ocupación");
+        exit(EXIT_FAILURE);
+    }
+
+    // Los contadores de instrumentación solo tienen la entrada de este productor
+    if (instrumentar){
+        if ((contadores = contadores_crear("productor_LIFO", 1)) == NULL || contadores_senal(contadores) == -1){
+            perror("Error - no se han podido crear los contadores de instrumentación");
+            exit(EXIT_FAILURE);
+        }
+        cont = contadores_hilo(contadores, "productor", 0);
+    }
+
     productor();        // Funcion principal del productor
+    if (contadores != NULL){
+        contadores_volcar(contadores, STDERR_FILENO);
+        contadores_destruir(contadores);
+    }
+    if (periodo_ocupacion) ocupacion_volcar(ocupacion, stderr, "productor_LIFO");
+    ocupacion_cerrar(ocupacion);
 
     // El productor cierra los buzones
     if (mq_close(buz_ordenes) || mq_close(buz_items)){
@@ -99,15 +267,17 @@ char producir_elemento(int iter){
     char item;              // Item a enviar
     long nelem;                       // Número de elementos presentes en el buzón
 
-    sleep(rand() % MAX_SLEEP);       // Espera aleatoria de 0 o 1 segundo para forzar vaciado y llenado
+    item = 'a' + (iter % NUM_CLAVES);           // Con NUM_CLAVES = 5, el mensaje será 'a', 'b', 'c', 'd' ó 'e'
+    if (rendimiento) return item;               // En el modo rendimiento no se espera, imprime ni guarda historial
+
+    sleep(rand() % espera_max);      // Espera aleatoria (de 0 a 2 segundos por defecto) para forzar vaciado y llenado
     if ((nelem = num_elementos_buzon('P')) == 0) printf("%sCola del productor vacía%s\n", AZUL, RESET);
-    else if (nelem == MAX_BUFFER) printf("%sCola del productor llena%s\n", ROJO, RESET);
+    else if (nelem == capacidad) printf("%sCola del productor llena%s\n", ROJO, RESET);
 
     // Tras recibir una orden (una indicación de que el consumidor tiene slots vacíos en su buffer de entrada),
     // el productor genera un nuevo mensaje.
     printf("[ITER %02d] Recibida orden\n", iter);
-    item = 'a' + (iter % MAX_BUFFER);           // Con MAX_BUFFER = 5, el mensaje será 'a', 'b', 'c', 'd' ó 'e'
-    historial_buzon[iter] = item;                    // Guarda el contenido en el historial de mensajes producidos
+    if (iter < DATOS_A_PRODUCIR) historial_buzon[iter] = item;  // Guarda el contenido en el historial de mensajes
     return item;
 }
 
@@ -117,14 +287,16 @@ char producir_elemento(int iter){
 void imprimir_historial_buzon(){
     int i, j;
 
+    int enviados = num_datos < DATOS_A_PRODUCIR? num_datos : DATOS_A_PRODUCIR;     // Mensajes del historial
+
     // Se imprime el historial en líneas de 10 mensajes
-    for (i = 0; i < DATOS_A_PRODUCIR; i += 10){
+    for (i = 0; i < enviados; i += 10){
         printf("ITER -> ");         // Título de la línea (iteración)
         // En la condicion de finalizacion se comprueba que j no alcance el tamaño del historial
-        for (j = i; j < i + 10 && j < DATOS_A_PRODUCIR; j++) printf("%02d ", j);
+        for (j = i; j < i + 10 && j < enviados; j++) printf("%02d ", j);
 
         printf("\nITEM -> ");       // Contenido de la línea (mensaje)
-        for (j = i; j < i + 10 && j < DATOS_A_PRODUCIR; j++) printf(" %c ", historial_buzon[j]);
+        for (j = i; j < i + 10 && j < enviados; j++) printf(" %c ", historial_buzon[j]);
 
         printf("\n\n");
     }
@@ -134,17 +306,30 @@ void imprimir_historial_buzon(){
 /* Función principal del productor.
  * En cada iteración, espera a recibir una orden (un mensaje vacío) del consumidor. A continuación, genera un nuevo
  * item y se lo envía.
- * Se llevan a cabo un total de DATOS_A_PRODUCIR iteraciones.
+ * Se llevan a cabo un total de DATOS_A_PRODUCIR iteraciones (DATOS_RENDIMIENTO en el modo rendimiento).
  */
 void productor(void) {
     char item;          // Item donde se almacena el mensaje recibido del consumidor
                         // También guardará el mensaje a enviar como respuesta
+    char * mensaje;     // Mensaje en el que se genera cada item (tam_elem bytes, seguidos del sello de tiempo)
+    char * registro;    // Donde se genera cada item: el mensaje o, con la pila, su hueco en la memoria compartida
+    uint64_t sello;     // Instante de envío del item
+    uint32_t iteracion; // Iteración del item, que con la pila va en su hueco tras el sello
     int i;              // Contador de iteraciones
     long nelem;         // Número de elementos presentes en la cola
+    ssize_t bytes;      // Tamaño de cada orden recogida al acabar (0 para el cierre del consumidor)
+    uint64_t t;         // Instante de comienzo de la espera (contadores de instrumentación)
 
-    for (i = 0; i < DATOS_A_PRODUCIR; i++){
-        if ((nelem = num_elementos_buzon('C')) == 0) printf("%sCola del productor vacia%s\n", AZUL, RESET);
-        else if (nelem == MAX_BUFFER) printf("%sCola del productor llena%s\n", ROJO, RESET);
+    if ((mensaje = (char *) malloc(tam_msg_items)) == NULL){
+        fprintf(stderr, "Error: no se ha podido reservar memoria para los items\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_datos; i++){
+        if (!rendimiento){
+            if ((nelem = num_elementos_buzon('C')) == 0) printf("%sCola del productor vacia%s\n", AZUL, RESET);
+            else if (nelem == capacidad) printf("%sCola del productor llena%s\n", ROJO, RESET);
+        }
 
         /* El productor lee un mensaje de su buffer de recepción, buz_ordenes, usando mq_receive. Se toma el mensaje
          * de mayor prioridad y, en caso de empate, aquel que ha llegado antes al buffer.
@@ -157,16 +342,57 @@ void productor(void) {
          * lo realmente significativo es que haya mensajes, pero no se lee su contenido). Por tanto, este argumento
          * se ignora (NULL).
          *
-         * Si no hay mensajes, el productor se bloquea hasta que llege uno o lo despierte una señal.
+         * Si no hay mensajes, el productor se bloquea hasta que llege uno o lo despierte una señal. Con los
+         * contadores de instrumentación, la espera se registra como espera por una condición, y si el buzón de
+         * órdenes está vacío según los contadores de ocupación, el buzón de items está lleno.
+         *
+         * Con la pila de memoria compartida, la orden es un crédito del contador compartido.
          */
-        mq_receive(buz_ordenes, &item, tam_msg, 0);
+        if (transporte == TRANSPORTE_SHM) canal_recibir_credito(canal);
+        else {
+            if (cont != NULL && ocupacion_profundidad(ocupacion, COLA_ORDENES) == 0) contadores_lleno(cont);
+            t = contadores_inicio(cont);
+            mq_receive(buz_ordenes, &item, tam_msg, 0);
+            contadores_tiempo(cont, CONTADORES_ESPERA, t);
+            ocupacion_recibidos(ocupacion, COLA_ORDENES, 1);
+        }
         item = producir_elemento(i);        // El elemento producido se genera en base a la iteración actual
+        registro = transporte == TRANSPORTE_SHM? (char *) canal_hueco_envio(canal) : mensaje;
+        registro_rellenar(registro, tam_elem, item);       // El registro se genera directamente en el mensaje
+        sello = medidas_ns();                               // Tras el registro se añade el instante de envío
+        memcpy(registro + tam_elem, &sello, sizeof(sello));
         /* El mensaje es enviado al buzón de entrada del consumidor (buz_items) con prioridad igual a la iteración
          * actual. Esto asegura que el consumidor siempre leerá el elemento de la iteración más reciente que haya
          * presente en el buffer, de forma que funciona como una pila LIFO.
+         * Con la pila de memoria compartida, el hueco se apila al publicarlo y el orden no depende de prioridades.
          */
-        mq_send(buz_items, &item, tam_msg, i);
-        printf("[ITER %02d] Enviado item %c\n", i, item);
+        if (transporte == TRANSPORTE_SHM){
+            iteracion = i;
+            memcpy(registro + tam_msg_items, &iteracion, sizeof(iteracion));
+            canal_enviar(canal);
+        }
+        else {
+            ocupacion_enviados(ocupacion, COLA_ITEMS, 1);       // Antes del envío: la profundidad nunca queda negativa
+            mq_send(buz_items, registro, tam_msg_items, i);
+            ocupacion_volcar_periodico(ocupacion, stderr, "productor_LIFO", periodo_ocupacion, &proximo_volcado);
+        }
+        contadores_items(cont, 1);
+        if (!rendimiento) printf("[ITER %02d] Enviado item %c\n", i, item);
+    }
+
+    // Se cierra el flujo de items. Con las colas, el mensaje vacío de cierre ocupa un hueco, así que necesita una orden
+    if (transporte == TRANSPORTE_SHM) canal_terminar_envios(canal);
+    else {
+        mq_receive(buz_ordenes, &item, tam_msg, 0);
+        ocupacion_recibidos(ocupacion, COLA_ORDENES, 1);
+        ocupacion_enviados(ocupacion, COLA_ITEMS, 1);
+        mq_send(buz_items, mensaje, 0, 0);
+    }
+
+    // En el modo rendimiento no se imprime el historial ni se espera al consumidor: el resultado lo da él
+    if (rendimiento){
+        free(mensaje);
+        return;
     }
 
     printf("\n\n\n");
@@ -175,32 +401,47 @@ void productor(void) {
     printf("Finalizados envíos y recepciones. Lista de items producidos:\n");
     imprimir_historial_buzon();
 
-    // El productor se asegura de que su buffer de recepción quede vacío
-    printf("Espero 5 segundos a que el consumidor acabe...\n");
-    sleep(5);           // Espera a que el consumidor finalice por completo
-    // El productor se asegura de que su buffer de recepción quede vacío
-    if (num_elementos_buzon('P')) printf("\n\nEl buffer de entrada del productor no esta vacio\n\n");
-    while (num_elementos_buzon('P')){
-        mq_receive(buz_ordenes, &item, tam_msg, NULL);
+    // El productor se asegura de que su buffer de recepción quede vacío: recoge las órdenes que queden hasta
+    // encontrar el cierre del consumidor (un mensaje vacío o, con la pila, el fin de los créditos), que llega cuando
+    // este ha terminado
+    printf("Espero a que el consumidor acabe...\n");
+    for (;;){
+        if (transporte == TRANSPORTE_SHM){
+            if (canal_recibir_credito(canal) == -1) break;
+        }
+        else {
+            if ((bytes = mq_receive(buz_ordenes, &item, tam_msg, NULL)) == -1){
+                perror("Error en la recepción de una orden");
+                exit(EXIT_FAILURE);
+            }
+            ocupacion_recibidos(ocupacion, COLA_ORDENES, 1);
+            if (bytes == 0) break;
+        }
         printf("Recogido item del buffer de entrada del productor\n");
     }
     printf("Buffer de entrada del productor vacio\n\n");
+
+    free(mensaje);
 }
 
-/* Función que comprueba el número de elementos presentes en un buzón.
+/* Función que comprueba el número de elementos presentes en un buzón, leyendo los contadores de ocupación (sin
+ * llamadas al sistema).
+ * Con la pila de memoria compartida, se leen directamente los contadores de créditos e items.
  * @param buffer 'P' para analizar buz_ordenes, 'C' para analizar buz_items.
  * @return El número de items del buzón indicado o -1 en caso de entrada no definida.
  */
 long num_elementos_buzon(char buffer){
-    struct mq_attr attr;    // Estructura para almacenar la configuración de la cola de mensajes
+    if (transporte == TRANSPORTE_SHM){
+        if (buffer == 'P') return canal_creditos(canal);
+        if (buffer == 'C') return canal_items(canal);
+        return -1;
+    }
 
     switch(buffer){
         case 'P':
-            mq_getattr(buz_ordenes, &attr);     // Se leen los atributos de buz_ordenes
-            return attr.mq_curmsgs;             // Se accede al número de mensajes actuales
+            return ocupacion_profundidad(ocupacion, COLA_ORDENES);     // Mensajes actuales de buz_ordenes
         case 'C':
-            mq_getattr(buz_items, &attr);
-            return attr.mq_curmsgs;
+            return ocupacion_profundidad(ocupacion, COLA_ITEMS);
     }
     return -1;
 }
@@ -6,6 +6,9 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include "../comun/medidas.h"
+#include "../comun/config.h"
+#include "../comun/vista.h"
 
 
 /* Xiana Carrera Alonso
@@ -29,12 +32,30 @@
  * al no haber inconsistencias en los cambios de estado de los hilos.
  * 
  * Se debe compilar con la opción -pthread.
+ *
+ * Uso: ./filosofos1 [-r] [-n N]
+ *  -n: número de filósofos. Si no se indica, se solicita al usuario.
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, cada
+ *      filósofo come MAX_ITER_RENDIMIENTO veces y al final se imprime una
+ *      línea CSV (módulo comun/medidas) con las comidas por segundo, los
+ *      percentiles del tiempo que pasa cada filósofo hambriento hasta que
+ *      consigue sus tenedores y los cambios de contexto.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra), también como
+ * variables de entorno SOII_NOMBRE:
+ *  --filosofos: número de filósofos (como -n).
+ *  --iteraciones: veces que come cada filósofo (MAX_ITER, o
+ *      MAX_ITER_RENDIMIENTO con -r, por defecto).
+ *  --espera_max: las esperas duran de 0 a espera_max - 1 segundos
+ *      (MAX_SLEEP por defecto).
  */
 
 
 
 #define MAX_ITER 10                 // Número de iteraciones máximas del programa
-#define MAX_SLEEP 3                 // Número máximo de segundos que puede durar un sleep
+#define MAX_ITER_RENDIMIENTO 20000  // Número de iteraciones de cada filósofo en el modo rendimiento
+#define MAX_SLEEP 3                 // Número máximo de segundos que puede durar un sleep (por defecto)
+#define MAX_FILOSOFOS 999           // Número máximo de filósofos (los nombres de los recursos usan 3 cifras)
 
 // Macros que simbolizan al filósofo a la izquierda y a la derecha en la mesa, empleando su id
 #define IZQUIERDO (id+N-1)%N
@@ -44,6 +65,7 @@
 #define PENSANDO 0
 #define HAMBRIENTO 1
 #define COMIENDO 2      
+#define LETRAS_ESTADO "PHC"        // Letra con la que se imprime cada estado
 
 // Control de la consola
 #define COLOR "\033[0;%dm"          // String que permite cambiar el color de la consola
@@ -52,8 +74,13 @@
 
 
 int N;                   // Número de filósofos (es introducido por el usuario)
+int rendimiento = 0;     // !0 para ejecutar sin esperas ni mensajes y medir las comidas por segundo
+int num_iter = MAX_ITER; // Número de iteraciones de cada filósofo
+int espera_max = MAX_SLEEP;         // Límite (exclusivo) en segundos de las esperas aleatorias
+struct medidas * medidas = NULL;    // Espera de cada filósofo desde que tiene hambre hasta que come
 
 int * estado;            // Estado de cada filósofo (pensando, hambriento o comiendo)
+struct vista * vista = NULL;       // Letra del estado de cada filósofo (NULL en el modo rendimiento)
 sem_t * mutex = NULL;    // Semáforo que da acceso exclusivo a la región crítica (donde se toman o liberan los tenedores)
 sem_t ** s;              // Cada filósofo tiene un semáforo
 
@@ -69,7 +96,7 @@ void comer(int id);
 
 // Funciones de impresión
 void log_consola(int id, char * msg);
-char * ver_estados();
+void fijar_estado(int id, int nuevo);
 
 // Funciones auxiliares
 void crear_hilo(pthread_t * hilo, int i);
@@ -81,29 +108,66 @@ void cerrar_semaforos();
 void salir_con_error(char * mensaje, int ver_errno);
 
 
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"filosofos", &N, CONFIG_INT, 1, MAX_FILOSOFOS, "Número de filósofos (como -n; si no se indica, se pregunta)"},
+    {"iteraciones", &num_iter, CONFIG_INT, 1, 100000000,
+     "Veces que come cada filósofo (con -r, MAX_ITER_RENDIMIENTO)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
+
 
-int main(){
+int main(int argc, char * argv[]){
+    int opcion;                     // Opción leída con getopt
+    uint64_t t_ini;                 // Instante en que se crean los filósofos
+    double segundos;                // Duración de la ejecución de los filósofos
     pthread_t * hilos;              // Filósofos del programa
     int i;                          // Contador de iteraciones
 
 
-    // Pedimos que se introduzca el valor de N 
-    printf("Introduce el numero de filosofos ó -1 para salir ");    
-    scanf("%d", &N);
-    if (N == -1){
-        printf("Cerrando programa...\n");
-        exit(EXIT_SUCCESS);
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: modo rendimiento y número de filósofos
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "rn:")) != -1){
+        switch (opcion){
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "iteraciones")) num_iter = MAX_ITER_RENDIMIENTO;
+                break;
+            case 'n':
+                if ((N = atoi(optarg)) < 1 || N > MAX_FILOSOFOS)
+                    salir_con_error("El numero de filosofos debe estar entre 1 y MAX_FILOSOFOS\n", 0);
+                break;
+            default:
+                salir_con_error("Uso: ./filosofos1 [-r] [-n N] [--parámetro=valor ...]\n", 0);
+        }
     }
-    while (N < 0){
-        printf("El numero de filosofos debe ser mayor o igual que 1\n");
-        printf("Introduce el numero de filosofos ó -1 para salir ");
+
+    // Si no se ha indicado con -n, se solicita el número de filósofos al usuario
+    if (!N){
+        // Pedimos que se introduzca el valor de N 
+        printf("Introduce el numero de filosofos ó -1 para salir ");    
         scanf("%d", &N);
         if (N == -1){
             printf("Cerrando programa...\n");
             exit(EXIT_SUCCESS);
         }
+        while (N < 0){
+            printf("El numero de filosofos debe ser mayor o igual que 1\n");
+            printf("Introduce el numero de filosofos ó -1 para salir ");
+            scanf("%d", &N);
+            if (N == -1){
+                printf("Cerrando programa...\n");
+                exit(EXIT_SUCCESS);
+            }
+        }
     }
 
+    // Reservamos la estructura de medidas, con un sello de tiempo por filósofo
+    if ((medidas = medidas_crear((long) N * num_iter, N)) == NULL)
+        salir_con_error("No se ha podido reservar memoria para las medidas", 1);
+
     srand(time(NULL));              // Semilla para la generación de números aleatorios
     // Emplearemos esperas aleatorias para representar los períodos en los que los filósofos
     // comen y piensan.
@@ -120,22 +184,31 @@ int main(){
     
     // Inicialmente todos los filósofos están pensando
     for (i = 0; i < N; i++) estado[i] = PENSANDO;    
-
-    printf("\n");
-    printf("Estados posibles para los filósofos:\n");
-    printf("  P: Pensando\n");
-    printf("  H: Hambriento\n");
-    printf("  C: Comiendo\n\n");
+    // Fuera del modo rendimiento, log_consola imprime los estados a partir de una vista que se actualiza con cada
+    // cambio (en memoria compartida, para que sirva también con procesos)
+    if (!rendimiento && (vista = vista_crear(N, LETRAS_ESTADO[PENSANDO])) == NULL)
+        salir_con_error("No se ha podido reservar la vista de estados", 1);
+
+    if (!rendimiento){
+        printf("\n");
+        printf("Estados posibles para los filósofos:\n");
+        printf("  P: Pensando\n");
+        printf("  H: Hambriento\n");
+        printf("  C: Comiendo\n\n");
+    }
 
     // Como medida cautelar, destruimos los semáforos que pudiera haber en el sistema antes de volverlos
     // a crear. Así, el hilo principal los deja disponibles para que sus hijos los empleen.
     destruir_semaforos();
     crear_semaforos();
 
+    t_ini = medidas_ns();       // Medimos el tiempo que tardan los filósofos en completar todas sus iteraciones
+
     // Creamos los N filósofos
     for (i = 0; i < N; i++) crear_hilo(&hilos[i], i);
     // El hilo principal espera a que todos los filósofos acaben antes de finalizar él
     for (i = 0; i < N; i++) unirse_a_hilo(hilos[i]);
+    segundos = (medidas_ns() - t_ini) / 1e9;
 
     cerrar_semaforos();         // El hilo principal cierra los semáforos (que nunca llega a usar)
     destruir_semaforos();       // Volvemos a destruir los semáforos para que no se queden en el sistema
@@ -145,7 +218,11 @@ int main(){
     free(s);
     free(estado);
 
-    printf("\n\nEjecución finalizada. Cerrando programa...\n\n");
+    // En el modo rendimiento se imprime la línea CSV con las comidas por segundo, las esperas y los cambios de contexto
+    if (rendimiento) medidas_informe(medidas, "filosofos1", "semaforos", 1, 0, (long) N * num_iter, segundos);
+    else printf("\n\nEjecución finalizada. Cerrando programa...\n\n");
+    medidas_destruir(medidas);
+    vista_destruir(vista);
     
     exit(EXIT_SUCCESS);
 }
@@ -162,7 +239,7 @@ void * filosofo(void * ptr_id){
     abrir_semaforos();          // El filósofo abre los semáforos para tener acceso a ellos
 
     // Realizamos un número finito de iteraciones para controlar el tiempo de ejecución
-    for (i = 0; i < MAX_ITER; i++){
+    for (i = 0; i < num_iter; i++){
         pensar();              // El filósofo no actúa
         tomar_tenedores(id);   // El filósofo toma ambos tenedores o queda bloqueado esperando
         comer(id);             // El filósofo espera mientras sostiene ambos tenedores
@@ -190,7 +267,7 @@ void probar(int id){
      * él aún no quiere.
      */
     if (estado[id] == HAMBRIENTO && estado[IZQUIERDO] != COMIENDO && estado[DERECHO] != COMIENDO){
-        estado[id] = COMIENDO;      // El filósofo ya no deja que ninguno de sus vecinos tome sus tenedores.
+        fijar_estado(id, COMIENDO); // El filósofo ya no deja que ninguno de sus vecinos tome sus tenedores.
         sem_post(s[id]);   // Este semáforo actúa a modo de 'return' para esta función. Le indicará al filósofo que puede comer.
     }
 }
@@ -199,13 +276,15 @@ void probar(int id){
  * El filósofo trata de tomar los tenedores de su izquierda y de su derecha. Si no puede, se bloquea hasta que pueda.
  */
 void tomar_tenedores(int id){
+    medidas_sellar(medidas, id);   // El filósofo tiene hambre desde este instante
     sem_wait(mutex);       // El filósofo trata de acceder a la región crítica. Queda bloqueado si ya hay alguien cogiendo/dejando tenedores.
     log_consola(id, "Quiere tomar tenedores");
-    estado[id] = HAMBRIENTO;  // Registra que quiere tomar los tenedores
+    fijar_estado(id, HAMBRIENTO); // Registra que quiere tomar los tenedores
     probar(id);             // Comprueba si el filósofo puede comer (él está hambriento y sus vecinos no están comiendo, es decir, tienen libres los tenedores)
     sem_post(mutex);        // Sale de la región crítica
     sem_wait(s[id]);        // Si el filósofo puede comer (al probar, ha comprobado que los tenedores están disponibles y se ha declarado como "COMIENDO"), su 
     // semáforo se habrá incrementado. Si no, seguirá a 0 y quedará bloqueado.
+    medidas_latencia(medidas, id); // Ya tiene los tenedores: se registra cuánto ha esperado
 }
 
 /*
@@ -214,7 +293,7 @@ void tomar_tenedores(int id){
 void poner_tenedores(int id){
     sem_wait(mutex);           // El filósofo trata de acceder a la región crítica. Queda bloqueado si ya hay alguien cogiendo/dejando tenedores.
     log_consola(id, "Va a dejar sus tenedores");
-    estado[id] = PENSANDO;    // El filósofo está ocioso. No está comiendo ni quiere tomar tenedores.
+    fijar_estado(id, PENSANDO); // El filósofo está ocioso. No está comiendo ni quiere tomar tenedores.
     probar(IZQUIERDO);      // Si el filósofo de la izquierda quiere comer y su tenedor izquierdo está libre, se le cede el tenedor derecho 
     // y se le permite comer (deja de esperar su turno).
     if (estado[IZQUIERDO] == COMIENDO) log_consola(id, "Cede un tenedor al vecino izquierdo y este come");
@@ -224,17 +303,17 @@ void poner_tenedores(int id){
 }
 
 
-// El filósofo queda bloqueado durante un tiempo aleatorio (como máximo, MAX_SLEEP segundos)
+// El filósofo queda bloqueado durante un tiempo aleatorio (como máximo, espera_max - 1 segundos)
 void pensar(){
-   sleep(rand() % MAX_SLEEP);
+   if (!rendimiento) sleep(rand() % espera_max);
 }
 
 /* 
- * El filósofo anuncia que está comiendo y queda bloqueado un tiempo aleatorio (como máximo, MAX_SLEEP segundos)
+ * El filósofo anuncia que está comiendo y queda bloqueado un tiempo aleatorio (como máximo, espera_max - 1 segundos)
  */
 void comer(int id){
     log_consola(id, "Está comiendo");
-    sleep(rand() % MAX_SLEEP);
+    if (!rendimiento) sleep(rand() % espera_max);
 }
 
 
@@ -243,38 +322,26 @@ void comer(int id){
  * al estado de cada filósofo en el momento actual de ejecución.
  */
 void log_consola(int id, char * msg) {
+    char estados[MAX_FILOSOFOS + 1];        // Estados de los filósofos
+
+    if (rendimiento) return;                // En el modo rendimiento no se imprime nada
+
     // Empleamos los colores rojo, verde, amarillo, azul, magenta o fucsia según el id del hilo (31-36)
     int color = 31 + id % 6;
-    char * estados = ver_estados();         // Estados de los filósofos
+    // Instantánea de la vista de estados (módulo comun/vista), sin reconstruirla ni tomar el mutex de la región crítica
+    vista_leer(vista, estados);
 
     // Con la macro MOVER_A_COL nos colocamos en una columna a la derecha para imprimir los estados de los filósofos
     printf(COLOR "[%d]: %s" MOVER_A_COL "%s" RESET "\n", color, id, msg, estados);
-    free(estados);
 }
 
 /*
- * Función que construye una cadena con el estado actual de cada filósofo, para poder imprimirla.
+ * Función que cambia el estado de un filósofo y actualiza su letra en la vista de estados que imprime log_consola.
+ * Solo se reescribe un carácter de la vista, sin recorrer el resto.
  */
-char * ver_estados(){
-    int i;
-    char * estados = (char *) malloc(N*sizeof(char));
-
-    for (i = 0; i < N; i++){
-        switch (estado[i]){
-            case PENSANDO:
-                estados[i] = 'P';
-                break;
-            case HAMBRIENTO:
-                estados[i] = 'H';
-                break;
-            case COMIENDO:
-                estados[i] = 'C';
-                break;
-            default:
-                estados[i] = '?';   // Error
-        }
-    }
-    return estados;
+void fijar_estado(int id, int nuevo){
+    estado[id] = nuevo;
+    vista_cambiar(vista, id, LETRAS_ESTADO[nuevo]);
 }
 
 /*
@@ -6,6 +6,14 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "../comun/medidas.h"
+#include "../comun/config.h"
+#include "../comun/vista.h"
+#include "../comun/cache.h"
 
 /* Xiana Carrera Alonso
  * Sistemas Operativos II
@@ -31,13 +39,59 @@
  * de un filósofo estén disponibles por el bloqueo asociado a una variable
  * de condición.
  * 
+ * Con un único mutex, solo un filósofo a la vez puede comprobar o cambiar el estado de los tenedores, sea cual sea
+ * N. Como alternativa se ofrece un modo con un mutex por tenedor (-m tenedores): cada filósofo bloquea únicamente
+ * sus dos tenedores, de modo que dos filósofos que no son vecinos nunca compiten por el mismo cerrojo y las comidas
+ * por segundo pueden crecer con N. Para evitar el interbloqueo (todos con el tenedor izquierdo esperando por el
+ * derecho), los tenedores se adquieren siempre en el mismo orden global, de menor a mayor número (jerarquía de
+ * recursos): el último filósofo toma primero el derecho, el tenedor 0, y así se rompe la espera circular. En este modo
+ * no se usan las variables de condición, ya que la espera por un tenedor ocupado es la del propio mutex.
+ *
+ * El modo sin cerrojos (-m lockfree) elimina también los mutexes. Los estados se guardan empaquetados, 2 bits por
+ * filósofo, en palabras atómicas de 64 bits (32 filósofos por palabra). Un filósofo hambriento cuyos dos vecinos
+ * están en su misma palabra comprueba sus estados y pasa a COMIENDO con un único CAS sobre ella: si algún vecino ha
+ * cambiado entretanto, el CAS falla y se vuelve a comprobar. Si algún vecino está en otra palabra (en los extremos de
+ * cada palabra), no basta con un CAS y se usa un protocolo en dos pasos con un cuarto estado, RESERVANDO:
+ *  1. Con un CAS sobre su palabra pasa de HAMBRIENTO a RESERVANDO, si ningún vecino de esa palabra está comiendo ni
+ *     reservando. A partir de aquí, esos vecinos no pueden empezar a comer.
+ *  2. Lee el estado del vecino de la otra palabra. Si come, o si también está reservando y su palabra es anterior a
+ *     la suya, vuelve a HAMBRIENTO y espera. Si reserva pero su palabra es posterior, gana él: espera a que el vecino
+ *     retroceda o coma y vuelve a comprobar. Si no, pasa de RESERVANDO a COMIENDO.
+ * Como todas las operaciones son secuencialmente consistentes, de dos vecinos que reservan a la vez al menos uno ve
+ * al otro, y el orden de las palabras decide cuál de ellos sigue, así que nunca comen dos vecinos a la vez ni se
+ * esperan en círculo. Para bloquearse, cada filósofo tiene su propia palabra futex: antes de comprobar si puede comer
+ * lee su valor, y quien deja de comer (o retrocede) la incrementa y lo despierta si está hambriento, de modo que
+ * ningún aviso se pierde. Como en probar(), quien deja de comer cede los tenedores a los vecinos hambrientos que ya
+ * pueden comer, en lugar de limitarse a despertarlos.
+ *
  * Se debe compilar con la opción -pthread.
+ *
+ * Uso: ./filosofos2 [-r] [-n N] [-m condvar|tenedores|lockfree]
+ *  -n: número de filósofos. Si no se indica, se solicita al usuario.
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, cada
+ *      filósofo come MAX_ITER_RENDIMIENTO veces y al final se imprime una
+ *      línea CSV (módulo comun/medidas) con las comidas por segundo, los
+ *      percentiles del tiempo que pasa cada filósofo hambriento hasta que
+ *      consigue sus tenedores y los cambios de contexto.
+ *  -m: mecanismo de sincronización: "condvar" (por defecto), un mutex para la región crítica y una variable de
+ *      condición por filósofo, "tenedores", un mutex por tenedor adquiridos en orden global, o "lockfree", los
+ *      estados empaquetados en palabras atómicas y una palabra futex por filósofo.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra), también como
+ * variables de entorno SOII_NOMBRE:
+ *  --filosofos: número de filósofos (como -n).
+ *  --iteraciones: veces que come cada filósofo (MAX_ITER, o
+ *      MAX_ITER_RENDIMIENTO con -r, por defecto).
+ *  --espera_max: las esperas duran de 0 a espera_max - 1 segundos
+ *      (MAX_SLEEP por defecto).
  */
 
 
 
 #define MAX_ITER 10                 // Número de iteraciones máximas del programa
-#define MAX_SLEEP 3                 // Número máximo de segundos que puede durar un sleep
+#define MAX_ITER_RENDIMIENTO 20000  // Número de iteraciones de cada filósofo en el modo rendimiento
+#define MAX_SLEEP 3                 // Número máximo de segundos que puede durar un sleep (por defecto)
+#define MAX_FILOSOFOS 999           // Número máximo de filósofos (los nombres de los recursos usan 3 cifras)
 
 // Macros que simbolizan al filósofo a la izquierda y a la derecha en la mesa, empleando su id
 #define IZQUIERDO (id+N-1)%N
@@ -47,6 +101,21 @@
 #define PENSANDO 0
 #define HAMBRIENTO 1
 #define COMIENDO 2      
+#define RESERVANDO 3                // Solo en el modo MODO_LOCKFREE: hambriento, comprobando un vecino de otra palabra
+#define LETRAS_ESTADO "PHCH"        // Letra con la que se imprime cada estado
+
+// Mecanismos de sincronización (opción -m)
+#define MODO_CONDVAR 0              // Mutex de la región crítica y una variable de condición por filósofo
+#define MODO_TENEDORES 1            // Un mutex por tenedor, adquiridos en orden global
+#define MODO_LOCKFREE 2             // Estados empaquetados en palabras atómicas y una palabra futex por filósofo
+
+// Estados empaquetados del modo MODO_LOCKFREE: 2 bits por filósofo, 32 filósofos por palabra de 64 bits
+#define BITS_ESTADO 2
+#define FILOSOFOS_PALABRA (64 / BITS_ESTADO)
+#define PALABRA(i) ((i) / FILOSOFOS_PALABRA)                            // Palabra con el estado del filósofo i
+#define DESPLAZAMIENTO(i) ((i) % FILOSOFOS_PALABRA * BITS_ESTADO)       // Posición de su estado en la palabra
+#define CAMPO(v, i) ((int) (((v) >> DESPLAZAMIENTO(i)) & 3))            // Estado del filósofo i en el valor v
+#define OCUPADO(e) ((e) == COMIENDO || (e) == RESERVANDO)                // El vecino puede estar usando el tenedor
 
 // Control de la consola
 #define COLOR "\033[0;%dm"          // String que permite cambiar el color de la consola
@@ -55,12 +124,38 @@
 
 
 int N;                             // Número de filósofos (es introducido por el usuario)
+int rendimiento = 0;     // !0 para ejecutar sin esperas ni mensajes y medir las comidas por segundo
+int num_iter = MAX_ITER; // Número de iteraciones de cada filósofo
+int espera_max = MAX_SLEEP;         // Límite (exclusivo) en segundos de las esperas aleatorias
+struct medidas * medidas = NULL;    // Espera de cada filósofo desde que tiene hambre hasta que come
 
 int * estado;                      // Estado de cada filósofo (pensando, hambriento o comiendo)
+struct vista * vista = NULL;       // Letra del estado de cada filósofo (NULL en el modo rendimiento)
 
 pthread_mutex_t mutex;             // Mutex de acceso a la región crítica
 pthread_cond_t * conds;            // Cada filósofo tiene una variable de condición
 
+/*
+ * Tenedor del modo MODO_TENEDORES. Cada mutex ocupa su propia línea de caché (módulo comun/cache), para que los
+ * filósofos que no comparten tenedor tampoco compartan líneas.
+ */
+struct tenedor {
+    CACHE_ALINEADO pthread_mutex_t mutex;
+};
+
+// Palabra de estados empaquetados del modo MODO_LOCKFREE, en su propia línea de caché
+struct palabra_estados {
+    CACHE_ALINEADO _Atomic uint64_t valor;
+};
+
+int modo = MODO_CONDVAR;           // Mecanismo de sincronización empleado
+struct tenedor * tenedores;        // Tenedores de la mesa (solo en el modo MODO_TENEDORES)
+struct palabra_estados * estados_emp;   // Estados empaquetados (solo en el modo MODO_LOCKFREE)
+struct cache_palabra * avisos;     // Palabra futex de cada filósofo (solo en el modo MODO_LOCKFREE)
+
+// Nombre de cada mecanismo en la variante del CSV
+const char * nombres_modo[] = {"mutex_varcon", "mutex_tenedores", "lockfree"};
+
 
 
 // Funciones principales
@@ -68,12 +163,23 @@ void * filosofo(void * ptr_id);
 void probar(int id);
 void tomar_tenedores(int id);
 void poner_tenedores(int id);
+void tomar_tenedores_ordenados(int id);
+void poner_tenedores_ordenados(int id);
+void tomar_tenedores_sin_cerrojos(int id);
+void poner_tenedores_sin_cerrojos(int id);
+int probar_sin_cerrojos(int id, int llamante);
+int estado_empaquetado(int i);
+void cambiar_estado(int id, int de, int a);
+void avisar(int id);
+void avisar_vecinos(int id);
+void esperar_futex(_Atomic uint32_t * palabra, uint32_t valor);
+void despertar_futex(_Atomic uint32_t * palabra);
 void pensar();
 void comer(int id);
 
 // Funciones de impresión
 void log_consola(int id, char * msg);
-char * ver_estados();
+void fijar_estado(int id, int nuevo);
 
 // Funciones auxiliares
 void crear_hilo(pthread_t * hilo, int i);
@@ -82,28 +188,71 @@ void inicializar_mutex_varcon();
 void destruir_mutex_varcon();
 void salir_con_error(char * mensaje, int ver_errno);
 
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"filosofos", &N, CONFIG_INT, 1, MAX_FILOSOFOS, "Número de filósofos (como -n; si no se indica, se pregunta)"},
+    {"iteraciones", &num_iter, CONFIG_INT, 1, 100000000,
+     "Veces que come cada filósofo (con -r, MAX_ITER_RENDIMIENTO)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
+
 
-int main(){
+int main(int argc, char * argv[]){
+    int opcion;                     // Opción leída con getopt
+    uint64_t t_ini;                 // Instante en que se crean los filósofos
+    double segundos;                // Duración de la ejecución de los filósofos
     pthread_t * hilos;      // Filósofos del programa
     int i;
 
-    // Solicite al usuario el número de filósofos (N)
-    printf("Introduce el numero de filosofos ó -1 para salir ");    
-    scanf("%d", &N);
-    if (N == -1){
-        printf("Cerrando programa...\n");
-        exit(EXIT_SUCCESS);
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: modo rendimiento y número de filósofos
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "rn:m:")) != -1){
+        switch (opcion){
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "iteraciones")) num_iter = MAX_ITER_RENDIMIENTO;
+                break;
+            case 'n':
+                if ((N = atoi(optarg)) < 1 || N > MAX_FILOSOFOS)
+                    salir_con_error("El numero de filosofos debe estar entre 1 y MAX_FILOSOFOS\n", 0);
+                break;
+            case 'm':
+                if (!strcmp(optarg, "condvar")) modo = MODO_CONDVAR;
+                else if (!strcmp(optarg, "tenedores")) modo = MODO_TENEDORES;
+                else if (!strcmp(optarg, "lockfree")) modo = MODO_LOCKFREE;
+                else salir_con_error("El mecanismo debe ser condvar, tenedores o lockfree\n", 0);
+                break;
+            default:
+                salir_con_error("Uso: ./filosofos2 [-r] [-n N] [-m condvar|tenedores|lockfree] [--parámetro=valor ...]\n", 0);
+        }
     }
-    while (N < 0){
-        printf("El numero de filosofos debe ser mayor o igual que 1\n");
-        printf("Introduce el numero de filosofos ó -1 para salir ");
+
+    // Si no se ha indicado con -n, se solicita el número de filósofos al usuario
+    if (!N){
+        // Solicite al usuario el número de filósofos (N)
+        printf("Introduce el numero de filosofos ó -1 para salir ");    
         scanf("%d", &N);
         if (N == -1){
             printf("Cerrando programa...\n");
             exit(EXIT_SUCCESS);
         }
+        while (N < 0){
+            printf("El numero de filosofos debe ser mayor o igual que 1\n");
+            printf("Introduce el numero de filosofos ó -1 para salir ");
+            scanf("%d", &N);
+            if (N == -1){
+                printf("Cerrando programa...\n");
+                exit(EXIT_SUCCESS);
+            }
+        }
     }
 
+    // Reservamos la estructura de medidas, con un sello de tiempo por filósofo
+    if ((medidas = medidas_crear((long) N * num_iter, N)) == NULL)
+        salir_con_error("No se ha podido reservar memoria para las medidas", 1);
+
 
     srand(time(NULL));              // Semilla para la generación de números aleatorios
     // Emplearemos esperas aleatorias para representar los períodos en los que los filósofos
@@ -115,27 +264,43 @@ int main(){
     // Reservamos memoria para el array de variables de condición (hay una por filósofo)
     if ((conds = (pthread_cond_t *) malloc(N * sizeof(pthread_cond_t))) == NULL)
         salir_con_error("No se ha podido reservar memoria para las variables de condicion\n", 0);
+    // Reservamos memoria para el array de tenedores (uno por filósofo), alineado a una línea de caché
+    if ((tenedores = (struct tenedor *) cache_reservar(N, sizeof(struct tenedor))) == NULL)
+        salir_con_error("No se ha podido reservar memoria para los tenedores\n", 0);
+    // Reservamos las palabras de estados empaquetados (todos empiezan a 0, PENSANDO) y las palabras futex
+    if ((estados_emp = (struct palabra_estados *) cache_reservar(PALABRA(N - 1) + 1, sizeof(struct palabra_estados)))
+            == NULL || (avisos = (struct cache_palabra *) cache_reservar(N, sizeof(struct cache_palabra))) == NULL)
+        salir_con_error("No se ha podido reservar memoria para los estados empaquetados\n", 0);
     // Reservamos memoria para el array de estados
     if ((estado = (int *) malloc(N * sizeof(int))) == NULL)
         salir_con_error("No se ha podido reservar memoria para el estado de los filosofos\n", 0);
         
     // Inicialmente todos los filósofos están pensando
     for (i = 0; i < N; i++) estado[i] = PENSANDO;    
-
-    printf("\n");
-    printf("Estados posibles para los filósofos:\n");
-    printf("  P: Pensando\n");
-    printf("  H: Hambriento\n");
-    printf("  C: Comiendo\n\n");
+    // Fuera del modo rendimiento, log_consola imprime los estados a partir de una vista que se actualiza con cada
+    // cambio (en memoria compartida, para que sirva también con procesos)
+    if (!rendimiento && (vista = vista_crear(N, LETRAS_ESTADO[PENSANDO])) == NULL)
+        salir_con_error("No se ha podido reservar la vista de estados", 1);
+
+    if (!rendimiento){
+        printf("\n");
+        printf("Estados posibles para los filósofos:\n");
+        printf("  P: Pensando\n");
+        printf("  H: Hambriento\n");
+        printf("  C: Comiendo\n\n");
+    }
 
 
     // Se inicializan el mutex y las variables de condicion
     inicializar_mutex_varcon();
 
+    t_ini = medidas_ns();       // Medimos el tiempo que tardan los filósofos en completar todas sus iteraciones
+
     // Se crean los filósofos
     for (i = 0; i < N; i++) crear_hilo(&hilos[i], i);
     // El hilo principal espera a que todos los filósofos terminen antes de continuar
     for (i = 0; i < N; i++) unirse_a_hilo(hilos[i]);
+    segundos = (medidas_ns() - t_ini) / 1e9;
 
     // Se destruye el mutex y las variables de condicion
     destruir_mutex_varcon();
@@ -143,9 +308,17 @@ int main(){
     // Liberamos la memoria reservada
     free(hilos);
     free(conds);
+    free(tenedores);
+    free(estados_emp);
+    free(avisos);
     free(estado);
 
-    printf("\n\nEjecución finalizada. Cerrando programa...\n\n");
+    // En el modo rendimiento se imprime la línea CSV con las comidas por segundo, las esperas y los cambios de contexto
+    if (rendimiento)
+        medidas_informe(medidas, "filosofos2", nombres_modo[modo], 1, 0, (long) N * num_iter, segundos);
+    else printf("\n\nEjecución finalizada. Cerrando programa...\n\n");
+    medidas_destruir(medidas);
+    vista_destruir(vista);
     
     exit(EXIT_SUCCESS);
 }
@@ -164,11 +337,17 @@ void * filosofo(void * ptr_id){
     // filósofos vuelvan a abrir los mutexes o las variables de condición que ya inicializó el hilo principal.
 
     // Realizamos un número finito de iteraciones para controlar el tiempo de ejecución
-    for (i = 0; i < MAX_ITER; i++){
+    for (i = 0; i < num_iter; i++){
         pensar();              // El filósofo no actúa
-        tomar_tenedores(id);   // El filósofo toma ambos tenedores o queda bloqueado esperando
+        // El filósofo toma ambos tenedores o queda bloqueado esperando
+        if (modo == MODO_TENEDORES) tomar_tenedores_ordenados(id);
+        else if (modo == MODO_LOCKFREE) tomar_tenedores_sin_cerrojos(id);
+        else tomar_tenedores(id);
         comer(id);             // El filósofo espera mientras sostiene ambos tenedores
-        poner_tenedores(id);   // El filósofo devuelve los 2 tenedores a la mesa
+        // El filósofo devuelve los 2 tenedores a la mesa
+        if (modo == MODO_TENEDORES) poner_tenedores_ordenados(id);
+        else if (modo == MODO_LOCKFREE) poner_tenedores_sin_cerrojos(id);
+        else poner_tenedores(id);
     }
 
     // Tampoco es necesario que los filósofos cierren los mutexes y las variables
@@ -193,7 +372,7 @@ void probar(int id){
      * comer cuando en realidad él aún no quiere.
      */
     if (estado[id] == HAMBRIENTO && estado[IZQUIERDO] != COMIENDO && estado[DERECHO] != COMIENDO){
-        estado[id] = COMIENDO;      // El filósofo ya no deja que ninguno de sus vecinos tome sus tenedores.
+        fijar_estado(id, COMIENDO); // El filósofo ya no deja que ninguno de sus vecinos tome sus tenedores.
         pthread_cond_signal(&conds[id]);    // El filósofo que ha llamado a esta función señala a su vecino para que
         // salga del bloqueo de la variable de condición, si estaba en él (al no haber estado los tenedores libres 
         // cuando llamó a probar), y comience a comer.
@@ -205,10 +384,11 @@ void probar(int id){
  * El filósofo trata de tomar los tenedores de su izquierda y de su derecha. Si no puede, se bloquea hasta que pueda.
  */
 void tomar_tenedores(int id){
+    medidas_sellar(medidas, id);   // El filósofo tiene hambre desde este instante
     pthread_mutex_lock(&mutex);       // El filósofo trata de acceder a la región crítica. Queda bloqueado si ya hay 
     // alguien cogiendo/dejando tenedores (es decir, si el mutex ya está tomado).
     log_consola(id, "Quiere tomar tenedores");
-    estado[id] = HAMBRIENTO;  // Registra que quiere tomar los tenedores
+    fijar_estado(id, HAMBRIENTO); // Registra que quiere tomar los tenedores
     probar(id);             // Comprueba si el filósofo puede comer (él está hambriento y sus vecinos no están 
     // comiendo, es decir, tienen libres los tenedores)
 
@@ -222,6 +402,7 @@ void tomar_tenedores(int id){
     }
 
     pthread_mutex_unlock(&mutex);    // Sale de la región crítica liberando el mutex.
+    medidas_latencia(medidas, id); // Ya tiene los tenedores: se registra cuánto ha esperado
 }
 
 /*
@@ -231,7 +412,7 @@ void poner_tenedores(int id){
     pthread_mutex_lock(&mutex);           // El filósofo trata de acceder a la región crítica. Queda bloqueado si 
     // ya hay alguien cogiendo/dejando tenedores.
     log_consola(id, "Va a dejar sus tenedores");
-    estado[id] = PENSANDO;    // El filósofo está ocioso. No está comiendo ni quiere tomar tenedores.
+    fijar_estado(id, PENSANDO); // El filósofo está ocioso. No está comiendo ni quiere tomar tenedores.
     probar(IZQUIERDO);      // Si el filósofo de la izquierda quiere comer y su tenedor izquierdo está libre, se 
     // le cede el tenedor derecho y se le permite comer (deja de esperar su turno).
     if (estado[IZQUIERDO] == COMIENDO) log_consola(id, "Cede un tenedor al vecino izquierdo y este come");
@@ -240,44 +421,201 @@ void poner_tenedores(int id){
     pthread_mutex_unlock(&mutex);        // Sale de la región crítica. Se dedicará a pensar.
 }
 
+/*
+ * Modo MODO_TENEDORES: el filósofo id usa el tenedor id (a su izquierda) y el tenedor id+1 (a su derecha, el 0 para
+ * el último filósofo). Los bloquea siempre de menor a mayor número, de modo que no puede formarse una cadena circular
+ * de filósofos que esperan cada uno por el tenedor del siguiente. Solo compite con sus dos vecinos.
+ */
+void tomar_tenedores_ordenados(int id){
+    int primero = id < DERECHO ? id : DERECHO;      // Tenedor de menor número
+    int segundo = id < DERECHO ? DERECHO : id;      // Tenedor de mayor número
+
+    medidas_sellar(medidas, id);   // El filósofo tiene hambre desde este instante
+    fijar_estado(id, HAMBRIENTO);  // Solo el propio filósofo escribe su estado (se lee únicamente para imprimirlo)
+    log_consola(id, "Quiere tomar tenedores");
+    pthread_mutex_lock(&tenedores[primero].mutex);
+    // Con un solo filósofo, sus dos tenedores son el mismo y no se puede bloquear dos veces
+    if (segundo != primero) pthread_mutex_lock(&tenedores[segundo].mutex);
+    fijar_estado(id, COMIENDO);
+    medidas_latencia(medidas, id); // Ya tiene los tenedores: se registra cuánto ha esperado
+}
 
-// El filósofo queda bloqueado durante un tiempo aleatorio (como máximo, MAX_SLEEP segundos)
-void pensar(){
-   sleep(rand() % MAX_SLEEP);
+/*
+ * Modo MODO_TENEDORES: el filósofo deja sus tenedores en la mesa. Los vecinos que estuvieran esperando por ellos
+ * quedan desbloqueados por los propios mutexes.
+ */
+void poner_tenedores_ordenados(int id){
+    log_consola(id, "Va a dejar sus tenedores");
+    fijar_estado(id, PENSANDO);
+    if (DERECHO != id) pthread_mutex_unlock(&tenedores[DERECHO].mutex);
+    pthread_mutex_unlock(&tenedores[id].mutex);
 }
 
-/* 
- * El filósofo anuncia que está comiendo y queda bloqueado un tiempo aleatorio (como máximo, MAX_SLEEP segundos)
+
+/*
+ * Modo MODO_LOCKFREE: el filósofo anuncia que tiene hambre y trata de comer. Si no puede, se bloquea en su palabra
+ * futex hasta que un vecino la cambie: o bien ya le ha cedido los tenedores (está COMIENDO), o bien debe volver a
+ * intentarlo. El valor de la palabra se lee antes de cada comprobación: si un vecino la cambia después, el filósofo
+ * no se quedará dormido.
  */
-void comer(int id){
-    log_consola(id, "Está comiendo");
-    sleep(rand() % MAX_SLEEP);
+void tomar_tenedores_sin_cerrojos(int id){
+    uint32_t aviso;             // Valor de la palabra futex antes de comprobar el estado
+
+    medidas_sellar(medidas, id);   // El filósofo tiene hambre desde este instante
+    log_consola(id, "Quiere tomar tenedores");
+    cambiar_estado(id, PENSANDO, HAMBRIENTO);
+    fijar_estado(id, HAMBRIENTO);
+    for (;;){
+        aviso = atomic_load(&avisos[id].valor);
+        if (estado_empaquetado(id) == COMIENDO || probar_sin_cerrojos(id, id)) break;
+        esperar_futex(&avisos[id].valor, aviso);
+    }
+    // La vista solo la actualiza el propio filósofo, aunque haya sido un vecino quien le ha cedido los tenedores: así
+    // sus cambios llegan a la vista en el mismo orden en que se producen
+    fijar_estado(id, COMIENDO);
+    medidas_latencia(medidas, id); // Ya tiene los tenedores: se registra cuánto ha esperado
 }
 
+/*
+ * Modo MODO_LOCKFREE: el filósofo deja de comer y, como probar() en el modo MODO_CONDVAR, cede los tenedores a los
+ * vecinos hambrientos que puedan comer. Después despierta a los vecinos que no están pensando: unos ya comen y los
+ * demás deben volver a intentarlo. Sin la cesión, un vecino despertado podría encontrar que el otro de sus vecinos ha
+ * vuelto a tomar el tenedor antes de que él llegue a ejecutarse, y pasar hambre indefinidamente.
+ */
+void poner_tenedores_sin_cerrojos(int id){
+    log_consola(id, "Va a dejar sus tenedores");
+    cambiar_estado(id, COMIENDO, PENSANDO);
+    fijar_estado(id, PENSANDO);
+    probar_sin_cerrojos(IZQUIERDO, id);
+    if (DERECHO != IZQUIERDO) probar_sin_cerrojos(DERECHO, id);
+    avisar_vecinos(id);
+}
 
 /*
- * Función que construye una cadena con el estado actual de cada filósofo, para poder imprimirla.
+ * Modo MODO_LOCKFREE: trata de que el filósofo hambriento id pase a COMIENDO, con un CAS si sus dos vecinos están en
+ * su palabra o con el protocolo de dos pasos (RESERVANDO) si alguno está en otra. Lo llama el propio filósofo o un
+ * vecino que deja de comer. Solo quien consigue el CAS desde HAMBRIENTO puede cambiar después el campo del
+ * filósofo, de modo que, si lo llaman a la vez el filósofo y un vecino, solo uno de ellos continúa.
+ * @param id: Filósofo que quiere comer.
+ * @param llamante: Filósofo que ejecuta la función.
+ * @return: 1 si el filósofo ha pasado a COMIENDO, 0 si no tenía hambre o algún vecino se lo impide.
  */
-char * ver_estados(){
+int probar_sin_cerrojos(int id, int llamante){
+    int vecinos[2] = {IZQUIERDO, DERECHO};
+    _Atomic uint64_t * palabra = &estados_emp[PALABRA(id)].valor;
+    uint64_t v = atomic_load(palabra);
+    int cruzados = 0;           // !0 si algún vecino está en otra palabra
+    int estado_vecino;
     int i;
-    char * estados = (char *) malloc(N*sizeof(char));
 
-    for (i = 0; i < N; i++){
-        switch (estado[i]){
-            case PENSANDO:
-                estados[i] = 'P';
-                break;
-            case HAMBRIENTO:
-                estados[i] = 'H';
-                break;
-            case COMIENDO:
-                estados[i] = 'C';
-                break;
-            default:
-                estados[i] = '?';   // Error
+    for (i = 0; i < 2; i++) if (PALABRA(vecinos[i]) != PALABRA(id)) cruzados = 1;
+
+    // Con un CAS sobre la palabra, el filósofo pasa a COMIENDO (sin vecinos en otra palabra) o a RESERVANDO si ningún
+    // vecino de su palabra come o reserva. Si el CAS falla, v pasa a tener el valor actual y se vuelve a comprobar.
+    // Con N = 1 o 2, los vecinos pueden ser el propio filósofo, que está HAMBRIENTO y no se lo impide
+    do {
+        if (CAMPO(v, id) != HAMBRIENTO) return 0;
+        for (i = 0; i < 2; i++)
+            if (PALABRA(vecinos[i]) == PALABRA(id) && OCUPADO(CAMPO(v, vecinos[i]))) return 0;
+    } while (!atomic_compare_exchange_weak(palabra, &v,
+                                           v + ((uint64_t) ((cruzados ? RESERVANDO : COMIENDO) - HAMBRIENTO)
+                                                << DESPLAZAMIENTO(id))));
+    if (!cruzados) return 1;
+
+    // Segundo paso: ningún vecino de la palabra puede empezar a comer, y falta comprobar los de otras palabras
+    for (i = 0; i < 2; i++){
+        if (PALABRA(vecinos[i]) == PALABRA(id)) continue;
+        while ((estado_vecino = estado_empaquetado(vecinos[i])) == RESERVANDO && PALABRA(vecinos[i]) > PALABRA(id))
+            sched_yield();      // El vecino reserva, pero su palabra es posterior: retrocederá o comerá enseguida
+        if (OCUPADO(estado_vecino)){
+            // El vecino come, o reserva y tiene preferencia: el filósofo retrocede y se avisa a los vecinos que se
+            // hayan bloqueado al verlo reservando y, si no es quien llama, al propio filósofo, que puede haberse
+            // bloqueado por lo mismo
+            cambiar_estado(id, RESERVANDO, HAMBRIENTO);
+            avisar_vecinos(id);
+            if (llamante != id) avisar(id);
+            return 0;
         }
     }
-    return estados;
+    cambiar_estado(id, RESERVANDO, COMIENDO);
+    return 1;
+}
+
+/*
+ * Modo MODO_LOCKFREE: devuelve el estado del filósofo i leyendo su palabra.
+ */
+int estado_empaquetado(int i){
+    return CAMPO(atomic_load(&estados_emp[PALABRA(i)].valor), i);
+}
+
+/*
+ * Modo MODO_LOCKFREE: cambia el estado del filósofo id de "de" a "a". Salvo la salida de HAMBRIENTO, que se hace con
+ * CAS, cada transición la hace un único hilo (el filósofo, o quien lo ha puesto a RESERVANDO), así que basta con
+ * sumar la diferencia a la palabra (sin acarreos hacia los campos vecinos).
+ */
+void cambiar_estado(int id, int de, int a){
+    if (a > de) atomic_fetch_add(&estados_emp[PALABRA(id)].valor, (uint64_t) (a - de) << DESPLAZAMIENTO(id));
+    else atomic_fetch_sub(&estados_emp[PALABRA(id)].valor, (uint64_t) (de - a) << DESPLAZAMIENTO(id));
+}
+
+/*
+ * Modo MODO_LOCKFREE: incrementa la palabra futex del filósofo id y lo despierta si estaba bloqueado en ella.
+ */
+void avisar(int id){
+    atomic_fetch_add(&avisos[id].valor, 1);
+    despertar_futex(&avisos[id].valor);
+}
+
+/*
+ * Modo MODO_LOCKFREE: el filósofo id ha dejado de comer o de reservar, así que avisa a los vecinos que no están
+ * pensando. Los que piensan volverán a mirar los estados cuando tengan hambre.
+ */
+void avisar_vecinos(int id){
+    if (IZQUIERDO != id && estado_empaquetado(IZQUIERDO) != PENSANDO) avisar(IZQUIERDO);
+    if (DERECHO != id && DERECHO != IZQUIERDO && estado_empaquetado(DERECHO) != PENSANDO) avisar(DERECHO);
+}
+
+/*
+ * Función que bloquea al hilo en una palabra futex mientras esta conserve el valor indicado. Si la palabra ya ha
+ * cambiado, el kernel retorna inmediatamente (EAGAIN). Como la palabra solo la usan hilos del mismo proceso, se usa la
+ * variante privada.
+ */
+void esperar_futex(_Atomic uint32_t * palabra, uint32_t valor){
+    if (syscall(SYS_futex, (uint32_t *) palabra, FUTEX_WAIT_PRIVATE, valor, NULL, NULL, 0) == -1
+            && errno != EAGAIN && errno != EINTR)
+        salir_con_error("Error en la espera sobre un futex", 1);
+}
+
+/*
+ * Función que despierta a (como mucho) un hilo bloqueado en una palabra futex.
+ */
+void despertar_futex(_Atomic uint32_t * palabra){
+    if (syscall(SYS_futex, (uint32_t *) palabra, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0) == -1)
+        salir_con_error("Error al despertar a un filósofo bloqueado en un futex", 1);
+}
+
+
+// El filósofo queda bloqueado durante un tiempo aleatorio (como máximo, espera_max - 1 segundos)
+void pensar(){
+   if (!rendimiento) sleep(rand() % espera_max);
+}
+
+/* 
+ * El filósofo anuncia que está comiendo y queda bloqueado un tiempo aleatorio (como máximo, espera_max - 1 segundos)
+ */
+void comer(int id){
+    log_consola(id, "Está comiendo");
+    if (!rendimiento) sleep(rand() % espera_max);
+}
+
+
+/*
+ * Función que cambia el estado de un filósofo y actualiza su letra en la vista de estados que imprime log_consola.
+ * Solo se reescribe un carácter de la vista, sin recorrer el resto.
+ */
+void fijar_estado(int id, int nuevo){
+    estado[id] = nuevo;
+    vista_cambiar(vista, id, LETRAS_ESTADO[nuevo]);
 }
 
 /*
@@ -285,13 +623,17 @@ char * ver_estados(){
  * al estado de cada filósofo en el momento actual de ejecución.
  */
 void log_consola(int id, char * msg) {
+    char estados[MAX_FILOSOFOS + 1];        // Estados de los filósofos
+
+    if (rendimiento) return;                // En el modo rendimiento no se imprime nada
+
     // Empleamos los colores rojo, verde, amarillo, azul, magenta o fucsia según el id del hilo (31-36)
     int color = 31 + id % 6;
-    char * estados = ver_estados();         // Estados de los filósofos
+    // Instantánea de la vista de estados (módulo comun/vista), sin reconstruirla ni tomar el mutex de la región crítica
+    vista_leer(vista, estados);
 
     // Con la macro MOVER_A_COL nos colocamos en una columna a la derecha para imprimir los estados de los filósofos
     printf(COLOR "[%d]: %s" MOVER_A_COL "%s" RESET "\n", color, id, msg, estados);
-    free(estados);
 }
 
 
@@ -352,6 +694,11 @@ void inicializar_mutex_varcon(){
         // De forma análoga, inicializamos las variables de condición empleando pthread_cond_init, indicando los atributos por defecto.
         if (pthread_cond_init(&conds[i], NULL))
             salir_con_error("Error en la inicializacion de la variable de condición de un filosofo\n", 0);
+
+    // Los mutexes de los tenedores (solo se usan en el modo MODO_TENEDORES)
+    for (i = 0; i < N; i++)
+        if (pthread_mutex_init(&tenedores[i].mutex, NULL))
+            salir_con_error("Error en la inicializacion del mutex de un tenedor\n", 0);
 }
 
 /*
@@ -369,6 +716,10 @@ void destruir_mutex_varcon(){
         if (pthread_cond_destroy(&conds[i]))
             salir_con_error("Error en la destruccion de la variable de condición de un filósofo\n", 0);
 
+    for (i = 0; i < N; i++)
+        if (pthread_mutex_destroy(&tenedores[i].mutex))
+            salir_con_error("Error en la destruccion del mutex de un tenedor\n", 0);
+
     // Hacemos lo mismo con el mutex de la región crítica
     // Tenemos la seguridad de que estará desbloqueado una vez todos
     // los hilos hayan finalizado correctamente (en caso contrario, pthread_mutex_destroy podría dar error)
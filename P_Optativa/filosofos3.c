@@ -6,6 +6,10 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <poll.h>
+#include "../comun/medidas.h"
+#include "../comun/config.h"
+#include "../comun/vista.h"
 
 /* Xiana Carrera Alonso
  * Sistemas Operativos II
@@ -34,14 +38,50 @@
  * podrán despertarlo (enviándole un mensaje y liberándolo del bloqueo
  * asociado a la lectura de la cola de recepción) para indicarle que 
  * puede continuar su ejecución.
+ *
+ * La cola global hace que esta solución sea tan centralizada como la de los semáforos: todos los filósofos pasan por
+ * la misma región crítica. Como alternativa se ofrece el algoritmo de Chandy y Misra de los tenedores higiénicos
+ * (-m chandy), completamente distribuido: cada filósofo solo se comunica con sus dos vecinos, a través de un canal
+ * por arista de la mesa (una cola en cada sentido por tenedor), y no hay ninguna región crítica global.
+ *  - Cada tenedor lo tiene uno de los dos filósofos que lo comparten (o está viajando hacia uno de ellos), y puede
+ *    estar limpio o sucio. Al principio todos están sucios y cada uno lo tiene el filósofo de menor número.
+ *  - Un filósofo hambriento pide los tenedores que le faltan enviando una petición al vecino que los tiene, y come
+ *    cuando tiene los dos. Al comer, sus tenedores se ensucian.
+ *  - Quien recibe una petición entrega el tenedor si está sucio y no está comiendo (y, si tiene hambre, lo vuelve a
+ *    pedir a continuación); si está limpio, anota la petición y lo entrega cuando acabe de comer. El tenedor llega
+ *    limpio a su destino.
+ * Un tenedor limpio siempre lo tiene quien aún no ha comido con él, de modo que las prioridades entre vecinos nunca
+ * forman un ciclo: no hay interbloqueo y ningún filósofo pasa hambre indefinidamente. Cada filósofo espera a la vez en
+ * sus dos colas de entrada con poll (en Linux, un mqd_t es un descriptor de fichero). Al acabar, el filósofo entrega
+ * a sus vecinos los tenedores que aún tenga, ya que no va a volver a pedirlos.
  * 
  * Se debe compilar con la opción -pthread y -lrt.
+ *
+ * Uso: ./filosofos3 [-r] [-n N] [-m rc|chandy]
+ *  -n: número de filósofos. Si no se indica, se solicita al usuario.
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, cada
+ *      filósofo come MAX_ITER_RENDIMIENTO veces y al final se imprime una
+ *      línea CSV (módulo comun/medidas) con las comidas por segundo, los
+ *      percentiles del tiempo que pasa cada filósofo hambriento hasta que
+ *      consigue sus tenedores y los cambios de contexto.
+ *  -m: mecanismo de sincronización: "rc" (por defecto), una cola global que hace de mutex de la región crítica y
+ *      una cola por filósofo, o "chandy", los tenedores higiénicos de Chandy y Misra con un canal por arista.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra), también como
+ * variables de entorno SOII_NOMBRE:
+ *  --filosofos: número de filósofos (como -n).
+ *  --iteraciones: veces que come cada filósofo (MAX_ITER, o
+ *      MAX_ITER_RENDIMIENTO con -r, por defecto).
+ *  --espera_max: las esperas duran de 0 a espera_max - 1 segundos
+ *      (MAX_SLEEP por defecto).
  */
 
 
 
 #define MAX_ITER 10                 // Número de iteraciones máximas del programa
-#define MAX_SLEEP 3                 // Número máximo de segundos que puede durar un sleep
+#define MAX_ITER_RENDIMIENTO 20000  // Número de iteraciones de cada filósofo en el modo rendimiento
+#define MAX_SLEEP 3                 // Número máximo de segundos que puede durar un sleep (por defecto)
+#define MAX_FILOSOFOS 999           // Número máximo de filósofos (los nombres de los recursos usan 3 cifras)
 
 // Macros que simbolizan al filósofo a la izquierda y a la derecha en la mesa, empleando su id
 #define IZQUIERDO (id+N-1)%N
@@ -51,6 +91,20 @@
 #define PENSANDO 0
 #define HAMBRIENTO 1
 #define COMIENDO 2      
+#define LETRAS_ESTADO "PHC"        // Letra con la que se imprime cada estado
+
+// Mecanismos de sincronización (opción -m)
+#define MODO_RC 0                   // Cola global de la región crítica y una cola por filósofo
+#define MODO_CHANDY 1               // Tenedores higiénicos de Chandy y Misra, con un canal por arista
+
+// Lados de un filósofo en el modo MODO_CHANDY. Cada lado es una arista de la mesa: la del tenedor que comparte con
+// el vecino de ese lado (el tenedor id a la izquierda y el id+1 a la derecha)
+#define IZQ 0
+#define DER 1
+
+// Mensajes que se intercambian los vecinos en el modo MODO_CHANDY
+#define MSG_TENEDOR 'T'             // Se entrega el tenedor de la arista
+#define MSG_PETICION 'P'            // Se pide el tenedor de la arista
 
 
 #define COLOR "\033[%dm"          // String que permite cambiar el color de la consola
@@ -59,8 +113,13 @@
 
 
 int N;                   // Número de filósofos (es introducido por el usuario)
+int rendimiento = 0;     // !0 para ejecutar sin esperas ni mensajes y medir las comidas por segundo
+int num_iter = MAX_ITER; // Número de iteraciones de cada filósofo
+int espera_max = MAX_SLEEP;         // Límite (exclusivo) en segundos de las esperas aleatorias
+struct medidas * medidas = NULL;    // Espera de cada filósofo desde que tiene hambre hasta que come
 
 int * estado;            // Estado de cada filósofo (pensando, hambriento o comiendo)
+struct vista * vista = NULL;       // Letra del estado de cada filósofo (NULL en el modo rendimiento)
 mqd_t * colas_fil;       // Cada filósofo tiene una cola de recepción que lo dejará
         // bloqueado si no puede tomar los tenedores y lo desbloqueará cuando estos
         // quedan libres
@@ -73,18 +132,39 @@ mqd_t cola_rc;           // Esta cola representa un mutex sobre la región crít
 
 size_t tam_msg;          // Tamaño de cada mensaje (emplearemos caracteres)
 
+/*
+ * Estado de un tenedor visto desde uno de los dos filósofos que lo comparten (modo MODO_CHANDY). Cada filósofo
+ * tiene uno por lado y solo lo consulta y modifica él mismo: lo que sabe del vecino le llega por mensajes.
+ */
+struct lado {
+    int tengo;               // !0 si el filósofo tiene el tenedor
+    int sucio;               // !0 si ya ha comido con él
+    int pedido;              // !0 si lo ha pedido y aún no le ha llegado
+    int pendiente;           // !0 si el vecino lo ha pedido y se le entregará al acabar de comer
+};
+
+int modo = MODO_RC;      // Mecanismo de sincronización empleado
+struct lado (* lados)[2];    // Tenedores de cada filósofo, por lados (solo en el modo MODO_CHANDY)
+mqd_t (* aristas)[2];    // Cola por la que cada filósofo recibe los mensajes del vecino de cada lado (modo MODO_CHANDY)
+
 
 // Funciones principales
 void * filosofo(void * ptr_id);
 void probar(int id);
 void tomar_tenedores(int id);
 void poner_tenedores(int id);
+void tomar_tenedores_higienicos(int id);
+void poner_tenedores_higienicos(int id);
+void pensar_atendiendo(int id);
+void dejar_mesa(int id);
+void atender_mensajes(int id, int espera_ms);
+void enviar_vecino(int id, int lado, char msg);
 void pensar();
 void comer(int id);
 
 // Funciones de impresión
 void log_consola(int id, char * msg);
-char * ver_estados();
+void fijar_estado(int id, int nuevo);
 
 // Funciones auxiliares
 void crear_hilo(pthread_t * hilo, int i);
@@ -92,33 +172,78 @@ void unirse_a_hilo(pthread_t hilo);
 void crear_colas();
 void cerrar_colas();
 void destruir_colas();
+void crear_aristas();
+void cerrar_aristas();
+void destruir_aristas();
 void salir_con_error(char * mensaje, int ver_errno);
 
 
 
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"filosofos", &N, CONFIG_INT, 1, MAX_FILOSOFOS, "Número de filósofos (como -n; si no se indica, se pregunta)"},
+    {"iteraciones", &num_iter, CONFIG_INT, 1, 100000000,
+     "Veces que come cada filósofo (con -r, MAX_ITER_RENDIMIENTO)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
 
-int main(){
+
+int main(int argc, char * argv[]){
+    int opcion;                     // Opción leída con getopt
+    uint64_t t_ini;                 // Instante en que se crean los filósofos
+    double segundos;                // Duración de la ejecución de los filósofos
     pthread_t * filosofos;         // Identificadores de los hilos filósofos
     char msg = '_';                // Mensaje que se enviará a cola_rc (contenido irrelevante)
     int i;                         // Variable de iteración
 
-    // Solicitamos al usuario que introduzca el número de filósofos, N
-    printf("Introduce el numero de filosofos ó -1 para salir ");    
-    scanf("%d", &N);
-    if (N == -1){
-        printf("Cerrando programa...\n");
-        exit(EXIT_SUCCESS);
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: modo rendimiento y número de filósofos
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "rn:m:")) != -1){
+        switch (opcion){
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "iteraciones")) num_iter = MAX_ITER_RENDIMIENTO;
+                break;
+            case 'n':
+                if ((N = atoi(optarg)) < 1 || N > MAX_FILOSOFOS)
+                    salir_con_error("El numero de filosofos debe estar entre 1 y MAX_FILOSOFOS\n", 0);
+                break;
+            case 'm':
+                if (!strcmp(optarg, "rc")) modo = MODO_RC;
+                else if (!strcmp(optarg, "chandy")) modo = MODO_CHANDY;
+                else salir_con_error("El mecanismo debe ser rc o chandy\n", 0);
+                break;
+            default:
+                salir_con_error("Uso: ./filosofos3 [-r] [-n N] [-m rc|chandy] [--parámetro=valor ...]\n", 0);
+        }
     }
-    while (N < 0){
-        printf("El numero de filosofos debe ser mayor o igual que 1\n");
-        printf("Introduce el numero de filosofos ó -1 para salir ");
+
+    // Si no se ha indicado con -n, se solicita el número de filósofos al usuario
+    if (!N){
+        // Solicitamos al usuario que introduzca el número de filósofos, N
+        printf("Introduce el numero de filosofos ó -1 para salir ");    
         scanf("%d", &N);
         if (N == -1){
             printf("Cerrando programa...\n");
             exit(EXIT_SUCCESS);
         }
+        while (N < 0){
+            printf("El numero de filosofos debe ser mayor o igual que 1\n");
+            printf("Introduce el numero de filosofos ó -1 para salir ");
+            scanf("%d", &N);
+            if (N == -1){
+                printf("Cerrando programa...\n");
+                exit(EXIT_SUCCESS);
+            }
+        }
     }
 
+    // Reservamos la estructura de medidas, con un sello de tiempo por filósofo
+    if ((medidas = medidas_crear((long) N * num_iter, N)) == NULL)
+        salir_con_error("No se ha podido reservar memoria para las medidas", 1);
+
     // Reservamos memoria para el array de hilos
     if ((filosofos = (pthread_t *) malloc(N * sizeof(pthread_t))) == NULL)
         salir_con_error("No se ha podido reservar memoria para los hilos\n", 0);
@@ -129,40 +254,81 @@ int main(){
     if ((estado = (int *) malloc(N * sizeof(int))) == NULL)
         salir_con_error("No se ha podido reservar memoria para el estado de los filosofos\n", 0);
     
+    // Reservamos memoria para los tenedores de cada filósofo y para sus colas de entrada del modo MODO_CHANDY
+    if ((lados = malloc(N * sizeof(lados[0]))) == NULL || (aristas = malloc(N * sizeof(aristas[0]))) == NULL)
+        salir_con_error("No se ha podido reservar memoria para las aristas\n", 0);
+
     // Inicialmente todos los filósofos están pensando
     for (i = 0; i < N; i++) estado[i] = PENSANDO;    
+    // Fuera del modo rendimiento, log_consola imprime los estados a partir de una vista que se actualiza con cada
+    // cambio (en memoria compartida, para que sirva también con procesos)
+    if (!rendimiento && (vista = vista_crear(N, LETRAS_ESTADO[PENSANDO])) == NULL)
+        salir_con_error("No se ha podido reservar la vista de estados", 1);
+
+    // En el modo MODO_CHANDY, todos los tenedores empiezan sucios y en manos del filósofo de menor número de los dos
+    // que lo comparten: el filósofo 0 tiene los dos suyos, el último ninguno y los demás, el derecho. Así el grafo de
+    // prioridades entre vecinos empieza sin ciclos
+    for (i = 0; i < N; i++){
+        lados[i][IZQ] = (struct lado) {.tengo = i == 0, .sucio = 1};
+        lados[i][DER] = (struct lado) {.tengo = i != N - 1, .sucio = 1};
+    }
 
-    printf("\n");
-    printf("Estados posibles para los filósofos:\n");
-    printf("  P: Pensando\n");
-    printf("  H: Hambriento\n");
-    printf("  C: Comiendo\n\n");
+    if (!rendimiento){
+        printf("\n");
+        printf("Estados posibles para los filósofos:\n");
+        printf("  P: Pensando\n");
+        printf("  H: Hambriento\n");
+        printf("  C: Comiendo\n\n");
+    }
 
-    destruir_colas();       // Destruimos las colas por si ya existían de una ejecución previa
-    crear_colas();          // Creamos la cola de la región crítica y las de los filósofos
+    if (modo == MODO_CHANDY){
+        destruir_aristas();     // Destruimos las colas de las aristas por si ya existían de una ejecución previa
+        crear_aristas();        // Creamos las dos colas de cada arista
+    }
+    else {
+        destruir_colas();       // Destruimos las colas por si ya existían de una ejecución previa
+        crear_colas();          // Creamos la cola de la región crítica y las de los filósofos
+
+        // Antes de empezar, enviamos un mensaje a la cola de la región crítica, que simboliza un mutex.
+        // Así, indicamos que la región crítica está libre
+        // El tamaño del mensaje es el de 1 char (1 byte). La prioridad es 0 porque este sistema no es
+        // necesario (todas las colas tienen solo un slot)
+        mq_send(cola_rc, &msg, tam_msg, 0);
+    }
 
-    // Antes de empezar, enviamos un mensaje a la cola de la región crítica, que simboliza un mutex.
-    // Así, indicamos que la región crítica está libre
-    // El tamaño del mensaje es el de 1 char (1 byte). La prioridad es 0 porque este sistema no es
-    // necesario (todas las colas tienen solo un slot)
-    mq_send(cola_rc, &msg, tam_msg, 0);
 
+    t_ini = medidas_ns();       // Medimos el tiempo que tardan los filósofos en completar todas sus iteraciones
 
     // Se crean los N filósofos
     for (i = 0; i < N; i++) crear_hilo(&filosofos[i], i);
     // El hilo principal espera a que todos los filósofos terminen antes de continuar
     for (i = 0; i < N; i++) unirse_a_hilo(filosofos[i]);
+    segundos = (medidas_ns() - t_ini) / 1e9;
 
 
-    cerrar_colas();         // Cerramos todas las colas
-    destruir_colas();       // Y también las borramos del sistema
+    if (modo == MODO_CHANDY){
+        cerrar_aristas();
+        destruir_aristas();
+    }
+    else {
+        cerrar_colas();         // Cerramos todas las colas
+        destruir_colas();       // Y también las borramos del sistema
+    }
     
     // Liberamos la memoria reservada
     free(filosofos);
     free(colas_fil);
+    free(lados);
+    free(aristas);
     free(estado);
 
-    printf("\n\nEjecución finalizada. Cerrando programa...\n\n");
+    // En el modo rendimiento se imprime la línea CSV con las comidas por segundo, las esperas y los cambios de contexto
+    if (rendimiento)
+        medidas_informe(medidas, "filosofos3", modo == MODO_CHANDY ? "chandy_misra" : "mensajes", 1, 0,
+                        (long) N * num_iter, segundos);
+    else printf("\n\nEjecución finalizada. Cerrando programa...\n\n");
+    medidas_destruir(medidas);
+    vista_destruir(vista);
 
     exit(EXIT_SUCCESS);}
 
@@ -181,12 +347,21 @@ void * filosofo(void * ptr_id){
     // No es necesario que los filósofos abran las colas, porque como usamos hilos, la heredan directamente del hilo padre
 
     // Realizamos un número finito de iteraciones para controlar el tiempo de ejecución
-    for (i = 0; i < MAX_ITER; i++){
-        pensar();              // El filósofo no actúa
-        tomar_tenedores(id);   // El filósofo toma ambos tenedores o queda bloqueado esperando
-        comer(id);             // El filósofo espera mientras sostiene ambos tenedores
-        poner_tenedores(id);   // El filósofo devuelve los 2 tenedores a la mesa
+    for (i = 0; i < num_iter; i++){
+        if (modo == MODO_CHANDY){
+            pensar_atendiendo(id);          // Mientras piensa, entrega los tenedores que le piden sus vecinos
+            tomar_tenedores_higienicos(id); // Pide a sus vecinos los tenedores que le faltan y espera por ellos
+            comer(id);
+            poner_tenedores_higienicos(id); // Entrega los tenedores que le han pedido mientras comía
+        }
+        else {
+            pensar();              // El filósofo no actúa
+            tomar_tenedores(id);   // El filósofo toma ambos tenedores o queda bloqueado esperando
+            comer(id);             // El filósofo espera mientras sostiene ambos tenedores
+            poner_tenedores(id);   // El filósofo devuelve los 2 tenedores a la mesa
+        }
     }
+    if (modo == MODO_CHANDY) dejar_mesa(id);
 
     // El hilo principal se encarga de cerrar y destruir las colas
 
@@ -212,7 +387,7 @@ void probar(int id){
      * él aún no quiere.
      */
     if (estado[id] == HAMBRIENTO && estado[IZQUIERDO] != COMIENDO && estado[DERECHO] != COMIENDO){
-        estado[id] = COMIENDO;      // El filósofo ya no deja que ninguno de sus vecinos tome sus tenedores.
+        fijar_estado(id, COMIENDO); // El filósofo ya no deja que ninguno de sus vecinos tome sus tenedores.
 
         // Se le envía un mensaje al filósofo id para que no quede bloqueado en la función tomar_tenedores
         // La prioridad es 0 porque en la implementación del problema estamos usando siempre colas sin prioridades 
@@ -226,6 +401,8 @@ void probar(int id){
 void tomar_tenedores(int id){
     char msg;           // Mensaje enviado/recibido a través de las colas
 
+    medidas_sellar(medidas, id);   // El filósofo tiene hambre desde este instante
+
     /*
      * El filósofo trata de acceder a la región crítica llamando a mq_receive. La clave de esta implementación es que la función es
      * bloqueante, de forma que si no hay ningún mensaje en la cola de la región crítica (análogo a un mutex tomado), el hilo
@@ -239,7 +416,7 @@ void tomar_tenedores(int id){
 
 
     log_consola(id, "Quiere tomar tenedores");
-    estado[id] = HAMBRIENTO;  // Registra que quiere tomar los tenedores
+    fijar_estado(id, HAMBRIENTO); // Registra que quiere tomar los tenedores
     probar(id);             // Comprueba si el filósofo puede comer (él está hambriento y sus vecinos no están comiendo, es decir, 
                             // tienen libres los tenedores)
 
@@ -252,6 +429,7 @@ void tomar_tenedores(int id){
     // que le llegue un mensaje.
     // Cuando reciba tal mensaje, el estado del filósofo será "COMIENDO" y tendrá disponibles ambos tenedores.
     mq_receive(colas_fil[id], &msg, tam_msg, NULL);
+    medidas_latencia(medidas, id); // Ya tiene los tenedores: se registra cuánto ha esperado
 }
 
 /*
@@ -268,7 +446,7 @@ void poner_tenedores(int id){
     mq_receive(cola_rc, &msg, tam_msg, NULL);
 
     log_consola(id, "Va a dejar sus tenedores");
-    estado[id] = PENSANDO;    // El filósofo está ocioso. No está comiendo ni quiere tomar tenedores.
+    fijar_estado(id, PENSANDO); // El filósofo está ocioso. No está comiendo ni quiere tomar tenedores.
 
     // Si el filósofo de la izquierda quiere comer y su tenedor izquierdo está libre, 
     // se le cede el tenedor derecho y se le permite comer (deja de esperar su turno). Esto se hará
@@ -284,17 +462,150 @@ void poner_tenedores(int id){
 }
 
 
-// El filósofo queda bloqueado durante un tiempo aleatorio (como máximo, MAX_SLEEP segundos)
+/*
+ * Modo MODO_CHANDY: el filósofo pide a sus vecinos los tenedores que le faltan y atiende sus mensajes hasta tener
+ * los dos. Antes de comprobar si ya los tiene, atiende las peticiones que le hayan llegado mientras pensaba: si tiene
+ * un tenedor sucio que su vecino le ha pedido, debe entregárselo aunque tenga hambre.
+ */
+void tomar_tenedores_higienicos(int id){
+    int l;                      // Lado del tenedor
+
+    medidas_sellar(medidas, id);   // El filósofo tiene hambre desde este instante
+    log_consola(id, "Quiere tomar tenedores");
+    fijar_estado(id, HAMBRIENTO);  // Solo el propio filósofo escribe su estado (se lee únicamente para imprimirlo)
+
+    // Con un solo filósofo, sus dos tenedores son el mismo y siempre lo tiene él: no hay vecinos a los que pedirlo
+    if (N > 1){
+        atender_mensajes(id, 0);
+        for (l = IZQ; l <= DER; l++){
+            if (!lados[id][l].tengo && !lados[id][l].pedido){
+                lados[id][l].pedido = 1;
+                enviar_vecino(id, l, MSG_PETICION);
+            }
+        }
+        while (!lados[id][IZQ].tengo || !lados[id][DER].tengo) atender_mensajes(id, -1);
+    }
+
+    fijar_estado(id, COMIENDO);
+    medidas_latencia(medidas, id); // Ya tiene los tenedores: se registra cuánto ha esperado
+}
+
+/*
+ * Modo MODO_CHANDY: tras comer, los tenedores del filósofo quedan sucios y entrega los que le han pedido sus vecinos
+ * mientras tenía hambre o comía.
+ */
+void poner_tenedores_higienicos(int id){
+    int l;                      // Lado del tenedor
+
+    log_consola(id, "Va a dejar sus tenedores");
+    fijar_estado(id, PENSANDO);
+    for (l = IZQ; l <= DER; l++){
+        lados[id][l].sucio = 1;
+        if (lados[id][l].pendiente){
+            lados[id][l].pendiente = 0;
+            lados[id][l].tengo = 0;
+            enviar_vecino(id, l, MSG_TENEDOR);
+            log_consola(id, l == IZQ ? "Cede un tenedor al vecino izquierdo" : "Cede un tenedor al vecino derecho");
+        }
+    }
+}
+
+/*
+ * Modo MODO_CHANDY: el filósofo piensa durante un tiempo aleatorio (como máximo, espera_max - 1 segundos), pero, en
+ * lugar de dormir, espera en sus colas de entrada para entregar enseguida los tenedores que le pidan sus vecinos.
+ */
+void pensar_atendiendo(int id){
+    uint64_t fin;               // Instante en que el filósofo deja de pensar
+    uint64_t ahora;
+
+    if (rendimiento || N == 1) return;
+    fin = medidas_ns() + (uint64_t) (rand() % espera_max) * 1000000000;
+    while ((ahora = medidas_ns()) < fin) atender_mensajes(id, (int) ((fin - ahora + 999999) / 1000000));
+}
+
+/*
+ * Modo MODO_CHANDY: el filósofo ya no va a comer más, así que entrega a sus vecinos los tenedores que aún tiene. Sus
+ * vecinos se quedarán con ellos hasta el final, puesto que él ya no se los volverá a pedir, y no esperarán por él.
+ */
+void dejar_mesa(int id){
+    int l;                      // Lado del tenedor
+
+    if (N == 1) return;
+    for (l = IZQ; l <= DER; l++){
+        if (lados[id][l].tengo){
+            lados[id][l].tengo = 0;
+            enviar_vecino(id, l, MSG_TENEDOR);
+        }
+    }
+}
+
+/*
+ * Modo MODO_CHANDY: el filósofo espera hasta espera_ms milisegundos (indefinidamente si es -1, nada si es 0) a que le
+ * llegue algún mensaje de sus vecinos y atiende todos los que le hayan llegado.
+ *  - Un tenedor pasa a ser suyo, limpio.
+ *  - Una petición de un tenedor sucio (o de cualquiera, si no tiene hambre) se atiende entregándolo; si tiene hambre,
+ *    lo vuelve a pedir a continuación. La de un tenedor limpio se anota y se atiende al acabar de comer.
+ * Nunca se llama mientras el filósofo come: las peticiones que le lleguen entonces esperan en la cola.
+ */
+void atender_mensajes(int id, int espera_ms){
+    struct pollfd entradas[2];  // Colas de entrada de cada lado
+    struct lado * t;            // Tenedor del lado por el que ha llegado el mensaje
+    char msg;                   // Mensaje recibido
+    int l;                      // Lado de la cola
+
+    for (l = IZQ; l <= DER; l++) entradas[l] = (struct pollfd) {.fd = aristas[id][l], .events = POLLIN};
+    if (poll(entradas, 2, espera_ms) == -1){
+        if (errno == EINTR) return;
+        salir_con_error("Error al esperar por los mensajes de los vecinos", 1);
+    }
+
+    for (l = IZQ; l <= DER; l++){
+        if (!(entradas[l].revents & POLLIN)) continue;
+        if (mq_receive(aristas[id][l], &msg, tam_msg, NULL) == -1)
+            salir_con_error("Error al recibir un mensaje de un vecino", 1);
+
+        t = &lados[id][l];
+        if (msg == MSG_TENEDOR){
+            t->tengo = 1;
+            t->sucio = 0;
+            t->pedido = 0;
+        }
+        else if (t->tengo && (t->sucio || estado[id] != HAMBRIENTO)){
+            t->tengo = 0;
+            enviar_vecino(id, l, MSG_TENEDOR);
+            log_consola(id, l == IZQ ? "Cede un tenedor al vecino izquierdo" : "Cede un tenedor al vecino derecho");
+            if (estado[id] == HAMBRIENTO){
+                t->pedido = 1;
+                enviar_vecino(id, l, MSG_PETICION);
+            }
+        }
+        else t->pendiente = 1;
+    }
+}
+
+/*
+ * Modo MODO_CHANDY: envía un mensaje al vecino del lado indicado, por la cola de entrada que ese vecino tiene en el
+ * lado opuesto (la otra mitad de la misma arista). Nunca bloquea: por cada sentido de una arista viajan a la vez, como
+ * mucho, el tenedor y una petición.
+ */
+void enviar_vecino(int id, int lado, char msg){
+    mqd_t destino = lado == IZQ ? aristas[IZQUIERDO][DER] : aristas[DERECHO][IZQ];
+
+    if (mq_send(destino, &msg, tam_msg, 0) == -1) salir_con_error("Error al enviar un mensaje a un vecino", 1);
+}
+
+
+// El filósofo queda bloqueado durante un tiempo aleatorio (como máximo, espera_max - 1 segundos)
 void pensar(){
-   sleep(rand() % MAX_SLEEP);
+   if (!rendimiento) sleep(rand() % espera_max);
 }
 
 /* 
- * El filósofo anuncia que está comiendo y queda bloqueado un tiempo aleatorio (como máximo, MAX_SLEEP segundos)
+ * El filósofo anuncia que está comiendo y queda bloqueado un tiempo aleatorio (como máximo, espera_max - 1 segundos)
  */
 void comer(int id){
     log_consola(id, "Está comiendo");
-    sleep(rand() % MAX_SLEEP);
+    if (!rendimiento) sleep(rand() % espera_max);
 }
 
 
@@ -303,38 +614,26 @@ void comer(int id){
  * al estado de cada filósofo en el momento actual de ejecución.
  */
 void log_consola(int id, char * msg) {
+    char estados[MAX_FILOSOFOS + 1];        // Estados de los filósofos
+
+    if (rendimiento) return;                // En el modo rendimiento no se imprime nada
+
     // Empleamos los colores rojo, verde, amarillo, azul, magenta o fucsia según el id del hilo (31-36)
     int color = 31 + id % 6;
-    char * estados = ver_estados();         // Estados de los filósofos
+    // Instantánea de la vista de estados (módulo comun/vista), sin reconstruirla ni tomar el mutex de la región crítica
+    vista_leer(vista, estados);
 
     // Con la macro MOVER_A_COL nos colocamos en una columna a la derecha para imprimir los estados de los filósofos
     printf(COLOR "[%d]: %s" MOVER_A_COL "%s" RESET "\n", color, id, msg, estados);
-    free(estados);
 }
 
 /*
- * Función que construye una cadena con el estado actual de cada filósofo, para poder imprimirla.
+ * Función que cambia el estado de un filósofo y actualiza su letra en la vista de estados que imprime log_consola.
+ * Solo se reescribe un carácter de la vista, sin recorrer el resto.
  */
-char * ver_estados(){
-    int i;
-    char * estados = (char *) malloc(N*sizeof(char));
-
-    for (i = 0; i < N; i++){
-        switch (estado[i]){
-            case PENSANDO:
-                estados[i] = 'P';
-                break;
-            case HAMBRIENTO:
-                estados[i] = 'H';
-                break;
-            case COMIENDO:
-                estados[i] = 'C';
-                break;
-            default:
-                estados[i] = '?';   // Error
-        }
-    }
-    return estados;
+void fijar_estado(int id, int nuevo){
+    estado[id] = nuevo;
+    vista_cambiar(vista, id, LETRAS_ESTADO[nuevo]);
 }
 
 /*
@@ -467,6 +766,63 @@ void destruir_colas(){
     free(nombre_buz);
 }
 
+/*
+ * Función auxiliar que construye el nombre de la cola por la que el filósofo p recibe los mensajes del vecino del
+ * lado l: /BUZON_A<p>I o /BUZON_A<p>D (asumimos N < 1000).
+ */
+static void nombre_arista(char * nombre, size_t tam, int p, int l){
+    snprintf(nombre, tam, "/BUZON_A%d%c", p, l == IZQ ? 'I' : 'D');
+}
+
+/*
+ * Función auxiliar que crea las colas de las aristas del modo MODO_CHANDY: dos por filósofo, una para cada vecino.
+ * Cada arista de la mesa tiene así una cola en cada sentido.
+ */
+void crear_aristas(){
+    struct mq_attr attr;        // Atributos de las colas
+    char nombre_buz[16];        // Nombre de una cola
+    int i, l;
+
+    // Los mensajes son de un carácter, y por cada sentido de una arista viajan como mucho el tenedor y una petición
+    tam_msg = sizeof(char);
+    attr.mq_maxmsg = 2;
+    attr.mq_msgsize = tam_msg;
+
+    for (i = 0; i < N; i++){
+        for (l = IZQ; l <= DER; l++){
+            nombre_arista(nombre_buz, sizeof(nombre_buz), i, l);
+            if ((aristas[i][l] = mq_open(nombre_buz, O_CREAT | O_RDWR, 0777, &attr)) == -1)
+                salir_con_error("No se ha podido crear la cola de una arista", 1);
+        }
+    }
+}
+
+/*
+ * Función auxiliar que cierra las colas de las aristas.
+ */
+void cerrar_aristas(){
+    int i, l;
+
+    for (i = 0; i < N; i++)
+        for (l = IZQ; l <= DER; l++)
+            if (mq_close(aristas[i][l])) salir_con_error("Error al cerrar la cola de una arista", 1);
+}
+
+/*
+ * Función auxiliar que destruye las colas de las aristas (las que existan).
+ */
+void destruir_aristas(){
+    char nombre_buz[16];        // Nombre de una cola
+    int i, l;
+
+    for (i = 0; i < N; i++){
+        for (l = IZQ; l <= DER; l++){
+            nombre_arista(nombre_buz, sizeof(nombre_buz), i, l);
+            mq_unlink(nombre_buz);
+        }
+    }
+}
+
 /*
  * Función auxiliar que cierra el programa en caso de error
  */
@@ -8,6 +8,10 @@
 #include <sys/wait.h>
 #include <sys/mman.h>
 #include <time.h>
+#include "../comun/medidas.h"
+#include "../comun/config.h"
+#include "../comun/vista.h"
+#include "../comun/cache.h"
 
 
 
@@ -37,13 +41,41 @@
  * de información entre procesos (con hilos, era una variable a la que todos podían acceder y 
  * modificar). No es necesario hacer lo mismo para los semáforos, pues es el propio sistema
  * operativo quien se encarga de las sincronizaciones necesarias.
- * 
+ *
+ * Con semáforos con nombre, el padre crea /F_MUTEX y un semáforo por filósofo, y cada hijo vuelve a abrirlos todos,
+ * así que el arranque cuesta O(N²) llamadas al sistema y operaciones sobre /dev/shm. Como alternativa se ofrece el
+ * modo compartido (-m compartido): el mutex y los N semáforos de los filósofos se guardan, junto con el array de
+ * estados, en la misma región compartida que se proyecta con mmap antes de los fork. Son semáforos sin nombre
+ * inicializados con sem_init(..., 1, ...) (el 1 indica que se comparten entre procesos), de modo que los hijos los
+ * heredan con la proyección y no tienen que abrir nada: el arranque es O(N) y no se crea ningún fichero. Como ya no
+ * hacen falta nombres de 3 cifras, en este modo se admiten hasta MAX_FILOSOFOS filósofos.
+ *
+ * Uso: ./filosofos4 [-r] [-n N] [-m nombrados|compartido]
+ *  -n: número de filósofos. Si no se indica, se solicita al usuario.
+ *  -r: modo rendimiento. Se eliminan las esperas y los mensajes, cada
+ *      filósofo come MAX_ITER_RENDIMIENTO veces y al final se imprime una
+ *      línea CSV (módulo comun/medidas) con las comidas por segundo, los
+ *      percentiles del tiempo que pasa cada filósofo hambriento hasta que
+ *      consigue sus tenedores y los cambios de contexto.
+ *  -m: semáforos empleados: "nombrados" (por defecto), abiertos con sem_open, o "compartido", sin nombre y dentro de
+ *      la región compartida.
+ *
+ * Parámetros (módulo comun/config; --ayuda los muestra), también como
+ * variables de entorno SOII_NOMBRE:
+ *  --filosofos: número de filósofos (como -n).
+ *  --iteraciones: veces que come cada filósofo (MAX_ITER, o
+ *      MAX_ITER_RENDIMIENTO con -r, por defecto).
+ *  --espera_max: las esperas duran de 0 a espera_max - 1 segundos
+ *      (MAX_SLEEP por defecto).
  */
 
 
 
 #define MAX_ITER 10                 // Número de iteraciones máximas del programa
-#define MAX_SLEEP 3                 // Número máximo de segundos que puede durar un sleep
+#define MAX_ITER_RENDIMIENTO 20000  // Número de iteraciones de cada filósofo en el modo rendimiento
+#define MAX_SLEEP 3                 // Número máximo de segundos que puede durar un sleep (por defecto)
+#define MAX_FILOSOFOS_NOMBRADOS 999 // Número máximo de filósofos con semáforos con nombre (usan 3 cifras)
+#define MAX_FILOSOFOS 9999          // Número máximo de filósofos (solo en el modo MODO_COMPARTIDO)
 
 // Macros que simbolizan al filósofo a la izquierda y a la derecha en la mesa, empleando su id
 #define IZQUIERDO (id+N-1)%N
@@ -53,6 +85,11 @@
 #define PENSANDO 0
 #define HAMBRIENTO 1
 #define COMIENDO 2      
+#define LETRAS_ESTADO "PHC"        // Letra con la que se imprime cada estado
+
+// Semáforos empleados (opción -m)
+#define MODO_NOMBRADOS 0            // Semáforos con nombre, creados por el padre y abiertos por cada hijo
+#define MODO_COMPARTIDO 1           // Semáforos sin nombre dentro de la región compartida
 
 // Control de la consola
 #define COLOR "\033[0;%dm"          // String que permite cambiar el color de la consola
@@ -61,11 +98,31 @@
 
 
 int N;                   // Número de filósofos (es introducido por el usuario)
+int rendimiento = 0;     // !0 para ejecutar sin esperas ni mensajes y medir las comidas por segundo
+int num_iter = MAX_ITER; // Número de iteraciones de cada filósofo
+int espera_max = MAX_SLEEP;         // Límite (exclusivo) en segundos de las esperas aleatorias
+struct medidas * medidas = NULL;    // Espera de cada filósofo desde que tiene hambre hasta que come
 
 int * estado;            // Estado de cada filósofo (pensando, hambriento o comiendo)
+struct vista * vista = NULL;       // Letra del estado de cada filósofo (NULL en el modo rendimiento)
 sem_t * mutex = NULL;    // Semáforo que da acceso exclusivo a la región crítica (donde se toman o liberan los tenedores)
 sem_t ** s;              // Cada filósofo tiene un semáforo
 
+/*
+ * Sincronización del modo MODO_COMPARTIDO, al comienzo de la región compartida (seguida del array de estados). Cada
+ * semáforo ocupa su propia línea de caché, para que los de filósofos distintos no la compartan.
+ */
+struct semaforo {
+    CACHE_ALINEADO sem_t sem;
+};
+struct mesa {
+    struct semaforo mutex;              // Acceso exclusivo a la región crítica
+    struct semaforo filosofos[];        // Semáforo de cada filósofo
+};
+
+int modo = MODO_NOMBRADOS;          // Semáforos empleados
+struct mesa * mesa = NULL;          // Semáforos de la región compartida (solo en el modo MODO_COMPARTIDO)
+
 
 // Funciones principales
 void filosofo(int id);
@@ -77,7 +134,7 @@ void comer(int id);
 
 // Funciones de impresión
 void log_consola(int id, char * msg);
-char * ver_estados();
+void fijar_estado(int id, int nuevo);
 
 // Funciones auxiliares
 void crear_hijo(int i);
@@ -86,30 +143,76 @@ void crear_semaforos();
 void destruir_semaforos();
 void abrir_semaforos();
 void cerrar_semaforos();
+void inicializar_mesa();
+void destruir_mesa();
 void salir_con_error(char * mensaje, int ver_errno);
 
+// Parámetros configurables en tiempo de ejecución (módulo comun/config)
+struct config_param config[] = {
+    {"filosofos", &N, CONFIG_INT, 1, MAX_FILOSOFOS, "Número de filósofos (como -n; si no se indica, se pregunta)"},
+    {"iteraciones", &num_iter, CONFIG_INT, 1, 100000000,
+     "Veces que come cada filósofo (con -r, MAX_ITER_RENDIMIENTO)"},
+    {"espera_max", &espera_max, CONFIG_INT, 1, 3600, "Las esperas aleatorias duran de 0 a espera_max - 1 segundos"},
+};
+#define NUM_CONFIG ((int) (sizeof(config) / sizeof(config[0])))
 
-int main(){
+
+int main(int argc, char * argv[]){
+    int opcion;                     // Opción leída con getopt
+    uint64_t t_ini;                 // Instante en que se crean los filósofos
+    double segundos;                // Duración de la ejecución de los filósofos
     void * area_compartida = NULL;      // Puntero al área de memoria compartida entre procesos
+    size_t tam_area;                    // Tamaño en bytes del área compartida
     int i;              // Variable de iteración
 
-    // Se solicita al usuario el número de filósofos (N)
-    printf("Introduce el numero de filosofos ó -1 para salir ");    
-    scanf("%d", &N);
-    if (N == -1){
-        printf("Cerrando programa...\n");
-        exit(EXIT_SUCCESS);
+    // Leemos primero los parámetros (--nombre=valor y variables de entorno) y después las opciones de la línea de
+    // comandos: modo rendimiento y número de filósofos
+    config_cargar(config, NUM_CONFIG, &argc, argv);
+    while ((opcion = getopt(argc, argv, "rn:m:")) != -1){
+        switch (opcion){
+            case 'r':
+                rendimiento = 1;
+                if (!config_fijado(config, NUM_CONFIG, "iteraciones")) num_iter = MAX_ITER_RENDIMIENTO;
+                break;
+            case 'n':
+                if ((N = atoi(optarg)) < 1 || N > MAX_FILOSOFOS)
+                    salir_con_error("El numero de filosofos debe estar entre 1 y MAX_FILOSOFOS\n", 0);
+                break;
+            case 'm':
+                if (!strcmp(optarg, "nombrados")) modo = MODO_NOMBRADOS;
+                else if (!strcmp(optarg, "compartido")) modo = MODO_COMPARTIDO;
+                else salir_con_error("Los semáforos deben ser nombrados o compartido\n", 0);
+                break;
+            default:
+                salir_con_error("Uso: ./filosofos4 [-r] [-n N] [-m nombrados|compartido] [--parámetro=valor ...]\n", 0);
+        }
     }
-    while (N < 0){
-        printf("El numero de filosofos debe ser mayor o igual que 1\n");
-        printf("Introduce el numero de filosofos ó -1 para salir ");
+
+    // Si no se ha indicado con -n, se solicita el número de filósofos al usuario
+    if (!N){
+        // Se solicita al usuario el número de filósofos (N)
+        printf("Introduce el numero de filosofos ó -1 para salir ");    
         scanf("%d", &N);
         if (N == -1){
             printf("Cerrando programa...\n");
             exit(EXIT_SUCCESS);
         }
+        while (N < 0){
+            printf("El numero de filosofos debe ser mayor o igual que 1\n");
+            printf("Introduce el numero de filosofos ó -1 para salir ");
+            scanf("%d", &N);
+            if (N == -1){
+                printf("Cerrando programa...\n");
+                exit(EXIT_SUCCESS);
+            }
+        }
     }
 
+    // Las medidas se reservan en memoria compartida, de forma que los filósofos (procesos hijo) escriben en la misma
+    // región que lee el padre. Hay un sello de tiempo por filósofo.
+    if ((medidas = medidas_crear((long) N * num_iter, N)) == NULL)
+        salir_con_error("No se ha podido reservar memoria para las medidas", 1);
+
 
     srand(time(NULL));              // Semilla para la generación de números aleatorios
     // Emplearemos esperas aleatorias para representar los períodos en los que los filósofos
@@ -120,48 +223,81 @@ int main(){
         salir_con_error("No se ha podido reservar memoria para los semaforos\n", 0);
 
 
+    // Con semáforos con nombre, el número de filósofos está limitado por las 3 cifras de los nombres
+    if (modo == MODO_NOMBRADOS && N > MAX_FILOSOFOS_NOMBRADOS)
+        salir_con_error("Con semaforos con nombre, el numero de filosofos debe ser como mucho "
+                        "MAX_FILOSOFOS_NOMBRADOS (o usar -m compartido)\n", 0);
+
     // Reservamos una región de memoria compartida entre procesos. Tendrá N enteros, y será equivalente
-    // al array de estados que utilizábamos en otros ejercicios.
-    if ((area_compartida = mmap(NULL, (size_t) N * sizeof(int), PROT_READ | PROT_WRITE,
+    // al array de estados que utilizábamos en otros ejercicios. En el modo MODO_COMPARTIDO, delante de
+    // los estados van el mutex y los semáforos de los filósofos.
+    tam_area = (size_t) N * sizeof(int);
+    if (modo == MODO_COMPARTIDO) tam_area += sizeof(struct mesa) + (size_t) N * sizeof(struct semaforo);
+    if ((area_compartida = mmap(NULL, tam_area, PROT_READ | PROT_WRITE,
         MAP_SHARED | MAP_ANONYMOUS, -1, (off_t) 0)) == MAP_FAILED)
         // Si hay algún error, finalizamos la ejecución e imprimimos errno con un mensaje personalizado
         salir_con_error("Error: no se ha podido reservar un área de memoria compartida", 1);
 
-    estado = (int *) area_compartida;       // Guardamos una referencia como memoria con enteros
+    if (modo == MODO_COMPARTIDO){
+        mesa = (struct mesa *) area_compartida;     // mmap devuelve la región alineada a página
+        estado = (int *) &mesa->filosofos[N];       // Los estados van a continuación de los semáforos
+    }
+    else estado = (int *) area_compartida;       // Guardamos una referencia como memoria con enteros
     // Podremos acceder a las posiciones del array como se haría normalmente con punteros
 
     // Inicialmente todos los filósofos están pensando
     for (i = 0; i < N; i++) estado[i] = PENSANDO;
+    // Fuera del modo rendimiento, log_consola imprime los estados a partir de una vista que se actualiza con cada
+    // cambio (en memoria compartida, para que sirva también con procesos)
+    if (!rendimiento && (vista = vista_crear(N, LETRAS_ESTADO[PENSANDO])) == NULL)
+        salir_con_error("No se ha podido reservar la vista de estados", 1);
+
+    if (!rendimiento){
+        printf("\n");
+        printf("Estados posibles para los filósofos:\n");
+        printf("  P: Pensando\n");
+        printf("  H: Hambriento\n");
+        printf("  C: Comiendo\n\n");
+    }
 
-    printf("\n");
-    printf("Estados posibles para los filósofos:\n");
-    printf("  P: Pensando\n");
-    printf("  H: Hambriento\n");
-    printf("  C: Comiendo\n\n");
 
+    if (modo == MODO_COMPARTIDO) inicializar_mesa();   // Los hijos heredarán los semáforos con la región
+    else {
+        // Como medida cautelar, destruimos los semáforos que pudiera haber en el sistema antes de volverlos
+        // a crear. Así, el proceso padre los deja disponibles para que sus hijos los empleen.
+        destruir_semaforos();
+        crear_semaforos();
+    }
 
-    // Como medida cautelar, destruimos los semáforos que pudiera haber en el sistema antes de volverlos
-    // a crear. Así, el proceso padre los deja disponibles para que sus hijos los empleen.
-    destruir_semaforos();
-    crear_semaforos();
+    t_ini = medidas_ns();       // Medimos el tiempo que tardan los filósofos en completar todas sus iteraciones
 
     // El proceso padre crea N filósofos llamando a fork()
     for (i = 0; i < N; i++) crear_hijo(i);
     esperar_hijos();            // El padre espera a que todos sus hijos finalicen
-
-    // Al acabar, el padre cierra los semáforos (que nunca llegó a emplear directamente)
-    cerrar_semaforos();
-    destruir_semaforos();       // También los destruye para eliminarlos del sistema (pues sabe que
-    // ya no queda nadie más usándolos)
+    segundos = (medidas_ns() - t_ini) / 1e9;
+
+    if (modo == MODO_COMPARTIDO) destruir_mesa();      // Ya no queda ningún hijo usando los semáforos
+    else {
+        // Al acabar, el padre cierra los semáforos (que nunca llegó a emplear directamente)
+        cerrar_semaforos();
+        destruir_semaforos();       // También los destruye para eliminarlos del sistema (pues sabe que
+        // ya no queda nadie más usándolos)
+    }
 
     // Liberamos la memoria reservada
     free(s);
 
     // Cerramos el área de memoria compartida
-    if (munmap(area_compartida, (size_t) N * sizeof(int)) == -1)
+    if (munmap(area_compartida, tam_area) == -1)
         salir_con_error("Error: no se ha podido cerrar la proyección del área compartida entre los procesos", 1);
 
-    printf("\n\nEjecución finalizada. Cerrando programa...\n\n");
+    // En el modo rendimiento se imprime la línea CSV con las comidas por segundo, las esperas y los cambios de contexto
+    if (rendimiento)
+        medidas_informe(medidas, "filosofos4", modo == MODO_COMPARTIDO ? "procesos_compartido" : "procesos", 1, 0,
+                        (long) N * num_iter, segundos);
+    else printf("\n\nEjecución finalizada. Cerrando programa...\n\n");
+    medidas_destruir(medidas);
+    vista_destruir(vista);
 
     exit(EXIT_SUCCESS);
 }
@@ -176,11 +312,12 @@ int main(){
 void filosofo(int id){
     int i;                      // Variable auxiliar para el bucle
 
-    // El hijo vuelve a abrir los semáforos que previamente creó el padre
-    abrir_semaforos();
+    // El hijo vuelve a abrir los semáforos que previamente creó el padre. En el modo MODO_COMPARTIDO no hace falta:
+    // los ha heredado con la región compartida
+    if (modo == MODO_NOMBRADOS) abrir_semaforos();
 
     // Realizamos un número finito de iteraciones para controlar el tiempo de ejecución
-    for (i = 0; i < MAX_ITER; i++){
+    for (i = 0; i < num_iter; i++){
         pensar();              // El filósofo no actúa
         tomar_tenedores(id);   // El filósofo toma ambos tenedores o queda bloqueado esperando
         comer(id);             // El filósofo espera mientras sostiene ambos tenedores
@@ -188,7 +325,7 @@ void filosofo(int id){
     }
 
     // El hijo cierra los semáforos y termina (el padre se encargará de destruirlos posteriormente)
-    cerrar_semaforos();
+    if (modo == MODO_NOMBRADOS) cerrar_semaforos();
 
     // Al volver de esta función, el proceso finaliza inmediatamente
 }
@@ -207,7 +344,7 @@ void probar(int id){
      * llamando a esta función. Si no se verificara, los vecinos tendrían la capacidad de obligarle a comer cuando en realidad él aún no quiere.
      */
     if (estado[id] == HAMBRIENTO && estado[IZQUIERDO] != COMIENDO && estado[DERECHO] != COMIENDO){
-        estado[id] = COMIENDO;      // El filósofo ya no deja que ninguno de sus vecinos tome sus tenedores.
+        fijar_estado(id, COMIENDO); // El filósofo ya no deja que ninguno de sus vecinos tome sus tenedores.
         sem_post(s[id]);   // Este semáforo actúa a modo de 'return' para esta función. Le indicará al filósofo que puede comer.
     }
 }
@@ -216,12 +353,14 @@ void probar(int id){
  * El filósofo trata de tomar los tenedores de su izquierda y de su derecha. Si no puede, se bloquea hasta que pueda.
  */
 void tomar_tenedores(int id){
+    medidas_sellar(medidas, id);   // El filósofo tiene hambre desde este instante
     sem_wait(mutex);       // El filósofo trata de acceder a la región crítica. Queda bloqueado si ya hay alguien cogiendo/dejando tenedores.
     log_consola(id, "Quiere tomar tenedores");
-    estado[id] = HAMBRIENTO;  // Registra que quiere tomar los tenedores
+    fijar_estado(id, HAMBRIENTO); // Registra que quiere tomar los tenedores
     probar(id);             // Comprueba si el filósofo puede comer (él está hambriento y sus vecinos no están comiendo, es decir, tienen libres los tenedores)
     sem_post(mutex);        // Sale de la región crítica
     sem_wait(s[id]);        // Si el filósofo puede comer (al probar, ha comprobado que los tenedores están disponibles y se ha declarado como "COMIENDO"), su semáforo se habrá incrementado. Si no, seguirá a 0 y quedará bloqueado.
+    medidas_latencia(medidas, id); // Ya tiene los tenedores: se registra cuánto ha esperado
 }
 
 /*
@@ -230,7 +369,7 @@ void tomar_tenedores(int id){
 void poner_tenedores(int id){
     sem_wait(mutex);           // El filósofo trata de acceder a la región crítica. Queda bloqueado si ya hay alguien cogiendo/dejando tenedores.
     log_consola(id, "Va a dejar sus tenedores");
-    estado[id] = PENSANDO;    // El filósofo está ocioso. No está comiendo ni quiere tomar tenedores.
+    fijar_estado(id, PENSANDO); // El filósofo está ocioso. No está comiendo ni quiere tomar tenedores.
     probar(IZQUIERDO);      // Si el filósofo de la izquierda quiere comer y su tenedor izquierdo está libre, se le cede el tenedor derecho y se le permite comer (deja de esperar su turno).
     if (estado[IZQUIERDO] == COMIENDO) log_consola(id, "Cede un tenedor al vecino izquierdo y este come");
     probar(DERECHO);        // Análogo con con el filósofo de la derecha.
@@ -239,17 +378,17 @@ void poner_tenedores(int id){
 }
 
 
-// El filósofo queda bloqueado durante un tiempo aleatorio (como máximo, MAX_SLEEP segundos)
+// El filósofo queda bloqueado durante un tiempo aleatorio (como máximo, espera_max - 1 segundos)
 void pensar(){
-   sleep(rand() % MAX_SLEEP);
+   if (!rendimiento) sleep(rand() % espera_max);
 }
 
 /* 
- * El filósofo anuncia que está comiendo y queda bloqueado un tiempo aleatorio (como máximo, MAX_SLEEP segundos)
+ * El filósofo anuncia que está comiendo y queda bloqueado un tiempo aleatorio (como máximo, espera_max - 1 segundos)
  */
 void comer(int id){
     log_consola(id, "Está comiendo");
-    sleep(rand() % MAX_SLEEP);
+    if (!rendimiento) sleep(rand() % espera_max);
 }
 
 /*
@@ -257,38 +396,26 @@ void comer(int id){
  * al estado de cada filósofo en el momento actual de ejecución.
  */
 void log_consola(int id, char * msg) {
+    char estados[MAX_FILOSOFOS + 1];        // Estados de los filósofos
+
+    if (rendimiento) return;                // En el modo rendimiento no se imprime nada
+
     // Empleamos los colores rojo, verde, amarillo, azul, magenta o fucsia según el id del hilo (31-36)
     int color = 31 + id % 6;
-    char * estados = ver_estados();         // Estados de los filósofos
+    // Instantánea de la vista de estados (módulo comun/vista), sin reconstruirla ni tomar el mutex de la región crítica
+    vista_leer(vista, estados);
 
     // Con la macro MOVER_A_COL nos colocamos en una columna a la derecha para imprimir los estados de los filósofos
     printf(COLOR "[%d]: %s" MOVER_A_COL "%s" RESET "\n", color, id, msg, estados);
-    free(estados);
 }
 
 /*
- * Función que construye una cadena con el estado actual de cada filósofo, para poder imprimirla.
+ * Función que cambia el estado de un filósofo y actualiza su letra en la vista de estados que imprime log_consola.
+ * Solo se reescribe un carácter de la vista, sin recorrer el resto.
  */
-char * ver_estados(){
-    int i;
-    char * estados = (char *) malloc(N*sizeof(char));
-
-    for (i = 0; i < N; i++){
-        switch (estado[i]){
-            case PENSANDO:
-                estados[i] = 'P';
-                break;
-            case HAMBRIENTO:
-                estados[i] = 'H';
-                break;
-            case COMIENDO:
-                estados[i] = 'C';
-                break;
-            default:
-                estados[i] = '?';   // Error
-        }
-    }
-    return estados;
+void fijar_estado(int id, int nuevo){
+    estado[id] = nuevo;
+    vista_cambiar(vista, id, LETRAS_ESTADO[nuevo]);
 }
 
 
@@ -435,6 +562,41 @@ void cerrar_semaforos(){
 }
 
 
+/*
+ * Función que inicializa los semáforos de la región compartida (modo MODO_COMPARTIDO). El segundo argumento de
+ * sem_init, distinto de 0, indica que el semáforo se comparte entre procesos: debe estar en memoria compartida, y los
+ * hijos creados después con fork lo usan directamente. Se deja en s y mutex la dirección de cada uno, de modo que el
+ * resto del programa no distingue entre los dos modos.
+ */
+void inicializar_mesa(){
+    int i;                      // Variable de iteración
+
+    if (sem_init(&mesa->mutex.sem, 1, 1) == -1)
+        salir_con_error("Error: no se ha podido inicializar el semaforo mutex", 1);
+    mutex = &mesa->mutex.sem;
+
+    for (i = 0; i < N; i++){
+        if (sem_init(&mesa->filosofos[i].sem, 1, 0) == -1)
+            salir_con_error("Error: no se ha podido inicializar el semaforo de un filosofo", 1);
+        s[i] = &mesa->filosofos[i].sem;
+    }
+}
+
+/*
+ * Función que destruye los semáforos de la región compartida (modo MODO_COMPARTIDO), una vez han finalizado todos
+ * los hijos.
+ */
+void destruir_mesa(){
+    int i;                      // Variable de iteración
+
+    if (sem_destroy(&mesa->mutex.sem) == -1)
+        salir_con_error("Error: no se ha podido destruir el semaforo mutex", 1);
+    for (i = 0; i < N; i++)
+        if (sem_destroy(&mesa->filosofos[i].sem) == -1)
+            salir_con_error("Error: no se ha podido destruir el semaforo de un filosofo", 1);
+}
+
+
 /*
  * Función auxiliar que cierra el programa en caso de error
  */
@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "afinidad.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Afinidad de los hilos
+ *
+ * Implementación de las políticas de colocación descritas en afinidad.h.
+ */
+
+
+#define AFINIDAD_RUTA_CPU "/sys/devices/system/cpu"     // Topología de cada CPU
+#define AFINIDAD_RUTA_NODO "/sys/devices/system/node"   // CPUs de cada nodo NUMA
+#define AFINIDAD_TAM_RUTA 512                           // Tamaño máximo de una ruta de /sys
+#define AFINIDAD_TAM_LISTA 4096                         // Tamaño máximo de una lista de CPUs leída de /sys
+
+
+// CPU en la que puede ejecutarse el proceso, con su posición en la topología
+struct cpu {
+    int cpu;            // Número de la CPU
+    int nodo;           // Nodo NUMA
+    int nucleo;         // Núcleo (la primera CPU de sus hilos hardware hermanos)
+    int hermano;        // Posición de la CPU entre los hilos hardware de su núcleo
+    int rango;          // Posición del núcleo entre los del nodo
+};
+
+// Topología leída una sola vez, la primera vez que se necesita (desde el hilo principal, antes de crear los hilos)
+static struct {
+    int leida;                      // !0 si ya se ha leído
+    int num_cpus;                   // CPUs en las que puede ejecutarse el proceso
+    int num_nucleos;                // Núcleos con alguna de esas CPUs
+    int nodo[CPU_SETSIZE];          // Nodo NUMA de cada CPU
+    int compacta[CPU_SETSIZE];      // CPUs en el orden de la política compacta
+    int dispersa[CPU_SETSIZE];      // CPUs en el orden de la política dispersa
+    int inicio[CPU_SETSIZE];        // Posición en compacta[] de la primera CPU de cada núcleo
+    int hilos[CPU_SETSIZE];         // Número de CPUs de cada núcleo
+} topologia;
+
+
+/*
+ * Función que lee una lista de CPUs de /sys (por ejemplo, "0-3,8,10-11") y marca sus CPUs en un conjunto.
+ * @param ruta: Fichero que contiene la lista.
+ * @param conjunto: Conjunto de CPUs en el que se marcan (no se vacía antes).
+ * @return: Primera CPU de la lista, o -1 si no se pudo leer.
+ */
+static int leer_lista(const char * ruta, cpu_set_t * conjunto){
+    char lista[AFINIDAD_TAM_LISTA];
+    char * p, * fin;
+    int primera = -1, desde, hasta, i;
+    FILE * f;
+
+    if ((f = fopen(ruta, "r")) == NULL) return -1;
+    if (fgets(lista, sizeof(lista), f) == NULL) lista[0] = '\0';
+    fclose(f);
+
+    for (p = lista; *p >= '0' && *p <= '9'; p = fin + (*fin == ',')){
+        desde = hasta = (int) strtol(p, &fin, 10);
+        if (*fin == '-') hasta = (int) strtol(fin + 1, &fin, 10);
+        if (primera == -1) primera = desde;
+        for (i = desde; i <= hasta && i < CPU_SETSIZE; i++) CPU_SET(i, conjunto);
+    }
+    return primera;
+}
+
+// Orden de la política compacta: por nodo, núcleo e hilo hardware
+static int comparar_compacta(const void * a, const void * b){
+    const struct cpu * x = a, * y = b;
+
+    if (x->nodo != y->nodo) return x->nodo - y->nodo;
+    if (x->nucleo != y->nucleo) return x->nucleo - y->nucleo;
+    return x->hermano - y->hermano;
+}
+
+// Orden de la política dispersa: primero un hilo hardware de cada núcleo, alternando los nodos
+static int comparar_dispersa(const void * a, const void * b){
+    const struct cpu * x = a, * y = b;
+
+    if (x->hermano != y->hermano) return x->hermano - y->hermano;
+    if (x->rango != y->rango) return x->rango - y->rango;
+    return x->nodo - y->nodo;
+}
+
+/*
+ * Función que lee la topología de las CPUs en las que puede ejecutarse el proceso y prepara el orden de cada política.
+ * Si /sys no está disponible, cada CPU se trata como un núcleo independiente del nodo 0.
+ */
+static void leer_topologia(){
+    static struct cpu cpus[CPU_SETSIZE];
+    char ruta[AFINIDAD_TAM_RUTA];
+    cpu_set_t permitidas, conjunto;
+    struct dirent * entrada;
+    DIR * dir;
+    int n = 0, nodo, i, j;
+
+    topologia.leida = 1;
+    if (sched_getaffinity(0, sizeof(permitidas), &permitidas) == -1){
+        CPU_ZERO(&permitidas);
+        CPU_SET(0, &permitidas);
+    }
+
+    // Nodo NUMA de cada CPU: cada /sys/devices/system/node/nodeX/cpulist enumera las CPUs del nodo X
+    memset(topologia.nodo, 0, sizeof(topologia.nodo));
+    if ((dir = opendir(AFINIDAD_RUTA_NODO)) != NULL){
+        while ((entrada = readdir(dir)) != NULL){
+            if (strncmp(entrada->d_name, "node", 4) || entrada->d_name[4] < '0' || entrada->d_name[4] > '9') continue;
+            nodo = atoi(entrada->d_name + 4);
+            snprintf(ruta, sizeof(ruta), "%s/%s/cpulist", AFINIDAD_RUTA_NODO, entrada->d_name);
+            CPU_ZERO(&conjunto);
+            if (leer_lista(ruta, &conjunto) == -1) continue;
+            for (i = 0; i < CPU_SETSIZE; i++) if (CPU_ISSET(i, &conjunto)) topologia.nodo[i] = nodo;
+        }
+        closedir(dir);
+    }
+
+    // Núcleo de cada CPU: la primera de sus hilos hardware hermanos, y posición de la CPU entre ellos
+    for (i = 0; i < CPU_SETSIZE; i++){
+        if (!CPU_ISSET(i, &permitidas)) continue;
+        cpus[n].cpu = i;
+        cpus[n].nodo = topologia.nodo[i];
+        snprintf(ruta, sizeof(ruta), "%s/cpu%d/topology/thread_siblings_list", AFINIDAD_RUTA_CPU, i);
+        CPU_ZERO(&conjunto);
+        if ((cpus[n].nucleo = leer_lista(ruta, &conjunto)) == -1){
+            cpus[n].nucleo = i;
+            cpus[n].hermano = 0;
+        }
+        else for (cpus[n].hermano = 0, j = 0; j < i; j++) if (CPU_ISSET(j, &conjunto)) cpus[n].hermano++;
+        n++;
+    }
+    topologia.num_cpus = n;
+
+    // Orden compacto. Los hilos hardware de cada núcleo quedan seguidos, lo que permite numerar los núcleos de cada
+    // nodo y guardar dónde empieza cada uno para la política de parejas
+    qsort(cpus, n, sizeof(struct cpu), comparar_compacta);
+    for (i = 0, j = -1; i < n; i++){
+        if (i == 0 || cpus[i].nucleo != cpus[i - 1].nucleo || cpus[i].nodo != cpus[i - 1].nodo){
+            j++;
+            topologia.inicio[j] = i;
+            topologia.hilos[j] = 0;
+            cpus[i].rango = (i == 0 || cpus[i].nodo != cpus[i - 1].nodo)? 0 : cpus[i - 1].rango + 1;
+        }
+        else cpus[i].rango = cpus[i - 1].rango;
+        topologia.hilos[j]++;
+        topologia.compacta[i] = cpus[i].cpu;
+    }
+    topologia.num_nucleos = j + 1;
+
+    qsort(cpus, n, sizeof(struct cpu), comparar_dispersa);
+    for (i = 0; i < n; i++) topologia.dispersa[i] = cpus[i].cpu;
+}
+
+
+/*
+ * Función que traduce el nombre de una política (opción -a de los programas) a su código.
+ * @param nombre: ninguna, compacta, dispersa o parejas.
+ * @return: Código AFINIDAD_* de la política, o -1 si el nombre no corresponde a ninguna.
+ */
+int afinidad_politica(const char * nombre){
+    if (!strcmp(nombre, "ninguna")) return AFINIDAD_NINGUNA;
+    if (!strcmp(nombre, "compacta")) return AFINIDAD_COMPACTA;
+    if (!strcmp(nombre, "dispersa")) return AFINIDAD_DISPERSA;
+    if (!strcmp(nombre, "parejas")) return AFINIDAD_PAREJAS;
+    return -1;
+}
+
+// Función que devuelve el nombre de una política
+const char * afinidad_nombre(int politica){
+    switch (politica){
+        case AFINIDAD_COMPACTA:
+            return "compacta";
+        case AFINIDAD_DISPERSA:
+            return "dispersa";
+        case AFINIDAD_PAREJAS:
+            return "parejas";
+        default:
+            return "ninguna";
+    }
+}
+
+/*
+ * Función que calcula la CPU en la que debe ejecutarse un hilo. En las políticas compacta y dispersa, los hilos se
+ * numeran en el orden en que los crean los programas: primero los consumidores y después los productores.
+ * @param politica: Política de colocación (AFINIDAD_*).
+ * @param rol: AFINIDAD_CONSUMIDOR o AFINIDAD_PRODUCTOR.
+ * @param indice: Identificador del hilo entre los de su rol (desde 0).
+ * @param num_consumidores: Número total de consumidores.
+ * @return: Número de la CPU, o -1 si la política no fija la afinidad.
+ */
+int afinidad_cpu(int politica, int rol, int indice, int num_consumidores){
+    int posicion = rol == AFINIDAD_CONSUMIDOR? indice : num_consumidores + indice;
+    int nucleo;
+
+    if (politica == AFINIDAD_NINGUNA) return -1;
+    if (!topologia.leida) leer_topologia();
+
+    switch (politica){
+        case AFINIDAD_COMPACTA:
+            return topologia.compacta[posicion % topologia.num_cpus];
+        case AFINIDAD_DISPERSA:
+            return topologia.dispersa[posicion % topologia.num_cpus];
+        default:
+            // Parejas: el productor ocupa el primer hilo hardware del núcleo y el consumidor, el segundo
+            nucleo = indice % topologia.num_nucleos;
+            return topologia.compacta[topologia.inicio[nucleo] +
+                                      (rol == AFINIDAD_CONSUMIDOR && topologia.hilos[nucleo] > 1)];
+    }
+}
+
+/*
+ * Función que fija en los atributos de creación de un hilo la afinidad a una única CPU, con
+ * pthread_attr_setaffinity_np. Si la CPU es -1, los atributos no se modifican.
+ * @param atributos: Atributos ya inicializados con pthread_attr_init.
+ * @param cpu: CPU en la que se ejecutará el hilo (de afinidad_cpu).
+ * @return: 0 si todo va bien, o el código de error de pthread_attr_setaffinity_np.
+ */
+int afinidad_atributos(pthread_attr_t * atributos, int cpu){
+    cpu_set_t conjunto;
+
+    if (cpu == -1) return 0;
+    CPU_ZERO(&conjunto);
+    CPU_SET(cpu, &conjunto);
+    return pthread_attr_setaffinity_np(atributos, sizeof(conjunto), &conjunto);
+}
+
+// Función que devuelve el nodo NUMA de una CPU (0 si no se conoce)
+int afinidad_nodo(int cpu){
+    if (!topologia.leida) leer_topologia();
+    return cpu >= 0 && cpu < CPU_SETSIZE? topologia.nodo[cpu] : 0;
+}
+
+/*
+ * Función que reserva una región de memoria anónima con mmap y, si se indica un nodo, pide al kernel (mbind, con la
+ * política MPOL_PREFERRED) que coloque en él sus páginas. Como las páginas se asignan al escribirlas por primera vez,
+ * la petición se hace antes de que nadie las toque. Si el kernel no admite mbind (sin soporte NUMA), la región se
+ * usa igualmente.
+ * @param tam: Tamaño en bytes de la región.
+ * @param nodo: Nodo NUMA preferido, o -1 para no indicar ninguno.
+ * @return: Puntero a la región, o NULL si no se pudo reservar.
+ */
+void * afinidad_reservar(size_t tam, int nodo){
+    unsigned long mascara;
+    void * region;
+
+    if ((region = mmap(NULL, tam, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        return NULL;
+    if (nodo >= 0 && nodo < (int) (8 * sizeof(mascara))){
+        // El kernel lee maxnode - 1 bits de la máscara, así que se le indica uno más que los que tiene
+        mascara = 1UL << nodo;
+        syscall(SYS_mbind, region, tam, MPOL_PREFERRED, &mascara, 8 * sizeof(mascara) + 1, 0);
+    }
+    return region;
+}
+
+// Función que libera una región reservada con afinidad_reservar
+void afinidad_liberar(void * region, size_t tam){
+    munmap(region, tam);
+}
@@ -0,0 +1,58 @@
+#ifndef AFINIDAD_H
+#define AFINIDAD_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Afinidad de los hilos
+ *
+ * Colocación de productores y consumidores en las CPUs según la topología de la máquina (nodos NUMA, núcleos e hilos
+ * hardware de cada núcleo), que se lee de /sys/devices/system. Sin una política, el planificador puede repartir los
+ * hilos entre sockets, y las líneas de caché del buffer y de cuenta viajan continuamente de un nodo a otro.
+ *
+ * Políticas:
+ *  - ninguna: no se fija la afinidad (comportamiento de siempre).
+ *  - compacta: los hilos ocupan CPUs contiguas, en el orden en que se crean (primero los consumidores y después los
+ *    productores), llenando los hilos hardware de un núcleo y los núcleos de un nodo antes de pasar al siguiente.
+ *  - dispersa: los hilos se reparten por turnos entre los nodos y, dentro de cada nodo, entre los núcleos, usando los
+ *    hilos hardware hermanos solo cuando ya no quedan núcleos libres.
+ *  - parejas: el productor i y el consumidor i comparten núcleo, en dos hilos hardware hermanos (en la misma CPU si el
+ *    núcleo solo tiene uno), de modo que los items que se pasan no salen de su caché.
+ *
+ * Con cualquier política distinta de ninguna, el buffer se reserva con afinidad_reservar en el nodo NUMA del primer
+ * consumidor, que es quien lee los items.
+ * Solo se consideran las CPUs en las que el proceso puede ejecutarse (sched_getaffinity). Si hay más hilos que CPUs,
+ * se vuelve a empezar por el principio.
+ */
+
+
+#define AFINIDAD_NINGUNA 0          // Sin afinidad: el planificador decide
+#define AFINIDAD_COMPACTA 1         // CPUs contiguas (núcleo a núcleo, nodo a nodo)
+#define AFINIDAD_DISPERSA 2         // Por turnos entre nodos y núcleos
+#define AFINIDAD_PAREJAS 3          // Productor y consumidor de cada pareja en hilos hardware hermanos
+
+#define AFINIDAD_CONSUMIDOR 0       // Rol de los hilos consumidores
+#define AFINIDAD_PRODUCTOR 1        // Rol de los hilos productores
+
+
+// Función que devuelve la política con el nombre indicado (ninguna, compacta, dispersa o parejas), o -1 si no existe
+int afinidad_politica(const char * nombre);
+// Función que devuelve el nombre de una política
+const char * afinidad_nombre(int politica);
+
+// Función que devuelve la CPU de un hilo según la política (-1 con la política ninguna)
+int afinidad_cpu(int politica, int rol, int indice, int num_consumidores);
+// Función que fija en los atributos de un hilo la afinidad a una CPU (0 si todo va bien, o un código de error)
+int afinidad_atributos(pthread_attr_t * atributos, int cpu);
+// Función que devuelve el nodo NUMA de una CPU (0 si no se conoce)
+int afinidad_nodo(int cpu);
+
+// Función que reserva una región de memoria, preferentemente en un nodo NUMA (-1 para no indicar ninguno)
+void * afinidad_reservar(size_t tam, int nodo);
+// Función que libera una región reservada con afinidad_reservar
+void afinidad_liberar(void * region, size_t tam);
+
+#endif
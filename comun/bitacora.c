@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "bitacora.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Bitácora asíncrona
+ *
+ * Implementación de la bitácora descrita en bitacora.h.
+ */
+
+
+#define TAM_FORMATO 160             // Bytes reservados por registro para dar formato a sus datos
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024                // Número máximo de vectores por llamada a writev
+#endif
+
+
+// Función ejecutada por el hilo escritor
+static void * escribir(void * ptr_bitacora);
+
+
+// Función que devuelve el instante actual según el reloj monótono, en nanosegundos
+static uint64_t instante(){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+// Función de comparación de registros para qsort (orden creciente de sello y, a igualdad, de secuencia)
+static int comparar_registros(const void * a, const void * b){
+    const struct bitacora_registro * x = *(const struct bitacora_registro * const *) a;
+    const struct bitacora_registro * y = *(const struct bitacora_registro * const *) b;
+
+    if (x->sello != y->sello) return (x->sello > y->sello) - (x->sello < y->sello);
+    return (x->secuencia > y->secuencia) - (x->secuencia < y->secuencia);
+}
+
+/*
+ * Función que crea la bitácora y lanza el hilo escritor. Los anillos no se reservan aquí, sino cuando cada hilo
+ * escribe por primera vez.
+ * @param fd: Descriptor en el que se volcarán los registros (normalmente, la salida estándar). Si se usa también con
+ *            stdio, debe vaciarse antes con fflush.
+ * @param formato: Función que da formato a los datos binarios de los registros (NULL si no se usan).
+ * @return: Puntero a la bitácora, o NULL si no se pudo reservar o lanzar el escritor.
+ */
+struct bitacora * bitacora_crear(int fd, bitacora_formato formato){
+    struct bitacora * b;
+
+    if ((b = calloc(1, sizeof(struct bitacora))) == NULL) return NULL;
+    b->fd = fd;
+    b->formato = formato;
+    atomic_init(&b->terminar, 0);
+    atomic_init(&b->num_anillos, 0);
+    atomic_init(&b->descartados, 0);
+
+    if (pthread_key_create(&b->clave, NULL)){
+        free(b);
+        return NULL;
+    }
+    if (pthread_create(&b->escritor, NULL, escribir, b)){
+        pthread_key_delete(b->clave);
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+/*
+ * Función que indica al hilo escritor que debe terminar, espera a que vuelque todos los registros pendientes y libera
+ * la bitácora. Debe llamarse cuando ya no queden hilos escribiendo en ella.
+ * @param b: Bitácora.
+ */
+void bitacora_cerrar(struct bitacora * b){
+    int i;
+
+    atomic_store(&b->terminar, 1);
+    pthread_join(b->escritor, NULL);
+
+    for (i = 0; i < atomic_load(&b->num_anillos) && i < BITACORA_MAX_HILOS; i++) free(atomic_load(&b->anillos[i]));
+    pthread_key_delete(b->clave);
+    free(b);
+}
+
+/*
+ * Función que crea el anillo del hilo que la llama y lo publica para que el escritor lo recorra.
+ * @param b: Bitácora.
+ * @return: Anillo del hilo, o NULL si se ha alcanzado BITACORA_MAX_HILOS o no hay memoria.
+ */
+static struct bitacora_anillo * crear_anillo(struct bitacora * b){
+    struct bitacora_anillo * a;
+    int i;
+
+    if ((i = atomic_fetch_add(&b->num_anillos, 1)) >= BITACORA_MAX_HILOS) return NULL;
+    if ((a = cache_reservar(1, sizeof(struct bitacora_anillo))) == NULL) return NULL;
+
+    atomic_init(&a->final, 0);
+    atomic_init(&a->inicio, 0);
+    atomic_init(&a->descartados, 0);
+    atomic_store_explicit(&b->anillos[i], a, memory_order_release);
+    pthread_setspecific(b->clave, a);
+    return a;
+}
+
+/*
+ * Función que añade un registro al anillo del hilo que la llama. Nunca se bloquea: si el anillo está lleno, el
+ * registro se descarta y se contabiliza.
+ * @param b: Bitácora.
+ * @param texto: Cadena a volcar (se copian como mucho BITACORA_TAM_TEXTO bytes).
+ * @param tipo: Valor que recibirá la función de formato junto a los datos.
+ * @param datos: Datos binarios a los que dará formato el escritor (NULL si no hay).
+ * @param tam_datos: Bytes de datos (se copian como mucho BITACORA_TAM_DATOS).
+ * @return: 0 si el registro se ha guardado, -1 si se ha descartado.
+ */
+int bitacora_escribir(struct bitacora * b, const char * texto, int tipo, const void * datos, size_t tam_datos){
+    struct bitacora_anillo * a = pthread_getspecific(b->clave);     // Anillo del hilo
+    struct bitacora_registro * r;           // Registro a rellenar
+    uint64_t final;                         // Posición del registro en el anillo
+    size_t longitud = strlen(texto);
+
+    if (a == NULL && (a = crear_anillo(b)) == NULL){
+        atomic_fetch_add_explicit(&b->descartados, 1, memory_order_relaxed);
+        return -1;
+    }
+
+    // Solo este hilo modifica final; inicio lo avanza el escritor cuando ya ha volcado los registros
+    final = atomic_load_explicit(&a->final, memory_order_relaxed);
+    if (final - atomic_load_explicit(&a->inicio, memory_order_acquire) == BITACORA_CAPACIDAD){
+        atomic_fetch_add_explicit(&a->descartados, 1, memory_order_relaxed);
+        return -1;
+    }
+
+    r = &a->registros[final % BITACORA_CAPACIDAD];
+    r->sello = instante();
+    r->secuencia = final;
+    r->tipo = tipo;
+    r->longitud = longitud < BITACORA_TAM_TEXTO? longitud : BITACORA_TAM_TEXTO;
+    memcpy(r->texto, texto, r->longitud);
+    r->tam_datos = datos == NULL? 0 : tam_datos < BITACORA_TAM_DATOS? tam_datos : BITACORA_TAM_DATOS;
+    if (r->tam_datos) memcpy(r->datos, datos, r->tam_datos);
+
+    // Publicamos el registro (release: el escritor que lea el nuevo final verá el registro completo)
+    atomic_store_explicit(&a->final, final + 1, memory_order_release);
+    return 0;
+}
+
+/*
+ * Función que devuelve el número total de registros descartados, por tener el anillo lleno o por no haberse podido
+ * crear el anillo de un hilo.
+ * @param b: Bitácora.
+ * @return: Registros descartados.
+ */
+long bitacora_descartados(struct bitacora * b){
+    long total = atomic_load_explicit(&b->descartados, memory_order_relaxed);
+    struct bitacora_anillo * a;
+    int i;
+
+    for (i = 0; i < atomic_load(&b->num_anillos) && i < BITACORA_MAX_HILOS; i++)
+        if ((a = atomic_load_explicit(&b->anillos[i], memory_order_acquire)) != NULL)
+            total += atomic_load_explicit(&a->descartados, memory_order_relaxed);
+    return total;
+}
+
+/*
+ * Función que escribe por completo un conjunto de vectores con writev, repitiendo la llamada si se interrumpe o si
+ * escribe solo una parte. Modifica los vectores.
+ * @param fd: Descriptor de destino.
+ * @param iov: Vectores a escribir.
+ * @param n: Número de vectores.
+ */
+static void volcar(int fd, struct iovec * iov, int n){
+    ssize_t escritos;
+
+    while (n > 0){
+        if ((escritos = writev(fd, iov, n < IOV_MAX? n : IOV_MAX)) == -1){
+            if (errno == EINTR) continue;
+            perror("Error al volcar la bitácora");
+            return;
+        }
+        // Saltamos los vectores completos y ajustamos el primero de los pendientes
+        while (n > 0 && (size_t) escritos >= iov->iov_len){
+            escritos -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0){
+            iov->iov_base = (char *) iov->iov_base + escritos;
+            iov->iov_len -= escritos;
+        }
+    }
+}
+
+/*
+ * Función ejecutada por el hilo escritor. En cada vuelta recoge hasta BITACORA_MAX_LOTE registros de los anillos, los
+ * ordena por su sello (para intercalar correctamente los de distintos hilos), da formato a sus datos y los vuelca con
+ * una sola llamada a writev. Solo después avanza el inicio de cada anillo, pues los vectores apuntan a los propios
+ * registros. Si no hay registros pendientes, duerme BITACORA_ESPERA_US microsegundos.
+ * Cuando se le indica que termine, sigue volcando hasta dejar vacíos todos los anillos.
+ * @param ptr_bitacora: Bitácora pasada como puntero a void.
+ */
+static void * escribir(void * ptr_bitacora){
+    struct bitacora * b = ptr_bitacora;
+    struct bitacora_registro * lote[BITACORA_MAX_LOTE];            // Registros recogidos en la vuelta
+    struct iovec iov[2 * BITACORA_MAX_LOTE];                        // Texto y datos de cada registro
+    char formato[BITACORA_MAX_LOTE * TAM_FORMATO];                  // Datos ya formateados
+    uint64_t tomados[BITACORA_MAX_HILOS];                           // Registros recogidos de cada anillo
+    struct bitacora_anillo * a;
+    uint64_t inicio, final;
+    size_t usado;                           // Bytes ocupados en formato
+    int num_anillos, fin, n, v, i;
+    uint64_t j;
+
+    do {
+        // Leemos terminar antes de recorrer los anillos: si estaba activo, ya nadie escribe y esta vuelta los vacía
+        fin = atomic_load(&b->terminar);
+        num_anillos = atomic_load(&b->num_anillos);
+        if (num_anillos > BITACORA_MAX_HILOS) num_anillos = BITACORA_MAX_HILOS;
+
+        for (i = 0, n = 0; i < num_anillos; i++){
+            tomados[i] = 0;
+            if ((a = atomic_load_explicit(&b->anillos[i], memory_order_acquire)) == NULL) continue;
+            inicio = atomic_load_explicit(&a->inicio, memory_order_relaxed);
+            final = atomic_load_explicit(&a->final, memory_order_acquire);
+            for (j = inicio; j < final && n < BITACORA_MAX_LOTE; j++, tomados[i]++)
+                lote[n++] = &a->registros[j % BITACORA_CAPACIDAD];
+        }
+
+        if (n == 0){
+            if (!fin) usleep(BITACORA_ESPERA_US);
+            continue;
+        }
+
+        qsort(lote, (size_t) n, sizeof(lote[0]), comparar_registros);
+        for (i = 0, v = 0, usado = 0; i < n; i++){
+            iov[v].iov_base = lote[i]->texto;
+            iov[v++].iov_len = lote[i]->longitud;
+            if (b->formato != NULL && lote[i]->tam_datos){
+                iov[v].iov_base = formato + usado;
+                iov[v].iov_len = b->formato(lote[i], formato + usado, TAM_FORMATO);
+                usado += iov[v++].iov_len;
+            }
+        }
+        volcar(b->fd, iov, v);
+
+        // Los registros ya se han volcado: se devuelven a sus anillos (release: el hilo no los reutiliza antes)
+        for (i = 0; i < num_anillos; i++)
+            if (tomados[i]){
+                a = atomic_load_explicit(&b->anillos[i], memory_order_relaxed);
+                atomic_store_explicit(&a->inicio, atomic_load_explicit(&a->inicio, memory_order_relaxed) + tomados[i],
+                                      memory_order_release);
+            }
+        // Si el lote estaba lleno puede quedar algo más; en otro caso, y si se debía terminar, ya está todo volcado
+        if (n == BITACORA_MAX_LOTE) fin = 0;
+    } while (!fin);
+
+    return NULL;
+}
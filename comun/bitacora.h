@@ -0,0 +1,82 @@
+#ifndef BITACORA_H
+#define BITACORA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "cache.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Bitácora asíncrona
+ *
+ * Registro de mensajes por consola sin cerrojos. Cada hilo que escribe en la bitácora dispone de su propio anillo
+ * (buffer circular de un productor y un consumidor) de registros binarios de tamaño fijo, que se crea la primera vez
+ * que el hilo escribe. Un único hilo escritor, lanzado por bitacora_crear, recoge los registros de todos los anillos,
+ * los ordena por su sello de tiempo, les da formato y los vuelca con writev en grandes lotes.
+ *
+ * Los hilos que escriben nunca se bloquean ni hacen llamadas al sistema: si su anillo está lleno porque la consola no
+ * da abasto, el registro se descarta y se contabiliza (bitacora_descartados).
+ *
+ * Cada registro contiene un texto ya preparado y, opcionalmente, unos datos binarios (por ejemplo, una instantánea
+ * del buffer tomada dentro de la región crítica) a los que el hilo escritor da formato con la función que se indique
+ * al crear la bitácora.
+ *
+ * Debe compilarse con la opción -pthread.
+ */
+
+
+#define BITACORA_TAM_TEXTO 128      // Bytes de texto de cada registro (los que sobren se truncan)
+#define BITACORA_TAM_DATOS 64       // Bytes de datos binarios de cada registro
+#define BITACORA_CAPACIDAD 256      // Registros de cada anillo (potencia de 2)
+#define BITACORA_MAX_HILOS 4096     // Número máximo de hilos que pueden escribir en la bitácora
+#define BITACORA_MAX_LOTE 512       // Número máximo de registros volcados en cada lote
+#define BITACORA_ESPERA_US 1000     // Microsegundos que duerme el escritor cuando no hay registros pendientes
+
+
+struct bitacora_registro {
+    uint64_t sello;                         // Instante de escritura (CLOCK_MONOTONIC, en nanosegundos)
+    uint64_t secuencia;                     // Posición del registro en su anillo (desempata sellos iguales)
+    int tipo;                               // Valor libre para el formato de los datos (0 si no hay datos)
+    uint16_t longitud;                      // Bytes de texto
+    uint16_t tam_datos;                     // Bytes de datos binarios
+    char texto[BITACORA_TAM_TEXTO];         // Texto ya preparado por el hilo
+    char datos[BITACORA_TAM_DATOS];         // Datos binarios a los que da formato el escritor
+};
+
+struct bitacora_anillo {
+    CACHE_ALINEADO _Atomic uint64_t final;          // Próximo registro a escribir (solo el hilo)
+    atomic_long descartados;                        // Registros descartados por estar lleno
+    CACHE_ALINEADO _Atomic uint64_t inicio;         // Próximo registro a volcar (solo el escritor)
+    struct bitacora_registro registros[BITACORA_CAPACIDAD];
+};
+
+// Función que da formato a los datos de un registro en destino (como mucho tam bytes) y devuelve los bytes escritos
+typedef size_t (*bitacora_formato)(const struct bitacora_registro * registro, char * destino, size_t tam);
+
+struct bitacora {
+    int fd;                                 // Descriptor en el que se vuelcan los registros
+    bitacora_formato formato;               // Formato de los datos binarios (NULL si no se usan)
+    pthread_t escritor;                     // Hilo escritor
+    pthread_key_t clave;                    // Anillo del hilo que escribe (dato específico de cada hilo)
+    atomic_int terminar;                    // !0 cuando el escritor debe vaciar los anillos y finalizar
+    atomic_int num_anillos;                 // Número de anillos creados
+    atomic_long descartados;                // Registros descartados por no poder crear un anillo
+    struct bitacora_anillo * _Atomic anillos[BITACORA_MAX_HILOS];     // Anillo de cada hilo
+};
+
+
+// Función que crea la bitácora y lanza el hilo escritor (NULL en caso de error)
+struct bitacora * bitacora_crear(int fd, bitacora_formato formato);
+// Función que vacía los anillos, finaliza el hilo escritor y libera la bitácora
+void bitacora_cerrar(struct bitacora * b);
+
+// Función que añade un registro al anillo del hilo que la llama, sin bloquearse (-1 si se descarta)
+int bitacora_escribir(struct bitacora * b, const char * texto, int tipo, const void * datos, size_t tam_datos);
+// Función que devuelve el número de registros descartados hasta el momento
+long bitacora_descartados(struct bitacora * b);
+
+#endif
@@ -0,0 +1,170 @@
+#include <string.h>
+#include "buffer.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Buffer de registros
+ *
+ * Implementación del buffer de registros de tamaño fijo descrito en buffer.h.
+ */
+
+
+/*
+ * Función que calcula el número de bytes que debe tener la región sobre la que se inicializará un buffer: la
+ * cabecera (struct buffer) seguida de los registros.
+ * @param capacidad: Número máximo de registros.
+ * @param tam_elem: Tamaño en bytes de cada registro.
+ * @return: Tamaño de la región en bytes.
+ */
+size_t buffer_tam_region(int capacidad, size_t tam_elem){
+    return sizeof(struct buffer) + (size_t) capacidad * tam_elem;
+}
+
+/*
+ * Función que inicializa un buffer vacío al comienzo de una región reservada por el llamante, que debe tener al
+ * menos buffer_tam_region(capacidad, tam_elem) bytes y estar alineada a una línea de caché (mmap lo garantiza).
+ * @param region: Comienzo de la región (memoria dinámica o compartida).
+ * @param capacidad: Número máximo de registros.
+ * @param tam_elem: Tamaño en bytes de cada registro.
+ * @param tipo: BUFFER_FIFO o BUFFER_LIFO.
+ * @param vacio: Byte con el que se rellenan los registros, para representar las posiciones vacías.
+ * @return: Puntero al buffer inicializado (la propia región).
+ */
+struct buffer * buffer_iniciar(void * region, int capacidad, size_t tam_elem, int tipo, char vacio){
+    struct buffer * b = (struct buffer *) region;
+
+    b->tam_elem = tam_elem;
+    b->capacidad = capacidad;
+    b->tipo = tipo;
+    b->inicio = 0;
+    b->final = 0;
+    b->cuenta = 0;
+    atomic_init(&b->cerrado, 0);
+    memset(b->datos, vacio, (size_t) capacidad * tam_elem);
+
+    return b;
+}
+
+/*
+ * Función que devuelve un puntero al registro que ocupa una posición del buffer, independientemente de que esté
+ * ocupada o no. Se utiliza, por ejemplo, para imprimir el contenido del buffer.
+ * @param b: Buffer.
+ * @param pos: Posición, entre 0 y capacidad - 1.
+ * @return: Puntero al primer byte del registro.
+ */
+void * buffer_registro(struct buffer * b, int pos){
+    return b->datos + (size_t) pos * b->tam_elem;
+}
+
+/*
+ * Función que devuelve la posición del buffer que ocupa un registro (la inversa de buffer_registro).
+ * @param b: Buffer.
+ * @param registro: Puntero a un registro del buffer.
+ * @return: Posición del registro, entre 0 y capacidad - 1.
+ */
+int buffer_posicion(struct buffer * b, void * registro){
+    return (int) (((char *) registro - b->datos) / b->tam_elem);
+}
+
+/*
+ * Función que devuelve un puntero al hueco en el que se escribirá el j-ésimo de los próximos registros (j = 0 para
+ * el siguiente). El llamante escribe el registro directamente en él y después llama a buffer_confirmar_insercion.
+ * No se comprueba que haya hueco; este es un prerrequisito a corroborar de forma externa.
+ * @param b: Buffer.
+ * @param j: Número de registros que se insertarán antes que este (dentro del mismo lote).
+ * @return: Puntero al hueco.
+ */
+void * buffer_hueco_insertar(struct buffer * b, int j){
+    // En una pila se inserta sobre la cima (cuenta); en una cola, a continuación del final
+    if (b->tipo == BUFFER_LIFO) return buffer_registro(b, b->cuenta + j);
+    return buffer_registro(b, (b->final + j) % b->capacidad);
+}
+
+/*
+ * Función que hace visibles en el buffer los n registros escritos en los huecos devueltos por
+ * buffer_hueco_insertar (j = 0, ..., n - 1).
+ * @param b: Buffer.
+ * @param n: Número de registros insertados.
+ */
+void buffer_confirmar_insercion(struct buffer * b, int n){
+    if (b->tipo == BUFFER_FIFO) b->final = (b->final + n) % b->capacidad;
+    b->cuenta += n;
+}
+
+/*
+ * Función que devuelve un puntero al j-ésimo de los próximos registros a extraer (j = 0 para el siguiente). El
+ * llamante lee el registro en el propio buffer y después llama a buffer_confirmar_extraccion, a partir de lo cual
+ * el hueco puede volver a ocuparse.
+ * No se comprueba que haya registros; este es un prerrequisito a corroborar de forma externa.
+ * @param b: Buffer.
+ * @param j: Número de registros que se extraerán antes que este (dentro del mismo lote).
+ * @return: Puntero al registro.
+ */
+void * buffer_hueco_extraer(struct buffer * b, int j){
+    // En una pila se extrae de la cima (cuenta - 1) hacia abajo; en una cola, a partir del inicio
+    if (b->tipo == BUFFER_LIFO) return buffer_registro(b, b->cuenta - 1 - j);
+    return buffer_registro(b, (b->inicio + j) % b->capacidad);
+}
+
+/*
+ * Función que libera los huecos de los n registros devueltos por buffer_hueco_extraer (j = 0, ..., n - 1).
+ * @param b: Buffer.
+ * @param n: Número de registros extraídos.
+ */
+void buffer_confirmar_extraccion(struct buffer * b, int n){
+    if (b->tipo == BUFFER_FIFO) b->inicio = (b->inicio + n) % b->capacidad;
+    b->cuenta -= n;
+}
+
+// Función que verifica si el buffer ha llegado a su máximo de capacidad
+// Devuelve 1 si es así y 0 en caso contrario.
+int buffer_lleno(struct buffer * b){
+    return b->cuenta == b->capacidad;
+}
+
+// Función que verfica si el buffer tiene algún registro
+// Devuelve 1 si está vacío, y 0 si hay registros en él
+int buffer_vacio(struct buffer * b){
+    return !b->cuenta;
+}
+
+/*
+ * Función que cierra el buffer, indicando que ya no se insertarán más registros. Debe llamarse después de confirmar
+ * la última inserción: como la escritura tiene semántica release, quien vea el buffer cerrado (buffer_cerrado, con
+ * semántica acquire) verá también todas las inserciones, y si además lo ve vacío, puede terminar.
+ * No despierta a nadie; el llamante debe despertar después a todos los hilos o procesos que esperen por el buffer.
+ * @param b: Buffer.
+ */
+void buffer_cerrar(struct buffer * b){
+    atomic_store_explicit(&b->cerrado, 1, memory_order_release);
+}
+
+// Función que verifica si el buffer se ha cerrado (ya no se insertarán más registros)
+// Devuelve 1 si es así y 0 en caso contrario.
+int buffer_cerrado(struct buffer * b){
+    return atomic_load_explicit(&b->cerrado, memory_order_acquire) != 0;
+}
+
+/*
+ * Función que genera en el propio hueco un registro de prueba: todos sus bytes toman el valor de la letra que
+ * identifica al item, de forma que el coste de producirlo crece con el tamaño del registro.
+ * @param registro: Hueco donde se escribe el registro.
+ * @param tam_elem: Tamaño en bytes del registro.
+ * @param letra: Letra del item (la que imprimen los programas).
+ */
+void registro_rellenar(void * registro, size_t tam_elem, char letra){
+    memset(registro, letra, tam_elem);
+}
+
+/*
+ * Función que lee un registro de prueba completo y comprueba que no esté corrupto, es decir, que todos sus bytes
+ * sigan siendo iguales al primero (una escritura parcial o concurrente lo detectaría).
+ * @param registro: Registro a comprobar.
+ * @param tam_elem: Tamaño en bytes del registro.
+ * @return: 1 si el registro es correcto, 0 si no.
+ */
+int registro_comprobar(const void * registro, size_t tam_elem){
+    // Comparar el registro consigo mismo desplazado un byte equivale a comprobar que todos los bytes son iguales
+    return tam_elem <= 1 || !memcmp(registro, (const char *) registro + 1, tam_elem - 1);
+}
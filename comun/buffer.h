@@ -0,0 +1,94 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "cache.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Buffer de registros
+ *
+ * Buffer acotado de registros de tamaño fijo (tam_elem bytes), que puede funcionar como una cola FIFO o como una pila
+ * LIFO. Es compartido por los programas de las prácticas 2, 3 y 4, que antes trabajaban con buffers de un solo
+ * carácter.
+ *
+ * La estructura se inicializa sobre una región que proporciona el llamante (malloc, o mmap si debe compartirse entre
+ * procesos) y los datos se guardan a continuación de la cabecera, de forma que no hay punteros internos.
+ * En lugar de copiar los registros, el módulo entrega al llamante un puntero al hueco correspondiente: el productor
+ * escribe el registro directamente en el buffer y el consumidor lo lee en el propio buffer. Solo después se confirma
+ * la inserción o la extracción.
+ *
+ * El módulo no incluye ninguna sincronización: cada programa protege las llamadas con su propio mecanismo
+ * (semáforos, mutexes, etc.).
+ *
+ * Los campos de la cabecera se agrupan en líneas de caché distintas (módulo comun/cache) según quién los escribe: la
+ * configuración, que solo se lee, el índice del productor (final), el del consumidor (inicio) y la cuenta, que
+ * escriben ambos. Los registros empiezan también en su propia línea, de modo que escribir la cuenta no invalida el
+ * primer registro ni la configuración que leen todos. Por ello, la región debe estar alineada a una línea de caché.
+ *
+ * Cuando el productor (o el último de ellos) termina, cierra el buffer con buffer_cerrar, y los consumidores retiran
+ * los registros que queden hasta encontrarlo cerrado y vacío, en lugar de contar de antemano los que van a consumir.
+ * Como el resto del módulo, buffer_cerrar solo marca el buffer: despertar a quien espere (difundiendo en las
+ * variables de condición, señalando los semáforos o despertando a todos los hilos de un futex) corresponde a cada
+ * programa, con su propio mecanismo.
+ */
+
+
+#define BUFFER_FIFO 0           // Los registros se extraen en el orden en el que se insertaron (cola)
+#define BUFFER_LIFO 1           // Se extrae siempre el último registro insertado (pila)
+
+
+struct buffer {
+    // Configuración (solo se escribe en buffer_iniciar)
+    CACHE_ALINEADO size_t tam_elem;         // Tamaño en bytes de cada registro
+    int capacidad;                          // Número máximo de registros
+    int tipo;                               // BUFFER_FIFO o BUFFER_LIFO
+    // Campo del productor
+    CACHE_ALINEADO int final;               // Posición del próximo hueco a ocupar (solo FIFO)
+    // Campo del consumidor
+    CACHE_ALINEADO int inicio;              // Posición del próximo registro a extraer (solo FIFO)
+    // Campo compartido
+    CACHE_ALINEADO int cuenta;              // Número de registros presentes en el buffer
+    // Campo del cierre (se escribe una sola vez, al terminar de producir)
+    CACHE_ALINEADO _Atomic int cerrado;     // !0 si ya no se insertarán más registros
+    CACHE_ALINEADO char datos[];            // capacidad * tam_elem bytes de registros
+};
+
+
+// Función que calcula el tamaño en bytes de la región necesaria para un buffer
+size_t buffer_tam_region(int capacidad, size_t tam_elem);
+// Función que inicializa un buffer en la región indicada
+struct buffer * buffer_iniciar(void * region, int capacidad, size_t tam_elem, int tipo, char vacio);
+
+// Función que devuelve un puntero al registro de una posición del buffer
+void * buffer_registro(struct buffer * b, int pos);
+// Función que devuelve la posición que ocupa un registro del buffer
+int buffer_posicion(struct buffer * b, void * registro);
+
+// Función que devuelve un puntero al j-ésimo hueco libre en el que se insertará el próximo registro
+void * buffer_hueco_insertar(struct buffer * b, int j);
+// Función que confirma la inserción de n registros
+void buffer_confirmar_insercion(struct buffer * b, int n);
+// Función que devuelve un puntero al j-ésimo registro que se extraerá a continuación
+void * buffer_hueco_extraer(struct buffer * b, int j);
+// Función que confirma la extracción de n registros
+void buffer_confirmar_extraccion(struct buffer * b, int n);
+
+// Función que comprueba si el buffer está lleno
+int buffer_lleno(struct buffer * b);
+// Función que comprueba si el buffer está vacío
+int buffer_vacio(struct buffer * b);
+
+// Función que marca el buffer como cerrado: no se insertarán más registros
+void buffer_cerrar(struct buffer * b);
+// Función que comprueba si el buffer está cerrado
+int buffer_cerrado(struct buffer * b);
+
+// Función que genera un registro de prueba a partir de una letra
+void registro_rellenar(void * registro, size_t tam_elem, char letra);
+// Función que comprueba que un registro de prueba no esté corrupto
+int registro_comprobar(const void * registro, size_t tam_elem);
+
+#endif
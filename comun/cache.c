@@ -0,0 +1,29 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Disposición en líneas de caché
+ *
+ * Implementación de la reserva alineada descrita en cache.h.
+ */
+
+
+/*
+ * Función que reserva un array alineado al comienzo de una línea de caché, con todos sus bytes a 0, de modo que los
+ * elementos declarados con CACHE_ALINEADO no compartan línea con ninguna otra reserva.
+ * @param n: Número de elementos.
+ * @param tam: Tamaño en bytes de cada elemento.
+ * @return: Puntero al array (se libera con free), o NULL si no se pudo reservar.
+ */
+void * cache_reservar(size_t n, size_t tam){
+    // aligned_alloc exige que el tamaño sea múltiplo del alineamiento
+    size_t total = (n * tam + CACHE_TAM_LINEA - 1) / CACHE_TAM_LINEA * CACHE_TAM_LINEA;
+    void * p;
+
+    if (total == 0) total = CACHE_TAM_LINEA;
+    if ((p = aligned_alloc(CACHE_TAM_LINEA, total)) != NULL) memset(p, 0, total);
+    return p;
+}
@@ -0,0 +1,49 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Disposición en líneas de caché
+ *
+ * Cuando dos hilos o procesos escriben en variables distintas que caen en la misma línea de caché, cada escritura
+ * invalida la copia del otro y la línea viaja de un núcleo a otro aunque no compartan ningún dato (compartición
+ * falsa). Para evitarlo, el estado compartido se agrupa en estructuras cuyos campos se separan según quién los
+ * escribe: los del productor, los del consumidor, los que escriben ambos y los de solo lectura.
+ *
+ * Cada grupo empieza con CACHE_ALINEADO, que lo alinea al comienzo de una línea. Como el tamaño de una estructura es
+ * múltiplo de su alineamiento, el último grupo queda rellenado hasta el final de su línea y nada de lo que venga
+ * después la comparte. La memoria de estas estructuras debe reservarse alineada: mmap (alineado a página),
+ * cache_reservar o variables globales.
+ *
+ * Compilando con -DCACHE_SIN_SEPARAR, CACHE_ALINEADO no hace nada y los campos vuelven a quedar juntos. Sirve para
+ * medir el efecto de la separación con los mismos programas (reglas "disposicion" de los makefiles).
+ */
+
+
+#define CACHE_TAM_LINEA 64          // Tamaño de una línea de caché
+
+#ifdef CACHE_SIN_SEPARAR
+#define CACHE_ALINEADO              // Campos juntos, como antes de separarlos
+#define CACHE_DISPOSICION "juntos"  // Nombre de la disposición (para los informes)
+#else
+#define CACHE_ALINEADO alignas(CACHE_TAM_LINEA)     // El campo empieza una línea de caché
+#define CACHE_DISPOSICION "separados"
+#endif
+
+
+// Palabra de 32 bits que ocupa su propia línea de caché, como la palabra futex de cada hilo de un array
+struct cache_palabra {
+    CACHE_ALINEADO _Atomic uint32_t valor;
+};
+
+
+// Función que reserva un array de n elementos alineado a una línea de caché e inicializado a 0 (como calloc)
+void * cache_reservar(size_t n, size_t tam);
+
+#endif
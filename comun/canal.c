@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "canal.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Canal de memoria compartida
+ *
+ * Implementación del canal descrito en canal.h.
+ */
+
+
+#define CANAL_INTENTOS 1000         // Pausas que canal_abrir espera, como mucho, a que el canal esté listo
+#define CANAL_PAUSA_NS 10000000L    // Duración de cada pausa (10 ms, así que se espera hasta 10 s)
+
+
+/*
+ * Función que bloquea al proceso mientras la palabra futex valga 0. Las esperas son entre procesos, así que no se usa
+ * la variante privada. Vuelve también si la palabra ya había cambiado, si llega una señal o si se agota el tiempo.
+ * @param palabra: Palabra futex (en la memoria compartida).
+ * @param tiempo: Tiempo máximo de espera (NULL para esperar sin límite).
+ */
+static void esperar_futex(_Atomic uint32_t * palabra, const struct timespec * tiempo){
+    if (syscall(SYS_futex, palabra, FUTEX_WAIT, 0, tiempo, NULL, 0) == -1 && errno != EAGAIN && errno != EINTR &&
+            errno != ETIMEDOUT){
+        perror("Error en la espera sobre el futex del canal");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Función que despierta a n procesos bloqueados en una palabra futex.
+ * @param palabra: Palabra futex (en la memoria compartida).
+ * @param n: Número máximo de procesos a despertar.
+ */
+static void despertar_futex(_Atomic uint32_t * palabra, uint32_t n){
+    if (syscall(SYS_futex, palabra, FUTEX_WAKE, n, NULL, NULL, 0) == -1){
+        perror("Error al despertar a un proceso del canal");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Función que decrementa un contador, esperando en su futex mientras valga 0 (la operación wait de un semáforo).
+ * El proceso se anota en dormidos antes de bloquearse y el núcleo comprueba de forma atómica que el contador siga a 0;
+ * quien lo incrementa lee dormidos después (ambas operaciones son seq_cst), así que no se puede perder un aviso.
+ * Si el contador está terminado (bit CANAL_TERMINADO), se siguen decrementando las unidades que queden, que no
+ * incluyen el bit, y cuando no queda ninguna se vuelve sin esperar. Como el bit hace que la palabra deje de valer 0,
+ * tampoco se puede perder el aviso de terminación.
+ * @param contador: Contador (créditos o items).
+ * @param dormidos: Procesos esperando en el contador.
+ * @return: 0 si se ha decrementado, -1 si el contador está terminado y a 0.
+ */
+static int bajar(_Atomic uint32_t * contador, atomic_int * dormidos){
+    uint32_t valor = atomic_load(contador);
+
+    for (;;){
+        while (valor & ~CANAL_TERMINADO)
+            if (atomic_compare_exchange_weak(contador, &valor, valor - 1)) return 0;
+        if (valor & CANAL_TERMINADO) return -1;
+
+        atomic_fetch_add(dormidos, 1);
+        esperar_futex(contador, NULL);
+        atomic_fetch_sub(dormidos, 1);
+        valor = atomic_load(contador);
+    }
+}
+
+/*
+ * Función que incrementa un contador en n (la operación signal de un semáforo) y, solo si hay procesos dormidos en
+ * él, despierta a tantos como unidades se han añadido.
+ * @param contador: Contador (créditos o items).
+ * @param dormidos: Procesos esperando en el contador.
+ * @param n: Unidades a añadir.
+ */
+static void subir(_Atomic uint32_t * contador, atomic_int * dormidos, uint32_t n){
+    atomic_fetch_add(contador, n);
+    if (atomic_load(dormidos) > 0) despertar_futex(contador, n);
+}
+
+/*
+ * Función que marca un contador como terminado (ya no se le sumarán más unidades) y despierta a todos los procesos
+ * dormidos en él, que recogerán las unidades que queden y, después, verán el bit y no volverán a esperar.
+ * @param contador: Contador (créditos o items).
+ * @param dormidos: Procesos esperando en el contador.
+ */
+static void terminar(_Atomic uint32_t * contador, atomic_int * dormidos){
+    atomic_fetch_or(contador, CANAL_TERMINADO);
+    if (atomic_load(dormidos) > 0) despertar_futex(contador, INT_MAX);
+}
+
+/*
+ * Función que adquiere el cerrojo de la pila. Las secciones críticas solo mueven un índice, así que basta con una
+ * espera activa, pero se cede el procesador si está ocupado: quien lo tiene puede haber sido expulsado.
+ * @param c: Canal.
+ */
+static void bloquear(struct canal * c){
+    while (atomic_exchange_explicit(&c->cerrojo, 1, memory_order_acquire))
+        while (atomic_load_explicit(&c->cerrojo, memory_order_relaxed)) sched_yield();
+}
+
+/*
+ * Función que libera el cerrojo de la pila.
+ * @param c: Canal.
+ */
+static void desbloquear(struct canal * c){
+    atomic_store_explicit(&c->cerrojo, 0, memory_order_release);
+}
+
+// Función que devuelve la pila de huecos publicados de un canal LIFO (a continuación de los huecos)
+static uint32_t * pila(struct canal * c){
+    return (uint32_t *) (c->huecos + (size_t) c->capacidad * c->tam_hueco);
+}
+
+// Función que devuelve la lista de huecos libres de un canal LIFO (a continuación de la pila)
+static uint32_t * libres(struct canal * c){
+    return pila(c) + c->capacidad;
+}
+
+/*
+ * Función que crea el objeto de memoria compartida del canal y lo proyecta. Si ya existía uno con el mismo nombre
+ * (de una ejecución previa), se borra antes.
+ * @param nombre: Nombre del objeto (empieza por '/', como en shm_open).
+ * @param capacidad: Número de huecos del anillo.
+ * @param tam_hueco: Tamaño en bytes de cada hueco.
+ * @param orden: CANAL_FIFO (anillo) o CANAL_LIFO (pila).
+ * @return: Puntero al canal, o NULL en caso de error (errno indica el motivo).
+ */
+struct canal * canal_crear(const char * nombre, uint32_t capacidad, size_t tam_hueco, int orden){
+    struct canal * c;
+    size_t tam_region = sizeof(struct canal) + (size_t) capacidad * tam_hueco;
+    uint32_t i;
+    int fd;
+
+    if (orden == CANAL_LIFO) tam_region += 2 * (size_t) capacidad * sizeof(uint32_t);     // Pila y huecos libres
+
+    shm_unlink(nombre);
+    if ((fd = shm_open(nombre, O_CREAT | O_EXCL | O_RDWR, 0777)) == -1) return NULL;
+    if (ftruncate(fd, (off_t) tam_region) == -1 ||
+        (c = mmap(NULL, tam_region, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED){
+        close(fd);
+        return NULL;
+    }
+    close(fd);          // La proyección se mantiene tras cerrar el descriptor
+
+    // ftruncate deja la región a 0, así que basta con fijar los tamaños
+    c->capacidad = capacidad;
+    c->tam_hueco = (uint32_t) tam_hueco;
+    c->orden = (uint32_t) orden;
+    c->tam_region = tam_region;
+    if (orden == CANAL_LIFO){           // Al principio, todos los huecos están libres
+        for (i = 0; i < capacidad; i++) libres(c)[i] = i;
+        c->num_libres = capacidad;
+    }
+
+    // Hasta ahora, quien abriera el objeto veía la cabecera a 0. La escritura con release publica todo lo anterior
+    // para quien lea listo con acquire, y se despierta a quien ya estuviera esperando en canal_abrir
+    atomic_store_explicit(&c->listo, 1, memory_order_release);
+    despertar_futex(&c->listo, INT_MAX);
+    return c;
+}
+
+/*
+ * Función que abre y proyecta el objeto de memoria compartida de un canal, si ya tiene su tamaño definitivo.
+ * @param nombre: Nombre del objeto de memoria compartida.
+ * @param st: Donde se devuelven los datos del objeto (su tamaño y su número de nodo-i).
+ * @return: Puntero al canal, o NULL en caso de error (errno indica el motivo: ENOENT si el objeto aún no existe y
+ *          EINVAL si aún no tiene tamaño).
+ */
+static struct canal * proyectar(const char * nombre, struct stat * st){
+    struct canal * c = NULL;
+    int fd, error = 0;
+
+    if ((fd = shm_open(nombre, O_RDWR, 0)) == -1) return NULL;
+    if (fstat(fd, st) == -1) error = errno;
+    else if ((size_t) st->st_size < sizeof(struct canal)) error = EINVAL;
+    else if ((c = mmap(NULL, (size_t) st->st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t) 0))
+            == MAP_FAILED){
+        c = NULL;
+        error = errno;
+    }
+    close(fd);          // La proyección se mantiene tras cerrar el descriptor
+    errno = error;
+    return c;
+}
+
+/*
+ * Función que comprueba si un nombre sigue correspondiendo al objeto de memoria compartida que ya se ha proyectado.
+ * @param nombre: Nombre del objeto de memoria compartida.
+ * @param ino: Número de nodo-i del objeto proyectado.
+ * @return: 1 si es el mismo objeto, 0 si el nombre ya no existe o es de otro.
+ */
+static int mismo_objeto(const char * nombre, ino_t ino){
+    struct stat st;
+    int fd, mismo;
+
+    if ((fd = shm_open(nombre, O_RDONLY, 0)) == -1) return 0;
+    mismo = fstat(fd, &st) == 0 && st.st_ino == ino;
+    close(fd);
+    return mismo;
+}
+
+/*
+ * Función que abre y proyecta un canal creado por otro proceso. Si el objeto aún no existe (ENOENT) o el productor
+ * todavía no le ha dado tamaño (EINVAL), se reintenta cada CANAL_PAUSA_NS nanosegundos. Una vez proyectado, se espera
+ * en el futex de listo a que canal_crear marque la cabecera como completa; a partir de ahí los tamaños se pueden leer
+ * de ella. La espera se interrumpe cada CANAL_PAUSA_NS para comprobar que el nombre no se haya pasado a otro objeto:
+ * si se abrió el de una ejecución anterior, el productor lo borra y crea uno nuevo, y hay que abrir ese. En total se
+ * espera como mucho CANAL_INTENTOS pausas.
+ * @param nombre: Nombre del objeto de memoria compartida.
+ * @return: Puntero al canal, o NULL en caso de error (errno indica el motivo; ETIMEDOUT si el canal no ha llegado a
+ *          estar listo).
+ */
+struct canal * canal_abrir(const char * nombre){
+    struct timespec pausa = {0, CANAL_PAUSA_NS};
+    struct canal * c = NULL;
+    struct stat st;
+    int intentos;
+
+    for (intentos = 0; intentos < CANAL_INTENTOS; intentos++){
+        if (c == NULL && (c = proyectar(nombre, &st)) == NULL){
+            if (errno != ENOENT && errno != EINVAL) return NULL;
+            nanosleep(&pausa, NULL);        // El productor aún no ha creado el objeto o no le ha dado tamaño
+            continue;
+        }
+        // El tamaño ya es el definitivo, pero la cabecera puede estar aún a 0
+        if (atomic_load_explicit(&c->listo, memory_order_acquire)) return c;
+        esperar_futex(&c->listo, &pausa);
+        if (atomic_load_explicit(&c->listo, memory_order_acquire)) return c;
+        if (!mismo_objeto(nombre, st.st_ino)){      // Era el de una ejecución anterior: se vuelve a abrir
+            munmap(c, (size_t) st.st_size);
+            c = NULL;
+        }
+    }
+
+    if (c != NULL) munmap(c, (size_t) st.st_size);
+    errno = ETIMEDOUT;
+    return NULL;
+}
+
+/*
+ * Función que deshace la proyección del canal en el proceso que la llama.
+ * @param c: Canal.
+ */
+void canal_cerrar(struct canal * c){
+    munmap(c, c->tam_region);
+}
+
+/*
+ * Función que borra el objeto de memoria compartida. Los procesos que lo tengan proyectado pueden seguir usándolo.
+ * @param nombre: Nombre del objeto de memoria compartida.
+ */
+void canal_borrar(const char * nombre){
+    shm_unlink(nombre);
+}
+
+/*
+ * Función con la que el consumidor concede n créditos al productor (equivale a enviarle n órdenes).
+ * @param c: Canal.
+ * @param n: Número de créditos.
+ */
+void canal_enviar_creditos(struct canal * c, uint32_t n){
+    subir(&c->creditos, &c->dormidos_creditos, n);
+}
+
+/*
+ * Función con la que el productor consume un crédito, bloqueándose si no hay ninguno.
+ * @param c: Canal.
+ * @return: 0 si se ha recibido un crédito, -1 si no quedan y el consumidor ya no concederá más.
+ */
+int canal_recibir_credito(struct canal * c){
+    return bajar(&c->creditos, &c->dormidos_creditos);
+}
+
+/*
+ * Función con la que el consumidor indica que no concederá más créditos. El productor puede recoger los que ya se
+ * hayan concedido, y después canal_recibir_credito devuelve -1 sin bloquearse.
+ * @param c: Canal.
+ */
+void canal_terminar_creditos(struct canal * c){
+    terminar(&c->creditos, &c->dormidos_creditos);
+}
+
+/*
+ * Función que devuelve el hueco del anillo en el que el productor debe escribir el próximo item. Solo es válida
+ * después de haber recibido un crédito. Con LIFO, toma un hueco de la lista de libres (el crédito garantiza que hay
+ * alguno), así que debe llamarse una sola vez antes de cada canal_enviar.
+ * @param c: Canal.
+ * @return: Puntero al hueco (tam_hueco bytes).
+ */
+void * canal_hueco_envio(struct canal * c){
+    if (c->orden == CANAL_FIFO) return c->huecos + (c->escritos % c->capacidad) * c->tam_hueco;
+
+    bloquear(c);
+    c->hueco_envio = libres(c)[--c->num_libres];
+    desbloquear(c);
+    return c->huecos + (size_t) c->hueco_envio * c->tam_hueco;
+}
+
+/*
+ * Función que publica el item que el productor ha escrito en el hueco de envío y avisa al consumidor si estaba
+ * esperando. La operación atómica sobre items ordena la escritura del hueco antes de su lectura por el consumidor.
+ * Con LIFO, el hueco se apila antes de avisar.
+ * @param c: Canal.
+ */
+void canal_enviar(struct canal * c){
+    if (c->orden == CANAL_LIFO){
+        bloquear(c);
+        pila(c)[c->cima++] = c->hueco_envio;
+        desbloquear(c);
+    }
+    c->escritos++;
+    subir(&c->items, &c->dormidos_items, 1);
+}
+
+/*
+ * Función con la que el consumidor espera al siguiente item. El item no se copia: se lee directamente en el hueco
+ * devuelto hasta llamar a canal_liberar. Con LIFO, se desapila el último hueco publicado.
+ * @param c: Canal.
+ * @return: Puntero al hueco que contiene el item, o NULL si no quedan items y el productor ya no enviará más.
+ */
+void * canal_recibir(struct canal * c){
+    if (bajar(&c->items, &c->dormidos_items) == -1) return NULL;
+    if (c->orden == CANAL_FIFO) return c->huecos + (c->leidos % c->capacidad) * c->tam_hueco;
+
+    bloquear(c);
+    c->hueco_recepcion = pila(c)[--c->cima];
+    desbloquear(c);
+    return c->huecos + (size_t) c->hueco_recepcion * c->tam_hueco;
+}
+
+/*
+ * Función con la que el productor indica que no enviará más items. El consumidor recibe los que queden en el canal, y
+ * después canal_recibir devuelve NULL sin bloquearse.
+ * @param c: Canal.
+ */
+void canal_terminar_envios(struct canal * c){
+    terminar(&c->items, &c->dormidos_items);
+}
+
+/*
+ * Función que indica que el consumidor ha terminado de leer el último item recibido. El hueco no vuelve a estar
+ * disponible para el productor hasta que el consumidor le envíe el crédito correspondiente. Con LIFO, el hueco vuelve
+ * a la lista de libres.
+ * @param c: Canal.
+ */
+void canal_liberar(struct canal * c){
+    if (c->orden == CANAL_LIFO){
+        bloquear(c);
+        libres(c)[c->num_libres++] = c->hueco_recepcion;
+        desbloquear(c);
+    }
+    c->leidos++;
+}
+
+/*
+ * Función que devuelve el número de créditos pendientes de leer por el productor, sin llamadas al sistema.
+ * @param c: Canal.
+ * @return: Créditos pendientes.
+ */
+long canal_creditos(struct canal * c){
+    return atomic_load_explicit(&c->creditos, memory_order_relaxed) & ~CANAL_TERMINADO;
+}
+
+/*
+ * Función que devuelve el número de items pendientes de leer por el consumidor, sin llamadas al sistema.
+ * @param c: Canal.
+ * @return: Items pendientes.
+ */
+long canal_items(struct canal * c){
+    return atomic_load_explicit(&c->items, memory_order_relaxed) & ~CANAL_TERMINADO;
+}
@@ -0,0 +1,110 @@
+#ifndef CANAL_H
+#define CANAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include "cache.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Canal de memoria compartida
+ *
+ * Alternativa a las colas de mensajes POSIX para la práctica 4. El canal es un anillo de huecos de tamaño fijo en un
+ * objeto de memoria compartida (shm_open y mmap) que abren tanto el productor como el consumidor. Se mantiene el
+ * protocolo de órdenes de la práctica: el consumidor concede créditos (uno por cada hueco libre) y el productor
+ * consume uno antes de enviar cada item. Pero los créditos y los items pendientes son contadores atómicos en la
+ * propia memoria compartida, y los mensajes no se copian: el productor escribe el item directamente en su hueco del
+ * anillo y el consumidor lo lee allí mismo.
+ *
+ * Los procesos solo hacen llamadas al sistema cuando tienen que bloquearse (contador a 0) o despertar al otro: cada
+ * contador es también una palabra futex compartida entre procesos, y junto a él se lleva la cuenta de los procesos
+ * dormidos en ella para no llamar a FUTEX_WAKE si no hay nadie esperando.
+ *
+ * Hay un único productor y un único consumidor por canal: cada uno avanza su propio índice del anillo.
+ *
+ * El consumidor puede arrancar a la vez que el productor: canal_abrir reintenta mientras el objeto no exista o aún no
+ * tenga su tamaño, y después espera (en el futex de la palabra listo) a que canal_crear haya escrito la cabecera, de
+ * modo que nunca lee una capacidad o un tamaño de hueco a 0.
+ *
+ * Con el orden CANAL_LIFO, el canal es una pila en lugar de un anillo: el consumidor recibe siempre el último item
+ * publicado, sin necesidad de prioridades. Los huecos no se reutilizan en orden, así que se lleva una lista de huecos
+ * libres y una pila con los huecos publicados (sus índices). Ambas las modifican los dos procesos, por lo que se
+ * protegen con un cerrojo de espera activa que solo se retiene para mover un índice; los items se siguen escribiendo
+ * y leyendo en su hueco sin copias, y el contador de items hace de timbre para despertar al consumidor.
+ *
+ * Para terminar, el productor llama a canal_terminar_envios tras publicar su último item: el consumidor sigue
+ * recibiendo los que queden y, cuando no hay más, canal_recibir devuelve NULL en lugar de bloquearse. Del mismo modo,
+ * el consumidor llama a canal_terminar_creditos tras conceder el último crédito, y canal_recibir_credito devuelve -1
+ * una vez agotados. Así ninguno de los dos necesita saber cuántos items se van a enviar. La terminación es un bit
+ * (CANAL_TERMINADO) del propio contador, de modo que despierta a quien duerma en su futex sin que se pueda perder.
+ */
+
+
+#define CANAL_FIFO 0                // Los items se reciben en el orden en que se publicaron (anillo)
+#define CANAL_LIFO 1                // Se recibe siempre el último item publicado (pila)
+
+#define CANAL_TERMINADO 0x80000000u // Bit de un contador que indica que ya no se añadirán más unidades
+
+
+struct canal {
+    // Configuración (solo la escribe canal_crear)
+    CACHE_ALINEADO uint32_t capacidad;              // Número de huecos del anillo
+    uint32_t tam_hueco;                             // Tamaño en bytes de cada hueco
+    uint32_t orden;                                 // CANAL_FIFO o CANAL_LIFO
+    size_t tam_region;                              // Tamaño total del objeto de memoria compartida
+    _Atomic uint32_t listo;                         // Pasa a 1 cuando la cabecera está completa (palabra futex)
+    // Campos compartidos, cada grupo en su línea
+    CACHE_ALINEADO _Atomic uint32_t creditos;       // Órdenes pendientes de leer por el productor
+    atomic_int dormidos_creditos;                   // Procesos esperando un crédito
+    CACHE_ALINEADO _Atomic uint32_t items;          // Items pendientes de leer por el consumidor
+    atomic_int dormidos_items;                      // Procesos esperando un item
+    CACHE_ALINEADO atomic_int cerrojo;              // Protege la pila y los huecos libres (solo LIFO)
+    uint32_t cima;                                  // Huecos publicados en la pila (solo LIFO)
+    uint32_t num_libres;                            // Huecos libres (solo LIFO)
+    // Campos del productor
+    CACHE_ALINEADO uint64_t escritos;               // Items enviados (solo el productor)
+    uint32_t hueco_envio;                           // Hueco del próximo envío (solo el productor, LIFO)
+    // Campos del consumidor
+    CACHE_ALINEADO uint64_t leidos;                 // Items recibidos (solo el consumidor)
+    uint32_t hueco_recepcion;                       // Hueco del último item recibido (solo LIFO)
+    CACHE_ALINEADO char huecos[];                   // capacidad * tam_hueco bytes (con LIFO, seguidos de la pila y
+                                                    // de los libres, capacidad índices cada una)
+};
+
+
+// Función que crea (borrando el anterior, si existía) y proyecta un canal con nombre
+struct canal * canal_crear(const char * nombre, uint32_t capacidad, size_t tam_hueco, int orden);
+// Función que abre y proyecta un canal creado por otro proceso, esperando a que esté listo
+struct canal * canal_abrir(const char * nombre);
+// Función que deshace la proyección del canal (el objeto de memoria compartida sigue existiendo)
+void canal_cerrar(struct canal * c);
+// Función que borra el objeto de memoria compartida de un canal
+void canal_borrar(const char * nombre);
+
+// Función con la que el consumidor concede n créditos al productor
+void canal_enviar_creditos(struct canal * c, uint32_t n);
+// Función con la que el productor espera y consume un crédito (-1 si el consumidor ya no concederá más)
+int canal_recibir_credito(struct canal * c);
+// Función con la que el consumidor indica que no concederá más créditos
+void canal_terminar_creditos(struct canal * c);
+
+// Función que devuelve el hueco en el que el productor debe escribir el próximo item
+void * canal_hueco_envio(struct canal * c);
+// Función que publica el item escrito en el hueco de envío
+void canal_enviar(struct canal * c);
+// Función que espera un item y devuelve el hueco en el que el consumidor puede leerlo (NULL si no llegarán más)
+void * canal_recibir(struct canal * c);
+// Función con la que el productor indica que no enviará más items
+void canal_terminar_envios(struct canal * c);
+// Función que indica que el consumidor ha terminado de leer el último item recibido
+void canal_liberar(struct canal * c);
+
+// Función que devuelve el número de créditos pendientes
+long canal_creditos(struct canal * c);
+// Función que devuelve el número de items pendientes
+long canal_items(struct canal * c);
+
+#endif
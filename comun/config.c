@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "config.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Configuración en tiempo de ejecución
+ *
+ * Implementación de la configuración descrita en config.h.
+ */
+
+
+#define CONFIG_PREFIJO_ENTORNO "SOII_"      // Prefijo de las variables de entorno
+#define CONFIG_TAM_VARIABLE 64              // Tamaño máximo del nombre de una variable de entorno
+
+
+// Función que devuelve el valor actual de un parámetro, sea cual sea su tipo
+static long leer(struct config_param * p){
+    switch (p->tipo){
+        case CONFIG_INT:
+            return *(int *) p->valor;
+        case CONFIG_SIZE:
+            return (long) *(size_t *) p->valor;
+        default:
+            return *(long *) p->valor;
+    }
+}
+
+/*
+ * Función que convierte el texto a número, comprueba que esté dentro del rango del parámetro y lo guarda en su
+ * variable. Si el valor no es válido, el programa termina con un mensaje de error.
+ * @param p: Parámetro.
+ * @param texto: Valor en forma de texto.
+ * @param origen: Opción o variable de entorno de la que procede el valor (para el mensaje de error).
+ */
+static void asignar(struct config_param * p, const char * texto, const char * origen){
+    char * fin;
+    long valor;
+
+    errno = 0;
+    valor = strtol(texto, &fin, 10);
+    if (errno || fin == texto || *fin != '\0' || valor < p->minimo || valor > p->maximo){
+        fprintf(stderr, "Error: valor no válido para %s (\"%s\"): debe ser un entero entre %ld y %ld\n", origen, texto,
+                p->minimo, p->maximo);
+        exit(EXIT_FAILURE);
+    }
+
+    switch (p->tipo){
+        case CONFIG_INT:
+            *(int *) p->valor = (int) valor;
+            break;
+        case CONFIG_SIZE:
+            *(size_t *) p->valor = (size_t) valor;
+            break;
+        default:
+            *(long *) p->valor = valor;
+    }
+    p->fijado = 1;
+}
+
+// Función que busca un parámetro por los primeros longitud caracteres de su nombre (NULL si no existe)
+static struct config_param * buscar(struct config_param params[], int num_params, const char * nombre,
+                                    size_t longitud){
+    int i;
+
+    for (i = 0; i < num_params; i++)
+        if (strlen(params[i].nombre) == longitud && !strncmp(params[i].nombre, nombre, longitud)) return &params[i];
+    return NULL;
+}
+
+/*
+ * Función que lee los parámetros, primero de las variables de entorno y después de la línea de comandos (que
+ * prevalece). Las opciones largas reconocidas se retiran de argv, que queda listo para getopt; el resto de argumentos
+ * se conserva en el mismo orden. Detrás de "--" no se busca ninguna opción.
+ * Si un valor no es válido o una opción larga no corresponde a ningún parámetro, el programa termina con un error.
+ * @param params: Tabla de parámetros del programa.
+ * @param num_params: Número de parámetros de la tabla.
+ * @param argc: Puntero al número de argumentos (se actualiza).
+ * @param argv: Argumentos del programa (se retiran las opciones largas).
+ */
+void config_cargar(struct config_param params[], int num_params, int * argc, char * argv[]){
+    char variable[CONFIG_TAM_VARIABLE];     // Nombre de la variable de entorno de un parámetro
+    const char * texto;                     // Valor de un parámetro en forma de texto
+    const char * igual;                     // Posición del '=' en una opción --nombre=valor
+    struct config_param * p;
+    size_t longitud;
+    int i, j, k;
+
+    // Valores de las variables de entorno: SOII_ seguido del nombre en mayúsculas
+    for (i = 0; i < num_params; i++){
+        snprintf(variable, sizeof(variable), "%s%s", CONFIG_PREFIJO_ENTORNO, params[i].nombre);
+        for (k = 0; variable[k]; k++) variable[k] = toupper((unsigned char) variable[k]);
+        if ((texto = getenv(variable)) != NULL) asignar(&params[i], texto, variable);
+    }
+
+    // Opciones largas de la línea de comandos. j es la posición en la que se copia el siguiente argumento que se
+    // conserva
+    for (i = 1, j = 1; i < *argc; i++){
+        if (!strcmp(argv[i], "--")){                    // Fin de las opciones: se conserva el resto tal cual
+            while (i < *argc) argv[j++] = argv[i++];
+            break;
+        }
+        if (strncmp(argv[i], "--", 2)){                 // No es una opción larga
+            argv[j++] = argv[i];
+            continue;
+        }
+        if (!strcmp(argv[i], "--ayuda")){
+            config_imprimir(params, num_params, stdout);
+            exit(EXIT_SUCCESS);
+        }
+
+        igual = strchr(argv[i] + 2, '=');
+        longitud = igual? (size_t) (igual - (argv[i] + 2)) : strlen(argv[i] + 2);
+        if ((p = buscar(params, num_params, argv[i] + 2, longitud)) == NULL){
+            fprintf(stderr, "Error: parámetro desconocido %.*s (--ayuda muestra los disponibles)\n",
+                    (int) longitud + 2, argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        if (igual) texto = igual + 1;
+        else if (i + 1 < *argc) texto = argv[++i];      // --nombre valor
+        else {
+            fprintf(stderr, "Error: falta el valor de %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        asignar(p, texto, p->nombre);
+    }
+    argv[j] = NULL;
+    *argc = j;
+}
+
+/*
+ * Función que indica si un parámetro se ha fijado en la línea de comandos o en el entorno. Sirve, por ejemplo, para
+ * que el modo rendimiento solo cambie los valores por defecto.
+ * @param params: Tabla de parámetros del programa.
+ * @param num_params: Número de parámetros de la tabla.
+ * @param nombre: Nombre del parámetro.
+ * @return: !0 si el parámetro se ha fijado; 0 si conserva su valor por defecto o no existe.
+ */
+int config_fijado(struct config_param params[], int num_params, const char * nombre){
+    struct config_param * p = buscar(params, num_params, nombre, strlen(nombre));
+
+    return p != NULL && p->fijado;
+}
+
+/*
+ * Función que imprime los parámetros, con su valor actual, su rango y su descripción.
+ * @param params: Tabla de parámetros del programa.
+ * @param num_params: Número de parámetros de la tabla.
+ * @param f: Flujo en el que se imprimen.
+ */
+void config_imprimir(struct config_param params[], int num_params, FILE * f){
+    int i;
+
+    fprintf(f, "Parámetros (--nombre=valor, o variable de entorno %sNOMBRE):\n", CONFIG_PREFIJO_ENTORNO);
+    for (i = 0; i < num_params; i++)
+        fprintf(f, "  --%-16s %-10ld [%ld, %ld]  %s\n", params[i].nombre, leer(&params[i]), params[i].minimo,
+                params[i].maximo, params[i].descripcion);
+}
@@ -0,0 +1,52 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdio.h>
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Configuración en tiempo de ejecución
+ *
+ * Parámetros de ejecución (capacidad del buffer, número de hilos o procesos, número y tamaño de los items, esperas)
+ * que antes eran constantes de compilación. Cada programa describe los suyos en una tabla: el nombre, la variable en
+ * la que se guarda (inicializada con el valor por defecto, el #define de siempre), su tipo y el rango admitido.
+ *
+ * El valor de cada parámetro se toma, de mayor a menor prioridad:
+ *  1. De la línea de comandos, como --nombre=valor o --nombre valor.
+ *  2. De la variable de entorno SOII_NOMBRE (el nombre en mayúsculas), útil para barrer parámetros desde un script.
+ *  3. Del valor por defecto.
+ *
+ * config_cargar retira de argv las opciones largas que reconoce, de modo que cada programa sigue leyendo después sus
+ * opciones cortas con getopt (que, si coinciden con un parámetro, prevalecen). Con --ayuda se imprimen los
+ * parámetros, con sus valores actuales, y el programa termina.
+ */
+
+
+#define CONFIG_INT 0                // El parámetro se guarda en un int
+#define CONFIG_LONG 1               // El parámetro se guarda en un long
+#define CONFIG_SIZE 2               // El parámetro se guarda en un size_t
+
+#define CONFIG_MAX_CAPACIDAD 1048576    // Capacidad máxima de un buffer (parámetro capacidad)
+#define CONFIG_MAX_TAM_ELEM 1048576     // Tamaño máximo de un item (parámetro tam_elem)
+
+
+struct config_param {
+    const char * nombre;            // Nombre del parámetro (--nombre, SOII_NOMBRE)
+    void * valor;                   // Variable en la que se guarda, con el valor por defecto
+    int tipo;                       // CONFIG_INT, CONFIG_LONG o CONFIG_SIZE
+    long minimo;                    // Valor mínimo admitido
+    long maximo;                    // Valor máximo admitido
+    const char * descripcion;       // Descripción para --ayuda
+    int fijado;                     // !0 si se ha indicado en la línea de comandos o en el entorno
+};
+
+
+// Función que lee los parámetros del entorno y de la línea de comandos, retirando de argv las opciones largas
+void config_cargar(struct config_param params[], int num_params, int * argc, char * argv[]);
+// Función que indica si un parámetro se ha fijado en la ejecución (y no tiene, por tanto, su valor por defecto)
+int config_fijado(struct config_param params[], int num_params, const char * nombre);
+// Función que imprime los parámetros con sus valores actuales
+void config_imprimir(struct config_param params[], int num_params, FILE * f);
+
+#endif
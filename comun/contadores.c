@@ -0,0 +1,346 @@
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "contadores.h"
+#include "medidas.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Contadores de instrumentación
+ *
+ * Implementación de los contadores descritos en contadores.h.
+ */
+
+
+#define TAM_SALIDA 4096                 // Bytes que se acumulan antes de cada write del volcado
+
+// Texto del volcado pendiente de escribir. Se construye a mano (sin printf), para poder volcar desde un manejador
+struct salida {
+    int fd;                             // Descriptor en el que se escribe
+    size_t n;                           // Bytes pendientes
+    char datos[TAM_SALIDA];             // Texto pendiente
+};
+
+static const char * nombres_tiempos[CONTADORES_NUM_TIEMPOS] = {"cerrojo", "espera", "seccion"};
+
+static struct contadores * contadores_senalados = NULL;    // Contadores que se vuelcan al recibir SIGUSR2
+
+
+// Función que calcula el tamaño en bytes de los contadores de max_hilos hilos
+static size_t tam_contadores(int max_hilos){
+    return sizeof(struct contadores) + (size_t) max_hilos * sizeof(struct contadores_hilo);
+}
+
+// Función que suma v a un contador que solo escribe el hilo que lo llama (sin instrucciones con lock)
+static void sumar(_Atomic uint64_t * contador, uint64_t v){
+    atomic_store_explicit(contador, atomic_load_explicit(contador, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+// Función que devuelve la cubeta de un valor: el propio valor si es pequeño y, si no, su potencia de 2 (por encima
+// de las CONTADORES_BITS_SUB primeras) y los CONTADORES_BITS_SUB bits que siguen al más significativo
+static int cubeta(uint64_t v){
+    int e;                              // Posición del bit más significativo
+
+    if (v < 2 * CONTADORES_SUBCUBETAS) return (int) v;
+    e = 63 - __builtin_clzll(v);
+    return (e - CONTADORES_BITS_SUB) * CONTADORES_SUBCUBETAS + (int) (v >> (e - CONTADORES_BITS_SUB));
+}
+
+// Función que devuelve el menor valor de una cubeta (la inversa de la función anterior)
+static uint64_t limite_cubeta(int i){
+    int desplazamiento = i / CONTADORES_SUBCUBETAS - 1;     // Bits descartados de los valores de la cubeta
+
+    if (i < 2 * CONTADORES_SUBCUBETAS) return (uint64_t) i;
+    return ((uint64_t) (i % CONTADORES_SUBCUBETAS + CONTADORES_SUBCUBETAS)) << desplazamiento;
+}
+
+// Función que escribe el texto pendiente de la salida
+static void vaciar(struct salida * s){
+    size_t hecho = 0;                   // Bytes ya escritos
+    ssize_t r;                          // Resultado de cada write
+
+    while (hecho < s->n){
+        if ((r = write(s->fd, s->datos + hecho, s->n - hecho)) == -1 && errno == EINTR) continue;
+        if (r <= 0) break;              // Si no se puede escribir, el resto del volcado se pierde
+        hecho += (size_t) r;
+    }
+    s->n = 0;
+}
+
+// Función que añade una cadena a la salida
+static void escribir(struct salida * s, const char * texto){
+    for (; *texto; texto++){
+        if (s->n == TAM_SALIDA) vaciar(s);
+        s->datos[s->n++] = *texto;
+    }
+}
+
+// Función que añade un entero sin signo, en decimal, a la salida
+static void escribir_numero(struct salida * s, uint64_t v){
+    char cifras[21];                    // Cifras del número, de atrás hacia delante
+    int i = sizeof(cifras) - 1;         // Posición de la siguiente cifra
+
+    cifras[i] = '\0';
+    do cifras[--i] = '0' + v % 10; while ((v /= 10) > 0);
+    escribir(s, cifras + i);
+}
+
+// Función que añade un campo numérico de un objeto JSON ("nombre":valor) a la salida
+static void escribir_campo(struct salida * s, const char * nombre, uint64_t v){
+    escribir(s, "\"");
+    escribir(s, nombre);
+    escribir(s, "\":");
+    escribir_numero(s, v);
+}
+
+/*
+ * Función que devuelve el percentil q de un histograma: el mayor valor de la cubeta en la que se alcanzan las q * n
+ * primeras muestras (sin pasar del máximo registrado).
+ * @param h: Histograma.
+ * @param n: Número de muestras del histograma.
+ * @param q: Percentil, entre 0 y 1.
+ * @return: Percentil en nanosegundos (0 si no hay muestras).
+ */
+static uint64_t percentil(struct contadores_histograma * h, uint64_t n, double q){
+    uint64_t objetivo = (uint64_t) (q * n) + 1;   // Número de muestras hasta el percentil
+    uint64_t acumuladas = 0;                       // Muestras de las cubetas ya recorridas
+    uint64_t maximo = atomic_load_explicit(&h->maximo, memory_order_relaxed);
+    int i;
+
+    if (objetivo > n) objetivo = n;
+    for (i = 0; i < CONTADORES_CUBETAS - 1 && n > 0; i++)
+        if ((acumuladas += atomic_load_explicit(&h->cubetas[i], memory_order_relaxed)) >= objetivo)
+            return limite_cubeta(i + 1) - 1 < maximo? limite_cubeta(i + 1) - 1 : maximo;
+    return maximo;
+}
+
+// Función que añade un histograma a la salida, como objeto JSON con su resumen y sus cubetas no vacías
+static void escribir_histograma(struct salida * s, const char * nombre, struct contadores_histograma * h){
+    uint64_t n = atomic_load_explicit(&h->n, memory_order_relaxed);            // Muestras
+    uint64_t total = atomic_load_explicit(&h->total, memory_order_relaxed);    // Suma de las muestras
+    uint64_t cuenta;                    // Muestras de una cubeta
+    int primera = 1;                    // !0 hasta escribir la primera cubeta
+    int i;
+
+    escribir(s, "\"");
+    escribir(s, nombre);
+    escribir(s, "\":{");
+    escribir_campo(s, "n", n);
+    escribir(s, ",");
+    escribir_campo(s, "total_ns", total);
+    escribir(s, ",");
+    escribir_campo(s, "medio_ns", n? total / n : 0);
+    escribir(s, ",");
+    escribir_campo(s, "p50_ns", percentil(h, n, 0.5));
+    escribir(s, ",");
+    escribir_campo(s, "p99_ns", percentil(h, n, 0.99));
+    escribir(s, ",");
+    escribir_campo(s, "p999_ns", percentil(h, n, 0.999));
+    escribir(s, ",");
+    escribir_campo(s, "max_ns", atomic_load_explicit(&h->maximo, memory_order_relaxed));
+    // Cada cubeta no vacía se escribe como [menor valor en ns, muestras]
+    escribir(s, ",\"cubetas\":[");
+    for (i = 0; i < CONTADORES_CUBETAS; i++){
+        if ((cuenta = atomic_load_explicit(&h->cubetas[i], memory_order_relaxed)) == 0) continue;
+        escribir(s, primera? "[" : ",[");
+        escribir_numero(s, limite_cubeta(i));
+        escribir(s, ",");
+        escribir_numero(s, cuenta);
+        escribir(s, "]");
+        primera = 0;
+    }
+    escribir(s, "]}");
+}
+
+// Manejador de SIGUSR2: vuelca los contadores en la salida de errores, conservando errno para el código interrumpido
+static void manejador_volcado(int senal){
+    int errno_previo = errno;           // errno del código interrumpido
+
+    (void) senal;
+    if (contadores_senalados != NULL) contadores_volcar(contadores_senalados, STDERR_FILENO);
+    errno = errno_previo;
+}
+
+
+/*
+ * Función que reserva los contadores en una región compartida y anónima, de forma que los procesos creados después
+ * con fork escriben en la misma memoria que el padre.
+ * @param programa: Nombre del programa (debe seguir existiendo mientras se usen los contadores).
+ * @param max_hilos: Número máximo de hilos o procesos con entrada propia.
+ * @return: Puntero a los contadores, o NULL si mmap falla (errno indica el motivo).
+ */
+struct contadores * contadores_crear(const char * programa, int max_hilos){
+    struct contadores * c;
+
+    if ((c = mmap(NULL, tam_contadores(max_hilos), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1,
+                  (off_t) 0)) == MAP_FAILED)
+        return NULL;
+
+    // mmap devuelve la región inicializada a 0, así que basta con fijar el programa y el tamaño
+    c->programa = programa;
+    c->max_hilos = max_hilos;
+    atomic_init(&c->num_hilos, 0);
+    return c;
+}
+
+/*
+ * Función que libera la región reservada por contadores_crear. Si se volcaban al recibir SIGUSR2, se deja de hacerlo.
+ * @param c: Contadores.
+ */
+void contadores_destruir(struct contadores * c){
+    if (c == contadores_senalados){
+        signal(SIGUSR2, SIG_IGN);
+        contadores_senalados = NULL;
+    }
+    munmap(c, tam_contadores(c->max_hilos));
+}
+
+/*
+ * Función que instala un manejador de SIGUSR2 que vuelca los contadores en la salida de errores, para poder
+ * consultarlos mientras el programa se ejecuta (kill -USR2 pid). Se usa SA_RESTART para que la señal no interrumpa
+ * las llamadas bloqueantes que se pueden reanudar (mq_receive, waitpid...). Solo un objeto de contadores por proceso
+ * puede volcarse así.
+ * @param c: Contadores.
+ * @return: 0 si todo va bien, -1 si sigaction falla (errno indica el motivo).
+ */
+int contadores_senal(struct contadores * c){
+    struct sigaction accion;            // Nueva acción de SIGUSR2
+
+    memset(&accion, 0, sizeof(accion));
+    accion.sa_handler = manejador_volcado;
+    accion.sa_flags = SA_RESTART;
+    sigemptyset(&accion.sa_mask);
+    contadores_senalados = c;
+    return sigaction(SIGUSR2, &accion, NULL);
+}
+
+/*
+ * Función que reserva la siguiente entrada libre para un hilo o proceso. La llama el propio hilo al comenzar.
+ * @param c: Contadores (NULL si no se usan).
+ * @param rol: Rol del hilo (productor, consumidor...).
+ * @param id: Identificador del hilo dentro de su rol.
+ * @return: Entrada del hilo, o NULL si c es NULL o ya no quedan entradas (en cuyo caso no se cuenta nada).
+ */
+struct contadores_hilo * contadores_hilo(struct contadores * c, const char * rol, int id){
+    struct contadores_hilo * h;
+    int i;
+
+    if (c == NULL || (i = atomic_fetch_add(&c->num_hilos, 1)) >= c->max_hilos) return NULL;
+    h = &c->hilos[i];
+    strncpy(h->rol, rol, CONTADORES_TAM_ROL - 1);
+    h->id = id;
+    return h;
+}
+
+/*
+ * Función que toma el instante de comienzo de una medida de tiempo.
+ * @param h: Entrada del hilo (NULL si no se usan los contadores).
+ * @return: Instante actual en nanosegundos, o 0 si h es NULL.
+ */
+uint64_t contadores_inicio(struct contadores_hilo * h){
+    return h == NULL? 0 : medidas_ns();
+}
+
+/*
+ * Función que registra en uno de los histogramas del hilo el tiempo transcurrido desde un instante. Devuelve el
+ * instante actual, de modo que sirve como comienzo de la siguiente medida (por ejemplo, al adquirir el cerrojo
+ * termina su espera y comienza la región crítica).
+ * @param h: Entrada del hilo (NULL si no se usan los contadores).
+ * @param tipo: CONTADORES_CERROJO, CONTADORES_ESPERA o CONTADORES_SECCION.
+ * @param inicio: Instante de comienzo, devuelto por contadores_inicio o contadores_tiempo.
+ * @return: Instante actual en nanosegundos, o 0 si h es NULL.
+ */
+uint64_t contadores_tiempo(struct contadores_hilo * h, int tipo, uint64_t inicio){
+    struct contadores_histograma * hist;
+    uint64_t ahora, t;
+
+    if (h == NULL) return 0;
+    hist = &h->tiempos[tipo];
+    ahora = medidas_ns();
+    t = ahora > inicio? ahora - inicio : 0;
+    sumar(&hist->n, 1);
+    sumar(&hist->total, t);
+    sumar(&hist->cubetas[cubeta(t)], 1);
+    if (t > atomic_load_explicit(&hist->maximo, memory_order_relaxed))
+        atomic_store_explicit(&hist->maximo, t, memory_order_relaxed);
+    return ahora;
+}
+
+/*
+ * Función que suma items procesados por el hilo.
+ * @param h: Entrada del hilo (NULL si no se usan los contadores).
+ * @param n: Número de items.
+ */
+void contadores_items(struct contadores_hilo * h, long n){
+    if (h != NULL) sumar(&h->items, (uint64_t) n);
+}
+
+/*
+ * Función que anota que el hilo ha encontrado el buffer lleno y va a esperar.
+ * @param h: Entrada del hilo (NULL si no se usan los contadores).
+ */
+void contadores_lleno(struct contadores_hilo * h){
+    if (h != NULL) sumar(&h->llenos, 1);
+}
+
+/*
+ * Función que anota que el hilo ha encontrado el buffer vacío y va a esperar.
+ * @param h: Entrada del hilo (NULL si no se usan los contadores).
+ */
+void contadores_vacio(struct contadores_hilo * h){
+    if (h != NULL) sumar(&h->vacios, 1);
+}
+
+/*
+ * Función que escribe en JSON, en una sola línea por hilo, los contadores de todas las entradas ocupadas:
+ *
+ *  {"programa":"p3_1","pid":1234,"hilos":[
+ *   {"rol":"productor","id":0,"items":20,"llenos":3,"vacios":0,"cerrojo":{...},"espera":{...},"seccion":{...}},
+ *   ...]}
+ *
+ * Cada histograma incluye n, total_ns, medio_ns, p50_ns, p99_ns, p999_ns, max_ns y sus cubetas no vacías. Solo usa
+ * write, así que puede llamarse desde un manejador de señales mientras los hilos siguen contando (cada campo se lee
+ * de forma atómica, aunque los de un mismo hilo pueden corresponder a instantes ligeramente distintos).
+ * @param c: Contadores (si es NULL, no se escribe nada).
+ * @param fd: Descriptor de fichero (por ejemplo, STDERR_FILENO).
+ */
+void contadores_volcar(struct contadores * c, int fd){
+    struct salida s;                    // Texto pendiente de escribir
+    struct contadores_hilo * h;
+    int n, i, j;
+
+    if (c == NULL) return;
+    s.fd = fd;
+    s.n = 0;
+    n = atomic_load(&c->num_hilos);
+    if (n > c->max_hilos) n = c->max_hilos;
+
+    escribir(&s, "{\"programa\":\"");
+    escribir(&s, c->programa);
+    escribir(&s, "\",");
+    escribir_campo(&s, "pid", (uint64_t) getpid());
+    escribir(&s, ",\"hilos\":[");
+    for (i = 0; i < n; i++){
+        h = &c->hilos[i];
+        escribir(&s, i? ",\n {\"rol\":\"" : "\n {\"rol\":\"");
+        escribir(&s, h->rol);
+        escribir(&s, "\",");
+        escribir_campo(&s, "id", (uint64_t) h->id);
+        escribir(&s, ",");
+        escribir_campo(&s, "items", atomic_load_explicit(&h->items, memory_order_relaxed));
+        escribir(&s, ",");
+        escribir_campo(&s, "llenos", atomic_load_explicit(&h->llenos, memory_order_relaxed));
+        escribir(&s, ",");
+        escribir_campo(&s, "vacios", atomic_load_explicit(&h->vacios, memory_order_relaxed));
+        for (j = 0; j < CONTADORES_NUM_TIEMPOS; j++){
+            escribir(&s, ",");
+            escribir_histograma(&s, nombres_tiempos[j], &h->tiempos[j]);
+        }
+        escribir(&s, "}");
+    }
+    escribir(&s, "]}\n");
+    vaciar(&s);
+}
@@ -0,0 +1,95 @@
+#ifndef CONTADORES_H
+#define CONTADORES_H
+
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include "cache.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Contadores de instrumentación
+ *
+ * Contadores por hilo (o por proceso) del camino crítico de los programas: dónde se va el tiempo cuando el buffer
+ * está lleno o vacío, o cuando hay muchos hilos compitiendo por el mismo cerrojo. De cada hilo se registran:
+ *  - Tres histogramas de tiempos: la espera para adquirir el cerrojo (pthread_mutex_lock, sem_wait sobre el mutex),
+ *    la espera por una condición (pthread_cond_wait, sem_wait sobre huecos o items, mq_receive) y el tiempo que se
+ *    pasa dentro de la región crítica.
+ *  - Las veces que encontró el buffer lleno o vacío y tuvo que esperar, y los items que procesó.
+ *
+ * Los histogramas son de tipo HDR (log-lineales): cada potencia de 2 se divide en CONTADORES_SUBCUBETAS cubetas
+ * iguales, de modo que el error relativo de cualquier valor, desde 1 ns hasta varios siglos, es como mucho de 1/8.
+ * Registrar una muestra es sumar 1 a una cubeta, sin reservar memoria ni ordenar nada.
+ *
+ * Cada hilo escribe solo en su propia entrada, que ocupa sus propias líneas de caché, así que no hay contención entre
+ * hilos. Los campos son atómicos, pero su único escritor los actualiza con lecturas y escrituras relaxed (sin
+ * instrucciones con lock), y así el volcado puede leerlos en cualquier momento.
+ *
+ * La estructura se reserva con mmap compartido y anónimo, como las medidas, así que sirve también para procesos creados
+ * con fork después de contadores_crear. Los contadores se vuelcan en JSON al acabar y, si se ha llamado a
+ * contadores_senal, cada vez que el proceso recibe SIGUSR2 (el volcado solo usa write, que se puede llamar desde un
+ * manejador de señales).
+ * Si un programa no los activa, trabaja con punteros NULL y cada llamada se reduce a una comprobación.
+ */
+
+
+#define CONTADORES_CERROJO 0            // Espera para adquirir el cerrojo de la región crítica
+#define CONTADORES_ESPERA 1             // Espera por una condición (buffer lleno o vacío, mensaje...)
+#define CONTADORES_SECCION 2            // Tiempo dentro de la región crítica
+#define CONTADORES_NUM_TIEMPOS 3        // Número de histogramas de tiempos de cada hilo
+
+#define CONTADORES_BITS_SUB 3                               // Bits de la mantisa de cada cubeta
+#define CONTADORES_SUBCUBETAS (1 << CONTADORES_BITS_SUB)    // Cubetas en que se divide cada potencia de 2
+#define CONTADORES_CUBETAS ((64 - CONTADORES_BITS_SUB + 1) * CONTADORES_SUBCUBETAS)    // Cubetas de un histograma
+#define CONTADORES_TAM_ROL 16           // Bytes del rol de cada hilo (productor, consumidor...)
+
+
+struct contadores_histograma {
+    _Atomic uint64_t n;                 // Número de muestras
+    _Atomic uint64_t total;             // Suma de las muestras, en nanosegundos
+    _Atomic uint64_t maximo;            // Mayor muestra
+    _Atomic uint64_t cubetas[CONTADORES_CUBETAS];   // Muestras de cada cubeta
+};
+
+struct contadores_hilo {
+    CACHE_ALINEADO char rol[CONTADORES_TAM_ROL];    // Rol del hilo (cada entrada, en sus propias líneas)
+    int id;                             // Identificador del hilo dentro de su rol
+    _Atomic uint64_t items;             // Items procesados
+    _Atomic uint64_t llenos;            // Veces que ha encontrado el buffer lleno
+    _Atomic uint64_t vacios;            // Veces que ha encontrado el buffer vacío
+    struct contadores_histograma tiempos[CONTADORES_NUM_TIEMPOS];
+};
+
+struct contadores {
+    const char * programa;              // Nombre del programa (para el volcado)
+    int max_hilos;                      // Número máximo de entradas
+    atomic_int num_hilos;               // Entradas ocupadas
+    struct contadores_hilo hilos[];     // Una entrada por hilo o proceso
+};
+
+
+// Función que reserva los contadores de hasta max_hilos hilos o procesos (NULL en caso de error)
+struct contadores * contadores_crear(const char * programa, int max_hilos);
+// Función que libera los contadores
+void contadores_destruir(struct contadores * c);
+// Función que instala el volcado de los contadores al recibir SIGUSR2 (0 si todo va bien, -1 en caso de error)
+int contadores_senal(struct contadores * c);
+
+// Función que reserva la entrada de un hilo (NULL si los contadores son NULL o no quedan entradas)
+struct contadores_hilo * contadores_hilo(struct contadores * c, const char * rol, int id);
+// Función que devuelve el instante actual en nanosegundos, o 0 si la entrada es NULL (sin llamar al reloj)
+uint64_t contadores_inicio(struct contadores_hilo * h);
+// Función que registra en un histograma el tiempo transcurrido desde inicio y devuelve el instante actual
+uint64_t contadores_tiempo(struct contadores_hilo * h, int tipo, uint64_t inicio);
+// Función que suma n items procesados
+void contadores_items(struct contadores_hilo * h, long n);
+// Función que anota que el hilo ha encontrado el buffer lleno
+void contadores_lleno(struct contadores_hilo * h);
+// Función que anota que el hilo ha encontrado el buffer vacío
+void contadores_vacio(struct contadores_hilo * h);
+
+// Función que escribe los contadores de todos los hilos en JSON en un descriptor de fichero
+void contadores_volcar(struct contadores * c, int fd);
+
+#endif
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "medidas.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Medidas de rendimiento
+ *
+ * Implementación de las medidas descritas en medidas.h.
+ */
+
+
+// Función que calcula el tamaño en bytes de la estructura de medidas
+static size_t tam_medidas(long max_muestras, int num_sellos){
+    return sizeof(struct medidas) + ((size_t) num_sellos + (size_t) max_muestras) * sizeof(uint64_t);
+}
+
+// Función de comparación de latencias para qsort (orden creciente)
+static int comparar_latencias(const void * a, const void * b){
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Función que reserva la estructura de medidas en una región compartida y anónima, de forma que los procesos
+ * creados después con fork escriben en la misma memoria que el padre.
+ * @param max_muestras: Número máximo de latencias a guardar (normalmente, el número total de items).
+ * @param num_sellos: Número de sellos de tiempo disponibles para medidas_sellar y medidas_latencia.
+ * @return: Puntero a la estructura, o NULL si mmap falla (errno indica el motivo).
+ */
+struct medidas * medidas_crear(long max_muestras, int num_sellos){
+    struct medidas * m;
+
+    if ((m = mmap(NULL, tam_medidas(max_muestras, num_sellos), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, (off_t) 0)) == MAP_FAILED)
+        return NULL;
+
+    // mmap devuelve la región inicializada a 0, así que basta con fijar los tamaños
+    m->max_muestras = max_muestras;
+    m->num_sellos = num_sellos;
+    atomic_init(&m->n, 0);
+    return m;
+}
+
+/*
+ * Función que libera la región reservada por medidas_crear.
+ * @param m: Estructura de medidas.
+ */
+void medidas_destruir(struct medidas * m){
+    munmap(m, tam_medidas(m->max_muestras, m->num_sellos));
+}
+
+/*
+ * Función que amplía el número máximo de latencias que se guardan, conservando los sellos y las latencias ya
+ * registradas. La usan quienes no conocen de antemano cuántos items recibirán (por ejemplo, un consumidor que recibe
+ * hasta que el productor cierra). Se reserva una región nueva y se copian los datos, así que solo puede llamarse
+ * mientras nadie más registre latencias, y los procesos creados antes con fork siguen viendo la región anterior.
+ * @param m: Estructura de medidas, que se libera si la ampliación tiene éxito.
+ * @param max_muestras: Nuevo número máximo de latencias a guardar.
+ * @return: Puntero a la estructura ampliada o, si no se puede reservar (o no es mayor), m sin cambios: las latencias
+ *          que no quepan se seguirán descartando.
+ */
+struct medidas * medidas_ampliar(struct medidas * m, long max_muestras){
+    struct medidas * nueva;                 // Estructura ampliada
+    long n = atomic_load(&m->n);            // Número de latencias guardadas
+
+    if (max_muestras <= m->max_muestras || (nueva = medidas_crear(max_muestras, m->num_sellos)) == NULL) return m;
+
+    if (n > m->max_muestras) n = m->max_muestras;
+    memcpy(nueva->datos, m->datos, ((size_t) m->num_sellos + (size_t) n) * sizeof(uint64_t));
+    atomic_store(&nueva->n, n);
+    medidas_destruir(m);
+    return nueva;
+}
+
+/*
+ * Función que devuelve el instante actual según el reloj monótono del sistema, que es común a todos los procesos.
+ * @return: Nanosegundos transcurridos desde un origen arbitrario.
+ */
+uint64_t medidas_ns(){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+/*
+ * Función que guarda el instante actual en un sello. Lo llama quien entrega el item (o el filósofo al pasar a
+ * estar hambriento).
+ * @param m: Estructura de medidas.
+ * @param pos: Número de sello (por ejemplo, la posición del item en el buffer).
+ */
+void medidas_sellar(struct medidas * m, int pos){
+    m->datos[pos] = medidas_ns();
+}
+
+/*
+ * Función que registra el tiempo transcurrido desde que se selló pos. Lo llama quien recibe el item, mientras el
+ * sello aún no ha podido ser reutilizado.
+ * @param m: Estructura de medidas.
+ * @param pos: Número de sello.
+ */
+void medidas_latencia(struct medidas * m, int pos){
+    medidas_registrar(m, medidas_ns() - m->datos[pos]);
+}
+
+/*
+ * Función que añade una latencia a las muestras. Puede llamarse desde varios hilos o procesos a la vez: cada uno
+ * obtiene su hueco incrementando n de forma atómica. Si ya no quedan huecos, la muestra se descarta.
+ * @param m: Estructura de medidas.
+ * @param latencia: Latencia en nanosegundos.
+ */
+void medidas_registrar(struct medidas * m, uint64_t latencia){
+    long i = atomic_fetch_add_explicit(&m->n, 1, memory_order_relaxed);
+
+    if (i < m->max_muestras) m->datos[m->num_sellos + i] = latencia;
+}
+
+/*
+ * Función que imprime por la salida estándar la línea CSV que resume la ejecución (las columnas se describen en
+ * MEDIDAS_CABECERA_CSV). Los percentiles se obtienen ordenando las muestras, por lo que debe llamarse cuando ya no
+ * queden hilos o procesos registrando latencias.
+ * @param m: Estructura de medidas.
+ * @param programa: Nombre del programa.
+ * @param variante: Mecanismo de sincronización o versión empleada.
+ * @param lote: Tamaño de lote (1 si el programa no trabaja por lotes).
+ * @param tam_elem: Tamaño en bytes de cada item (0 si no se transfieren datos, como en los filósofos).
+ * @param items: Número de items transferidos (o de comidas, en los filósofos).
+ * @param segundos: Duración de la ejecución medida por el programa.
+ */
+void medidas_informe(struct medidas * m, const char * programa, const char * variante, int lote, size_t tam_elem,
+                     long items, double segundos){
+    uint64_t * muestras = m->datos + m->num_sellos;     // Latencias registradas
+    long n = atomic_load(&m->n);                         // Número de latencias guardadas
+    uint64_t p50 = 0, p99 = 0, p999 = 0, max = 0;        // Percentiles de latencia y latencia máxima
+    struct rusage propio, hijos;                         // Uso de recursos del proceso y de sus hijos
+
+    if (n > m->max_muestras) n = m->max_muestras;
+    if (n > 0){
+        qsort(muestras, (size_t) n, sizeof(uint64_t), comparar_latencias);
+        p50 = muestras[(long) (0.5 * (n - 1))];
+        p99 = muestras[(long) (0.99 * (n - 1))];
+        p999 = muestras[(long) (0.999 * (n - 1))];
+        max = muestras[n - 1];
+    }
+
+    getrusage(RUSAGE_SELF, &propio);
+    getrusage(RUSAGE_CHILDREN, &hijos);
+
+    printf("%s,%s,%d,%zu,%ld,%.6f,%.0f,%llu,%llu,%llu,%llu,%ld,%ld\n", programa, variante, lote, tam_elem, items,
+           segundos, items / segundos, (unsigned long long) p50, (unsigned long long) p99, (unsigned long long) p999,
+           (unsigned long long) max, propio.ru_nvcsw + hijos.ru_nvcsw, propio.ru_nivcsw + hijos.ru_nivcsw);
+    fflush(stdout);
+}
@@ -0,0 +1,62 @@
+#ifndef MEDIDAS_H
+#define MEDIDAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Medidas de rendimiento
+ *
+ * Recoge las latencias de traspaso de los items (o, en los filósofos, la espera desde que tienen hambre hasta que
+ * comen) y, al acabar, imprime una línea CSV con el resumen de la ejecución:
+ *
+ *  programa,variante,lote,tam_elem,items,segundos,items_s,p50_ns,p99_ns,p999_ns,max_ns,cs_voluntarios,
+ *  cs_involuntarios
+ *
+ * Las latencias se calculan a partir de sellos de tiempo tomados con clock_gettime(CLOCK_MONOTONIC). Los cambios de
+ * contexto se obtienen con getrusage, sumando los del propio proceso (con todos sus hilos) y los de sus hijos ya
+ * esperados.
+ *
+ * La estructura se reserva con mmap compartido y anónimo, de forma que la pueden usar tanto hilos como procesos
+ * creados con fork después de medidas_crear. Las muestras se añaden de forma atómica, sin necesidad de mutex.
+ * Si el número de muestras no se conoce de antemano, un único hilo o proceso puede ampliar la estructura con
+ * medidas_ampliar antes de que se llene.
+ */
+
+
+#define MEDIDAS_CABECERA_CSV "programa,variante,lote,tam_elem,items,segundos,items_s,p50_ns,p99_ns,p999_ns,max_ns," \
+                             "cs_voluntarios,cs_involuntarios"
+
+
+struct medidas {
+    long max_muestras;          // Número máximo de latencias que se guardan (las siguientes se descartan)
+    int num_sellos;             // Número de sellos de tiempo (uno por hueco del buffer, por filósofo, etc.)
+    atomic_long n;              // Número de latencias registradas
+    uint64_t datos[];           // num_sellos sellos seguidos de max_muestras latencias, en nanosegundos
+};
+
+
+// Función que reserva e inicializa la estructura de medidas (NULL en caso de error)
+struct medidas * medidas_crear(long max_muestras, int num_sellos);
+// Función que libera la estructura de medidas
+void medidas_destruir(struct medidas * m);
+// Función que amplía el número máximo de latencias de la estructura (devuelve la nueva, o m si no se puede)
+struct medidas * medidas_ampliar(struct medidas * m, long max_muestras);
+
+// Función que devuelve el instante actual en nanosegundos (CLOCK_MONOTONIC)
+uint64_t medidas_ns();
+// Función que guarda el instante actual en el sello pos
+void medidas_sellar(struct medidas * m, int pos);
+// Función que registra como latencia el tiempo transcurrido desde el sello pos
+void medidas_latencia(struct medidas * m, int pos);
+// Función que registra una latencia calculada por el llamante
+void medidas_registrar(struct medidas * m, uint64_t latencia);
+
+// Función que imprime la línea CSV con el resumen de la ejecución
+void medidas_informe(struct medidas * m, const char * programa, const char * variante, int lote, size_t tam_elem,
+                     long items, double segundos);
+
+#endif
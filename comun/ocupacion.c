@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "ocupacion.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Ocupación de colas
+ *
+ * Implementación de los contadores descritos en ocupacion.h.
+ */
+
+
+/*
+ * Función que crea el objeto de memoria compartida con los contadores de varias colas y lo proyecta. Si ya existía uno
+ * con el mismo nombre (de una ejecución previa), se borra antes.
+ * @param nombre: Nombre del objeto (empieza por '/', como en shm_open).
+ * @param num_colas: Número de colas (como mucho, OCUPACION_MAX_COLAS).
+ * @param nombres_colas: Nombre de cada cola, para los volcados.
+ * @param capacidad: Número máximo de mensajes de cada cola.
+ * @return: Puntero a los contadores, o NULL en caso de error (errno indica el motivo).
+ */
+struct ocupacion * ocupacion_crear(const char * nombre, int num_colas, const char * nombres_colas[], long capacidad){
+    struct ocupacion * o;
+    int fd, i;
+
+    shm_unlink(nombre);
+    if ((fd = shm_open(nombre, O_CREAT | O_EXCL | O_RDWR, 0777)) == -1) return NULL;
+    if (ftruncate(fd, (off_t) sizeof(struct ocupacion)) == -1 ||
+        (o = mmap(NULL, sizeof(struct ocupacion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED){
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    // ftruncate deja la región a 0: solo hay que fijar las capacidades y los nombres
+    o->num_colas = num_colas < OCUPACION_MAX_COLAS? num_colas : OCUPACION_MAX_COLAS;
+    for (i = 0; i < o->num_colas; i++){
+        o->colas[i].capacidad = capacidad;
+        strncpy(o->colas[i].nombre, nombres_colas[i], OCUPACION_TAM_NOMBRE - 1);
+    }
+    return o;
+}
+
+/*
+ * Función que abre y proyecta los contadores que ha creado otro proceso.
+ * @param nombre: Nombre del objeto de memoria compartida.
+ * @return: Puntero a los contadores, o NULL en caso de error (errno indica el motivo).
+ */
+struct ocupacion * ocupacion_abrir(const char * nombre){
+    struct ocupacion * o;
+    int fd;
+
+    if ((fd = shm_open(nombre, O_RDWR, 0)) == -1) return NULL;
+    o = mmap(NULL, sizeof(struct ocupacion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t) 0);
+    close(fd);
+
+    return o == MAP_FAILED? NULL : o;
+}
+
+/*
+ * Función que deshace la proyección de los contadores en el proceso que la llama.
+ * @param o: Contadores de ocupación.
+ */
+void ocupacion_cerrar(struct ocupacion * o){
+    munmap(o, sizeof(struct ocupacion));
+}
+
+/*
+ * Función que registra el envío de n mensajes a una cola. Debe llamarse antes de mq_send. Actualiza el máximo y, si
+ * la cola ha llegado a su capacidad, el número de llenados.
+ * @param o: Contadores de ocupación.
+ * @param cola: Índice de la cola.
+ * @param n: Número de mensajes enviados.
+ */
+void ocupacion_enviados(struct ocupacion * o, int cola, long n){
+    struct ocupacion_cola * c = &o->colas[cola];
+    long profundidad = atomic_fetch_add_explicit(&c->profundidad, n, memory_order_relaxed) + n;
+    long maximo = atomic_load_explicit(&c->maximo, memory_order_relaxed);
+
+    while (profundidad > maximo &&
+           !atomic_compare_exchange_weak_explicit(&c->maximo, &maximo, profundidad, memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+    if (profundidad >= c->capacidad && profundidad - n < c->capacidad)
+        atomic_fetch_add_explicit(&c->llenados, 1, memory_order_relaxed);
+}
+
+/*
+ * Función que registra la recepción de n mensajes de una cola. Debe llamarse después de mq_receive. Si la cola se
+ * queda vacía, se contabiliza.
+ * @param o: Contadores de ocupación.
+ * @param cola: Índice de la cola.
+ * @param n: Número de mensajes recibidos.
+ */
+void ocupacion_recibidos(struct ocupacion * o, int cola, long n){
+    struct ocupacion_cola * c = &o->colas[cola];
+
+    if (atomic_fetch_sub_explicit(&c->profundidad, n, memory_order_relaxed) == n)
+        atomic_fetch_add_explicit(&c->vaciados, 1, memory_order_relaxed);
+}
+
+// Función que devuelve el número de mensajes de una cola
+long ocupacion_profundidad(struct ocupacion * o, int cola){
+    return atomic_load_explicit(&o->colas[cola].profundidad, memory_order_relaxed);
+}
+
+// Función que devuelve la máxima profundidad alcanzada por una cola
+long ocupacion_maximo(struct ocupacion * o, int cola){
+    return atomic_load_explicit(&o->colas[cola].maximo, memory_order_relaxed);
+}
+
+// Función que devuelve el número de veces que una cola ha llegado a su capacidad
+long ocupacion_llenados(struct ocupacion * o, int cola){
+    return atomic_load_explicit(&o->colas[cola].llenados, memory_order_relaxed);
+}
+
+// Función que devuelve el número de veces que una cola se ha quedado vacía
+long ocupacion_vaciados(struct ocupacion * o, int cola){
+    return atomic_load_explicit(&o->colas[cola].vaciados, memory_order_relaxed);
+}
+
+/*
+ * Función que imprime, en una sola línea que empieza por '#', la profundidad actual, el máximo y los llenados y
+ * vaciados de cada cola.
+ * @param o: Contadores de ocupación.
+ * @param f: Flujo en el que se imprime (normalmente, stderr, para no mezclarse con el CSV del modo rendimiento).
+ * @param programa: Nombre del programa que imprime la línea.
+ */
+void ocupacion_volcar(struct ocupacion * o, FILE * f, const char * programa){
+    int i;
+
+    fprintf(f, "# %s,ocupacion:", programa);
+    for (i = 0; i < o->num_colas; i++)
+        fprintf(f, "%s %s %ld/%ld (max %ld, llena %ld, vacia %ld)", i? ";" : "", o->colas[i].nombre,
+                ocupacion_profundidad(o, i), o->colas[i].capacidad, ocupacion_maximo(o, i), ocupacion_llenados(o, i),
+                ocupacion_vaciados(o, i));
+    fprintf(f, "\n");
+}
+
+/*
+ * Función que imprime las estadísticas con ocupacion_volcar si ha llegado el instante del próximo volcado, y fija el
+ * siguiente. Está pensada para llamarse en cada iteración del bucle principal: si no toca volcar, solo lee el reloj.
+ * @param o: Contadores de ocupación.
+ * @param f: Flujo en el que se imprime.
+ * @param programa: Nombre del programa que imprime la línea.
+ * @param periodo_ns: Nanosegundos entre dos volcados (0 para no volcar nunca).
+ * @param proximo: Instante (CLOCK_MONOTONIC, en nanosegundos) del próximo volcado, propio del proceso. Si vale 0, se
+ *                 empieza a contar el periodo desde ahora.
+ */
+void ocupacion_volcar_periodico(struct ocupacion * o, FILE * f, const char * programa, uint64_t periodo_ns,
+                                uint64_t * proximo){
+    struct timespec t;
+    uint64_t ahora;
+
+    if (periodo_ns == 0) return;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    ahora = (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+
+    if (*proximo == 0) *proximo = ahora + periodo_ns;
+    else if (ahora >= *proximo){
+        ocupacion_volcar(o, f, programa);
+        *proximo = ahora + periodo_ns;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef OCUPACION_H
+#define OCUPACION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include "cache.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Ocupación de colas
+ *
+ * Contadores de ocupación de las colas de mensajes de la práctica 4, que sustituyen a las consultas con mq_getattr.
+ * Los contadores están en un objeto de memoria compartida (shm_open y mmap) que crea el proceso que crea las colas y
+ * abren los demás. Quien envía un mensaje incrementa la profundidad de la cola antes de mq_send, y quien lo recibe la
+ * decrementa después de mq_receive, de modo que la profundidad nunca es negativa y, como mucho, cuenta de más los
+ * mensajes que se están enviando en ese momento.
+ *
+ * Además de la profundidad, se lleva el máximo alcanzado y el número de veces que cada cola se ha llenado y vaciado.
+ * Todas las consultas son simples lecturas atómicas, sin llamadas al sistema.
+ */
+
+
+#define OCUPACION_MAX_COLAS 64          // Número máximo de colas de un objeto de ocupación
+#define OCUPACION_TAM_NOMBRE 32         // Bytes del nombre de cada cola (para los volcados)
+
+
+struct ocupacion_cola {
+    CACHE_ALINEADO atomic_long profundidad;    // Mensajes en la cola (los contadores de cada cola, en su línea)
+    atomic_long maximo;                 // Máxima profundidad alcanzada
+    atomic_long llenados;               // Veces que la cola ha llegado a su capacidad
+    atomic_long vaciados;               // Veces que la cola se ha quedado vacía
+    long capacidad;                     // Número máximo de mensajes de la cola
+    char nombre[OCUPACION_TAM_NOMBRE];  // Nombre de la cola
+};
+
+struct ocupacion {
+    int num_colas;                      // Número de colas
+    struct ocupacion_cola colas[OCUPACION_MAX_COLAS];
+};
+
+
+// Función que crea (borrando el anterior, si existía) y proyecta un objeto de ocupación con nombre
+struct ocupacion * ocupacion_crear(const char * nombre, int num_colas, const char * nombres_colas[], long capacidad);
+// Función que abre y proyecta un objeto de ocupación creado por otro proceso
+struct ocupacion * ocupacion_abrir(const char * nombre);
+// Función que deshace la proyección del objeto (que sigue existiendo)
+void ocupacion_cerrar(struct ocupacion * o);
+
+// Función que registra el envío de n mensajes a una cola (antes de mq_send)
+void ocupacion_enviados(struct ocupacion * o, int cola, long n);
+// Función que registra la recepción de n mensajes de una cola (después de mq_receive)
+void ocupacion_recibidos(struct ocupacion * o, int cola, long n);
+
+// Función que devuelve el número de mensajes de una cola
+long ocupacion_profundidad(struct ocupacion * o, int cola);
+// Función que devuelve la máxima profundidad alcanzada por una cola
+long ocupacion_maximo(struct ocupacion * o, int cola);
+// Función que devuelve el número de veces que una cola se ha llenado
+long ocupacion_llenados(struct ocupacion * o, int cola);
+// Función que devuelve el número de veces que una cola se ha vaciado
+long ocupacion_vaciados(struct ocupacion * o, int cola);
+
+// Función que imprime una línea con las estadísticas de todas las colas
+void ocupacion_volcar(struct ocupacion * o, FILE * f, const char * programa);
+// Función que imprime las estadísticas si ha vencido el periodo indicado desde el último volcado
+void ocupacion_volcar_periodico(struct ocupacion * o, FILE * f, const char * programa, uint64_t periodo_ns,
+                                uint64_t * proximo);
+
+#endif
@@ -0,0 +1,89 @@
+#include <sched.h>
+#include <sys/mman.h>
+#include "vista.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Vista de estados
+ *
+ * Implementación de la vista con seqlock descrita en vista.h.
+ */
+
+
+// Función que calcula el tamaño en bytes de una vista de n caracteres
+static size_t tam_vista(int n){
+    return sizeof(struct vista) + (size_t) n + 1;
+}
+
+/*
+ * Función que reserva la vista en una región compartida y anónima, de forma que los procesos creados después con fork
+ * ven los mismos caracteres que el padre.
+ * @param n: Número de caracteres.
+ * @param inicial: Carácter con el que empiezan todas las posiciones.
+ * @return: Puntero a la vista, o NULL si mmap falla (errno indica el motivo).
+ */
+struct vista * vista_crear(int n, char inicial){
+    struct vista * v;
+    int i;
+
+    if ((v = mmap(NULL, tam_vista(n), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, (off_t) 0))
+            == MAP_FAILED)
+        return NULL;
+
+    // mmap devuelve la región inicializada a 0: la secuencia empieza siendo par y la cadena ya tiene su nulo final
+    v->n = n;
+    for (i = 0; i < n; i++) atomic_init(&v->texto[i], inicial);
+    return v;
+}
+
+/*
+ * Función que libera la región reservada por vista_crear.
+ * @param v: Vista (puede ser NULL).
+ */
+void vista_destruir(struct vista * v){
+    if (v != NULL) munmap(v, tam_vista(v->n));
+}
+
+/*
+ * Función que cambia un carácter de la vista. El escritor pasa la secuencia de par a impar con un CAS (si otro está
+ * escribiendo, espera a que acabe), escribe el carácter y la vuelve a dejar par.
+ * @param v: Vista (si es NULL, no se hace nada).
+ * @param i: Posición del carácter.
+ * @param c: Nuevo carácter.
+ */
+void vista_cambiar(struct vista * v, int i, char c){
+    uint32_t s;
+
+    if (v == NULL) return;
+    for (;;){
+        s = atomic_load_explicit(&v->secuencia, memory_order_relaxed);
+        if (!(s & 1) && atomic_compare_exchange_weak_explicit(&v->secuencia, &s, s + 1, memory_order_acquire,
+                                                              memory_order_relaxed))
+            break;
+        sched_yield();          // Otro escritor tiene la secuencia impar: se le cede la CPU para que acabe
+    }
+    // La escritura del carácter no puede adelantarse al CAS, ni retrasarse hasta después de la secuencia par
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&v->texto[i], c, memory_order_relaxed);
+    atomic_store_explicit(&v->secuencia, s + 2, memory_order_release);
+}
+
+/*
+ * Función que copia una instantánea coherente de la vista. Si la secuencia era impar al empezar o ha cambiado al
+ * acabar, algún escritor ha modificado la cadena durante la copia y se repite.
+ * @param v: Vista.
+ * @param destino: Cadena de al menos n + 1 bytes en la que se copian los caracteres y el nulo final.
+ */
+void vista_leer(struct vista * v, char * destino){
+    uint32_t s1, s2;            // Secuencia antes y después de la copia
+    int i;
+
+    do {
+        while ((s1 = atomic_load_explicit(&v->secuencia, memory_order_acquire)) & 1) sched_yield();
+        for (i = 0; i < v->n; i++) destino[i] = atomic_load_explicit(&v->texto[i], memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&v->secuencia, memory_order_relaxed);
+    } while (s1 != s2);
+    destino[v->n] = '\0';
+}
@@ -0,0 +1,47 @@
+#ifndef VISTA_H
+#define VISTA_H
+
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include "cache.h"
+
+/*
+ * Xiana Carrera Alonso
+ * Sistemas Operativos II
+ * Módulo común - Vista de estados
+ *
+ * Cadena persistente con un carácter por hilo o proceso (en los filósofos, 'P', 'H' o 'C'), que se mantiene al día
+ * de forma incremental: cada cambio de estado reescribe un único carácter, en lugar de reconstruir la cadena entera
+ * cada vez que se quiere imprimir.
+ *
+ * Las lecturas se protegen con un seqlock: un contador de secuencia que es impar mientras alguien escribe. Quien lee
+ * copia la cadena y repite la copia si el contador era impar o ha cambiado durante ella, de modo que siempre obtiene
+ * una instantánea coherente sin bloquear a nadie (ni tomar el mutex de los filósofos). Los escritores pueden ser
+ * varios a la vez: ponen el contador a impar con un CAS, que hace también de cerrojo entre ellos, y la escritura de un
+ * carácter es tan corta que la espera es mínima.
+ *
+ * La estructura se reserva con mmap compartido y anónimo, como las medidas, así que sirve también para procesos
+ * creados con fork después de vista_crear. Si un programa no la usa (por ejemplo, en el modo rendimiento, en el que no
+ * se imprime nada), trabaja con un puntero NULL y cada cambio se reduce a una comprobación.
+ */
+
+
+struct vista {
+    CACHE_ALINEADO _Atomic uint32_t secuencia;  // Impar mientras un escritor modifica la cadena
+    int n;                                      // Número de caracteres (sin contar el nulo final)
+    CACHE_ALINEADO _Atomic char texto[];        // n caracteres y un nulo final
+};
+
+
+// Función que reserva una vista de n caracteres, todos iguales a inicial (NULL en caso de error)
+struct vista * vista_crear(int n, char inicial);
+// Función que libera la vista
+void vista_destruir(struct vista * v);
+
+// Función que cambia el carácter i de la vista (no hace nada si la vista es NULL)
+void vista_cambiar(struct vista * v, int i, char c);
+// Función que copia en destino (de n + 1 bytes) una instantánea coherente de la vista, terminada en nulo
+void vista_leer(struct vista * v, char * destino);
+
+#endif